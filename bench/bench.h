@@ -0,0 +1,51 @@
+#ifndef PCTRL_BENCH_H
+#define PCTRL_BENCH_H
+
+#include <stdint.h>
+
+// Shape of the synthetic machines and size of the runs
+typedef struct BenchConfig {
+    unsigned depth;        // Levels of nesting in every region
+    unsigned fanout;       // Children per state, and states on the top level
+    unsigned regions;      // Orthogonal regions of the top-level composite
+    unsigned transitions;  // Polled and event transitions per leaf state
+    double fire_rate;      // Probability that a polled guard passes
+    unsigned instances;
+    unsigned ticks;        // Cycles over all instances per measurement
+    unsigned samples;      // Single ticks timed for the cold/warm cases
+} BenchConfig;
+
+// Negative fields are not measured and left out of the report
+typedef struct BenchResult {
+    const char *name;
+    double ns_per_tick;
+    double ns_per_transition;
+    double transitions_per_tick;
+    double events_per_sec;
+    double cold_ns_per_tick;  // Caches flushed before every timed tick
+    double warm_ns_per_tick;  // Instance and definition ticked just before
+} BenchResult;
+
+// Guard context shared by the FSM and HSM benchmarks
+typedef struct BenchContext {
+    uint32_t rng;
+    uint32_t threshold;  // Guards pass when the next random number is <= threshold
+    uint64_t transitions;
+    uint64_t runs;
+    uint32_t inputs;      // Input word of machines with bitmask guards
+    uint32_t num_inputs;  // Bits of inputs drawn by each handler call
+} BenchContext;
+
+uint64_t bench_now_ns(void);
+double bench_timer_overhead_ns(void);
+uint32_t bench_random(uint32_t *state);
+uint32_t bench_threshold(double rate);
+void bench_evict_caches(void);
+void bench_clear_result(BenchResult *result, const char *name);
+
+void bench_fsm(const BenchConfig *config, BenchResult *indexed, BenchResult *scanned);
+// Control kernels: a tick is one loop update or one channel sample
+int bench_pid(const BenchConfig *config, BenchResult *vector, BenchResult *scalar);
+int bench_filter_bank(const BenchConfig *config, BenchResult *vector, BenchResult *scalar);
+
+#endif // PCTRL_BENCH_H
@@ -0,0 +1,202 @@
+/*
+ * bench_control.c
+ *
+ * Control kernel benchmarks: the batched PID update and the IIR filter bank,
+ * each with its vector kernel and the scalar per-loop version. `instances`
+ * sets the number of loops or channels and `ticks` the number of updates or
+ * samples per channel. One tick is one loop update or one channel sample.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "control/filter_bank.h"
+#include "control/pid.h"
+#include "bench.h"
+
+#define BENCH_DT 0.001f
+#define BENCH_FS 10000.0f
+#define BENCH_SECTIONS 4
+#define BENCH_BLOCK 64
+
+// Uniform in [lo, hi), from the shared xorshift generator
+static float bench_uniform(uint32_t *rng, float lo, float hi)
+{
+    return lo + (hi - lo) * (float)(bench_random(rng) >> 8) / 16777216.0f;
+}
+
+static void *bench_aligned(size_t alignment, size_t size)
+{
+    void *p = aligned_alloc(alignment, (size + alignment - 1) & ~(alignment - 1));
+    if (p)
+    {
+        memset(p, 0, size);
+    }
+    return p;
+}
+
+/* ----------------------------------------------------------------------------
+ * PID bank
+ * ------------------------------------------------------------------------- */
+
+typedef void (*PidUpdate)(PidBank *bank);
+
+static void run_pid(const BenchConfig *config, PidBank *bank, PidUpdate update, BenchResult *result)
+{
+    // Measurements move a little every update so no loop sits still
+    uint32_t rng = 2463534242u;
+    pid_bank_reset(bank);
+    uint64_t start = bench_now_ns();
+    for (unsigned tick = 0; tick < config->ticks; ++tick)
+    {
+        bank->measurement[tick % bank->count] = bench_uniform(&rng, -1.0f, 1.0f);
+        update(bank);
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+    result->ns_per_tick = (double)elapsed / ((double)config->ticks * bank->count);
+
+    uint64_t warm = 0;
+    uint64_t cold = 0;
+    for (unsigned s = 0; s < config->samples; ++s)
+    {
+        update(bank);
+        start = bench_now_ns();
+        update(bank);
+        warm += bench_now_ns() - start;
+
+        bench_evict_caches();
+        start = bench_now_ns();
+        update(bank);
+        cold += bench_now_ns() - start;
+    }
+    // Per loop, like ns_per_tick
+    result->warm_ns_per_tick = ((double)warm / config->samples - bench_timer_overhead_ns()) / bank->count;
+    result->cold_ns_per_tick = ((double)cold / config->samples - bench_timer_overhead_ns()) / bank->count;
+}
+
+/**
+ * @brief Benchmarks pid_bank_update() against pid_bank_update_scalar().
+ *
+ * The bank holds one loop per configured instance, with random gains and
+ * setpoints, and is updated `ticks` times by each kernel.
+ */
+
+int bench_pid(const BenchConfig *config, BenchResult *vector, BenchResult *scalar)
+{
+    PidBank bank;
+    size_t size = pid_bank_storage_size(config->instances);
+    void *storage = bench_aligned(PID_ALIGN, size);
+    if (!storage || pid_bank_init(&bank, config->instances, BENCH_DT, storage, size) != 0)
+    {
+        free(storage);
+        return -1;
+    }
+
+    uint32_t rng = 88172645u;
+    for (unsigned i = 0; i < bank.count; ++i)
+    {
+        PidGains gains = {bench_uniform(&rng, 2.0f, 4.0f), bench_uniform(&rng, 10.0f, 20.0f),
+                          bench_uniform(&rng, 0.0f, 0.02f), 0.005f, 1.0f, -10.0f, 10.0f};
+        pid_bank_set(&bank, i, &gains);
+        bank.setpoint[i] = bench_uniform(&rng, -2.0f, 2.0f);
+    }
+
+    run_pid(config, &bank, pid_bank_update, vector);
+    run_pid(config, &bank, pid_bank_update_scalar, scalar);
+    free(storage);
+    return 0;
+}
+
+/* ----------------------------------------------------------------------------
+ * Filter bank
+ * ------------------------------------------------------------------------- */
+
+typedef void (*FilterProcess)(FilterBank *bank, const float *in, float *out, unsigned frames);
+
+static void run_filter(const BenchConfig *config, FilterBank *bank, FilterProcess process,
+                       const float *in, float *out, BenchResult *result)
+{
+    filter_bank_reset(bank);
+    uint64_t start = bench_now_ns();
+    for (unsigned frame = 0; frame < config->ticks; frame += BENCH_BLOCK)
+    {
+        unsigned frames = config->ticks - frame < BENCH_BLOCK ? config->ticks - frame : BENCH_BLOCK;
+        process(bank, in, out, frames);
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+    result->ns_per_tick = (double)elapsed / ((double)config->ticks * bank->channels);
+
+    uint64_t warm = 0;
+    uint64_t cold = 0;
+    for (unsigned s = 0; s < config->samples; ++s)
+    {
+        process(bank, in, out, BENCH_BLOCK);
+        start = bench_now_ns();
+        process(bank, in, out, BENCH_BLOCK);
+        warm += bench_now_ns() - start;
+
+        bench_evict_caches();
+        start = bench_now_ns();
+        process(bank, in, out, BENCH_BLOCK);
+        cold += bench_now_ns() - start;
+    }
+    // Per channel sample, like ns_per_tick
+    double samples = (double)BENCH_BLOCK * bank->channels;
+    result->warm_ns_per_tick = ((double)warm / config->samples - bench_timer_overhead_ns()) / samples;
+    result->cold_ns_per_tick = ((double)cold / config->samples - bench_timer_overhead_ns()) / samples;
+}
+
+/**
+ * @brief Benchmarks filter_bank_process() against filter_bank_process_scalar().
+ *
+ * One channel per configured instance, each behind a low-pass, high-pass,
+ * band-pass and notch section with random corners, is fed `ticks` samples
+ * in blocks of BENCH_BLOCK frames.
+ */
+
+int bench_filter_bank(const BenchConfig *config, BenchResult *vector, BenchResult *scalar)
+{
+    FilterBank bank;
+    size_t size = filter_bank_storage_size(config->instances, BENCH_SECTIONS);
+    void *storage = bench_aligned(FILTER_ALIGN, size);
+    if (!storage || filter_bank_init(&bank, config->instances, BENCH_SECTIONS, storage, size) != 0)
+    {
+        free(storage);
+        return -1;
+    }
+
+    uint32_t rng = 88172645u;
+    for (unsigned ch = 0; ch < bank.channels; ++ch)
+    {
+        FilterSection s;
+        filter_design_lowpass(&s, BENCH_FS, bench_uniform(&rng, 500.0f, 3000.0f), bench_uniform(&rng, 0.5f, 2.0f));
+        filter_bank_set(&bank, ch, 0, &s);
+        filter_design_highpass1(&s, BENCH_FS, bench_uniform(&rng, 1.0f, 50.0f));
+        filter_bank_set(&bank, ch, 1, &s);
+        filter_design_bandpass(&s, BENCH_FS, bench_uniform(&rng, 100.0f, 1000.0f), bench_uniform(&rng, 0.3f, 1.0f));
+        filter_bank_set(&bank, ch, 2, &s);
+        filter_design_notch(&s, BENCH_FS, bench_uniform(&rng, 40.0f, 70.0f), 5.0f);
+        filter_bank_set(&bank, ch, 3, &s);
+    }
+
+    size_t block_size = (size_t)BENCH_BLOCK * bank.padded * sizeof(float);
+    float *in = bench_aligned(FILTER_ALIGN, block_size);
+    float *out = bench_aligned(FILTER_ALIGN, block_size);
+    if (!in || !out)
+    {
+        free(in);
+        free(out);
+        free(storage);
+        return -1;
+    }
+    for (size_t i = 0; i < (size_t)BENCH_BLOCK * bank.padded; ++i)
+    {
+        in[i] = bench_uniform(&rng, -1.0f, 1.0f);
+    }
+
+    run_filter(config, &bank, filter_bank_process, in, out, vector);
+    run_filter(config, &bank, filter_bank_process_scalar, in, out, scalar);
+    free(in);
+    free(out);
+    free(storage);
+    return 0;
+}
@@ -0,0 +1,154 @@
+/*
+ * bench_fsm.c
+ *
+ * Flat state machine benchmarks. The FSM and HSM modules share their
+ * function names, so this file and its copy of fsm.c are built with the FSM
+ * functions renamed to fsm_state_machine_* (see CMakeLists.txt).
+ */
+
+#include <stdlib.h>
+#include "fsm/fsm.h"
+#include "bench.h"
+
+static char bench_guard(void *context)
+{
+    BenchContext *c = context;
+    return bench_random(&c->rng) <= c->threshold;
+}
+
+static void bench_on_entry(void *context) { ((BenchContext *)context)->transitions++; }
+static void bench_on_run(void *context) { ((BenchContext *)context)->runs++; }
+
+static uint64_t total_transitions(const BenchContext *contexts, unsigned count)
+{
+    uint64_t total = 0;
+    for (unsigned i = 0; i < count; ++i)
+    {
+        total += contexts[i].transitions;
+    }
+    return total;
+}
+
+static void run_fsm(const BenchConfig *config, const st_StateMachine *sm, BenchResult *result)
+{
+    unsigned count = config->instances;
+    st_StateMachineInstance *instances = malloc(count * sizeof(*instances));
+    BenchContext *contexts = calloc(count, sizeof(*contexts));
+    uint32_t threshold = bench_threshold(config->fire_rate);
+
+    for (unsigned i = 0; i < count; ++i)
+    {
+        contexts[i].rng = 2463534242u + i;
+        contexts[i].threshold = threshold;
+        state_machine_init(sm, &instances[i], &contexts[i]);
+    }
+
+    // Steady state at the configured fire rate
+    uint64_t before = total_transitions(contexts, count);
+    uint64_t start = bench_now_ns();
+    for (unsigned tick = 0; tick < config->ticks; ++tick)
+    {
+        for (unsigned i = 0; i < count; ++i)
+        {
+            state_machine_run(sm, &instances[i]);
+        }
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+    double ticks = (double)config->ticks * count;
+    result->ns_per_tick = elapsed / ticks;
+    result->transitions_per_tick = (total_transitions(contexts, count) - before) / ticks;
+
+    // Every tick takes its first transition
+    for (unsigned i = 0; i < count; ++i)
+    {
+        contexts[i].threshold = UINT32_MAX;
+    }
+    before = total_transitions(contexts, count);
+    start = bench_now_ns();
+    for (unsigned tick = 0; tick < config->ticks; ++tick)
+    {
+        for (unsigned i = 0; i < count; ++i)
+        {
+            state_machine_run(sm, &instances[i]);
+        }
+    }
+    elapsed = bench_now_ns() - start;
+    result->ns_per_transition = (double)elapsed / (double)(total_transitions(contexts, count) - before);
+
+    for (unsigned i = 0; i < count; ++i)
+    {
+        contexts[i].threshold = threshold;
+    }
+
+    uint64_t warm = 0;
+    uint64_t cold = 0;
+    for (unsigned s = 0; s < config->samples; ++s)
+    {
+        st_StateMachineInstance *inst = &instances[s % count];
+
+        state_machine_run(sm, inst);
+        start = bench_now_ns();
+        state_machine_run(sm, inst);
+        warm += bench_now_ns() - start;
+
+        bench_evict_caches();
+        start = bench_now_ns();
+        state_machine_run(sm, inst);
+        cold += bench_now_ns() - start;
+    }
+    result->warm_ns_per_tick = (double)warm / config->samples - bench_timer_overhead_ns();
+    result->cold_ns_per_tick = (double)cold / config->samples - bench_timer_overhead_ns();
+
+    free(instances);
+    free(contexts);
+}
+
+/**
+ * @brief Benchmarks a flat machine with and without the CSR transition index.
+ *
+ * The machine has fanout^depth states, the leaf count of the hierarchical
+ * benchmark, each with the configured number of transitions to random
+ * states.
+ */
+
+void bench_fsm(const BenchConfig *config, BenchResult *indexed, BenchResult *scanned)
+{
+    unsigned num_states = 1;
+    for (unsigned d = 0; d < config->depth; ++d)
+    {
+        num_states *= config->fanout;
+    }
+    if (num_states * config->transitions > 0xFFFF)
+    {
+        num_states = 0xFFFF / config->transitions;
+    }
+
+    unsigned num_transitions = num_states * config->transitions;
+    st_State *states = calloc(num_states, sizeof(*states));
+    st_Transition *transitions = malloc(num_transitions * sizeof(*transitions));
+    uint16_t *offsets = malloc((num_states + 1) * sizeof(*offsets));
+    uint32_t rng = 88172645u;
+
+    for (unsigned i = 0; i < num_states; ++i)
+    {
+        states[i].on_entry = bench_on_entry;
+        states[i].on_run = bench_on_run;
+    }
+    for (unsigned i = 0; i < num_transitions; ++i)
+    {
+        transitions[i].source_state = &states[i / config->transitions];
+        transitions[i].target_state = &states[bench_random(&rng) % num_states];
+        transitions[i].condition = bench_guard;
+    }
+
+    st_StateMachine sm = {states, transitions, (uint16_t)num_states, (uint16_t)num_transitions, offsets, &states[0]};
+    state_machine_compile(&sm);
+    run_fsm(config, &sm, indexed);
+
+    sm.transition_offsets = NULL;
+    run_fsm(config, &sm, scanned);
+
+    free(states);
+    free(transitions);
+    free(offsets);
+}
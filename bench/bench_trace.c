@@ -0,0 +1,19 @@
+/*
+ * bench_trace.c
+ *
+ * The HSM engine built once more with HSM_TRACE. This file and its copy of
+ * hsm.c are built with the engine's functions renamed to
+ * traced_state_machine_* (see CMakeLists.txt), so pctrl_bench can time the
+ * same machine with tracing compiled in and compiled out.
+ */
+
+#include "hsm/hsm.h"
+#include "bench_trace.h"
+
+const BenchHsmApi bench_traced_hsm = {
+    state_machine_compile_size,
+    state_machine_compile,
+    state_machine_instance_size,
+    state_machine_init,
+    state_machine_tick,
+};
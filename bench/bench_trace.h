@@ -0,0 +1,19 @@
+#ifndef PCTRL_BENCH_TRACE_H
+#define PCTRL_BENCH_TRACE_H
+
+#include <stddef.h>
+#include "hsm/hsm.h"
+
+// Entry points of one build of the HSM engine
+typedef struct BenchHsmApi {
+    size_t (*compile_size)(StateMachine *sm);
+    int (*compile)(StateMachine *sm, StateMachineDef *def, void *buffer, size_t size);
+    size_t (*instance_size)(const StateMachineDef *def);
+    void (*init)(const StateMachineDef *def, StateMachineInstance *inst, void *context);
+    void (*tick)(const StateMachineDef *def, StateMachineInstance *inst);
+} BenchHsmApi;
+
+// The engine built with HSM_TRACE, see bench_trace.c
+extern const BenchHsmApi bench_traced_hsm;
+
+#endif // PCTRL_BENCH_TRACE_H
@@ -0,0 +1,627 @@
+/*
+ * pctrl_bench.c
+ *
+ * Benchmarks tick, transition and event cost of the hierarchical and flat
+ * state machines on synthetic machines and prints the results as JSON.
+ *
+ * The hierarchical machine has a top-level composite owning `regions`
+ * orthogonal regions. Every region is a tree of `fanout` states per level,
+ * `depth` levels deep. Each leaf has `transitions` polled transitions and as
+ * many event-triggered ones (events 1..transitions) to random leaves of its
+ * region; inner states have one event transition (transitions + 1) that
+ * their leaves inherit. Polled guards pass with probability `fire-rate`.
+ *
+ * Tracing is timed on the same machine, once through the engine as built
+ * and once through a copy built with HSM_TRACE recording into a ring.
+ *
+ * The control kernels run on `instances` PID loops and filter channels,
+ * for `ticks` updates or samples each, vector kernel against scalar.
+ *
+ * Usage: pctrl_bench [--depth N] [--fanout N] [--regions N] [--transitions N]
+ *                    [--fire-rate P] [--instances N] [--ticks N] [--samples N]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hsm/hsm.h"
+#include "hsm/trace.h"
+#include "bench.h"
+#include "bench_trace.h"
+
+#define EVICT_BYTES (64u << 20)
+#define TRACE_RECORDS 4096
+
+uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Cost of a pair of bench_now_ns() calls, removed from single-tick timings
+double bench_timer_overhead_ns(void)
+{
+    static double overhead = -1;
+    if (overhead < 0)
+    {
+        uint64_t best = UINT64_MAX;
+        for (int i = 0; i < 1000; ++i)
+        {
+            uint64_t start = bench_now_ns();
+            uint64_t elapsed = bench_now_ns() - start;
+            best = elapsed < best ? elapsed : best;
+        }
+        overhead = (double)best;
+    }
+    return overhead;
+}
+
+// xorshift32, never returns 0
+uint32_t bench_random(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+uint32_t bench_threshold(double rate)
+{
+    if (rate <= 0.0)
+    {
+        return 0;
+    }
+    if (rate >= 1.0)
+    {
+        return UINT32_MAX;
+    }
+    return (uint32_t)(rate * 4294967295.0);
+}
+
+// Streams through a buffer larger than the last-level cache
+void bench_evict_caches(void)
+{
+    static volatile unsigned char *buffer;
+    if (!buffer)
+    {
+        buffer = malloc(EVICT_BYTES);
+    }
+    for (size_t i = 0; i < EVICT_BYTES; i += 64)
+    {
+        buffer[i]++;
+    }
+}
+
+void bench_clear_result(BenchResult *result, const char *name)
+{
+    result->name = name;
+    result->ns_per_tick = -1;
+    result->ns_per_transition = -1;
+    result->transitions_per_tick = -1;
+    result->events_per_sec = -1;
+    result->cold_ns_per_tick = -1;
+    result->warm_ns_per_tick = -1;
+}
+
+/* ----------------------------------------------------------------------------
+ * Synthetic hierarchical machine
+ * ------------------------------------------------------------------------- */
+
+typedef struct SyntheticMachine {
+    StateMachine root;
+    State top;
+    State *top_list[1];
+    StateMachine *regions;
+    State *states;         // All region states, region after region
+    State **state_lists;
+    Transition *transitions;
+    unsigned num_states;
+} SyntheticMachine;
+
+static int bench_guard(void *context)
+{
+    BenchContext *c = context;
+    return bench_random(&c->rng) <= c->threshold;
+}
+
+static void bench_on_entry(void *context) { ((BenchContext *)context)->transitions++; }
+static void bench_on_run(void *context) { ((BenchContext *)context)->runs++; }
+
+/* With bitmask guards the random draws move from the guards to the handlers:
+   bit k of the input word is set with the configured fire rate and enables
+   polled transition k, so both variants fire equally often. */
+static void bench_draw_inputs(BenchContext *c)
+{
+    uint32_t inputs = 0;
+    for (uint32_t k = 0; k < c->num_inputs; ++k)
+    {
+        inputs |= (uint32_t)(bench_random(&c->rng) <= c->threshold) << k;
+    }
+    c->inputs = inputs;
+}
+
+static void bench_masked_on_entry(void *context)
+{
+    ((BenchContext *)context)->transitions++;
+    bench_draw_inputs(context);
+}
+
+static void bench_masked_on_run(void *context)
+{
+    ((BenchContext *)context)->runs++;
+    bench_draw_inputs(context);
+}
+
+static int build_machine(const BenchConfig *config, int masked, SyntheticMachine *m)
+{
+    unsigned per_region = 0;
+    unsigned level = 1;
+    unsigned leaves = 1;
+    for (unsigned d = 0; d < config->depth; ++d)
+    {
+        level *= config->fanout;
+        per_region += level;
+        leaves = level;
+    }
+
+    m->num_states = per_region * config->regions;
+    if (m->num_states + 1 >= HSM_NO_STATE)
+    {
+        return -1;
+    }
+
+    unsigned per_leaf = 2 * config->transitions;
+    unsigned per_region_transitions = leaves * per_leaf + (per_region - leaves);
+    uint32_t rng = 88172645u;
+
+    m->regions = calloc(config->regions, sizeof(StateMachine));
+    m->states = calloc(m->num_states, sizeof(State));
+    m->state_lists = malloc(m->num_states * sizeof(State *));
+    m->transitions = calloc((size_t)per_region_transitions * config->regions, sizeof(Transition));
+
+    for (unsigned r = 0; r < config->regions; ++r)
+    {
+        State *states = &m->states[r * per_region];
+        State **list = &m->state_lists[r * per_region];
+        Transition *t = &m->transitions[(size_t)r * per_region_transitions];
+        unsigned first_leaf = per_region - leaves;
+        unsigned level_start = 0;
+        unsigned level_size = config->fanout;
+
+        // Levels are stored one after another, each state's parent being
+        // the state index / fanout of the previous level
+        for (unsigned d = 0; d < config->depth; ++d)
+        {
+            for (unsigned i = 0; i < level_size; ++i)
+            {
+                State *s = &states[level_start + i];
+                unsigned prev_start = level_start - level_size / config->fanout;
+                s->parent = d == 0 ? NULL : &states[prev_start + i / config->fanout];
+                list[level_start + i] = s;
+            }
+            level_start += level_size;
+            level_size *= config->fanout;
+        }
+
+        for (unsigned i = 0; i < per_region; ++i)
+        {
+            State *s = &states[i];
+            s->transitions = t;
+            if (i >= first_leaf)
+            {
+                s->on_entry = masked ? bench_masked_on_entry : bench_on_entry;
+                s->on_run = masked ? bench_masked_on_run : bench_on_run;
+                for (unsigned k = 0; k < config->transitions; ++k)
+                {
+                    t->target = &states[first_leaf + bench_random(&rng) % leaves];
+                    if (masked)
+                    {
+                        t->input_mask = t->input_value = 1u << (k % 32);
+                    }
+                    else
+                    {
+                        t->condition = bench_guard;
+                    }
+                    t++;
+                }
+                for (unsigned k = 0; k < config->transitions; ++k)
+                {
+                    t->target = &states[first_leaf + bench_random(&rng) % leaves];
+                    t->event = (int)k + 1;
+                    t++;
+                }
+                s->num_transitions = (int)per_leaf;
+            }
+            else
+            {
+                t->target = &states[first_leaf + bench_random(&rng) % leaves];
+                t->event = (int)config->transitions + 1;
+                t++;
+                s->num_transitions = 1;
+            }
+        }
+
+        m->regions[r].states = list;
+        m->regions[r].num_states = (int)per_region;
+        m->regions[r].initial_state = &states[first_leaf];
+    }
+
+    memset(&m->top, 0, sizeof(m->top));
+    m->top.submachine = m->regions;
+    m->top.num_submachines = (int)config->regions;
+    m->top_list[0] = &m->top;
+    memset(&m->root, 0, sizeof(m->root));
+    m->root.states = m->top_list;
+    m->root.num_states = 1;
+    m->root.initial_state = &m->top;
+    m->root.input_offset = offsetof(BenchContext, inputs);
+    return 0;
+}
+
+static void free_machine(SyntheticMachine *m)
+{
+    free(m->regions);
+    free(m->states);
+    free(m->state_lists);
+    free(m->transitions);
+}
+
+static uint64_t total_transitions(const BenchContext *contexts, unsigned count)
+{
+    uint64_t total = 0;
+    for (unsigned i = 0; i < count; ++i)
+    {
+        total += contexts[i].transitions;
+    }
+    return total;
+}
+
+static void set_threshold(BenchContext *contexts, unsigned count, uint32_t threshold)
+{
+    for (unsigned i = 0; i < count; ++i)
+    {
+        contexts[i].threshold = threshold;
+    }
+}
+
+static int bench_hsm(const BenchConfig *config, int masked, BenchResult *single, BenchResult *batch)
+{
+    SyntheticMachine m;
+    StateMachineDef def;
+
+    if (build_machine(config, masked, &m) != 0)
+    {
+        return -1;
+    }
+    size_t compiled_size = state_machine_compile_size(&m.root);
+    void *compiled = malloc(compiled_size);
+    if (state_machine_compile(&m.root, &def, compiled, compiled_size) != 0)
+    {
+        free(compiled);
+        free_machine(&m);
+        return -1;
+    }
+
+    unsigned count = config->instances;
+    size_t instance_size = state_machine_instance_size(&def);
+    char *arena = malloc(instance_size * count);
+    StateMachineInstance **instances = malloc(count * sizeof(*instances));
+    BenchContext *contexts = calloc(count, sizeof(*contexts));
+    void *workspace = malloc(state_machine_batch_workspace_size(&def, (int)count));
+    uint32_t threshold = bench_threshold(config->fire_rate);
+    double ticks = (double)config->ticks * count;
+
+    for (unsigned i = 0; i < count; ++i)
+    {
+        contexts[i].rng = 2463534242u + i;
+        contexts[i].threshold = threshold;
+        contexts[i].num_inputs = config->transitions < 32 ? config->transitions : 32;
+        instances[i] = (StateMachineInstance *)(arena + i * instance_size);
+        state_machine_init(&def, instances[i], &contexts[i]);
+    }
+
+    // Steady state at the configured fire rate
+    uint64_t before = total_transitions(contexts, count);
+    uint64_t start = bench_now_ns();
+    for (unsigned tick = 0; tick < config->ticks; ++tick)
+    {
+        for (unsigned i = 0; i < count; ++i)
+        {
+            state_machine_tick(&def, instances[i]);
+        }
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+    single->ns_per_tick = elapsed / ticks;
+    single->transitions_per_tick = (total_transitions(contexts, count) - before) / ticks;
+
+    before = total_transitions(contexts, count);
+    start = bench_now_ns();
+    for (unsigned tick = 0; tick < config->ticks; ++tick)
+    {
+        state_machine_tick_batch(&def, instances, (int)count, workspace);
+    }
+    elapsed = bench_now_ns() - start;
+    batch->ns_per_tick = elapsed / ticks;
+    batch->transitions_per_tick = (total_transitions(contexts, count) - before) / ticks;
+
+    // Every region takes its first polled transition on every tick
+    set_threshold(contexts, count, UINT32_MAX);
+    before = total_transitions(contexts, count);
+    start = bench_now_ns();
+    for (unsigned tick = 0; tick < config->ticks; ++tick)
+    {
+        for (unsigned i = 0; i < count; ++i)
+        {
+            state_machine_tick(&def, instances[i]);
+        }
+    }
+    elapsed = bench_now_ns() - start;
+    single->ns_per_transition = (double)elapsed / (double)(total_transitions(contexts, count) - before);
+    set_threshold(contexts, count, threshold);
+
+    // Events 1..transitions + 1, each handled by a leaf or inherited
+    uint32_t rng = 123456789u;
+    uint64_t events = 0;
+    start = bench_now_ns();
+    for (unsigned tick = 0; tick < config->ticks; ++tick)
+    {
+        for (unsigned i = 0; i < count; ++i)
+        {
+            int event = (int)(bench_random(&rng) % (config->transitions + 1)) + 1;
+            state_machine_send_event(&def, instances[i], event);
+            events++;
+        }
+    }
+    elapsed = bench_now_ns() - start;
+    single->events_per_sec = events * 1e9 / (double)elapsed;
+
+    uint64_t warm = 0;
+    uint64_t cold = 0;
+    for (unsigned s = 0; s < config->samples; ++s)
+    {
+        StateMachineInstance *inst = instances[s % count];
+
+        state_machine_tick(&def, inst);
+        start = bench_now_ns();
+        state_machine_tick(&def, inst);
+        warm += bench_now_ns() - start;
+
+        bench_evict_caches();
+        start = bench_now_ns();
+        state_machine_tick(&def, inst);
+        cold += bench_now_ns() - start;
+    }
+    single->warm_ns_per_tick = (double)warm / config->samples - bench_timer_overhead_ns();
+    single->cold_ns_per_tick = (double)cold / config->samples - bench_timer_overhead_ns();
+
+    free(workspace);
+    free(contexts);
+    free(instances);
+    free(arena);
+    free(compiled);
+    free_machine(&m);
+    return 0;
+}
+
+/* Steady ticks at the configured fire rate, then ticks taking a transition
+   in every region, through one build of the engine. */
+static int time_transitions(const BenchConfig *config, SyntheticMachine *m, const BenchHsmApi *api,
+                            BenchResult *result)
+{
+    StateMachineDef def;
+    size_t compiled_size = api->compile_size(&m->root);
+    void *compiled = malloc(compiled_size);
+    if (!compiled || api->compile(&m->root, &def, compiled, compiled_size) != 0)
+    {
+        free(compiled);
+        return -1;
+    }
+
+    unsigned count = config->instances;
+    size_t instance_size = api->instance_size(&def);
+    char *arena = malloc(instance_size * count);
+    BenchContext *contexts = calloc(count, sizeof(*contexts));
+    uint32_t threshold = bench_threshold(config->fire_rate);
+    double ticks = (double)config->ticks * count;
+
+    for (unsigned i = 0; i < count; ++i)
+    {
+        contexts[i].rng = 2463534242u + i;
+        contexts[i].threshold = threshold;
+        api->init(&def, (StateMachineInstance *)(arena + i * instance_size), &contexts[i]);
+    }
+
+    uint64_t before = total_transitions(contexts, count);
+    uint64_t start = bench_now_ns();
+    for (unsigned tick = 0; tick < config->ticks; ++tick)
+    {
+        for (unsigned i = 0; i < count; ++i)
+        {
+            api->tick(&def, (StateMachineInstance *)(arena + i * instance_size));
+        }
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+    result->ns_per_tick = elapsed / ticks;
+    result->transitions_per_tick = (total_transitions(contexts, count) - before) / ticks;
+
+    set_threshold(contexts, count, UINT32_MAX);
+    before = total_transitions(contexts, count);
+    start = bench_now_ns();
+    for (unsigned tick = 0; tick < config->ticks; ++tick)
+    {
+        for (unsigned i = 0; i < count; ++i)
+        {
+            api->tick(&def, (StateMachineInstance *)(arena + i * instance_size));
+        }
+    }
+    elapsed = bench_now_ns() - start;
+    result->ns_per_transition = (double)elapsed / (double)(total_transitions(contexts, count) - before);
+
+    free(contexts);
+    free(arena);
+    free(compiled);
+    return 0;
+}
+
+/**
+ * @brief Times the synthetic machine with tracing compiled out and in.
+ *
+ * The traced engine records every transition into a ring attached to this
+ * thread, wrapping around as it would in the field.
+ */
+
+static int bench_trace(const BenchConfig *config, BenchResult *untraced, BenchResult *traced)
+{
+    static const BenchHsmApi engine = {
+        state_machine_compile_size,
+        state_machine_compile,
+        state_machine_instance_size,
+        state_machine_init,
+        state_machine_tick,
+    };
+    static TraceRecord records[TRACE_RECORDS];
+    TraceRing ring;
+    SyntheticMachine m;
+
+    if (build_machine(config, 0, &m) != 0)
+    {
+        return -1;
+    }
+    int result = time_transitions(config, &m, &engine, untraced);
+    if (result == 0)
+    {
+        trace_attach(&ring, records, TRACE_RECORDS);
+        result = time_transitions(config, &m, &bench_traced_hsm, traced);
+        trace_detach();
+    }
+    free_machine(&m);
+    return result;
+}
+
+/* ----------------------------------------------------------------------------
+ * Report
+ * ------------------------------------------------------------------------- */
+
+static void print_field(const char *name, double value, int *first)
+{
+    if (value < 0)
+    {
+        return;
+    }
+    printf("%s\n      \"%s\": %.3f", *first ? "" : ",", name, value);
+    *first = 0;
+}
+
+static void print_result(const BenchResult *result, int last)
+{
+    int first = 0;
+    printf("    {\n      \"name\": \"%s\"", result->name);
+    print_field("ns_per_tick", result->ns_per_tick, &first);
+    print_field("ns_per_transition", result->ns_per_transition, &first);
+    print_field("transitions_per_tick", result->transitions_per_tick, &first);
+    print_field("events_per_sec", result->events_per_sec, &first);
+    print_field("cold_ns_per_tick", result->cold_ns_per_tick, &first);
+    print_field("warm_ns_per_tick", result->warm_ns_per_tick, &first);
+    printf("\n    }%s\n", last ? "" : ",");
+}
+
+static int parse_args(int argc, char **argv, BenchConfig *config)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        if (i + 1 >= argc)
+        {
+            return -1;
+        }
+        const char *value = argv[++i];
+        const char *option = argv[i - 1];
+
+        if (strcmp(option, "--fire-rate") == 0)
+        {
+            config->fire_rate = atof(value);
+            continue;
+        }
+
+        unsigned n = (unsigned)strtoul(value, NULL, 10);
+        if (n == 0)
+        {
+            return -1;
+        }
+        if (strcmp(option, "--depth") == 0) config->depth = n;
+        else if (strcmp(option, "--fanout") == 0) config->fanout = n;
+        else if (strcmp(option, "--regions") == 0) config->regions = n;
+        else if (strcmp(option, "--transitions") == 0) config->transitions = n;
+        else if (strcmp(option, "--instances") == 0) config->instances = n;
+        else if (strcmp(option, "--ticks") == 0) config->ticks = n;
+        else if (strcmp(option, "--samples") == 0) config->samples = n;
+        else return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    BenchConfig config = {
+        .depth = 3,
+        .fanout = 4,
+        .regions = 2,
+        .transitions = 4,
+        .fire_rate = 0.05,
+        .instances = 1000,
+        .ticks = 1000,
+        .samples = 200,
+    };
+
+    if (parse_args(argc, argv, &config) != 0)
+    {
+        fprintf(stderr, "usage: %s [--depth N] [--fanout N] [--regions N] [--transitions N]\n"
+                        "       [--fire-rate P] [--instances N] [--ticks N] [--samples N]\n", argv[0]);
+        return 1;
+    }
+
+    BenchResult results[12];
+    bench_clear_result(&results[0], "hsm_tick");
+    bench_clear_result(&results[1], "hsm_tick_batch");
+    bench_clear_result(&results[2], "hsm_tick_masked");
+    bench_clear_result(&results[3], "hsm_tick_batch_masked");
+    bench_clear_result(&results[4], "fsm_run_indexed");
+    bench_clear_result(&results[5], "fsm_run_scan");
+    bench_clear_result(&results[6], "pid_update_vector");
+    bench_clear_result(&results[7], "pid_update_scalar");
+    bench_clear_result(&results[8], "filter_bank_vector");
+    bench_clear_result(&results[9], "filter_bank_scalar");
+    bench_clear_result(&results[10], "hsm_tick_untraced");
+    bench_clear_result(&results[11], "hsm_tick_traced");
+
+    if (bench_hsm(&config, 0, &results[0], &results[1]) != 0 ||
+        bench_hsm(&config, 1, &results[2], &results[3]) != 0 ||
+        bench_trace(&config, &results[10], &results[11]) != 0)
+    {
+        fprintf(stderr, "machine too large for the configuration\n");
+        return 1;
+    }
+    bench_fsm(&config, &results[4], &results[5]);
+    if (bench_pid(&config, &results[6], &results[7]) != 0 ||
+        bench_filter_bank(&config, &results[8], &results[9]) != 0)
+    {
+        fprintf(stderr, "out of memory for the control kernels\n");
+        return 1;
+    }
+
+    printf("{\n  \"config\": {\n");
+    printf("    \"depth\": %u,\n    \"fanout\": %u,\n    \"regions\": %u,\n", config.depth, config.fanout, config.regions);
+    printf("    \"transitions\": %u,\n    \"fire_rate\": %.3f,\n", config.transitions, config.fire_rate);
+    printf("    \"instances\": %u,\n    \"ticks\": %u,\n    \"samples\": %u\n", config.instances, config.ticks, config.samples);
+    printf("  },\n  \"results\": [\n");
+    for (int i = 0; i < 12; ++i)
+    {
+        print_result(&results[i], i == 11);
+    }
+    printf("  ]\n}\n");
+    return 0;
+}
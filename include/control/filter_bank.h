@@ -0,0 +1,64 @@
+#ifndef FILTER_BANK_H
+#define FILTER_BANK_H
+
+#include <stddef.h>
+
+/* ----------------------------------------------------------------------------
+ * IIR filter bank
+ *
+ * Filters many channels at once, each through the same number of cascaded
+ * second-order sections (biquads) in transposed direct form II. A
+ * first-order section is a biquad with b2 = a2 = 0. Every channel has its
+ * own coefficients, and channels are stored side by side so that a group of
+ * FILTER_LANES channels is one vector: coefficients and state hold an array
+ * per section and term, and samples are interleaved frame by frame,
+ * sample[frame * padded + channel].
+ *
+ * Samples are processed in blocks. For each group of channels the filter
+ * state stays in registers over the whole block, and only goes back to
+ * memory once the block is done. filter_bank_process() uses AVX2, SSE2 or
+ * NEON when available; filter_bank_process_scalar() is the plain version
+ * it is checked and measured against.
+ *
+ * Each section computes, from input x to output y:
+ *
+ *   y  = b0 * x + z1
+ *   z1 = b1 * x - a1 * y + z2
+ *   z2 = b2 * x - a2 * y
+ * ------------------------------------------------------------------------- */
+
+#define FILTER_LANES 8          // Channels are padded to a multiple of this
+#define FILTER_ALIGN 32         // Alignment of the storage and of the sample blocks
+#define FILTER_MAX_SECTIONS 8   // Sections per channel
+
+// Coefficients of one section, normalized so that a0 = 1
+typedef struct FilterSection {
+    float b0, b1, b2;
+    float a1, a2;
+} FilterSection;
+
+typedef struct FilterBank {
+    unsigned channels;
+    unsigned padded;      // channels rounded up to FILTER_LANES, the frame stride of sample blocks
+    unsigned sections;
+    float *coefficients;  // [section][b0 b1 b2 a1 a2][padded]
+    float *state;         // [section][z1 z2][padded]
+} FilterBank;
+
+size_t filter_bank_storage_size(unsigned channels, unsigned sections);
+int filter_bank_init(FilterBank *bank, unsigned channels, unsigned sections, void *storage, size_t size);
+int filter_bank_set(FilterBank *bank, unsigned channel, unsigned section, const FilterSection *coefficients);
+void filter_bank_reset(FilterBank *bank);
+void filter_bank_process(FilterBank *bank, const float *in, float *out, unsigned frames);
+void filter_bank_process_scalar(FilterBank *bank, const float *in, float *out, unsigned frames);
+const char *filter_isa(void);
+
+// Coefficient design, fs the sample rate and fc the corner or centre frequency in Hz
+int filter_design_lowpass(FilterSection *s, float fs, float fc, float q);
+int filter_design_highpass(FilterSection *s, float fs, float fc, float q);
+int filter_design_bandpass(FilterSection *s, float fs, float fc, float q);
+int filter_design_notch(FilterSection *s, float fs, float fc, float q);
+int filter_design_lowpass1(FilterSection *s, float fs, float fc);
+int filter_design_highpass1(FilterSection *s, float fs, float fc);
+
+#endif // FILTER_BANK_H
@@ -0,0 +1,81 @@
+#ifndef PID_H
+#define PID_H
+
+#include <stddef.h>
+
+/* ----------------------------------------------------------------------------
+ * Batched PID controllers
+ *
+ * A bank of independent PID loops sharing one sample time, stored as a
+ * structure of arrays: one array per parameter, input, output and state,
+ * each holding every loop. pid_bank_update() advances all loops at once,
+ * eight at a time with AVX2, four with SSE2 or NEON, one at a time
+ * elsewhere; pid_bank_update_scalar() is the plain per-loop version it is
+ * checked and measured against.
+ *
+ * Each loop computes, with e = setpoint - measurement:
+ *
+ *   P = kp * e
+ *   D = D + alpha * (-kd * d(measurement)/dt - D)    filtered, on the measurement
+ *   I = I + ki * dt * e
+ *   u = P + I + D, output = u clamped to [out_min, out_max]
+ *   I = I + kt * (output - u)                         anti-windup back-calculation
+ *
+ * The derivative acts on the measurement so setpoint steps do not kick the
+ * output; alpha = dt / (tf + dt) low-passes it with time constant tf. With
+ * kt = 1 the integrator stops exactly where the output saturates.
+ *
+ * Callers write setpoint[] and measurement[], call an update and read
+ * output[]. Arrays are padded to a multiple of PID_LANES loops; the padding
+ * loops have zero gains and output 0.
+ * ------------------------------------------------------------------------- */
+
+#define PID_LANES 8     // Arrays are padded to a multiple of this many loops
+#define PID_ALIGN 32    // Alignment of the storage and of every array
+
+// Tuning of one loop
+typedef struct PidGains {
+    float kp;
+    float ki;
+    float kd;
+    float tf;       // Derivative filter time constant, 0 for no filtering
+    float kt;       // Anti-windup tracking gain, 0 to 1
+    float out_min;
+    float out_max;
+} PidGains;
+
+typedef struct PidBank {
+    unsigned count;    // Loops
+    unsigned padded;   // count rounded up to PID_LANES
+    float dt;          // Sample time in seconds
+
+    // Parameters, set by pid_bank_set()
+    float *kp;
+    float *ki_dt;      // ki * dt
+    float *kd_dt;      // kd / dt
+    float *alpha;
+    float *kt;
+    float *out_min;
+    float *out_max;
+
+    // Inputs and outputs
+    float *setpoint;
+    float *measurement;
+    float *output;
+
+    // State
+    float *integral;
+    float *derivative;
+    float *previous;   // Measurement of the last update
+} PidBank;
+
+size_t pid_bank_storage_size(unsigned count);
+int pid_bank_init(PidBank *bank, unsigned count, float dt, void *storage, size_t size);
+int pid_bank_set(PidBank *bank, unsigned index, const PidGains *gains);
+void pid_bank_reset(PidBank *bank);
+void pid_bank_update(PidBank *bank);
+void pid_bank_update_scalar(PidBank *bank);
+void pid_bank_on_run(void *context);
+const char *pid_isa(void);
+
+#endif // PID_H
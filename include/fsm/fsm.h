@@ -1,25 +1,50 @@
+#ifndef FSM_H
+#define FSM_H
+
+#include <stdint.h>
+
+#define ST_NO_STATE 0xFFFFu
+
+// Every callback receives the context pointer of the instance being run
 typedef struct {
-    void (*on_entry)(void);
-    void (*on_run)(void);
-    void (*on_exit)(void);
+    void (*on_entry)(void *context);
+    void (*on_run)(void *context);
+    void (*on_exit)(void *context);
 } st_State;
 
 typedef struct {
     st_State *source_state;
     st_State *target_state;
-    char (*condition)(void);
+    char (*condition)(void *context);
 } st_Transition;
 
+// Read-only machine definition, shared by any number of instances
 typedef struct {
     st_State *states;
     st_Transition *transitions;
-    char num_states;
-    char num_transitions;
+    uint16_t num_states;
+    uint16_t num_transitions;
+    /* Optional CSR index, num_states + 1 entries. When provided,
+       state_machine_compile() reorders the transitions array in place,
+       grouping it by source state (stable, so declared priority within a
+       state is kept), and fills the index in so that state_machine_run() only visits the transitions
+       leaving the current state. Leave NULL to scan every transition. */
+    uint16_t *transition_offsets;
     st_State *default_state;
-    st_State *prev_state;
-    st_State *current_state;
 } st_StateMachine;
 
-void state_machine_init(st_StateMachine *state_machine);
+// Per-instance runtime record: state indices into st_StateMachine.states
+typedef struct {
+    void *context;
+    uint16_t current_state;
+    uint16_t prev_state;  // ST_NO_STATE until the first transition
+} st_StateMachineInstance;
+
+// Validates default_state and builds the optional index. Reorders transitions[].
+int state_machine_compile(st_StateMachine *state_machine);
+
+void state_machine_init(const st_StateMachine *state_machine, st_StateMachineInstance *instance, void *context);
+
+void state_machine_run(const st_StateMachine *state_machine, st_StateMachineInstance *instance);
 
-void state_machine_run(st_StateMachine *state_machine);
\ No newline at end of file
+#endif // FSM_H
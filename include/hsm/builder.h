@@ -0,0 +1,70 @@
+#ifndef BUILDER_H
+#define BUILDER_H
+
+#include <stddef.h>
+#include "hsm/hsm.h"
+
+/* ----------------------------------------------------------------------------
+ * Machine builder
+ *
+ * Assembles a machine description at runtime and compiles it, all inside
+ * one contiguous arena. The arena is split in two: the compiled image, the
+ * only data touched while instances run, is placed at the start on a cache
+ * line boundary; everything else -- the State, Transition and StateMachine
+ * descriptors, the arrays tying them together and the state names -- is
+ * cold data growing down from the end. Nothing is allocated per node, and
+ * the whole machine is released by freeing the arena.
+ *
+ * The descriptors returned while building are ordinary description structs;
+ * fields the builder calls do not take (parent, on_event, pure_guard,
+ * after, ...) may be set on them directly until machine_builder_finish().
+ * ------------------------------------------------------------------------- */
+
+#define MACHINE_BUILDER_ALIGN 64  // Alignment of the arena and of the compiled image
+
+typedef struct MachineBuilder {
+    unsigned char *arena;
+    size_t size;
+    size_t cold;          // Offset of the cold data, which grows down from the end
+    size_t hot;           // Bytes of compiled image at the start, 0 until finished
+    size_t required;      // Arena size that would have fit, set when the arena ran out
+    int owned;            // Non-zero if the builder allocated the arena
+    int error;            // Set once a call failed; finishing then fails too
+
+    State *states;
+    StateMachine **state_regions;  // Region each state was added to
+    State **members;               // Backing store of the StateMachine.states arrays
+    unsigned num_states;
+    unsigned max_states;
+
+    StateMachine *regions;         // regions[0] is the root
+    unsigned *region_offsets;      // max_regions + 1 entries, used while finishing
+    unsigned num_regions;
+    unsigned max_regions;
+
+    unsigned *state_offsets;       // max_states + 1 entries, used while finishing
+
+    Transition *transitions;
+    State **sources;               // Source state of each transition
+    unsigned *slots;               // Sorted position of each transition, used while finishing
+    unsigned num_transitions;
+    unsigned max_transitions;
+
+    const char **names;            // Name of each state by StateId, once finished
+} MachineBuilder;
+
+size_t machine_builder_tables_size(unsigned max_states, unsigned max_regions, unsigned max_transitions);
+int machine_builder_init(MachineBuilder *b, void *arena, size_t size, unsigned max_states,
+                         unsigned max_regions, unsigned max_transitions);
+StateMachine *machine_builder_root(MachineBuilder *b);
+StateMachine *machine_builder_regions(MachineBuilder *b, State *owner, int count);
+State *machine_builder_state(MachineBuilder *b, StateMachine *region, const char *name,
+                             StateFunc on_entry, StateFunc on_run, StateFunc on_exit);
+Transition *machine_builder_transition(MachineBuilder *b, State *source, State *target,
+                                       GuardFunc condition, int event);
+void *machine_builder_alloc(MachineBuilder *b, size_t size);
+int machine_builder_finish(MachineBuilder *b, StateMachineDef *def);
+const char *machine_builder_state_name(const MachineBuilder *b, StateId id);
+void machine_builder_destroy(MachineBuilder *b);
+
+#endif // BUILDER_H
@@ -0,0 +1,70 @@
+#ifndef DEFINITION_FILE_H
+#define DEFINITION_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "hsm/hsm.h"
+
+/* ----------------------------------------------------------------------------
+ * Definition files
+ *
+ * A definition file stores a compiled image together with the names of the
+ * handlers it refers to. The image is pointer-free and placed at a 64-byte
+ * aligned offset, so a loaded or mapped file is used in place: loading only
+ * checks the header and binds the handler names to functions of the running
+ * program. Files are tied to the byte order that wrote them.
+ *
+ * Layout: DefinitionFileHeader, name offsets (uint32_t per handler, relative
+ * to the start of the file), the NUL-terminated names, padding, the image.
+ * ------------------------------------------------------------------------- */
+
+#define DEFINITION_FILE_MAGIC 0x46534D48u  // "HMSF" in little-endian byte order
+#define DEFINITION_FILE_VERSION 6
+#define DEFINITION_FILE_ALIGN 64
+
+typedef struct DefinitionFileHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t size;          // Bytes, including this header
+    uint32_t fingerprint;   // state_machine_fingerprint() of the image
+    uint32_t num_handlers;  // Including the unused slot 0
+    uint32_t names;         // Offset of the name offsets
+    uint32_t image;         // Offset of the image
+    uint32_t image_size;
+} DefinitionFileHeader;
+
+// Associates a callback with the name stored for it in definition files
+typedef struct HandlerBinding {
+    const char *name;
+    HandlerFunc handler;
+} HandlerBinding;
+
+#define HSM_BIND(fn) {#fn, (HandlerFunc)(fn)}
+
+// A definition file mapped into memory, see definition_file_map()
+typedef struct MappedDefinition {
+    const void *data;
+    size_t size;
+    int mapped;     // Zero when the file was read into allocated memory
+} MappedDefinition;
+
+// Flags of definition_file_bind()
+#define DEFINITION_FILE_VERIFY 0x0001u  // Check the image against its fingerprint
+
+size_t definition_file_size(const StateMachineDef *def, const HandlerBinding *bindings, unsigned num_bindings);
+size_t definition_file_write(const StateMachineDef *def, const HandlerBinding *bindings, unsigned num_bindings,
+                             void *buffer, size_t size);
+int definition_file_save(const StateMachineDef *def, const HandlerBinding *bindings, unsigned num_bindings,
+                         FILE *out);
+
+unsigned definition_file_handlers(const void *file, size_t size);
+int definition_file_bind(StateMachineDef *def, const void *file, size_t size,
+                         const HandlerBinding *bindings, unsigned num_bindings,
+                         HandlerFunc *handlers, unsigned max_handlers, unsigned flags);
+
+int definition_file_map(MappedDefinition *map, const char *path);
+void definition_file_unmap(MappedDefinition *map);
+
+#endif // DEFINITION_FILE_H
@@ -0,0 +1,33 @@
+#ifndef EVENT_QUEUE_H
+#define EVENT_QUEUE_H
+
+#include <stdatomic.h>
+
+typedef struct EventQueueSlot {
+    atomic_uint sequence;
+    int event;
+} EventQueueSlot;
+
+// Bounded multi-producer/single-consumer ring buffer of events. Any thread
+// may post; only the thread that owns the machine may pop.
+typedef struct EventQueue {
+    EventQueueSlot *slots;
+    unsigned mask;  // capacity - 1, capacity is a power of two
+
+    // Producer and consumer cursors live on separate cache lines
+    char pad0[64];
+    atomic_uint head;
+    char pad1[64];
+    atomic_uint tail;
+    char pad2[64];
+
+    atomic_uint dropped;  // Events rejected because the queue was full
+} EventQueue;
+
+int event_queue_init(EventQueue *queue, EventQueueSlot *slots, unsigned capacity);
+int event_queue_post(EventQueue *queue, int event);
+int event_queue_pop(EventQueue *queue, int *event);
+unsigned event_queue_depth(EventQueue *queue);
+unsigned event_queue_dropped(EventQueue *queue);
+
+#endif // EVENT_QUEUE_H
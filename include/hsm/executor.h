@@ -0,0 +1,71 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include "hsm/hsm.h"
+
+/* ----------------------------------------------------------------------------
+ * Periodic executor
+ *
+ * Calls a step function at a fixed rate on the calling thread, typically a
+ * state_machine_tick() of a control loop. Releases lie on a fixed grid of
+ * absolute deadlines, so sleeping late in one cycle does not shift the
+ * following ones. Every cycle records its release latency (how late the
+ * step started) in a histogram; a cycle still running at the next release
+ * is an overrun, and the catch-up policy decides what happens to the
+ * releases it missed.
+ *
+ * The executor sleeps with clock_nanosleep() on an absolute deadline and
+ * can spin for the last stretch before each release, trading a core for
+ * lower latency. Real-time scheduling and CPU pinning are applied to the
+ * calling thread separately by executor_set_realtime().
+ * ------------------------------------------------------------------------- */
+
+#define EXECUTOR_HISTOGRAM_BINS 64
+
+// Catch-up policies: what to do with the releases missed by an overrun
+#define EXECUTOR_CATCH_UP 0  // Run the missed cycles back to back, keeping the cycle count
+#define EXECUTOR_SKIP 1      // Drop the missed releases, staying on the original grid
+#define EXECUTOR_RESTART 2   // Drop them and start a new grid one period after the overrun
+
+typedef void (*ExecutorStep)(void *arg);
+
+typedef struct ExecutorStats {
+    uint64_t cycles;
+    uint64_t overruns;        // Cycles that ended after the next release
+    uint64_t skipped;         // Releases dropped by the catch-up policy
+    uint64_t min_latency_ns;  // Start of the step after its release
+    uint64_t max_latency_ns;
+    uint64_t sum_latency_ns;
+    uint64_t max_step_ns;     // Longest step
+    uint32_t histogram[EXECUTOR_HISTOGRAM_BINS];  // Latencies by bin_ns; the last bin takes the rest
+} ExecutorStats;
+
+typedef struct Executor {
+    ExecutorStep step;
+    void *arg;
+    uint64_t period_ns;
+    uint64_t spin_ns;     // Spin instead of sleeping this long before each release, 0 to only sleep
+    uint64_t bin_ns;      // Width of a histogram bin
+    int policy;           // EXECUTOR_CATCH_UP, EXECUTOR_SKIP or EXECUTOR_RESTART
+    uint64_t release_ns;  // Next release on the monotonic clock
+    atomic_int stop;
+    ExecutorStats stats;
+} Executor;
+
+// Argument of executor_tick_machine(), for steps that are a single tick
+typedef struct ExecutorMachine {
+    const StateMachineDef *def;
+    StateMachineInstance *inst;
+} ExecutorMachine;
+
+int executor_init(Executor *ex, uint64_t period_ns, int policy, ExecutorStep step, void *arg);
+int executor_set_realtime(int priority, int cpu);
+uint64_t executor_run(Executor *ex, uint64_t cycles);
+void executor_stop(Executor *ex);
+void executor_reset_stats(Executor *ex);
+uint64_t executor_jitter_ns(const Executor *ex);
+void executor_tick_machine(void *arg);
+
+#endif // EXECUTOR_H
@@ -1,26 +1,94 @@
 #ifndef HSM_H
 #define HSM_H
 
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "hsm/event_queue.h"
+
 typedef struct State State;
 typedef struct Transition Transition;
 typedef struct StateMachine StateMachine;
+struct WorkerPool;
+struct TimerWheel;
+struct TimerNode;
+
+typedef uint16_t StateId;
+#define HSM_NO_STATE ((StateId)0xFFFF)
+
+// Every callback receives the context pointer of the instance being run
+typedef void (*StateFunc)(void *context);
+typedef void (*EventFunc)(void *context, int event);
+typedef int (*GuardFunc)(void *context);
+typedef void (*ActionFunc)(void *context);
 
+/* Asynchronous actions start slow work (flash writes, DMA transfers, ...)
+   and return at once. The token identifies the work: whoever finishes it,
+   on any thread, calls state_machine_complete(token), which posts the
+   action's completion event to the instance's queue. An action that
+   finished on the spot may return HSM_ASYNC_DONE instead. Completion
+   events are reserved: state_machine_dispatch() delivers one only while
+   the work it completes has not been abandoned. */
+typedef struct AsyncOp AsyncOp;
+typedef struct AsyncToken {
+    AsyncOp *op;
+    uint32_t id;
+} AsyncToken;
+typedef int (*AsyncFunc)(void *context, AsyncToken token);
 
-typedef void (*StateFunc)(State *self);
-typedef void (*EventFunc)(State *self, int event);
+#define HSM_ASYNC_DONE 0     // Finished, post the completion event now
+#define HSM_ASYNC_PENDING 1  // Still running, state_machine_complete() follows
+#define HSM_ASYNC_POSTED 0x80000000u  // AsyncOp.pending bit: completion queued, not yet delivered
+
+/* ----------------------------------------------------------------------------
+ * Machine description
+ *
+ * Machines are described with the structs below and turned into a read-only
+ * StateMachineDef by state_machine_compile(). The description is only read
+ * while compiling, apart from the ids written back for the caller's use.
+ * ------------------------------------------------------------------------- */
 
 typedef struct Transition {
     State *target;
-    int (*condition)(void);
-    void (*action)(void);
+    GuardFunc condition;
+    ActionFunc action;
 
     // Optional partial entry overrides for orthogonal regions
     State **parallel_targets;  // One per region (indexed by region index)
     int num_parallel_targets;  // Must match number of regions in target->submachine[]
+
+    // Trigger event (> 0). 0 for transitions polled through condition on every tick.
+    // Event-triggered transitions may still have a condition acting as a guard.
+    int event;
+
+    /* Non-zero if condition is pure for the duration of a tick: it only
+       depends on inputs that do not change while the tick runs. Such a guard
+       is called at most once per tick (or per delivered event) and instance,
+       however many transitions share it; later uses read the cached result,
+       even after handlers of the same tick changed the context. */
+    int pure_guard;
+
+    /* Optional bitmask guard on the input word of the instance, see
+       StateMachine.input_offset: the transition is enabled when
+       (inputs & input_mask) == input_value. Tested for all polled
+       transitions of a state at once, before any condition is called.
+       When condition is also set both must pass. 0 for none. */
+    uint32_t input_mask;
+    uint32_t input_value;
+
+    /* Time-triggered transition: fires this many ticks of the definition's
+       timer_wheel after its source state was entered, unless the state was
+       left before. condition, if set, is checked when the time is up. The
+       event must be 0. 0 for none. */
+    uint32_t after;
+
+    /* Optional asynchronous action, started after action once the source
+       is exited. Its completion posts done_event. */
+    AsyncFunc async_action;
+    int done_event;
 } Transition;
 
 typedef struct State {
-    //const char *name;
     State *parent;  // NULL if top-level
     StateFunc on_entry;
     StateFunc on_run;
@@ -33,18 +101,240 @@ typedef struct State {
     // If this state is a composite, these fields are used
     StateMachine *submachine;
     int num_submachines;
+    int parallel_regions;  // Non-zero to tick the regions concurrently, see region_pool
+    const char *name;      // Optional, only used by diagnostics such as trace_write_names()
+
+    StateId id;  // Filled in by state_machine_compile()
+
+    /* Optional asynchronous actions: async_entry is started after on_entry,
+       async_run after on_run whenever no work of the state is in flight.
+       Each completion posts done_event; work still in flight when the state
+       is exited is not waited for, its completion is dropped. */
+    AsyncFunc async_entry;
+    AsyncFunc async_run;
+    int done_event;
 } State;
 
+// StateMachine.history: how a region resumes when its owner is entered again
+#define HSM_HISTORY_NONE 0     // Start over in initial_state
+#define HSM_HISTORY_SHALLOW 1  // Resume in the last active top-level state of the region
+#define HSM_HISTORY_DEEP 2     // Resume in the last active leaf, nested regions included
+
 typedef struct StateMachine {
     State **states;
     int num_states;
     State *initial_state;
-    State *current_state;
-    State *previous_state;
+
+    // Root only: byte offset of the uint32_t input word in every context, read by bitmask guards
+    size_t input_offset;
+
+    /* HSM_HISTORY_* for the regions of composite states. Transitions and
+       parallel_targets naming a state inside the region still enter that state. */
+    int history;
+
+    uint16_t id;  // Region index, filled in by state_machine_compile()
 } StateMachine;
 
-void state_machine_init(StateMachine *sm);
-void state_machine_tick(StateMachine *sm);
-void state_machine_send_event(StateMachine *sm, int event);
+/* ----------------------------------------------------------------------------
+ * Compiled definition
+ *
+ * A compiled machine is a single pointer-free image: fixed-size records
+ * that refer to each other by index and to shared pools by offset. Callbacks
+ * are referenced by index into a separate handler table, index 0 meaning
+ * "none". One definition is shared by any number of instances.
+ * ------------------------------------------------------------------------- */
+
+typedef void (*HandlerFunc)(void);
+
+#define HSM_NO_TABLE 0xFFFFFFFFu
+#define HSM_NO_MEMO 0xFFFFu
+#define HSM_NO_TIMER 0xFFFFu
+#define HSM_NO_ASYNC 0xFFFFu
+#define HSM_MAX_GUARD_MEMOS 64  // Distinct pure guards cached per tick, others are always called
+#define HSM_MAX_REGION_NESTING 32  // Regions within regions, the root counting as one; bounds the engine's work stacks
+
+// StateDef.flags
+#define HSM_STATE_PARALLEL 0x0001u  // Regions may be ticked concurrently
+#define HSM_STATE_MASKED 0x0002u    // Some polled transitions have bitmask guards
+#define HSM_STATE_TIMED 0x0004u     // Some transitions are time-triggered
+#define HSM_STATE_ASYNC 0x0008u     // Has asynchronous entry or run actions
+
+typedef struct StateDef {
+    StateId parent;            // HSM_NO_STATE at the region root
+    uint16_t region;           // Region the state belongs to
+    uint16_t depth;            // Number of states on the root-to-state path
+    uint16_t first_region;     // Orthogonal regions owned by this state
+    uint16_t num_regions;
+    uint16_t num_polled;       // Guarded transitions without a trigger event
+    uint16_t on_entry;         // Handler indices
+    uint16_t on_run;
+    uint16_t on_exit;
+    uint16_t on_event;
+    uint16_t flags;            // HSM_STATE_* bits
+    uint16_t async;            // With HSM_STATE_ASYNC: operation of the instance, HSM_NO_ASYNC otherwise
+    uint32_t path;             // Root-to-state path, offset into paths
+    uint32_t polled;           // Polled transition ids, offset into refs
+    uint32_t first_transition; // Transitions declared on this state
+    uint32_t num_transitions;
+    uint32_t event_table;      // Index into event_tables, HSM_NO_TABLE if none
+    uint32_t input_masks;      // With HSM_STATE_MASKED: masks then values of the polled
+                               // transitions, padded to INPUT_MASK_LANES, offset into input_masks
+} StateDef;
+
+typedef struct RegionDef {
+    StateId owner;    // Composite state owning the region, HSM_NO_STATE for the root
+    StateId initial;
+    uint16_t history; // HSM_HISTORY_*
+    uint16_t reserved;
+} RegionDef;
+
+typedef struct TransitionDef {
+    StateId source;
+    StateId target;
+    StateId ancestor;          // Lowest common ancestor, HSM_NO_STATE at the region root
+    uint16_t guard;            // Handler indices
+    uint16_t action;
+    uint16_t exit_len;
+    uint16_t entry_len;
+    uint16_t num_parallel_targets;
+    uint16_t memo;             // Cache slot of a pure guard, HSM_NO_MEMO if not cached
+    uint16_t timer;            // Timer of time-triggered transitions in the instance, HSM_NO_TIMER if none
+    int32_t event;             // 0 for polled transitions
+    uint32_t exit_path;        // States to exit, innermost first, offset into paths
+    uint32_t entry_path;       // States to enter, outermost first, offset into paths
+    uint32_t parallel_targets; // Per-region entry overrides, offset into paths
+    uint32_t after;            // Delay of time-triggered transitions, in timer wheel ticks
+    uint16_t async;            // Operation of the asynchronous action in the instance, HSM_NO_ASYNC if none
+    uint16_t reserved;
+} TransitionDef;
+
+// Asynchronous actions of a state or transition, sharing one operation per instance
+typedef struct AsyncDef {
+    uint16_t start;   // Handler started on entry, or the transition's action
+    uint16_t run;     // Handler started after on_run, states only
+    int32_t event;    // Completion event
+} AsyncDef;
+
+// One slot of a state's event dispatch table
+typedef struct EventEntry {
+    int32_t event;   // 0 for an empty slot
+    uint32_t first;  // First candidate, relative to EventTableDef.transitions
+    uint32_t count;  // Number of candidates for this event, tried in order
+} EventEntry;
+
+// Constant-time map from event to the transitions it triggers in a state
+typedef struct EventTableDef {
+    uint32_t entries;      // First slot in event_entries
+    uint32_t size;         // Number of slots
+    uint32_t seed;         // 0 for a dense table indexed by event - base
+    uint32_t shift;        // Hash shift when seed != 0
+    int32_t base;          // Smallest event when dense
+    uint32_t transitions;  // Candidate ids grouped by event, offset into refs
+} EventTableDef;
+
+typedef struct StateMachineImage {
+    uint32_t size;             // Bytes, including this header
+    uint16_t num_states;
+    uint16_t num_regions;
+    uint32_t num_transitions;
+    uint32_t num_handlers;     // Including the unused slot 0
+    uint32_t num_event_tables;
+    uint32_t num_memos;        // Cache slots used by pure guards
+    uint32_t input_offset;     // Byte offset of the input word in contexts
+    uint32_t num_history;      // Regions with history; instances then keep a history slot per region
+    uint32_t num_timers;       // Time-triggered transitions; instances keep a TimerNode for each
+    uint32_t num_async;        // Asynchronous operations; instances keep an AsyncOp for each
+    uint32_t states;           // Byte offsets of the arrays from the start of the image
+    uint32_t regions;
+    uint32_t transitions;
+    uint32_t event_tables;
+    uint32_t event_entries;
+    uint32_t refs;
+    uint32_t paths;
+    uint32_t input_masks;
+    uint32_t async;
+} StateMachineImage;
+
+// An image bound to its handler table, with the arrays resolved for fast access
+typedef struct StateMachineDef {
+    const StateMachineImage *image;
+    const StateDef *states;
+    const RegionDef *regions;
+    const TransitionDef *transitions;
+    const EventTableDef *event_tables;
+    const EventEntry *event_entries;
+    const uint32_t *refs;
+    const StateId *paths;
+    const uint32_t *input_masks;
+    const AsyncDef *async;
+    const HandlerFunc *handlers;
+
+    /* Optional pool ticking the regions of composites marked parallel_regions,
+       NULL after compiling. Regions then run on different threads, so their
+       handlers must only touch disjoint parts of the context. The regions are
+       joined before the tick returns. When the pool is busy (nested parallel
+       composites, or another thread ticking) or a timer wheel is attached,
+       regions run sequentially. */
+    struct WorkerPool *region_pool;
+
+    /* Wheel arming the time-triggered transitions of the instances, NULL
+       after compiling, in which case those transitions never fire. Timers
+       are armed and cancelled while states are entered and exited, so every
+       instance using the wheel must run on the thread advancing it, with
+       state_machine_expire() as the expire callback. */
+    struct TimerWheel *timer_wheel;
+} StateMachineDef;
+
+/* ----------------------------------------------------------------------------
+ * Instances
+ *
+ * The runtime record of one machine: its context pointer followed by the
+ * current state of every region, then the previous state of every region
+ * and, for machines with history, the leaf each region was in when it was
+ * last exited. Machines with time-triggered transitions keep one timer per
+ * such transition behind the states, so instances must not be moved while
+ * timers are armed, and machines with asynchronous actions keep one AsyncOp
+ * per state or transition having them after that. Allocate
+ * state_machine_instance_size() bytes per instance, aligned for pointers.
+ * ------------------------------------------------------------------------- */
+
+typedef struct StateMachineInstance {
+    void *context;
+    StateId state[];
+} StateMachineInstance;
+
+// Asynchronous work of an instance, see AsyncFunc
+struct AsyncOp {
+    EventQueue *queue;    // Where completions are posted, see state_machine_set_queue()
+    atomic_uint pending;  // Token id of the work in flight, 0 when idle, with HSM_ASYNC_POSTED once completed
+    uint32_t serial;      // Last token id handed out
+    int32_t event;        // Completion event
+};
+
+size_t state_machine_compile_size(StateMachine *sm);
+int state_machine_compile(StateMachine *sm, StateMachineDef *def, void *buffer, size_t size);
+int state_machine_bind(StateMachineDef *def, const void *image, size_t size, const HandlerFunc *handlers);
+
+size_t state_machine_instance_size(const StateMachineDef *def);
+unsigned state_machine_state_slots(const StateMachineDef *def);
+struct TimerNode *state_machine_timers(const StateMachineDef *def, StateMachineInstance *inst);
+AsyncOp *state_machine_async_ops(const StateMachineDef *def, StateMachineInstance *inst);
+void state_machine_set_queue(const StateMachineDef *def, StateMachineInstance *inst, EventQueue *queue);
+StateId state_machine_current_state(const StateMachineDef *def, const StateMachineInstance *inst, unsigned region);
+StateId state_machine_previous_state(const StateMachineDef *def, const StateMachineInstance *inst, unsigned region);
+StateId state_machine_history_state(const StateMachineDef *def, const StateMachineInstance *inst, unsigned region);
+int state_machine_is_active(const StateMachineDef *def, const StateMachineInstance *inst, StateId state);
+
+void state_machine_init(const StateMachineDef *def, StateMachineInstance *inst, void *context);
+void state_machine_rearm(const StateMachineDef *def, StateMachineInstance *inst);
+void state_machine_restart_async(const StateMachineDef *def, StateMachineInstance *inst);
+void state_machine_tick(const StateMachineDef *def, StateMachineInstance *inst);
+size_t state_machine_batch_workspace_size(const StateMachineDef *def, int count);
+void state_machine_tick_batch(const StateMachineDef *def, StateMachineInstance **instances,
+                              int count, void *workspace);
+int state_machine_send_event(const StateMachineDef *def, StateMachineInstance *inst, int event);
+int state_machine_dispatch(const StateMachineDef *def, StateMachineInstance *inst, EventQueue *queue, int max_events);
+void state_machine_expire(void *def, struct TimerNode *timer);
+int state_machine_complete(AsyncToken token);
 
-#endif // HSM_H
\ No newline at end of file
+#endif // HSM_H
@@ -0,0 +1,36 @@
+#ifndef INPUT_MASK_H
+#define INPUT_MASK_H
+
+#include <stdint.h>
+
+/* ----------------------------------------------------------------------------
+ * Bitmask guards
+ *
+ * A bitmask guard enables a transition when (inputs & mask) == value, where
+ * inputs is the 32-bit input word of the instance. The kernels below test
+ * up to 64 guards against one input word, or one guard against up to 64
+ * input words, and return the result as a bit set. They use AVX2 when the
+ * CPU supports it, SSE2 on other x86 CPUs and plain C elsewhere; every
+ * version gives the same result.
+ * ------------------------------------------------------------------------- */
+
+#define INPUT_MASK_LANES 8  // Guard tables are padded to a multiple of this
+
+/* Padding entry that never matches: no input word has bit 0 of the value
+   set under an empty mask. */
+#define INPUT_MASK_PAD_MASK 0u
+#define INPUT_MASK_PAD_VALUE 1u
+
+// Bit i set when (inputs & masks[i]) == values[i], count a multiple of INPUT_MASK_LANES, at most 64
+uint64_t input_mask_match_guards(const uint32_t *masks, const uint32_t *values, unsigned count,
+                                 uint32_t inputs);
+// Bit i set when (inputs[i] & mask) == value, count at most 64
+uint64_t input_mask_match_inputs(const uint32_t *inputs, unsigned count, uint32_t mask, uint32_t value);
+// Plain C versions of the two kernels above, whatever the CPU
+uint64_t input_mask_match_guards_scalar(const uint32_t *masks, const uint32_t *values, unsigned count,
+                                        uint32_t inputs);
+uint64_t input_mask_match_inputs_scalar(const uint32_t *inputs, unsigned count, uint32_t mask, uint32_t value);
+// Instruction set used by the kernels: "avx2", "sse2" or "scalar"
+const char *input_mask_isa(void);
+
+#endif // INPUT_MASK_H
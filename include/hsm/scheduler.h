@@ -0,0 +1,37 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+#include "hsm/hsm.h"
+#include "hsm/worker_pool.h"
+
+/* ----------------------------------------------------------------------------
+ * Multi-core scheduler
+ *
+ * Ticks a population of instances of one definition across a pool of worker
+ * threads. Instances are cut into fixed-size chunks that are sharded over the
+ * workers; idle workers steal chunks from busy ones. Every instance is ticked
+ * exactly once per cycle by a single thread, so its sequence of callbacks is
+ * the same as with a single-threaded loop. scheduler_tick() returns only once
+ * every instance has been ticked, acting as a per-cycle barrier.
+ * ------------------------------------------------------------------------- */
+
+typedef struct Scheduler {
+    const StateMachineDef *def;
+    StateMachineInstance **instances;
+    unsigned count;
+    unsigned chunk_size;  // Instances per chunk, the unit of stealing
+    WorkerPool pool;
+
+    uint64_t cycles;
+    uint64_t cycle_ns;      // Wall time of the last cycle
+    uint64_t max_cycle_ns;  // Worst cycle so far
+} Scheduler;
+
+int scheduler_init(Scheduler *sched, const StateMachineDef *def, StateMachineInstance **instances,
+                   unsigned count, unsigned chunk_size, unsigned num_workers, const int *cpus);
+void scheduler_tick(Scheduler *sched);
+const WorkerStats *scheduler_worker_stats(const Scheduler *sched, unsigned worker);
+void scheduler_destroy(Scheduler *sched);
+
+#endif // SCHEDULER_H
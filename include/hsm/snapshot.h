@@ -0,0 +1,41 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hsm/hsm.h"
+
+/* ----------------------------------------------------------------------------
+ * Snapshots
+ *
+ * A snapshot holds the complete active configuration of a set of instances:
+ * the current and previous state of every region and, for machines with
+ * history, the leaf every region was last exited from. It contains state
+ * ids only, so it can be written to disk or sent to another process and
+ * restored into instances at different addresses, as long as the
+ * definition and the byte order are the same. Restoring writes the
+ * configuration back without running any entry actions. Contexts, armed
+ * timers and asynchronous work in flight are not part of a snapshot;
+ * restoring arms the timers of the active states afresh and abandons the
+ * work in flight.
+ * ------------------------------------------------------------------------- */
+
+#define SNAPSHOT_MAGIC 0x534D5348u  // "HSMS" in little-endian byte order
+#define SNAPSHOT_VERSION 1
+
+typedef struct SnapshotHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t slots;         // StateId slots per instance
+    uint32_t definition;    // Fingerprint of the compiled image
+    uint32_t count;         // Number of instances
+} SnapshotHeader;
+
+uint32_t state_machine_fingerprint(const StateMachineDef *def);
+size_t state_machine_snapshot_size(const StateMachineDef *def, unsigned count);
+size_t state_machine_snapshot(const StateMachineDef *def, StateMachineInstance *const *instances,
+                              unsigned count, void *buffer, size_t size);
+int state_machine_restore(const StateMachineDef *def, StateMachineInstance *const *instances,
+                          unsigned count, const void *buffer, size_t size);
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,69 @@
+#ifndef TICKLESS_SCHEDULER_H
+#define TICKLESS_SCHEDULER_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "hsm/event_queue.h"
+#include "hsm/hsm.h"
+#ifndef __linux__
+#include <pthread.h>
+#endif
+
+/* ----------------------------------------------------------------------------
+ * Tickless scheduler
+ *
+ * Ticks only the instances that have something to do. An instance becomes
+ * ready when an event is posted to it, when one of its timers expires, or
+ * when its inputs are marked dirty by the caller; each cycle dispatches the
+ * pending events of the ready instances, ticks them once and forgets them.
+ * Instances that are not ready are not touched at all, so the cost of a
+ * cycle follows the number of active instances rather than the size of the
+ * population. When nothing is ready the scheduler thread sleeps until
+ * another thread marks an instance or the next timer is due.
+ *
+ * Polled transitions only see changed inputs once the instance is marked:
+ * whoever writes the context calls tickless_scheduler_mark() afterwards.
+ *
+ * Cycles, timers and sleeping all run on one thread. mark() and post() may
+ * be called from any thread.
+ * ------------------------------------------------------------------------- */
+
+typedef struct TicklessScheduler {
+    const StateMachineDef *def;
+    StateMachineInstance **instances;
+    EventQueue *queues;       // Optional per-instance event queues, NULL if events are not used
+    unsigned count;
+
+    EventQueue ready;         // Indices of the ready instances, each queued at most once
+    atomic_uchar *queued;     // Per instance: non-zero while its index is in ready
+
+    // Timer wheel ticks are derived from the monotonic clock
+    uint64_t tick_ns;         // Length of a timer wheel tick
+    uint64_t epoch_ns;        // Clock at epoch_tick
+    uint64_t epoch_tick;
+
+    atomic_uint wake;         // Bumped to wake the sleeping scheduler (futex word on Linux)
+    atomic_int sleeping;
+#ifndef __linux__
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+#endif
+
+    uint64_t cycles;
+    uint64_t ticked;          // Instance ticks over all cycles
+    uint64_t expired;         // Timers expired over all cycles
+    uint64_t sleeps;
+} TicklessScheduler;
+
+size_t tickless_scheduler_storage_size(unsigned count);
+int tickless_scheduler_init(TicklessScheduler *sched, const StateMachineDef *def,
+                            StateMachineInstance **instances, EventQueue *queues, unsigned count,
+                            uint64_t tick_ns, void *storage, size_t size);
+void tickless_scheduler_mark(TicklessScheduler *sched, unsigned index);
+int tickless_scheduler_post(TicklessScheduler *sched, unsigned index, int event);
+unsigned tickless_scheduler_run(TicklessScheduler *sched);
+int tickless_scheduler_wait(TicklessScheduler *sched, uint64_t max_ns);
+void tickless_scheduler_destroy(TicklessScheduler *sched);
+
+#endif // TICKLESS_SCHEDULER_H
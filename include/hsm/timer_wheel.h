@@ -0,0 +1,53 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+
+/* ----------------------------------------------------------------------------
+ * Timing wheel
+ *
+ * A hierarchical timing wheel of TIMER_WHEEL_LEVELS levels of
+ * TIMER_WHEEL_SLOTS slots each. Level 0 holds the timers due within the next
+ * TIMER_WHEEL_SLOTS ticks, one slot per tick; each further level covers
+ * TIMER_WHEEL_SLOTS times the span of the previous one and is cascaded into
+ * it as time passes. Timers are intrusive nodes owned by the caller, so
+ * arming and cancelling are constant-time list operations and the wheel
+ * allocates nothing. Ticks are whatever unit the caller advances the wheel
+ * in. A wheel is not synchronized: arm, cancel and advance it from one
+ * thread.
+ * ------------------------------------------------------------------------- */
+
+#define TIMER_WHEEL_BITS 8
+#define TIMER_WHEEL_SLOTS (1u << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 5  // Covers 2^40 ticks; longer timers are re-cascaded
+
+typedef struct TimerNode {
+    struct TimerNode *next;
+    struct TimerNode **pprev;  // NULL while not armed
+    uint64_t expires;          // Tick the timer fires at
+    void *owner;               // Free for the user, e.g. the instance
+    uint32_t id;               // Free for the user, e.g. the transition
+    uint32_t tag;              // Free for the user, kept by timer_node_init()
+} TimerNode;
+
+typedef struct TimerWheel {
+    uint64_t now;       // Last tick processed
+    uint64_t armed;     // Number of armed timers
+    TimerNode *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+} TimerWheel;
+
+typedef void (*TimerExpireFunc)(void *arg, TimerNode *timer);
+
+void timer_wheel_init(TimerWheel *wheel, uint64_t now);
+void timer_node_init(TimerNode *timer);
+void timer_wheel_arm(TimerWheel *wheel, TimerNode *timer, uint64_t expires);
+void timer_wheel_cancel(TimerWheel *wheel, TimerNode *timer);
+unsigned timer_wheel_advance(TimerWheel *wheel, uint64_t now, TimerExpireFunc expire, void *arg);
+uint64_t timer_wheel_next_expiry(const TimerWheel *wheel);
+
+static inline int timer_node_armed(const TimerNode *timer)
+{
+    return timer->pprev != 0;
+}
+
+#endif // TIMER_WHEEL_H
@@ -0,0 +1,70 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "hsm/hsm.h"
+
+/* ----------------------------------------------------------------------------
+ * Transition trace
+ *
+ * When the HSM sources are built with HSM_TRACE defined, every transition
+ * and every initial entry is recorded into the ring attached to the calling
+ * thread, if any. Rings have a single writer, their owning thread, so
+ * recording needs no atomic read-modify-write; the oldest records are
+ * overwritten once a ring is full. Without HSM_TRACE the hooks are not
+ * compiled in at all.
+ * ------------------------------------------------------------------------- */
+
+#define TRACE_MAGIC 0x45434152544D5348ull  // "HSMTRACE"
+#define TRACE_VERSION 1
+
+enum {
+    TRACE_TRANSITION = 1,  // Transition taken by a tick or an event
+    TRACE_INIT = 2         // Initial entry from state_machine_init()
+};
+
+typedef struct TraceRecord {
+    uint64_t timestamp;     // Time stamp counter at the start of the exit chain
+    uint32_t instance;      // Low 32 bits of the instance address
+    StateId source;         // Current state left, HSM_NO_STATE for TRACE_INIT
+    StateId target;
+    int32_t event;          // Trigger event, 0 for polled transitions
+    uint32_t exit_ticks;    // Duration of the exit chain
+    uint32_t entry_ticks;   // Duration of the entry chain
+    uint16_t region;
+    uint16_t type;          // TRACE_TRANSITION or TRACE_INIT
+} TraceRecord;
+
+typedef struct TraceRing {
+    TraceRecord *records;
+    uint32_t mask;
+    uint32_t thread;        // Assigned by trace_attach()
+    atomic_uint_fast64_t head;  // Records written so far
+} TraceRing;
+
+// Header written by trace_dump(), followed by count records, oldest first
+typedef struct TraceDumpHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    double ticks_per_ns;    // Time stamp counter rate
+    uint32_t thread;
+    uint32_t count;
+    uint64_t dropped;       // Records overwritten before the dump
+} TraceDumpHeader;
+
+int trace_attach(TraceRing *ring, TraceRecord *storage, uint32_t capacity);
+void trace_detach(void);
+uint32_t trace_count(const TraceRing *ring);
+const TraceRecord *trace_record(const TraceRing *ring, uint32_t index);
+int trace_dump(const TraceRing *ring, FILE *out);
+void trace_write_names(StateMachine *sm, FILE *out);
+
+// Hooks used by hsm.c
+uint64_t trace_now(void);
+void trace_transition(const StateMachineInstance *inst, unsigned region, StateId source, StateId target,
+                      int event, uint64_t start, uint64_t exited, uint64_t entered, unsigned type);
+
+#endif // TRACE_H
@@ -0,0 +1,38 @@
+#ifndef WCET_H
+#define WCET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hsm/hsm.h"
+
+/* ----------------------------------------------------------------------------
+ * Worst-case analysis
+ *
+ * Walks a compiled definition and bounds the work a single call to
+ * state_machine_tick() can do, counted in handler calls: whatever state
+ * every region is in, whichever guards pass and wherever history leads, no
+ * tick makes more calls than reported. Together with the worst-case time
+ * of each handler this bounds the execution time of a tick. Each kind of
+ * call is bounded on its own; calls bounds their sum over one tick, which
+ * is usually less than the sum of the separate bounds.
+ * ------------------------------------------------------------------------- */
+
+typedef struct WcetCounts {
+    uint32_t entries;  // on_entry calls
+    uint32_t exits;    // on_exit calls
+    uint32_t guards;   // Guard conditions evaluated
+    uint32_t runs;     // on_run calls
+    uint32_t actions;  // Transition actions called and asynchronous actions started
+    uint32_t calls;    // All of the above in one tick
+} WcetCounts;
+
+typedef struct WcetReport {
+    WcetCounts tick;          // Bounds for one state_machine_tick()
+    unsigned max_depth;       // Most states on a root-to-state path inside one region
+    unsigned region_nesting;  // Levels of nested regions, at most HSM_MAX_REGION_NESTING
+} WcetReport;
+
+size_t state_machine_wcet_workspace_size(const StateMachineDef *def);
+int state_machine_wcet(const StateMachineDef *def, WcetReport *report, void *workspace);
+
+#endif // WCET_H
@@ -0,0 +1,52 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Runs task number `task` of the current job on worker `worker`
+typedef void (*WorkerTask)(void *arg, unsigned task, unsigned worker);
+
+// Per-worker statistics, updated at the end of every job
+typedef struct WorkerStats {
+    uint64_t busy_ns;      // Time spent running tasks in the last job
+    uint64_t max_busy_ns;  // Worst busy_ns seen so far
+    unsigned tasks;        // Tasks run in the last job, stolen ones included
+    unsigned steals;       // Tasks taken from other workers in the last job
+} WorkerStats;
+
+// Range of task indices owned by one worker. Owners and thieves both claim
+// tasks by advancing next, so stealing needs no lock.
+typedef struct WorkerRange {
+    atomic_uint next;
+    unsigned end;
+    char pad[64 - sizeof(atomic_uint) - sizeof(unsigned)];
+} WorkerRange;
+
+// Fork/join pool. Worker 0 is the thread calling worker_pool_run().
+typedef struct WorkerPool {
+    unsigned num_workers;
+    pthread_t *threads;
+    WorkerRange *ranges;
+    WorkerStats *stats;
+
+    // Current job
+    WorkerTask task;
+    void *arg;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    unsigned generation;
+    unsigned active;
+    int stop;
+    atomic_flag busy;  // Held by the thread running a job
+} WorkerPool;
+
+int worker_pool_init(WorkerPool *pool, unsigned num_workers, const int *cpus);
+void worker_pool_run(WorkerPool *pool, WorkerTask task, void *arg, unsigned num_tasks);
+int worker_pool_try_run(WorkerPool *pool, WorkerTask task, void *arg, unsigned num_tasks);
+void worker_pool_destroy(WorkerPool *pool);
+
+#endif // WORKER_POOL_H
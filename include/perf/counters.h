@@ -0,0 +1,159 @@
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* ----------------------------------------------------------------------------
+ * Performance counters
+ *
+ * Per-state and per-transition counters for the FSM and HSM engines, fed by
+ * hooks compiled in with FSM_COUNTERS / HSM_COUNTERS. Counters are per
+ * thread: every thread attaches its own set, so updates are plain loads and
+ * stores without contention. Other threads may take snapshots at any time
+ * and aggregate the sets of several threads. States and transitions are
+ * indexed like the definition numbers them (state ids and transition ids for
+ * the HSM, array indices for the FSM), so a set belongs to one definition: a
+ * thread attaches one set per definition it runs, keyed by the definition
+ * pointer it passes to the engine (the StateMachineDef for the HSM, the
+ * st_StateMachine for the FSM). Definitions without a set are not counted.
+ * ------------------------------------------------------------------------- */
+
+#define PERF_HISTOGRAM_BUCKETS 16  // Bucket k counts durations in [2^(k-1), 2^k) ticks
+#define PERF_MAX_DEFINITIONS 8     // Sets a thread can have attached at once
+
+typedef _Atomic uint64_t PerfCounter;
+
+typedef struct PerfStateCounters {
+    PerfCounter entries;
+    PerfCounter exits;
+    PerfCounter ticks;      // Ticks during which the state was current, i.e. time in state
+    PerfCounter run_time;   // Total on_run duration, in perf_now() ticks
+    PerfCounter run_histogram[PERF_HISTOGRAM_BUCKETS];
+} PerfStateCounters;
+
+typedef struct PerfTransitionCounters {
+    PerfCounter guard_evaluations;
+    PerfCounter guard_hits;
+    PerfCounter taken;
+} PerfTransitionCounters;
+
+typedef struct PerfCounters {
+    unsigned num_states;
+    unsigned num_transitions;
+    PerfStateCounters *states;
+    PerfTransitionCounters *transitions;
+} PerfCounters;
+
+size_t perf_counters_size(unsigned num_states, unsigned num_transitions);
+int perf_counters_init(PerfCounters *counters, unsigned num_states, unsigned num_transitions,
+                       void *storage, size_t size);
+void perf_counters_reset(PerfCounters *counters);
+int perf_counters_attach(const void *definition, PerfCounters *counters);
+void perf_counters_detach(const void *definition);
+void perf_counters_snapshot(PerfCounters *dest, const PerfCounters *src);
+void perf_counters_aggregate(PerfCounters *total, const PerfCounters *const *parts, unsigned count);
+
+/* ----------------------------------------------------------------------------
+ * Hooks used by the engines
+ * ------------------------------------------------------------------------- */
+
+typedef struct PerfBinding {
+    const void *definition;
+    PerfCounters *counters;
+} PerfBinding;
+
+extern _Thread_local PerfBinding perf_thread_bindings[PERF_MAX_DEFINITIONS];
+
+static inline uint64_t perf_now(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    extern uint64_t perf_clock_ns(void);
+    return perf_clock_ns();
+#endif
+}
+
+// Only the owning thread writes, so no atomic read-modify-write is needed
+static inline void perf_add(PerfCounter *counter, uint64_t value)
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value,
+                          memory_order_relaxed);
+}
+
+// A thread runs a handful of definitions at most, so a linear scan is enough
+static inline PerfCounters *perf_counters(const void *definition)
+{
+    for (unsigned i = 0; i < PERF_MAX_DEFINITIONS; ++i)
+    {
+        if (perf_thread_bindings[i].definition == definition)
+        {
+            return perf_thread_bindings[i].counters;
+        }
+    }
+    return NULL;
+}
+
+static inline PerfStateCounters *perf_state(const void *definition, unsigned state)
+{
+    PerfCounters *c = perf_counters(definition);
+    return c && state < c->num_states ? &c->states[state] : NULL;
+}
+
+static inline PerfTransitionCounters *perf_transition(const void *definition, unsigned transition)
+{
+    PerfCounters *c = perf_counters(definition);
+    return c && transition < c->num_transitions ? &c->transitions[transition] : NULL;
+}
+
+static inline void perf_count_entry(const void *definition, unsigned state)
+{
+    PerfStateCounters *s = perf_state(definition, state);
+    if (s) perf_add(&s->entries, 1);
+}
+
+static inline void perf_count_exit(const void *definition, unsigned state)
+{
+    PerfStateCounters *s = perf_state(definition, state);
+    if (s) perf_add(&s->exits, 1);
+}
+
+static inline void perf_count_tick(const void *definition, unsigned state)
+{
+    PerfStateCounters *s = perf_state(definition, state);
+    if (s) perf_add(&s->ticks, 1);
+}
+
+static inline void perf_count_run(const void *definition, unsigned state, uint64_t duration)
+{
+    PerfStateCounters *s = perf_state(definition, state);
+    if (s)
+    {
+        unsigned bucket = duration ? 64 - (unsigned)__builtin_clzll(duration) : 0;
+        perf_add(&s->run_time, duration);
+        perf_add(&s->run_histogram[bucket < PERF_HISTOGRAM_BUCKETS ? bucket : PERF_HISTOGRAM_BUCKETS - 1], 1);
+    }
+}
+
+static inline void perf_count_guard(const void *definition, unsigned transition, int hit)
+{
+    PerfTransitionCounters *t = perf_transition(definition, transition);
+    if (t)
+    {
+        perf_add(&t->guard_evaluations, 1);
+        perf_add(&t->guard_hits, hit != 0);
+    }
+}
+
+static inline void perf_count_taken(const void *definition, unsigned transition)
+{
+    PerfTransitionCounters *t = perf_transition(definition, transition);
+    if (t) perf_add(&t->taken, 1);
+}
+
+#endif // COUNTERS_H
@@ -0,0 +1,390 @@
+#include "control/filter_bank.h"
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && defined(__GNUC__)
+#include <immintrin.h>
+#define FILTER_X86 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define FILTER_NEON 1
+#endif
+
+#define COEFFICIENTS 5  // b0 b1 b2 a1 a2
+#define STATES 2        // z1 z2
+#define PI 3.14159265358979323846
+
+static unsigned padded_channels(unsigned channels)
+{
+    return (channels + FILTER_LANES - 1u) & ~(FILTER_LANES - 1u);
+}
+
+/**
+ * @brief Returns the bytes of storage filter_bank_init() needs.
+ *
+ * @param channels Number of channels.
+ * @param sections Sections per channel, at most FILTER_MAX_SECTIONS.
+ */
+
+size_t filter_bank_storage_size(unsigned channels, unsigned sections)
+{
+    return (size_t)sections * (COEFFICIENTS + STATES) * padded_channels(channels) * sizeof(float);
+}
+
+/**
+ * @brief Lays out a filter bank in caller-provided storage.
+ *
+ * Every section starts as a pass-through (b0 = 1) with zero state.
+ *
+ * @param bank Pointer to the bank to initialize.
+ * @param channels Number of channels.
+ * @param sections Sections per channel, 1 to FILTER_MAX_SECTIONS.
+ * @param storage Storage of filter_bank_storage_size() bytes aligned to
+ *        FILTER_ALIGN. Must outlive the bank.
+ * @param size Size of the storage.
+ * @return 0 on success, -1 if the arguments are invalid.
+ */
+
+int filter_bank_init(FilterBank *bank, unsigned channels, unsigned sections, void *storage, size_t size)
+{
+    if (!bank || channels == 0 || sections == 0 || sections > FILTER_MAX_SECTIONS || !storage ||
+        (uintptr_t)storage % FILTER_ALIGN != 0 || size < filter_bank_storage_size(channels, sections))
+    {
+        return -1;
+    }
+
+    unsigned padded = padded_channels(channels);
+    bank->channels = channels;
+    bank->padded = padded;
+    bank->sections = sections;
+    bank->coefficients = storage;
+    bank->state = bank->coefficients + (size_t)sections * COEFFICIENTS * padded;
+    memset(storage, 0, filter_bank_storage_size(channels, sections));
+    for (unsigned s = 0; s < sections; ++s)
+    {
+        for (unsigned ch = 0; ch < channels; ++ch)
+        {
+            bank->coefficients[(size_t)s * COEFFICIENTS * padded + ch] = 1.0f;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Sets the coefficients of one section of one channel. The state is
+ *        kept, so coefficients can be changed while filtering.
+ *
+ * @return 0 on success, -1 if the channel or section is out of range.
+ */
+
+int filter_bank_set(FilterBank *bank, unsigned channel, unsigned section, const FilterSection *coefficients)
+{
+    if (channel >= bank->channels || section >= bank->sections)
+    {
+        return -1;
+    }
+
+    float *c = &bank->coefficients[(size_t)section * COEFFICIENTS * bank->padded + channel];
+    c[0] = coefficients->b0;
+    c[bank->padded] = coefficients->b1;
+    c[2 * bank->padded] = coefficients->b2;
+    c[3 * bank->padded] = coefficients->a1;
+    c[4 * bank->padded] = coefficients->a2;
+    return 0;
+}
+
+void filter_bank_reset(FilterBank *bank)
+{
+    memset(bank->state, 0, (size_t)bank->sections * STATES * bank->padded * sizeof(float));
+}
+
+/**
+ * @brief Filters a block one channel at a time.
+ *
+ * The reference for filter_bank_process(), and the baseline it is measured
+ * against. Takes the same interleaved blocks; padding channels are not
+ * written.
+ */
+
+void filter_bank_process_scalar(FilterBank *bank, const float *in, float *out, unsigned frames)
+{
+    unsigned n = bank->padded;
+    for (unsigned ch = 0; ch < bank->channels; ++ch)
+    {
+        float z1[FILTER_MAX_SECTIONS], z2[FILTER_MAX_SECTIONS];
+        for (unsigned s = 0; s < bank->sections; ++s)
+        {
+            z1[s] = bank->state[(STATES * s) * n + ch];
+            z2[s] = bank->state[(STATES * s + 1) * n + ch];
+        }
+        for (unsigned f = 0; f < frames; ++f)
+        {
+            float x = in[(size_t)f * n + ch];
+            for (unsigned s = 0; s < bank->sections; ++s)
+            {
+                const float *c = &bank->coefficients[COEFFICIENTS * s * n + ch];
+                float y = c[0] * x + z1[s];
+                z1[s] = c[n] * x - c[3 * n] * y + z2[s];
+                z2[s] = c[2 * n] * x - c[4 * n] * y;
+                x = y;
+            }
+            out[(size_t)f * n + ch] = x;
+        }
+        for (unsigned s = 0; s < bank->sections; ++s)
+        {
+            bank->state[(STATES * s) * n + ch] = z1[s];
+            bank->state[(STATES * s + 1) * n + ch] = z2[s];
+        }
+    }
+}
+
+#ifdef FILTER_X86
+
+static void process_sse2(FilterBank *bank, const float *in, float *out, unsigned frames)
+{
+    unsigned n = bank->padded;
+    for (unsigned g = 0; g < n; g += 4)
+    {
+        __m128 z1[FILTER_MAX_SECTIONS], z2[FILTER_MAX_SECTIONS];
+        for (unsigned s = 0; s < bank->sections; ++s)
+        {
+            z1[s] = _mm_load_ps(&bank->state[(STATES * s) * n + g]);
+            z2[s] = _mm_load_ps(&bank->state[(STATES * s + 1) * n + g]);
+        }
+        for (unsigned f = 0; f < frames; ++f)
+        {
+            __m128 x = _mm_load_ps(&in[(size_t)f * n + g]);
+            for (unsigned s = 0; s < bank->sections; ++s)
+            {
+                const float *c = &bank->coefficients[COEFFICIENTS * s * n + g];
+                __m128 y = _mm_add_ps(_mm_mul_ps(_mm_load_ps(c), x), z1[s]);
+                z1[s] = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(_mm_load_ps(c + n), x),
+                                              _mm_mul_ps(_mm_load_ps(c + 3 * n), y)), z2[s]);
+                z2[s] = _mm_sub_ps(_mm_mul_ps(_mm_load_ps(c + 2 * n), x), _mm_mul_ps(_mm_load_ps(c + 4 * n), y));
+                x = y;
+            }
+            _mm_store_ps(&out[(size_t)f * n + g], x);
+        }
+        for (unsigned s = 0; s < bank->sections; ++s)
+        {
+            _mm_store_ps(&bank->state[(STATES * s) * n + g], z1[s]);
+            _mm_store_ps(&bank->state[(STATES * s + 1) * n + g], z2[s]);
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static void process_avx2(FilterBank *bank, const float *in, float *out, unsigned frames)
+{
+    unsigned n = bank->padded;
+    for (unsigned g = 0; g < n; g += 8)
+    {
+        __m256 z1[FILTER_MAX_SECTIONS], z2[FILTER_MAX_SECTIONS];
+        for (unsigned s = 0; s < bank->sections; ++s)
+        {
+            z1[s] = _mm256_load_ps(&bank->state[(STATES * s) * n + g]);
+            z2[s] = _mm256_load_ps(&bank->state[(STATES * s + 1) * n + g]);
+        }
+        for (unsigned f = 0; f < frames; ++f)
+        {
+            __m256 x = _mm256_load_ps(&in[(size_t)f * n + g]);
+            for (unsigned s = 0; s < bank->sections; ++s)
+            {
+                const float *c = &bank->coefficients[COEFFICIENTS * s * n + g];
+                __m256 y = _mm256_add_ps(_mm256_mul_ps(_mm256_load_ps(c), x), z1[s]);
+                z1[s] = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(_mm256_load_ps(c + n), x),
+                                                    _mm256_mul_ps(_mm256_load_ps(c + 3 * n), y)), z2[s]);
+                z2[s] = _mm256_sub_ps(_mm256_mul_ps(_mm256_load_ps(c + 2 * n), x),
+                                      _mm256_mul_ps(_mm256_load_ps(c + 4 * n), y));
+                x = y;
+            }
+            _mm256_store_ps(&out[(size_t)f * n + g], x);
+        }
+        for (unsigned s = 0; s < bank->sections; ++s)
+        {
+            _mm256_store_ps(&bank->state[(STATES * s) * n + g], z1[s]);
+            _mm256_store_ps(&bank->state[(STATES * s + 1) * n + g], z2[s]);
+        }
+    }
+}
+
+static int have_avx2(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+#elif defined(FILTER_NEON)
+
+static void process_neon(FilterBank *bank, const float *in, float *out, unsigned frames)
+{
+    unsigned n = bank->padded;
+    for (unsigned g = 0; g < n; g += 4)
+    {
+        float32x4_t z1[FILTER_MAX_SECTIONS], z2[FILTER_MAX_SECTIONS];
+        for (unsigned s = 0; s < bank->sections; ++s)
+        {
+            z1[s] = vld1q_f32(&bank->state[(STATES * s) * n + g]);
+            z2[s] = vld1q_f32(&bank->state[(STATES * s + 1) * n + g]);
+        }
+        for (unsigned f = 0; f < frames; ++f)
+        {
+            float32x4_t x = vld1q_f32(&in[(size_t)f * n + g]);
+            for (unsigned s = 0; s < bank->sections; ++s)
+            {
+                const float *c = &bank->coefficients[COEFFICIENTS * s * n + g];
+                float32x4_t y = vaddq_f32(vmulq_f32(vld1q_f32(c), x), z1[s]);
+                z1[s] = vaddq_f32(vsubq_f32(vmulq_f32(vld1q_f32(c + n), x), vmulq_f32(vld1q_f32(c + 3 * n), y)),
+                                  z2[s]);
+                z2[s] = vsubq_f32(vmulq_f32(vld1q_f32(c + 2 * n), x), vmulq_f32(vld1q_f32(c + 4 * n), y));
+                x = y;
+            }
+            vst1q_f32(&out[(size_t)f * n + g], x);
+        }
+        for (unsigned s = 0; s < bank->sections; ++s)
+        {
+            vst1q_f32(&bank->state[(STATES * s) * n + g], z1[s]);
+            vst1q_f32(&bank->state[(STATES * s + 1) * n + g], z2[s]);
+        }
+    }
+}
+
+#endif
+
+/**
+ * @brief Filters a block of frames through every channel.
+ *
+ * @param bank Pointer to the bank.
+ * @param in Block of frames * padded samples aligned to FILTER_ALIGN,
+ *        sample[frame * padded + channel]. Padding channels are read but
+ *        their content does not matter.
+ * @param out Block of the same shape receiving the filtered samples, or
+ *        @p in itself to filter in place.
+ * @param frames Number of frames in the block.
+ */
+
+void filter_bank_process(FilterBank *bank, const float *in, float *out, unsigned frames)
+{
+#ifdef FILTER_X86
+    if (have_avx2())
+    {
+        process_avx2(bank, in, out, frames);
+        return;
+    }
+    process_sse2(bank, in, out, frames);
+#elif defined(FILTER_NEON)
+    process_neon(bank, in, out, frames);
+#else
+    filter_bank_process_scalar(bank, in, out, frames);
+#endif
+}
+
+// Instruction set used by filter_bank_process(): "avx2", "sse2", "neon" or "scalar"
+const char *filter_isa(void)
+{
+#ifdef FILTER_X86
+    return have_avx2() ? "avx2" : "sse2";
+#elif defined(FILTER_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
+
+/* ----------------------------------------------------------------------------
+ * Coefficient design
+ *
+ * Second-order sections follow the bilinear-transform designs of R.
+ * Bristow-Johnson's Audio EQ Cookbook; q = 0.7071 gives a Butterworth
+ * response. First-order sections are bilinear transforms with the corner
+ * frequency prewarped. All return -1 unless 0 < fc < fs / 2 and q > 0.
+ * ------------------------------------------------------------------------- */
+
+static int check_design(float fs, float fc, float q)
+{
+    return fs > 0.0f && fc > 0.0f && fc < 0.5f * fs && q > 0.0f ? 0 : -1;
+}
+
+// Normalizes by a0 and stores the section
+static void set_section(FilterSection *s, double b0, double b1, double b2, double a0, double a1, double a2)
+{
+    s->b0 = (float)(b0 / a0);
+    s->b1 = (float)(b1 / a0);
+    s->b2 = (float)(b2 / a0);
+    s->a1 = (float)(a1 / a0);
+    s->a2 = (float)(a2 / a0);
+}
+
+int filter_design_lowpass(FilterSection *s, float fs, float fc, float q)
+{
+    if (check_design(fs, fc, q) != 0)
+    {
+        return -1;
+    }
+    double w0 = 2.0 * PI * fc / fs;
+    double cw = cos(w0);
+    double alpha = sin(w0) / (2.0 * q);
+    set_section(s, (1.0 - cw) / 2.0, 1.0 - cw, (1.0 - cw) / 2.0, 1.0 + alpha, -2.0 * cw, 1.0 - alpha);
+    return 0;
+}
+
+int filter_design_highpass(FilterSection *s, float fs, float fc, float q)
+{
+    if (check_design(fs, fc, q) != 0)
+    {
+        return -1;
+    }
+    double w0 = 2.0 * PI * fc / fs;
+    double cw = cos(w0);
+    double alpha = sin(w0) / (2.0 * q);
+    set_section(s, (1.0 + cw) / 2.0, -(1.0 + cw), (1.0 + cw) / 2.0, 1.0 + alpha, -2.0 * cw, 1.0 - alpha);
+    return 0;
+}
+
+// Band-pass with a gain of 1 at fc
+int filter_design_bandpass(FilterSection *s, float fs, float fc, float q)
+{
+    if (check_design(fs, fc, q) != 0)
+    {
+        return -1;
+    }
+    double w0 = 2.0 * PI * fc / fs;
+    double alpha = sin(w0) / (2.0 * q);
+    set_section(s, alpha, 0.0, -alpha, 1.0 + alpha, -2.0 * cos(w0), 1.0 - alpha);
+    return 0;
+}
+
+int filter_design_notch(FilterSection *s, float fs, float fc, float q)
+{
+    if (check_design(fs, fc, q) != 0)
+    {
+        return -1;
+    }
+    double w0 = 2.0 * PI * fc / fs;
+    double cw = cos(w0);
+    double alpha = sin(w0) / (2.0 * q);
+    set_section(s, 1.0, -2.0 * cw, 1.0, 1.0 + alpha, -2.0 * cw, 1.0 - alpha);
+    return 0;
+}
+
+int filter_design_lowpass1(FilterSection *s, float fs, float fc)
+{
+    if (check_design(fs, fc, 1.0f) != 0)
+    {
+        return -1;
+    }
+    double k = tan(PI * fc / fs);
+    set_section(s, k, k, 0.0, 1.0 + k, k - 1.0, 0.0);
+    return 0;
+}
+
+int filter_design_highpass1(FilterSection *s, float fs, float fc)
+{
+    if (check_design(fs, fc, 1.0f) != 0)
+    {
+        return -1;
+    }
+    double k = tan(PI * fc / fs);
+    set_section(s, 1.0, -1.0, 0.0, 1.0 + k, k - 1.0, 0.0);
+    return 0;
+}
@@ -0,0 +1,279 @@
+#include "control/pid.h"
+#include <stdint.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && defined(__GNUC__)
+#include <immintrin.h>
+#define PID_X86 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PID_NEON 1
+#endif
+
+#define PID_ARRAYS 13  // Float arrays in a bank
+
+/**
+ * @brief Returns the bytes of storage pid_bank_init() needs for count loops.
+ */
+
+size_t pid_bank_storage_size(unsigned count)
+{
+    size_t padded = (count + PID_LANES - 1u) & ~(size_t)(PID_LANES - 1u);
+    return PID_ARRAYS * padded * sizeof(float);
+}
+
+/**
+ * @brief Lays out a bank of PID loops in caller-provided storage.
+ *
+ * Every loop starts with zero gains, an unbounded output and zero state;
+ * tune them with pid_bank_set().
+ *
+ * @param bank Pointer to the bank to initialize.
+ * @param count Number of loops.
+ * @param dt Sample time in seconds, the time between two updates.
+ * @param storage Storage of pid_bank_storage_size() bytes aligned to
+ *        PID_ALIGN. Must outlive the bank.
+ * @param size Size of the storage.
+ * @return 0 on success, -1 if the arguments are invalid.
+ */
+
+int pid_bank_init(PidBank *bank, unsigned count, float dt, void *storage, size_t size)
+{
+    if (!bank || !(dt > 0.0f) || !storage || (uintptr_t)storage % PID_ALIGN != 0 ||
+        size < pid_bank_storage_size(count))
+    {
+        return -1;
+    }
+
+    unsigned padded = (count + PID_LANES - 1u) & ~(PID_LANES - 1u);
+    float *arrays[PID_ARRAYS];
+    float *p = storage;
+    memset(storage, 0, pid_bank_storage_size(count));
+    for (unsigned i = 0; i < PID_ARRAYS; ++i)
+    {
+        arrays[i] = p;
+        p += padded;
+    }
+
+    bank->count = count;
+    bank->padded = padded;
+    bank->dt = dt;
+    bank->kp = arrays[0];
+    bank->ki_dt = arrays[1];
+    bank->kd_dt = arrays[2];
+    bank->alpha = arrays[3];
+    bank->kt = arrays[4];
+    bank->out_min = arrays[5];
+    bank->out_max = arrays[6];
+    bank->setpoint = arrays[7];
+    bank->measurement = arrays[8];
+    bank->output = arrays[9];
+    bank->integral = arrays[10];
+    bank->derivative = arrays[11];
+    bank->previous = arrays[12];
+    for (unsigned i = 0; i < count; ++i)
+    {
+        bank->alpha[i] = 1.0f;
+        bank->out_min[i] = -3.402823466e38f;
+        bank->out_max[i] = 3.402823466e38f;
+    }
+    return 0;
+}
+
+/**
+ * @brief Tunes one loop. Its state is kept, so loops can be retuned live.
+ *
+ * @return 0 on success, -1 if the index is out of range or the gains are
+ *         invalid (tf < 0, kt outside [0, 1], out_min > out_max).
+ */
+
+int pid_bank_set(PidBank *bank, unsigned index, const PidGains *gains)
+{
+    if (index >= bank->count || !(gains->tf >= 0.0f) || !(gains->kt >= 0.0f && gains->kt <= 1.0f) ||
+        !(gains->out_min <= gains->out_max))
+    {
+        return -1;
+    }
+
+    bank->kp[index] = gains->kp;
+    bank->ki_dt[index] = gains->ki * bank->dt;
+    bank->kd_dt[index] = gains->kd / bank->dt;
+    bank->alpha[index] = bank->dt / (gains->tf + bank->dt);
+    bank->kt[index] = gains->kt;
+    bank->out_min[index] = gains->out_min;
+    bank->out_max[index] = gains->out_max;
+    return 0;
+}
+
+/**
+ * @brief Clears the state of every loop.
+ *
+ * The current measurements become the previous ones, so the first update
+ * sees no derivative. Write measurement[] before calling this.
+ */
+
+void pid_bank_reset(PidBank *bank)
+{
+    memset(bank->integral, 0, bank->padded * sizeof(float));
+    memset(bank->derivative, 0, bank->padded * sizeof(float));
+    memcpy(bank->previous, bank->measurement, bank->padded * sizeof(float));
+}
+
+/* One loop, the reference every vector kernel follows operation for
+   operation so that all of them round the same way. */
+static inline void update_loop(PidBank *b, unsigned i)
+{
+    float pv = b->measurement[i];
+    float e = b->setpoint[i] - pv;
+    float p = b->kp[i] * e;
+    float d = b->derivative[i] + b->alpha[i] * (b->kd_dt[i] * (b->previous[i] - pv) - b->derivative[i]);
+    float integral = b->integral[i] + b->ki_dt[i] * e;
+    float u = p + integral + d;
+    float out = u > b->out_min[i] ? u : b->out_min[i];
+    out = out < b->out_max[i] ? out : b->out_max[i];
+
+    b->integral[i] = integral + b->kt[i] * (out - u);
+    b->derivative[i] = d;
+    b->previous[i] = pv;
+    b->output[i] = out;
+}
+
+/**
+ * @brief Updates every loop one at a time.
+ *
+ * The reference for pid_bank_update(), and the baseline it is measured
+ * against.
+ */
+
+void pid_bank_update_scalar(PidBank *bank)
+{
+    for (unsigned i = 0; i < bank->count; ++i)
+    {
+        update_loop(bank, i);
+    }
+}
+
+#ifdef PID_X86
+
+static void update_sse2(PidBank *b)
+{
+    for (unsigned i = 0; i < b->padded; i += 4)
+    {
+        __m128 pv = _mm_load_ps(&b->measurement[i]);
+        __m128 e = _mm_sub_ps(_mm_load_ps(&b->setpoint[i]), pv);
+        __m128 p = _mm_mul_ps(_mm_load_ps(&b->kp[i]), e);
+        __m128 d = _mm_load_ps(&b->derivative[i]);
+        __m128 slope = _mm_mul_ps(_mm_load_ps(&b->kd_dt[i]), _mm_sub_ps(_mm_load_ps(&b->previous[i]), pv));
+        d = _mm_add_ps(d, _mm_mul_ps(_mm_load_ps(&b->alpha[i]), _mm_sub_ps(slope, d)));
+        __m128 integral = _mm_add_ps(_mm_load_ps(&b->integral[i]), _mm_mul_ps(_mm_load_ps(&b->ki_dt[i]), e));
+        __m128 u = _mm_add_ps(_mm_add_ps(p, integral), d);
+        __m128 out = _mm_min_ps(_mm_max_ps(u, _mm_load_ps(&b->out_min[i])), _mm_load_ps(&b->out_max[i]));
+
+        _mm_store_ps(&b->integral[i], _mm_add_ps(integral, _mm_mul_ps(_mm_load_ps(&b->kt[i]), _mm_sub_ps(out, u))));
+        _mm_store_ps(&b->derivative[i], d);
+        _mm_store_ps(&b->previous[i], pv);
+        _mm_store_ps(&b->output[i], out);
+    }
+}
+
+__attribute__((target("avx2")))
+static void update_avx2(PidBank *b)
+{
+    for (unsigned i = 0; i < b->padded; i += 8)
+    {
+        __m256 pv = _mm256_load_ps(&b->measurement[i]);
+        __m256 e = _mm256_sub_ps(_mm256_load_ps(&b->setpoint[i]), pv);
+        __m256 p = _mm256_mul_ps(_mm256_load_ps(&b->kp[i]), e);
+        __m256 d = _mm256_load_ps(&b->derivative[i]);
+        __m256 slope = _mm256_mul_ps(_mm256_load_ps(&b->kd_dt[i]),
+                                     _mm256_sub_ps(_mm256_load_ps(&b->previous[i]), pv));
+        d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_load_ps(&b->alpha[i]), _mm256_sub_ps(slope, d)));
+        __m256 integral = _mm256_add_ps(_mm256_load_ps(&b->integral[i]),
+                                        _mm256_mul_ps(_mm256_load_ps(&b->ki_dt[i]), e));
+        __m256 u = _mm256_add_ps(_mm256_add_ps(p, integral), d);
+        __m256 out = _mm256_min_ps(_mm256_max_ps(u, _mm256_load_ps(&b->out_min[i])),
+                                   _mm256_load_ps(&b->out_max[i]));
+
+        _mm256_store_ps(&b->integral[i],
+                        _mm256_add_ps(integral, _mm256_mul_ps(_mm256_load_ps(&b->kt[i]), _mm256_sub_ps(out, u))));
+        _mm256_store_ps(&b->derivative[i], d);
+        _mm256_store_ps(&b->previous[i], pv);
+        _mm256_store_ps(&b->output[i], out);
+    }
+}
+
+static int have_avx2(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+#elif defined(PID_NEON)
+
+static void update_neon(PidBank *b)
+{
+    for (unsigned i = 0; i < b->padded; i += 4)
+    {
+        float32x4_t pv = vld1q_f32(&b->measurement[i]);
+        float32x4_t e = vsubq_f32(vld1q_f32(&b->setpoint[i]), pv);
+        float32x4_t p = vmulq_f32(vld1q_f32(&b->kp[i]), e);
+        float32x4_t d = vld1q_f32(&b->derivative[i]);
+        float32x4_t slope = vmulq_f32(vld1q_f32(&b->kd_dt[i]), vsubq_f32(vld1q_f32(&b->previous[i]), pv));
+        d = vaddq_f32(d, vmulq_f32(vld1q_f32(&b->alpha[i]), vsubq_f32(slope, d)));
+        float32x4_t integral = vaddq_f32(vld1q_f32(&b->integral[i]), vmulq_f32(vld1q_f32(&b->ki_dt[i]), e));
+        float32x4_t u = vaddq_f32(vaddq_f32(p, integral), d);
+        float32x4_t out = vminq_f32(vmaxq_f32(u, vld1q_f32(&b->out_min[i])), vld1q_f32(&b->out_max[i]));
+
+        vst1q_f32(&b->integral[i], vaddq_f32(integral, vmulq_f32(vld1q_f32(&b->kt[i]), vsubq_f32(out, u))));
+        vst1q_f32(&b->derivative[i], d);
+        vst1q_f32(&b->previous[i], pv);
+        vst1q_f32(&b->output[i], out);
+    }
+}
+
+#endif
+
+/**
+ * @brief Updates every loop of the bank, several at a time.
+ *
+ * Reads setpoint[] and measurement[] and writes output[]. Padding loops
+ * are updated too, which is harmless.
+ */
+
+void pid_bank_update(PidBank *bank)
+{
+#ifdef PID_X86
+    if (have_avx2())
+    {
+        update_avx2(bank);
+        return;
+    }
+    update_sse2(bank);
+#elif defined(PID_NEON)
+    update_neon(bank);
+#else
+    pid_bank_update_scalar(bank);
+#endif
+}
+
+/**
+ * @brief State handler updating a bank, for use as on_run.
+ *
+ * The instance context must be the PidBank, or start with one.
+ */
+
+void pid_bank_on_run(void *context)
+{
+    pid_bank_update(context);
+}
+
+// Instruction set used by pid_bank_update(): "avx2", "sse2", "neon" or "scalar"
+const char *pid_isa(void)
+{
+#ifdef PID_X86
+    return have_avx2() ? "avx2" : "sse2";
+#elif defined(PID_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
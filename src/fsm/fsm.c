@@ -1,48 +1,200 @@
 #include "fsm/fsm.h"
 #include "stdio.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef FSM_COUNTERS
+#include "perf/counters.h"
+#endif
 
-void state_machine_init(st_StateMachine *state_machine)
+/**
+ * @brief Groups the transitions by source state and fills the CSR index.
+ *
+ * The transitions array is reordered in place by the index of its source
+ * state with a counting sort, which is stable, so transitions leaving the
+ * same state keep their declared priority. Afterwards the transitions of
+ * state i live in [transition_offsets[i], transition_offsets[i + 1]).
+ *
+ * @param state_machine Pointer to the state machine to index.
+ * @return 0 on success, -1 if a transition does not start in states[] or the
+ *         scratch buffer cannot be allocated. The array is left untouched then.
+ */
+static int build_transition_index(st_StateMachine *state_machine)
 {
-    // Check if current state is uninitialized
-    if (!state_machine->current_state)
+    st_State *states = state_machine->states;
+    st_Transition *transitions = state_machine->transitions;
+    uint16_t *offsets = state_machine->transition_offsets;
+    int num_transitions = state_machine->num_transitions;
+
+    for (int i = 0; i <= state_machine->num_states; ++i)
+    {
+        offsets[i] = 0;
+    }
+
+    // Count the out-degree of each state, shifted by one for the prefix sum
+    for (int i = 0; i < num_transitions; ++i)
+    {
+        st_State *source = transitions[i].source_state;
+        if (source < states || source >= states + state_machine->num_states)
+        {
+            return -1;
+        }
+        offsets[(source - states) + 1]++;
+    }
+
+    for (int i = 0; i < state_machine->num_states; ++i)
+    {
+        offsets[i + 1] += offsets[i];
+    }
+
+    if (num_transitions == 0)
     {
-        state_machine->current_state = state_machine->default_state;
+        return 0;
     }
 
-    // Check for null state/state entry function
-    if (state_machine->current_state && state_machine->current_state->on_entry)
+    st_Transition *sorted = malloc((size_t)num_transitions * sizeof(st_Transition));
+    if (!sorted)
     {
-        state_machine->current_state->on_entry();
+        return -1;
     }
+
+    // Place each transition at the cursor of its source state. offsets[i]
+    // doubles as the cursor and ends up at the start of state i + 1.
+    for (int i = 0; i < num_transitions; ++i)
+    {
+        sorted[offsets[transitions[i].source_state - states]++] = transitions[i];
+    }
+
+    for (int i = state_machine->num_states; i > 0; --i)
+    {
+        offsets[i] = offsets[i - 1];
+    }
+    offsets[0] = 0;
+
+    memcpy(transitions, sorted, (size_t)num_transitions * sizeof(st_Transition));
+    free(sorted);
+    return 0;
 }
 
-void state_machine_run(st_StateMachine *state_machine) 
+/**
+ * @brief Prepares a machine definition for use by its instances.
+ *
+ * Builds the per-state transition index when the definition provides storage
+ * for it, reordering the transitions array by source state. Must be called
+ * once before any instance is initialized.
+ *
+ * @param state_machine Pointer to the machine definition.
+ * @return 0 on success, -1 if default_state is NULL or outside states[], or if
+ *         the index cannot be built. In the latter case the definition is
+ *         still usable, falling back to scanning every transition.
+ */
+int state_machine_compile(st_StateMachine *state_machine)
 {
+    const st_State *initial = state_machine->default_state;
+    if (!initial || initial < state_machine->states ||
+        initial >= state_machine->states + state_machine->num_states)
+    {
+        return -1;
+    }
+
+    if (state_machine->transition_offsets &&
+        build_transition_index(state_machine) != 0)
+    {
+        state_machine->transition_offsets = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void state_machine_init(const st_StateMachine *state_machine, st_StateMachineInstance *instance, void *context)
+{
+    const st_State *current = state_machine->default_state;
+
+    instance->context = context;
+    instance->prev_state = ST_NO_STATE;
+
+    // A machine without an initial state stays inactive and never runs
+    if (!current)
+    {
+        instance->current_state = ST_NO_STATE;
+        return;
+    }
+    instance->current_state = (uint16_t)(current - state_machine->states);
+
+    if (current->on_entry)
+    {
+        current->on_entry(context);
+    }
+#ifdef FSM_COUNTERS
+    perf_count_entry(state_machine, instance->current_state);
+#endif
+}
+
+void state_machine_run(const st_StateMachine *state_machine, st_StateMachineInstance *instance)
+{
+    int first = 0;
+    int last = state_machine->num_transitions;
+    if (instance->current_state == ST_NO_STATE)
+    {
+        return;
+    }
+    st_State *current = &state_machine->states[instance->current_state];
+#ifdef FSM_COUNTERS
+    perf_count_tick(state_machine, instance->current_state);
+#endif
+
+    // Only visit the transitions leaving the current state when indexed
+    if (state_machine->transition_offsets)
+    {
+        first = state_machine->transition_offsets[instance->current_state];
+        last = state_machine->transition_offsets[instance->current_state + 1];
+    }
+
     // Check for transitions
-    for (int i = 0; i < state_machine->num_transitions; ++i) {
-        if ((state_machine->transitions[i].source_state == state_machine->current_state) && 
-            state_machine->transitions[i].condition()) {
+    for (int i = first; i < last; ++i) {
+        const st_Transition *transition = &state_machine->transitions[i];
+        if (transition->source_state != current) {
+            continue;
+        }
+        char hit = transition->condition(instance->context);
+#ifdef FSM_COUNTERS
+        perf_count_guard(state_machine, (unsigned)i, hit);
+#endif
+        if (hit) {
             // Execute exit function of current state
-            if ( state_machine->current_state->on_exit)
+            if (current->on_exit)
             {
-                state_machine->current_state->on_exit();
+                current->on_exit(instance->context);
             }
+#ifdef FSM_COUNTERS
+            perf_count_exit(state_machine, instance->current_state);
+            perf_count_taken(state_machine, (unsigned)i);
+#endif
             // Transition to new state
-            state_machine->prev_state = state_machine->current_state;
-            state_machine->current_state = state_machine->transitions[i].target_state;
+            instance->prev_state = instance->current_state;
+            instance->current_state = (uint16_t)(transition->target_state - state_machine->states);
+            current = transition->target_state;
 
             // Execute entry function of new state
-            if ( state_machine->current_state->on_entry)
+            if (current->on_entry)
             {
-                state_machine->current_state->on_entry();
+                current->on_entry(instance->context);
             }
+#ifdef FSM_COUNTERS
+            perf_count_entry(state_machine, instance->current_state);
+#endif
 
             break; // Only one transition per cycle
         }
     }
     // Execute run function of current state
-    if (state_machine->current_state->on_run)
+    if (current->on_run)
     {
-        state_machine->current_state->on_run();
+#ifdef FSM_COUNTERS
+        uint64_t run_start = perf_now();
+        current->on_run(instance->context);
+        perf_count_run(state_machine, instance->current_state, perf_now() - run_start);
+#else
+        current->on_run(instance->context);
+#endif
     }
 }
@@ -0,0 +1,419 @@
+#include "hsm/builder.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <malloc.h>
+#define aligned_alloc(align, size) _aligned_malloc(size, align)
+#define aligned_free _aligned_free
+#else
+#define aligned_free free
+#endif
+
+#define TABLE_ALIGN 16  // Alignment of every cold table, enough for the description structs
+
+static size_t table_size(size_t count, size_t size)
+{
+    return (count * size + TABLE_ALIGN - 1) & ~(size_t)(TABLE_ALIGN - 1);
+}
+
+/* Takes cold storage from the end of the arena. Fails the builder when the
+   arena runs out, remembering how much it would have needed. */
+static void *cold_alloc(MachineBuilder *b, size_t size, size_t align)
+{
+    if (size + align > b->cold)
+    {
+        b->required = b->size - b->cold + size + align;
+        b->error = 1;
+        return NULL;
+    }
+    b->cold = (b->cold - size) & ~(align - 1);
+    return b->arena + b->cold;
+}
+
+/**
+ * @brief Returns the cold bytes taken by the descriptor tables of a builder.
+ *
+ * The arena must hold these tables, the state names and the compiled image.
+ *
+ * @param max_states Most states the machine may have, over all regions.
+ * @param max_regions Most regions, the root included.
+ * @param max_transitions Most transitions.
+ */
+
+size_t machine_builder_tables_size(unsigned max_states, unsigned max_regions, unsigned max_transitions)
+{
+    return table_size(max_states, sizeof(State)) + table_size(max_states, sizeof(StateMachine *)) +
+           table_size(max_states, sizeof(State *)) + table_size(max_states, sizeof(const char *)) +
+           table_size(max_regions, sizeof(StateMachine)) +
+           table_size(max_regions + 1u, sizeof(unsigned)) +
+           table_size(max_states + 1u, sizeof(unsigned)) +
+           table_size(max_transitions, sizeof(Transition)) +
+           table_size(max_transitions, sizeof(State *)) +
+           table_size(max_transitions, sizeof(unsigned));
+}
+
+/**
+ * @brief Starts building a machine in an arena.
+ *
+ * @param b Pointer to the builder to initialize.
+ * @param arena Storage of @p size bytes aligned to MACHINE_BUILDER_ALIGN, or
+ *        NULL to have the builder allocate it; machine_builder_destroy() then
+ *        frees it.
+ * @param size Size of the arena. Must at least cover
+ *        machine_builder_tables_size(); the names and the compiled image
+ *        come on top.
+ * @param max_states Most states the machine may have, over all regions.
+ * @param max_regions Most regions, the root included.
+ * @param max_transitions Most transitions.
+ * @return 0 on success, -1 if the arena is misaligned, too small for the
+ *         tables or could not be allocated.
+ */
+
+int machine_builder_init(MachineBuilder *b, void *arena, size_t size, unsigned max_states,
+                         unsigned max_regions, unsigned max_transitions)
+{
+    memset(b, 0, sizeof(*b));
+    size &= ~(size_t)(MACHINE_BUILDER_ALIGN - 1);
+    if (max_regions == 0 || max_states >= HSM_NO_STATE || max_regions >= HSM_NO_STATE ||
+        (arena && (uintptr_t)arena % MACHINE_BUILDER_ALIGN != 0) ||
+        size < machine_builder_tables_size(max_states, max_regions, max_transitions))
+    {
+        return -1;
+    }
+    if (!arena)
+    {
+        arena = aligned_alloc(MACHINE_BUILDER_ALIGN, size);
+        if (!arena)
+        {
+            return -1;
+        }
+        b->owned = 1;
+    }
+
+    b->arena = arena;
+    b->size = size;
+    b->cold = size;
+    b->max_states = max_states;
+    b->max_regions = max_regions;
+    b->max_transitions = max_transitions;
+
+    b->states = cold_alloc(b, table_size(max_states, sizeof(State)), TABLE_ALIGN);
+    b->state_regions = cold_alloc(b, table_size(max_states, sizeof(StateMachine *)), TABLE_ALIGN);
+    b->members = cold_alloc(b, table_size(max_states, sizeof(State *)), TABLE_ALIGN);
+    b->names = cold_alloc(b, table_size(max_states, sizeof(const char *)), TABLE_ALIGN);
+    b->regions = cold_alloc(b, table_size(max_regions, sizeof(StateMachine)), TABLE_ALIGN);
+    b->region_offsets = cold_alloc(b, table_size(max_regions + 1u, sizeof(unsigned)), TABLE_ALIGN);
+    b->state_offsets = cold_alloc(b, table_size(max_states + 1u, sizeof(unsigned)), TABLE_ALIGN);
+    b->transitions = cold_alloc(b, table_size(max_transitions, sizeof(Transition)), TABLE_ALIGN);
+    b->sources = cold_alloc(b, table_size(max_transitions, sizeof(State *)), TABLE_ALIGN);
+    b->slots = cold_alloc(b, table_size(max_transitions, sizeof(unsigned)), TABLE_ALIGN);
+
+    memset(&b->regions[0], 0, sizeof(StateMachine));
+    b->num_regions = 1;
+    return 0;
+}
+
+StateMachine *machine_builder_root(MachineBuilder *b)
+{
+    return &b->regions[0];
+}
+
+/**
+ * @brief Adds the orthogonal regions of a composite state.
+ *
+ * @param b Pointer to the builder.
+ * @param owner Composite state owning the regions. Its regions must all be
+ *        added in this one call.
+ * @param count Number of regions.
+ * @return The first of @p count consecutive regions, or NULL if the owner
+ *         already has regions or max_regions is exceeded.
+ */
+
+StateMachine *machine_builder_regions(MachineBuilder *b, State *owner, int count)
+{
+    if (!owner || owner < b->states || owner >= b->states + b->num_states || owner->submachine ||
+        count <= 0 || (unsigned)count > b->max_regions - b->num_regions)
+    {
+        b->error = 1;
+        return NULL;
+    }
+
+    StateMachine *regions = &b->regions[b->num_regions];
+    memset(regions, 0, (size_t)count * sizeof(StateMachine));
+    b->num_regions += (unsigned)count;
+    owner->submachine = regions;
+    owner->num_submachines = count;
+    return regions;
+}
+
+/**
+ * @brief Adds a state to a region.
+ *
+ * The first state added to a region becomes its initial state unless the
+ * caller sets initial_state. To nest the state inside another state of the
+ * same region, set its parent.
+ *
+ * @param b Pointer to the builder.
+ * @param region Region the state belongs to, the root or one returned by
+ *        machine_builder_regions().
+ * @param name Optional name, copied into the arena.
+ * @param on_entry Handlers, NULL for none.
+ * @param on_run
+ * @param on_exit
+ * @return The new state, or NULL if max_states is exceeded or the arena ran out.
+ */
+
+State *machine_builder_state(MachineBuilder *b, StateMachine *region, const char *name,
+                             StateFunc on_entry, StateFunc on_run, StateFunc on_exit)
+{
+    if (!region || region < b->regions || region >= b->regions + b->num_regions ||
+        b->num_states == b->max_states)
+    {
+        b->error = 1;
+        return NULL;
+    }
+
+    char *copy = NULL;
+    if (name)
+    {
+        size_t length = strlen(name) + 1;
+        copy = cold_alloc(b, length, 1);
+        if (!copy)
+        {
+            return NULL;
+        }
+        memcpy(copy, name, length);
+    }
+
+    State *s = &b->states[b->num_states];
+    memset(s, 0, sizeof(*s));
+    s->on_entry = on_entry;
+    s->on_run = on_run;
+    s->on_exit = on_exit;
+    s->name = copy;
+    b->state_regions[b->num_states++] = region;
+    if (!region->initial_state)
+    {
+        region->initial_state = s;
+    }
+    return s;
+}
+
+/**
+ * @brief Adds a transition.
+ *
+ * Transitions leaving the same state keep the order they were added in,
+ * which is their priority.
+ *
+ * @param b Pointer to the builder.
+ * @param source State the transition leaves.
+ * @param target State the transition enters.
+ * @param condition Guard, NULL for none.
+ * @param event Trigger event, 0 for a polled transition.
+ * @return The transition, valid until machine_builder_finish(), or NULL if
+ *         max_transitions is exceeded.
+ */
+
+Transition *machine_builder_transition(MachineBuilder *b, State *source, State *target,
+                                       GuardFunc condition, int event)
+{
+    if (!source || source < b->states || source >= b->states + b->num_states || !target ||
+        target < b->states || target >= b->states + b->num_states ||
+        b->num_transitions == b->max_transitions)
+    {
+        b->error = 1;
+        return NULL;
+    }
+
+    Transition *t = &b->transitions[b->num_transitions];
+    memset(t, 0, sizeof(*t));
+    t->target = target;
+    t->condition = condition;
+    t->event = event;
+    b->sources[b->num_transitions++] = source;
+    return t;
+}
+
+/**
+ * @brief Takes cold storage from the arena, e.g. for parallel_targets.
+ *
+ * @return Pointer-aligned storage living as long as the arena, or NULL if
+ *         the arena ran out.
+ */
+
+void *machine_builder_alloc(MachineBuilder *b, size_t size)
+{
+    return cold_alloc(b, size, TABLE_ALIGN);
+}
+
+/* Gives every region the contiguous states array the description expects. */
+static void place_states(MachineBuilder *b)
+{
+    unsigned *offsets = b->region_offsets;
+
+    memset(offsets, 0, (b->num_regions + 1u) * sizeof(unsigned));
+    for (unsigned i = 0; i < b->num_states; ++i)
+    {
+        offsets[(b->state_regions[i] - b->regions) + 1]++;
+    }
+    for (unsigned r = 0; r < b->num_regions; ++r)
+    {
+        offsets[r + 1] += offsets[r];
+        b->regions[r].states = &b->members[offsets[r]];
+        b->regions[r].num_states = (int)(offsets[r + 1] - offsets[r]);
+    }
+    for (unsigned i = 0; i < b->num_states; ++i)
+    {
+        b->members[offsets[b->state_regions[i] - b->regions]++] = &b->states[i];
+    }
+}
+
+/* Groups the transitions by source and hands each state its slice. A
+   stable counting sort over the source indices, which are dense in
+   b->states, gives every transition its slot; the transitions are then
+   swapped into their slots in place, one cycle of the permutation at a
+   time, so no copy of the Transition table is needed. */
+static void place_transitions(MachineBuilder *b)
+{
+    Transition *transitions = b->transitions;
+    State **sources = b->sources;
+    unsigned *offsets = b->state_offsets;
+    unsigned *slots = b->slots;
+
+    memset(offsets, 0, (b->num_states + 1u) * sizeof(unsigned));
+    for (unsigned i = 0; i < b->num_transitions; ++i)
+    {
+        offsets[(sources[i] - b->states) + 1]++;
+    }
+    for (unsigned k = 0; k < b->num_states; ++k)
+    {
+        offsets[k + 1] += offsets[k];
+    }
+    for (unsigned i = 0; i < b->num_transitions; ++i)
+    {
+        slots[i] = offsets[sources[i] - b->states]++;
+    }
+
+    for (unsigned i = 0; i < b->num_transitions; ++i)
+    {
+        // Every swap puts the transition at j into its final slot
+        while (slots[i] != i)
+        {
+            unsigned j = slots[i];
+            Transition t = transitions[j];
+            State *source = sources[j];
+            transitions[j] = transitions[i];
+            sources[j] = sources[i];
+            slots[i] = slots[j];
+            slots[j] = j;
+            transitions[i] = t;
+            sources[i] = source;
+        }
+    }
+
+    for (unsigned i = 0; i < b->num_transitions; ++i)
+    {
+        State *s = sources[i];
+        if (s->num_transitions == 0)
+        {
+            s->transitions = &transitions[i];
+        }
+        s->num_transitions++;
+    }
+}
+
+/**
+ * @brief Compiles the machine into the hot end of the arena.
+ *
+ * After this call no more nodes can be added. The descriptors stay valid,
+ * so diagnostics such as trace_write_names(machine_builder_root(b)) keep
+ * working.
+ *
+ * @param b Pointer to the builder.
+ * @param def Receives the compiled definition, valid as long as the arena.
+ * @return 0 on success, -1 if an earlier call failed, the machine is invalid
+ *         or the arena is too small; required then tells the size needed.
+ *
+ * \startuml
+ * start
+ * if (earlier call failed or finished already?) then (yes)
+ *   :return -1;
+ *   stop
+ * endif
+ * :place_states;
+ * note right: one states array per region
+ * :place_transitions;
+ * note right: one transitions slice per state
+ * if (image fits below the cold data?) then (no)
+ *   :set required;
+ *   :return -1;
+ *   stop
+ * endif
+ * :state_machine_compile into the arena start;
+ * :index the names by StateId;
+ * :return 0;
+ * stop
+ * \enduml
+ */
+
+int machine_builder_finish(MachineBuilder *b, StateMachineDef *def)
+{
+    if (b->error || b->hot)
+    {
+        return -1;
+    }
+
+    place_states(b);
+    place_transitions(b);
+    b->error = 1;  // Nodes are in place; the builder is done either way
+
+    size_t size = state_machine_compile_size(machine_builder_root(b));
+    if (size > b->cold)
+    {
+        b->required = b->size - b->cold + size;
+        return -1;
+    }
+    if (state_machine_compile(machine_builder_root(b), def, b->arena, size) != 0)
+    {
+        return -1;
+    }
+    b->hot = size;
+
+    for (unsigned i = 0; i < b->num_states; ++i)
+    {
+        b->names[b->states[i].id] = b->states[i].name;
+    }
+    return 0;
+}
+
+/**
+ * @brief Returns the name a state was added with, NULL if it has none.
+ *
+ * Cold data, meant for diagnostics. Only valid once finished.
+ */
+
+const char *machine_builder_state_name(const MachineBuilder *b, StateId id)
+{
+    if (!b->hot || id >= b->num_states)
+    {
+        return NULL;
+    }
+    return b->names[id];
+}
+
+/**
+ * @brief Releases the arena if the builder allocated it.
+ *
+ * Definitions compiled by the builder are invalid afterwards.
+ */
+
+void machine_builder_destroy(MachineBuilder *b)
+{
+    if (b->owned)
+    {
+        aligned_free(b->arena);
+    }
+    b->arena = NULL;
+    b->owned = 0;
+}
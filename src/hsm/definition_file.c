@@ -0,0 +1,348 @@
+#include "hsm/definition_file.h"
+#include "hsm/snapshot.h"
+#include <stdlib.h>
+#include <string.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define DEFINITION_FILE_MMAP 1
+#elif defined(_WIN32)
+#include <malloc.h>
+#define aligned_alloc(align, size) _aligned_malloc(size, align)
+#define aligned_free _aligned_free
+#endif
+#ifndef aligned_free
+#define aligned_free free
+#endif
+
+/* Returns the binding of a handler, NULL if the caller did not name it. */
+static const HandlerBinding *find_handler(HandlerFunc handler, const HandlerBinding *bindings,
+                                          unsigned num_bindings)
+{
+    for (unsigned i = 0; i < num_bindings; ++i)
+    {
+        if (bindings[i].handler == handler)
+        {
+            return &bindings[i];
+        }
+    }
+    return NULL;
+}
+
+/* Returns the function bound to a name, NULL if there is none. */
+static HandlerFunc find_name(const char *name, const HandlerBinding *bindings, unsigned num_bindings)
+{
+    for (unsigned i = 0; i < num_bindings; ++i)
+    {
+        if (strcmp(bindings[i].name, name) == 0)
+        {
+            return bindings[i].handler;
+        }
+    }
+    return NULL;
+}
+
+static size_t align_up(size_t offset, size_t align)
+{
+    return (offset + align - 1) & ~(align - 1);
+}
+
+/**
+ * @brief Computes the size of the definition file for a compiled machine.
+ *
+ * @return Size in bytes, 0 if a handler of the definition has no binding.
+ */
+
+size_t definition_file_size(const StateMachineDef *def, const HandlerBinding *bindings, unsigned num_bindings)
+{
+    unsigned num_handlers = def->image->num_handlers;
+    size_t offset = sizeof(DefinitionFileHeader) + (size_t)num_handlers * sizeof(uint32_t);
+
+    for (unsigned i = 1; i < num_handlers; ++i)
+    {
+        const HandlerBinding *binding = find_handler(def->handlers[i], bindings, num_bindings);
+        if (!binding)
+        {
+            return 0;
+        }
+        offset += strlen(binding->name) + 1;
+    }
+    return align_up(offset, DEFINITION_FILE_ALIGN) + def->image->size;
+}
+
+/**
+ * @brief Writes a compiled machine as a definition file into a buffer.
+ *
+ * Every handler referenced by the definition must appear in @p bindings;
+ * its name is what definition_file_bind() later resolves.
+ *
+ * @param def Pointer to the compiled definition.
+ * @param bindings Names of the handlers.
+ * @param num_bindings Number of entries in @p bindings.
+ * @param buffer Receives the file.
+ * @param size Size of @p buffer, at least definition_file_size().
+ * @return Number of bytes written, 0 if a handler has no name or the
+ *         buffer is missing or too small.
+ */
+
+size_t definition_file_write(const StateMachineDef *def, const HandlerBinding *bindings, unsigned num_bindings,
+                             void *buffer, size_t size)
+{
+    size_t total = definition_file_size(def, bindings, num_bindings);
+    if (total == 0 || !buffer || size < total)
+    {
+        return 0;
+    }
+
+    char *out = (char *)buffer;
+    unsigned num_handlers = def->image->num_handlers;
+    DefinitionFileHeader header = {
+        .magic = DEFINITION_FILE_MAGIC,
+        .version = DEFINITION_FILE_VERSION,
+        .header_size = sizeof(DefinitionFileHeader),
+        .size = (uint32_t)total,
+        .fingerprint = state_machine_fingerprint(def),
+        .num_handlers = num_handlers,
+        .names = sizeof(DefinitionFileHeader),
+        .image = (uint32_t)(total - def->image->size),
+        .image_size = def->image->size,
+    };
+
+    // Slot 0 has no handler and gets an empty name
+    size_t offset = header.names + (size_t)num_handlers * sizeof(uint32_t);
+    for (unsigned i = 0; i < num_handlers; ++i)
+    {
+        const char *name = i ? find_handler(def->handlers[i], bindings, num_bindings)->name : "";
+        size_t length = strlen(name) + 1;
+        uint32_t name_offset = (uint32_t)offset;
+        memcpy(out + header.names + i * sizeof(uint32_t), &name_offset, sizeof(name_offset));
+        memcpy(out + offset, name, length);
+        offset += length;
+    }
+    memset(out + offset, 0, header.image - offset);
+    memcpy(out, &header, sizeof(header));
+    memcpy(out + header.image, def->image, def->image->size);
+    return total;
+}
+
+/**
+ * @brief Writes a compiled machine as a definition file to a stream.
+ *
+ * @return 0 on success, -1 if a handler has no name or writing failed.
+ */
+
+int definition_file_save(const StateMachineDef *def, const HandlerBinding *bindings, unsigned num_bindings,
+                         FILE *out)
+{
+    size_t size = definition_file_size(def, bindings, num_bindings);
+    void *buffer = size ? malloc(size) : NULL;
+    int result = -1;
+
+    if (buffer && definition_file_write(def, bindings, num_bindings, buffer, size) == size &&
+        fwrite(buffer, size, 1, out) == 1)
+    {
+        result = 0;
+    }
+    free(buffer);
+    return result;
+}
+
+/* Copies and checks the header of a definition file. */
+static int read_header(const void *file, size_t size, DefinitionFileHeader *header)
+{
+    if (!file || size < sizeof(*header))
+    {
+        return -1;
+    }
+    memcpy(header, file, sizeof(*header));
+    if (header->magic != DEFINITION_FILE_MAGIC || header->version != DEFINITION_FILE_VERSION ||
+        header->header_size != sizeof(*header) || header->size > size ||
+        header->num_handlers == 0 || header->names < sizeof(*header) ||
+        header->names > header->image ||
+        (header->image - header->names) / sizeof(uint32_t) < header->num_handlers ||
+        header->image % DEFINITION_FILE_ALIGN != 0 ||
+        header->image > header->size || header->size - header->image < header->image_size)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Returns the size of the handler table a definition file needs.
+ *
+ * @return Number of handler slots, 0 if @p file is not a definition file.
+ */
+
+unsigned definition_file_handlers(const void *file, size_t size)
+{
+    DefinitionFileHeader header;
+    return read_header(file, size, &header) == 0 ? header.num_handlers : 0;
+}
+
+/**
+ * @brief Binds a definition file held in memory, without copying the image.
+ *
+ * Handler names are resolved against @p bindings into the caller's handler
+ * table; the image itself is used where it lies, so @p file must stay
+ * mapped as long as @p def is used. There are no pointers to fix up, and the
+ * work is proportional to the number of handlers, not to the machine size.
+ *
+ * @param def Receives the definition.
+ * @param file Start of the file, aligned to DEFINITION_FILE_ALIGN, as
+ *             returned by definition_file_map().
+ * @param size Size of @p file.
+ * @param bindings Functions of this program, by name.
+ * @param num_bindings Number of entries in @p bindings.
+ * @param handlers Receives the handler table.
+ * @param max_handlers Capacity of @p handlers, at least definition_file_handlers().
+ * @param flags DEFINITION_FILE_VERIFY to hash the image and compare it with
+ *              the stored fingerprint, for files from untrusted sources.
+ * @return 0 on success, -1 if the file is invalid or a name is not bound.
+ *
+ * \startuml
+ * start
+ * :check header;
+ * if (valid and table big enough?) then (no)
+ *   :return -1;
+ *   stop
+ * endif
+ * :look up every handler name;
+ * if (all names bound?) then (no)
+ *   :return -1;
+ *   stop
+ * endif
+ * :state_machine_bind(image in place);
+ * if (DEFINITION_FILE_VERIFY?) then (yes)
+ *   :compare fingerprint;
+ * endif
+ * :return 0;
+ * stop
+ * \enduml
+ */
+
+int definition_file_bind(StateMachineDef *def, const void *file, size_t size,
+                         const HandlerBinding *bindings, unsigned num_bindings,
+                         HandlerFunc *handlers, unsigned max_handlers, unsigned flags)
+{
+    DefinitionFileHeader header;
+    const char *base = (const char *)file;
+
+    if (read_header(file, size, &header) != 0 || !handlers || max_handlers < header.num_handlers)
+    {
+        return -1;
+    }
+
+    handlers[0] = NULL;
+    for (unsigned i = 1; i < header.num_handlers; ++i)
+    {
+        uint32_t name_offset;
+        memcpy(&name_offset, base + header.names + i * sizeof(uint32_t), sizeof(name_offset));
+        if (name_offset >= header.image || !memchr(base + name_offset, '\0', header.image - name_offset))
+        {
+            return -1;
+        }
+        handlers[i] = find_name(base + name_offset, bindings, num_bindings);
+        if (!handlers[i])
+        {
+            return -1;
+        }
+    }
+
+    StateMachineDef bound;
+    if (state_machine_bind(&bound, base + header.image, header.image_size, handlers) != 0 ||
+        bound.image->num_handlers != header.num_handlers)
+    {
+        return -1;
+    }
+    if ((flags & DEFINITION_FILE_VERIFY) && state_machine_fingerprint(&bound) != header.fingerprint)
+    {
+        return -1;
+    }
+    *def = bound;
+    return 0;
+}
+
+/**
+ * @brief Maps a definition file read-only into memory.
+ *
+ * On POSIX systems the pages are shared with every other process mapping
+ * the same file; elsewhere the file is read into allocated memory.
+ *
+ * @return 0 on success, -1 if the file cannot be opened or read.
+ */
+
+int definition_file_map(MappedDefinition *map, const char *path)
+{
+    map->data = NULL;
+    map->size = 0;
+    map->mapped = 0;
+#ifdef DEFINITION_FILE_MMAP
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size <= 0)
+    {
+        close(fd);
+        return -1;
+    }
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return -1;
+    }
+    map->data = data;
+    map->size = (size_t)st.st_size;
+    map->mapped = 1;
+    return 0;
+#else
+    FILE *in = fopen(path, "rb");
+    long size;
+    if (!in)
+    {
+        return -1;
+    }
+    if (fseek(in, 0, SEEK_END) != 0 || (size = ftell(in)) <= 0 || fseek(in, 0, SEEK_SET) != 0)
+    {
+        fclose(in);
+        return -1;
+    }
+    // malloc alignment is not enough for the image offset guarantee
+    size_t allocated = ((size_t)size + DEFINITION_FILE_ALIGN - 1) & ~(size_t)(DEFINITION_FILE_ALIGN - 1);
+    void *data = aligned_alloc(DEFINITION_FILE_ALIGN, allocated);
+    if (!data || fread(data, (size_t)size, 1, in) != 1)
+    {
+        aligned_free(data);
+        fclose(in);
+        return -1;
+    }
+    fclose(in);
+    map->data = data;
+    map->size = (size_t)size;
+    return 0;
+#endif
+}
+
+void definition_file_unmap(MappedDefinition *map)
+{
+    if (!map->data)
+    {
+        return;
+    }
+#ifdef DEFINITION_FILE_MMAP
+    if (map->mapped)
+    {
+        munmap((void *)map->data, map->size);
+    }
+#else
+    aligned_free((void *)map->data);
+#endif
+    map->data = NULL;
+    map->size = 0;
+}
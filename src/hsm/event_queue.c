@@ -0,0 +1,153 @@
+#include "hsm/event_queue.h"
+#include <stddef.h>
+
+/**
+ * @brief Initializes an event queue over caller-provided slot storage.
+ *
+ * Each slot carries a sequence number that tells producers and the consumer
+ * whose turn it is, so posting never takes a lock.
+ *
+ * @param queue Pointer to the queue to initialize.
+ * @param slots Storage for @p capacity slots. Must outlive the queue.
+ * @param capacity Number of slots, a power of two of at least 2.
+ * @return 0 on success, -1 if the arguments are invalid.
+ */
+
+int event_queue_init(EventQueue *queue, EventQueueSlot *slots, unsigned capacity)
+{
+    if (!queue || !slots || capacity < 2 || (capacity & (capacity - 1)) != 0)
+    {
+        return -1;
+    }
+
+    queue->slots = slots;
+    queue->mask = capacity - 1;
+
+    for (unsigned i = 0; i < capacity; ++i)
+    {
+        atomic_init(&slots[i].sequence, i);
+        slots[i].event = 0;
+    }
+
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    atomic_init(&queue->dropped, 0);
+    return 0;
+}
+
+/**
+ * @brief Posts an event to the queue. Safe to call from any thread.
+ *
+ * Producers claim a slot by advancing the head with a compare-and-swap, then
+ * publish the event by bumping the slot's sequence number.
+ *
+ * @param queue Pointer to the queue.
+ * @param event Event to post.
+ * @return 0 if the event was queued, -1 if the queue was full and the
+ *         event was dropped.
+ *
+ * \startuml
+ * start
+ * repeat
+ *   :load head and its slot sequence;
+ *   if (sequence == head?) then (yes)
+ *     if (CAS head -> head + 1?) then (yes)
+ *       :write event;
+ *       :publish sequence = head + 1;
+ *       :return 0;
+ *       stop
+ *     endif
+ *   elseif (sequence < head?) then (yes)
+ *     :count dropped event;
+ *     :return -1;
+ *     stop
+ *   endif
+ * repeat while (retry)
+ * \enduml
+ */
+
+int event_queue_post(EventQueue *queue, int event)
+{
+    unsigned pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+
+    for (;;)
+    {
+        EventQueueSlot *slot = &queue->slots[pos & queue->mask];
+        unsigned sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        int diff = (int)(sequence - pos);
+
+        if (diff == 0)
+        {
+            /* The slot is free for this lap, try to claim it. */
+            if (atomic_compare_exchange_weak_explicit(&queue->head, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed))
+            {
+                slot->event = event;
+                atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+                return 0;
+            }
+        }
+        else if (diff < 0)
+        {
+            /* The consumer has not freed this slot yet: the queue is full. */
+            atomic_fetch_add_explicit(&queue->dropped, 1, memory_order_relaxed);
+            return -1;
+        }
+        else
+        {
+            /* Another producer claimed the slot first. */
+            pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+        }
+    }
+}
+
+/**
+ * @brief Pops the oldest event. Must only be called by the owning thread.
+ *
+ * @param queue Pointer to the queue.
+ * @param event Receives the event.
+ * @return 1 if an event was popped, 0 if the queue was empty.
+ */
+
+int event_queue_pop(EventQueue *queue, int *event)
+{
+    unsigned pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    EventQueueSlot *slot = &queue->slots[pos & queue->mask];
+    unsigned sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+
+    if ((int)(sequence - (pos + 1)) < 0)
+    {
+        return 0;
+    }
+
+    *event = slot->event;
+
+    /* Hand the slot back to producers for the next lap. */
+    atomic_store_explicit(&slot->sequence, pos + queue->mask + 1, memory_order_release);
+    atomic_store_explicit(&queue->tail, pos + 1, memory_order_release);
+    return 1;
+}
+
+/**
+ * @brief Returns the number of events waiting in the queue.
+ *
+ * The value is a snapshot and may be stale by the time it is used when
+ * producers are posting concurrently.
+ */
+
+unsigned event_queue_depth(EventQueue *queue)
+{
+    unsigned tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    unsigned head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    return head - tail;
+}
+
+/**
+ * @brief Returns the number of events dropped because the queue was full.
+ */
+
+unsigned event_queue_dropped(EventQueue *queue)
+{
+    return atomic_load_explicit(&queue->dropped, memory_order_relaxed);
+}
@@ -0,0 +1,249 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  // pthread_setaffinity_np
+#endif
+
+#include "hsm/executor.h"
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* Sleeps until the monotonic clock reaches deadline_ns. The deadline is
+   absolute on Linux, so time lost to preemption before the call is not
+   slept again. */
+static void sleep_until(uint64_t deadline_ns)
+{
+#ifdef __linux__
+    struct timespec ts = {(time_t)(deadline_ns / 1000000000u), (long)(deadline_ns % 1000000000u)};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    {
+    }
+#else
+    uint64_t now = now_ns();
+    if (deadline_ns > now)
+    {
+        struct timespec ts = {(time_t)((deadline_ns - now) / 1000000000u),
+                              (long)((deadline_ns - now) % 1000000000u)};
+        nanosleep(&ts, NULL);
+    }
+#endif
+}
+
+// Waits for a release: sleeps most of the way, then spins the rest
+static void wait_release(const Executor *ex, uint64_t release_ns)
+{
+    if (release_ns > ex->spin_ns)
+    {
+        uint64_t wake = release_ns - ex->spin_ns;
+        if (now_ns() < wake)
+        {
+            sleep_until(wake);
+        }
+    }
+    while (now_ns() < release_ns)
+    {
+    }
+}
+
+/**
+ * @brief Prepares an executor.
+ *
+ * @param ex Pointer to the executor to initialize.
+ * @param period_ns Time between releases.
+ * @param policy EXECUTOR_CATCH_UP, EXECUTOR_SKIP or EXECUTOR_RESTART.
+ * @param step Function called once per cycle.
+ * @param arg Argument of @p step.
+ * @return 0 on success, -1 if the arguments are invalid.
+ *
+ * @note Spinning is off and the latency histogram spans one period; set
+ *       spin_ns and bin_ns afterwards to change them.
+ */
+
+int executor_init(Executor *ex, uint64_t period_ns, int policy, ExecutorStep step, void *arg)
+{
+    if (!ex || period_ns == 0 || !step || policy < EXECUTOR_CATCH_UP || policy > EXECUTOR_RESTART)
+    {
+        return -1;
+    }
+
+    ex->step = step;
+    ex->arg = arg;
+    ex->period_ns = period_ns;
+    ex->spin_ns = 0;
+    ex->bin_ns = period_ns / EXECUTOR_HISTOGRAM_BINS ? period_ns / EXECUTOR_HISTOGRAM_BINS : 1;
+    ex->policy = policy;
+    ex->release_ns = 0;
+    atomic_init(&ex->stop, 0);
+    executor_reset_stats(ex);
+    return 0;
+}
+
+/**
+ * @brief Gives the calling thread real-time priority and pins it to a CPU.
+ *
+ * Usually needs privileges (CAP_SYS_NICE, or an rtprio limit). Locking
+ * memory and isolating the CPU are left to the application.
+ *
+ * @param priority SCHED_FIFO priority, 0 to keep the current policy.
+ * @param cpu CPU to run on, -1 to leave the affinity alone.
+ * @return 0 on success, -1 if either could not be applied. Whatever could
+ *         be applied stays applied.
+ */
+
+int executor_set_realtime(int priority, int cpu)
+{
+    int result = 0;
+#ifdef __linux__
+    if (cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        {
+            result = -1;
+        }
+    }
+#else
+    if (cpu >= 0)
+    {
+        result = -1;
+    }
+#endif
+    if (priority > 0)
+    {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = priority;
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0)
+        {
+            result = -1;
+        }
+    }
+    return result;
+}
+
+static void record_cycle(Executor *ex, uint64_t latency_ns, uint64_t step_ns)
+{
+    ExecutorStats *stats = &ex->stats;
+    uint64_t bin = latency_ns / ex->bin_ns;
+
+    stats->cycles++;
+    stats->min_latency_ns = latency_ns < stats->min_latency_ns ? latency_ns : stats->min_latency_ns;
+    stats->max_latency_ns = latency_ns > stats->max_latency_ns ? latency_ns : stats->max_latency_ns;
+    stats->sum_latency_ns += latency_ns;
+    stats->max_step_ns = step_ns > stats->max_step_ns ? step_ns : stats->max_step_ns;
+    stats->histogram[bin < EXECUTOR_HISTOGRAM_BINS ? bin : EXECUTOR_HISTOGRAM_BINS - 1]++;
+}
+
+/**
+ * @brief Runs cycles on the calling thread.
+ *
+ * The first release is now; the following ones are one period apart. A
+ * step ending after the next release counts as an overrun, and the policy
+ * then either runs the missed cycles back to back (EXECUTOR_CATCH_UP), drops
+ * the missed releases and waits for the next one on the grid
+ * (EXECUTOR_SKIP), or drops them and starts a new grid one period after the
+ * overrun (EXECUTOR_RESTART).
+ *
+ * @param ex Pointer to the executor.
+ * @param cycles Cycles to run, 0 to run until executor_stop().
+ * @return Number of cycles run.
+ *
+ * \startuml
+ * start
+ * :first release = now;
+ * while (cycles left and not stopped?)
+ *   :sleep, then spin until the release;
+ *   :step();
+ *   :record latency and step time;
+ *   :next release += period;
+ *   if (step ended after the next release?) then (yes)
+ *     :count overrun;
+ *     if (policy?) then (catch up)
+ *     elseif (skip) then
+ *       :move to the first release after the end;
+ *     else (restart)
+ *       :next release = end + period;
+ *     endif
+ *   endif
+ * endwhile
+ * :return cycles run;
+ * stop
+ * \enduml
+ */
+
+uint64_t executor_run(Executor *ex, uint64_t cycles)
+{
+    uint64_t done = 0;
+
+    ex->release_ns = now_ns();
+    while ((cycles == 0 || done < cycles) && !atomic_load_explicit(&ex->stop, memory_order_relaxed))
+    {
+        wait_release(ex, ex->release_ns);
+        uint64_t start = now_ns();
+        ex->step(ex->arg);
+        uint64_t end = now_ns();
+        record_cycle(ex, start - ex->release_ns, end - start);
+        done++;
+
+        uint64_t next = ex->release_ns + ex->period_ns;
+        if (end > next)
+        {
+            uint64_t missed = (end - next) / ex->period_ns + 1;  // Releases already past
+            ex->stats.overruns++;
+            if (ex->policy == EXECUTOR_SKIP)
+            {
+                next += missed * ex->period_ns;
+                ex->stats.skipped += missed;
+            }
+            else if (ex->policy == EXECUTOR_RESTART)
+            {
+                next = end + ex->period_ns;
+                ex->stats.skipped += missed;
+            }
+        }
+        ex->release_ns = next;
+    }
+    atomic_store(&ex->stop, 0);
+    return done;
+}
+
+/**
+ * @brief Makes executor_run() return after the current cycle. Safe to call
+ *        from any thread, and from the step itself.
+ */
+
+void executor_stop(Executor *ex)
+{
+    atomic_store(&ex->stop, 1);
+}
+
+void executor_reset_stats(Executor *ex)
+{
+    memset(&ex->stats, 0, sizeof(ex->stats));
+    ex->stats.min_latency_ns = UINT64_MAX;
+}
+
+/* Spread of the release latencies seen, 0 before the first cycle. */
+uint64_t executor_jitter_ns(const Executor *ex)
+{
+    return ex->stats.cycles ? ex->stats.max_latency_ns - ex->stats.min_latency_ns : 0;
+}
+
+/* Step ticking one instance; arg points to an ExecutorMachine. */
+void executor_tick_machine(void *arg)
+{
+    ExecutorMachine *machine = arg;
+    state_machine_tick(machine->def, machine->inst);
+}
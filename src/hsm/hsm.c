@@ -1,5 +1,16 @@
 #include "hsm/hsm.h"
+#include "hsm/worker_pool.h"
+#include "hsm/input_mask.h"
+#include "hsm/timer_wheel.h"
+#ifdef HSM_TRACE
+#include "hsm/trace.h"
+#endif
+#ifdef HSM_COUNTERS
+#include "perf/counters.h"
+#endif
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 
 /**
  * @brief Computes the depth of a state in the state hierarchy.
@@ -46,7 +57,8 @@ static int get_depth(State *s)
  * up both states’ parent chains in parallel until a common ancestor is found.
  *
  * This is useful when performing transitions between states that may not share
- * a direct parent, and a minimal exit/entry path needs to be determined.
+ * a direct parent, and a minimal exit/entry path needs to be determined. It is
+ * only run by state_machine_compile(), never while the machine is ticking.
  *
  * @param a Pointer to the first state.
  * @param b Pointer to the second state.
@@ -106,232 +118,1703 @@ static State* find_common_ancestor(State *a, State *b)
     return a;
 }
 
+/* Running totals used to size the image and the compile buffer. */
+typedef struct CompileCounts {
+    unsigned states;
+    unsigned regions;
+    unsigned transitions;
+    unsigned event_tables;
+    unsigned event_entries;
+    unsigned refs;
+    unsigned paths;
+    unsigned handler_refs;
+    unsigned input_masks;
+    unsigned async;
+} CompileCounts;
+
+/* Write cursors into the image while it is being filled. */
+typedef struct CompileContext {
+    StateDef *states;
+    RegionDef *regions;
+    TransitionDef *transitions;
+    EventTableDef *event_tables;
+    EventEntry *event_entries;
+    uint32_t *refs;
+    StateId *paths;
+    uint32_t *input_masks;
+    AsyncDef *async;
+    HandlerFunc *handlers;
+    uint32_t *handler_slots;  // Open-addressed set used to deduplicate handlers
+    unsigned handler_capacity;
+    unsigned num_transitions;
+    unsigned num_event_tables;
+    unsigned num_event_entries;
+    unsigned num_refs;
+    unsigned num_paths;
+    unsigned num_input_masks;
+    unsigned num_handlers;
+    uint16_t memo_guards[HSM_MAX_GUARD_MEMOS];  // Guard handler of each cache slot
+    unsigned num_memos;
+    unsigned num_history;
+    unsigned num_timers;
+    unsigned num_async;
+    int error;
+} CompileContext;
+
+/* Transitions state_machine_tick() evaluates: no trigger event, no delay,
+   and a condition or a bitmask guard. */
+static int is_polled(const Transition *t)
+{
+    return t->event == 0 && t->after == 0 && (t->condition || t->input_mask);
+}
+
+/* Size of the bitmask guard table of a state: masks and values of all its
+   polled transitions, padded to whole vectors. 0 without bitmask guards. */
+static unsigned input_mask_table_size(const State *s)
+{
+    unsigned num_polled = 0;
+    int masked = 0;
+    for (int i = 0; i < s->num_transitions; ++i)
+    {
+        if (is_polled(&s->transitions[i]))
+        {
+            num_polled++;
+            masked |= s->transitions[i].input_mask != 0;
+        }
+    }
+    return masked ? 2 * ((num_polled + INPUT_MASK_LANES - 1) & ~(INPUT_MASK_LANES - 1u)) : 0;
+}
+
+static unsigned next_power_of_two(unsigned n)
+{
+    unsigned size = 1;
+    while (size < n)
+    {
+        size <<= 1;
+    }
+    return size;
+}
+
+/* Number of event-triggered transitions visible from a state: its own,
+   then those inherited from its ancestors within the region. */
+static unsigned count_event_transitions(State *s)
+{
+    unsigned count = 0;
+    for (State *p = s; p; p = p->parent)
+    {
+        for (int i = 0; i < p->num_transitions; ++i)
+        {
+            if (p->transitions[i].event != 0)
+            {
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Numbers the states and regions of a region and measures their records.
+ *
+ * States get consecutive ids region by region. The orthogonal regions of a
+ * state are numbered before any region nested inside them, so the regions
+ * owned by one state are always contiguous.
+ *
+ * @param sm Pointer to the region to number. Its own id must already be set.
+ * @param counts Running totals, updated in place.
+ */
+
+static void enumerate_region(StateMachine *sm, CompileCounts *counts)
+{
+    for (int idx_state = 0; idx_state < sm->num_states; ++idx_state)
+    {
+        State *s = sm->states[idx_state];
+        int depth = get_depth(s);
+        unsigned num_candidates = count_event_transitions(s);
+
+        s->id = (StateId)counts->states++;
+        counts->transitions += (unsigned)s->num_transitions;
+        counts->paths += (unsigned)depth;
+        counts->handler_refs += 6 + 3 * (unsigned)s->num_transitions;
+        counts->input_masks += input_mask_table_size(s);
+        if (s->async_entry || s->async_run)
+        {
+            counts->async++;
+        }
+
+        for (int idx_trans = 0; idx_trans < s->num_transitions; ++idx_trans)
+        {
+            Transition *t = &s->transitions[idx_trans];
+            State *ancestor = find_common_ancestor(s, t->target);
+            if (ancestor == t->target)
+            {
+                ancestor = t->target->parent;
+            }
+
+            counts->paths += (unsigned)(depth - (ancestor ? get_depth(ancestor) : 0));
+            counts->paths += (unsigned)t->num_parallel_targets;
+            if (is_polled(t))
+            {
+                counts->refs++;
+            }
+            if (t->async_action)
+            {
+                counts->async++;
+            }
+        }
+
+        /* Reserve the worst case: a hashed table sized for one event per
+           candidate is never smaller than the table actually built. */
+        if (num_candidates > 0)
+        {
+            counts->event_tables++;
+            counts->event_entries += next_power_of_two(2 * num_candidates);
+            counts->refs += num_candidates;
+        }
+    }
+
+    for (int idx_state = 0; idx_state < sm->num_states; ++idx_state)
+    {
+        State *s = sm->states[idx_state];
+        for (int i = 0; i < s->num_submachines; ++i)
+        {
+            s->submachine[i].id = (uint16_t)counts->regions++;
+        }
+    }
+
+    for (int idx_state = 0; idx_state < sm->num_states; ++idx_state)
+    {
+        State *s = sm->states[idx_state];
+        for (int i = 0; i < s->num_submachines; ++i)
+        {
+            enumerate_region(&s->submachine[i], counts);
+        }
+    }
+}
+
+/* Lays out the image arrays one after the other, then the handler table and
+   the deduplication scratch space behind it. Returns the total byte size. */
+static size_t layout_image(const CompileCounts *counts, StateMachineImage *image,
+                           size_t *handlers_offset, size_t *slots_offset, unsigned *capacity)
+{
+    size_t offset = sizeof(StateMachineImage);
+
+#define PLACE(field, count, type)                                          \
+    do {                                                                   \
+        offset = (offset + _Alignof(type) - 1) & ~(size_t)(_Alignof(type) - 1); \
+        image->field = (uint32_t)offset;                                   \
+        offset += (size_t)(count) * sizeof(type);                          \
+    } while (0)
+
+    PLACE(states, counts->states, StateDef);
+    PLACE(regions, counts->regions, RegionDef);
+    PLACE(transitions, counts->transitions, TransitionDef);
+    PLACE(event_tables, counts->event_tables, EventTableDef);
+    PLACE(event_entries, counts->event_entries, EventEntry);
+    PLACE(refs, counts->refs, uint32_t);
+    PLACE(paths, counts->paths, StateId);
+    PLACE(input_masks, counts->input_masks, uint32_t);
+    PLACE(async, counts->async, AsyncDef);
+#undef PLACE
+
+    offset = (offset + _Alignof(StateMachineImage) - 1) & ~(size_t)(_Alignof(StateMachineImage) - 1);
+    image->size = (uint32_t)offset;
+
+    offset = (offset + sizeof(HandlerFunc) - 1) & ~(sizeof(HandlerFunc) - 1);
+    *handlers_offset = offset;
+    offset += (size_t)(counts->handler_refs + 1) * sizeof(HandlerFunc);
+
+    *capacity = next_power_of_two(2 * counts->handler_refs + 2);
+    *slots_offset = offset;
+    offset += (size_t)*capacity * sizeof(uint32_t);
+    return offset;
+}
+
+/* Returns the handler table index of a callback, adding it on first use. */
+static uint16_t add_handler(CompileContext *ctx, HandlerFunc fn)
+{
+    if (!fn)
+    {
+        return 0;
+    }
+
+    unsigned mask = ctx->handler_capacity - 1;
+    unsigned idx = (unsigned)(((uintptr_t)fn >> 2) * 0x9E3779B1u) & mask;
+    while (ctx->handler_slots[idx] != 0)
+    {
+        uint32_t handler = ctx->handler_slots[idx];
+        if (ctx->handlers[handler] == fn)
+        {
+            return (uint16_t)handler;
+        }
+        idx = (idx + 1) & mask;
+    }
+
+    if (ctx->num_handlers > 0xFFFF)
+    {
+        ctx->error = 1;
+        return 0;
+    }
+    ctx->handlers[ctx->num_handlers] = fn;
+    ctx->handler_slots[idx] = ctx->num_handlers;
+    return (uint16_t)ctx->num_handlers++;
+}
+
+/* Returns the cache slot of a pure guard, allocating one on first use, or
+   HSM_NO_MEMO once every slot is taken. */
+static uint16_t add_memo(CompileContext *ctx, uint16_t guard)
+{
+    for (unsigned i = 0; i < ctx->num_memos; ++i)
+    {
+        if (ctx->memo_guards[i] == guard)
+        {
+            return (uint16_t)i;
+        }
+    }
+    if (ctx->num_memos == HSM_MAX_GUARD_MEMOS)
+    {
+        return HSM_NO_MEMO;
+    }
+    ctx->memo_guards[ctx->num_memos] = guard;
+    return (uint16_t)ctx->num_memos++;
+}
+
+/**
+ * @brief Fills the region and state records of a region.
+ *
+ * Each state gets its root-to-state path as a slice of the path pool, built
+ * once here from the parent chain, and a contiguous range of transition ids.
+ *
+ * @param ctx Pointer to the compile context.
+ * @param sm Pointer to the region to fill.
+ * @param owner Composite state owning the region, HSM_NO_STATE for the root.
+ */
+
+static void compile_states(CompileContext *ctx, StateMachine *sm, StateId owner)
+{
+    RegionDef *region = &ctx->regions[sm->id];
+    region->owner = owner;
+    region->initial = sm->initial_state ? sm->initial_state->id : HSM_NO_STATE;
+    region->history = (uint16_t)sm->history;
+    region->reserved = 0;
+    if (sm->history < HSM_HISTORY_NONE || sm->history > HSM_HISTORY_DEEP)
+    {
+        ctx->error = 1;
+    }
+    else if (sm->history != HSM_HISTORY_NONE)
+    {
+        ctx->num_history++;
+    }
+
+    for (int idx_state = 0; idx_state < sm->num_states; ++idx_state)
+    {
+        State *s = sm->states[idx_state];
+        StateDef *d = &ctx->states[s->id];
+        int depth = get_depth(s);
+
+        d->parent = s->parent ? s->parent->id : HSM_NO_STATE;
+        d->region = sm->id;
+        d->depth = (uint16_t)depth;
+        d->first_region = s->num_submachines > 0 ? s->submachine[0].id : 0;
+        d->num_regions = (uint16_t)s->num_submachines;
+        d->on_entry = add_handler(ctx, (HandlerFunc)s->on_entry);
+        d->on_run = add_handler(ctx, (HandlerFunc)s->on_run);
+        d->on_exit = add_handler(ctx, (HandlerFunc)s->on_exit);
+        d->on_event = add_handler(ctx, (HandlerFunc)s->on_event);
+        d->flags = s->parallel_regions && s->num_submachines > 1 ? HSM_STATE_PARALLEL : 0;
+        d->async = HSM_NO_ASYNC;
+        if (s->async_entry || s->async_run)
+        {
+            AsyncDef *a = &ctx->async[ctx->num_async];
+            a->start = add_handler(ctx, (HandlerFunc)s->async_entry);
+            a->run = add_handler(ctx, (HandlerFunc)s->async_run);
+            a->event = s->done_event;
+            d->async = (uint16_t)ctx->num_async++;
+            d->flags |= HSM_STATE_ASYNC;
+        }
+        d->first_transition = ctx->num_transitions;
+        d->num_transitions = (uint32_t)s->num_transitions;
+        d->event_table = HSM_NO_TABLE;
+        d->input_masks = 0;
+        ctx->num_transitions += (unsigned)s->num_transitions;
+
+        /* Fill from the bottom up so the path starts at the region root. */
+        d->path = ctx->num_paths;
+        ctx->num_paths += (unsigned)depth;
+        State *p = s;
+        for (int i = depth - 1; i >= 0; --i)
+        {
+            ctx->paths[d->path + i] = p->id;
+            p = p->parent;
+        }
+    }
+
+    for (int idx_state = 0; idx_state < sm->num_states; ++idx_state)
+    {
+        State *s = sm->states[idx_state];
+        for (int i = 0; i < s->num_submachines; ++i)
+        {
+            compile_states(ctx, &s->submachine[i], s->id);
+        }
+    }
+}
+
+/**
+ * @brief Precomputes the ancestor, exit path and entry path of every transition.
+ *
+ * The common ancestor is resolved once here instead of on every transition.
+ * A transition into the source itself or one of its ancestors is treated as
+ * an external transition, so the target is exited and re-entered.
+ *
+ * The exit path gets its own slice of the path pool (innermost first), while
+ * the entry path is a view into the target's root-to-state path. The guarded
+ * transitions without a trigger event are also collected into the state's
+ * polled list, the only ones state_machine_tick() evaluates.
+ *
+ * @param ctx Pointer to the compile context. State records must be filled.
+ * @param sm Pointer to the region to compile.
+ */
+
+static void compile_transitions(CompileContext *ctx, StateMachine *sm)
+{
+    for (int idx_state = 0; idx_state < sm->num_states; ++idx_state)
+    {
+        State *s = sm->states[idx_state];
+        StateDef *d = &ctx->states[s->id];
+
+        /* Parents and targets must live in the same region. */
+        if (d->parent != HSM_NO_STATE && ctx->states[d->parent].region != d->region)
+        {
+            ctx->error = 1;
+        }
+
+        d->polled = ctx->num_refs;
+        d->num_polled = 0;
+
+        for (int idx_trans = 0; idx_trans < s->num_transitions; ++idx_trans)
+        {
+            Transition *t = &s->transitions[idx_trans];
+            TransitionDef *td = &ctx->transitions[d->first_transition + idx_trans];
+            const StateDef *target = &ctx->states[t->target->id];
+            State *ancestor = find_common_ancestor(s, t->target);
+
+            /* Self transitions and transitions into an ancestor leave and
+               re-enter the target. */
+            if (ancestor == t->target)
+            {
+                ancestor = t->target->parent;
+            }
+
+            int ancestor_depth = ancestor ? get_depth(ancestor) : 0;
+            if (target->region != d->region)
+            {
+                ctx->error = 1;
+            }
+
+            td->source = s->id;
+            td->target = t->target->id;
+            td->ancestor = ancestor ? ancestor->id : HSM_NO_STATE;
+            td->guard = add_handler(ctx, (HandlerFunc)t->condition);
+            td->action = add_handler(ctx, (HandlerFunc)t->action);
+            td->memo = t->pure_guard && td->guard ? add_memo(ctx, td->guard) : HSM_NO_MEMO;
+            td->event = t->event;
+            td->after = t->after;
+            td->timer = HSM_NO_TIMER;
+            td->async = HSM_NO_ASYNC;
+            td->reserved = 0;
+            if (t->async_action)
+            {
+                AsyncDef *a = &ctx->async[ctx->num_async];
+                a->start = add_handler(ctx, (HandlerFunc)t->async_action);
+                a->run = 0;
+                a->event = t->done_event;
+                td->async = (uint16_t)ctx->num_async++;
+            }
+            if (t->after)
+            {
+                td->timer = (uint16_t)ctx->num_timers++;
+                d->flags |= HSM_STATE_TIMED;
+                if (t->event || ctx->num_timers >= HSM_NO_TIMER)
+                {
+                    ctx->error = 1;
+                }
+            }
+
+            td->exit_len = (uint16_t)(d->depth - ancestor_depth);
+            td->exit_path = ctx->num_paths;
+            for (int i = 0; i < td->exit_len; ++i)
+            {
+                ctx->paths[ctx->num_paths++] = ctx->paths[d->path + d->depth - 1 - i];
+            }
+
+            td->entry_path = target->path + (uint32_t)ancestor_depth;
+            td->entry_len = (uint16_t)(target->depth - ancestor_depth);
+
+            td->parallel_targets = ctx->num_paths;
+            td->num_parallel_targets = (uint16_t)t->num_parallel_targets;
+            for (int i = 0; i < t->num_parallel_targets; ++i)
+            {
+                State *p = t->parallel_targets ? t->parallel_targets[i] : NULL;
+                ctx->paths[ctx->num_paths++] = p ? p->id : HSM_NO_STATE;
+            }
+
+            if (is_polled(t))
+            {
+                ctx->refs[ctx->num_refs++] = d->first_transition + (uint32_t)idx_trans;
+                d->num_polled++;
+            }
+        }
+
+        /* Masks and values of the polled transitions in polling order, so
+           one vector compare covers several of them. Transitions guarded by
+           a condition only get an empty mask, which always matches. */
+        unsigned table_size = input_mask_table_size(s);
+        if (table_size > 0)
+        {
+            uint32_t *masks = &ctx->input_masks[ctx->num_input_masks];
+            uint32_t *values = masks + table_size / 2;
+            unsigned k = 0;
+            for (int idx_trans = 0; idx_trans < s->num_transitions; ++idx_trans)
+            {
+                Transition *t = &s->transitions[idx_trans];
+                if (is_polled(t))
+                {
+                    masks[k] = t->input_mask;
+                    values[k] = t->input_value & t->input_mask;
+                    k++;
+                }
+            }
+            for (; k < table_size / 2; ++k)
+            {
+                masks[k] = INPUT_MASK_PAD_MASK;
+                values[k] = INPUT_MASK_PAD_VALUE;
+            }
+            d->flags |= HSM_STATE_MASKED;
+            d->input_masks = ctx->num_input_masks;
+            ctx->num_input_masks += table_size;
+        }
+
+        for (int i = 0; i < s->num_submachines; ++i)
+        {
+            compile_transitions(ctx, &s->submachine[i]);
+        }
+    }
+}
+
+/* Inserts every group into a hashed table using the given seed and returns
+   the total number of probes needed. Zero means the hash is perfect. */
+static unsigned fill_event_hash(CompileContext *ctx, const EventTableDef *table,
+                                unsigned num_candidates, unsigned seed)
+{
+    EventEntry *entries = &ctx->event_entries[table->entries];
+    const uint32_t *candidates = &ctx->refs[table->transitions];
+    unsigned mask = table->size - 1;
+    unsigned probes = 0;
+
+    for (unsigned i = 0; i < table->size; ++i)
+    {
+        entries[i].event = 0;
+    }
+
+    for (unsigned first = 0; first < num_candidates; )
+    {
+        int32_t event = ctx->transitions[candidates[first]].event;
+        unsigned count = 1;
+        while (first + count < num_candidates &&
+               ctx->transitions[candidates[first + count]].event == event)
+        {
+            count++;
+        }
+
+        unsigned idx = ((uint32_t)event * seed) >> table->shift;
+        while (entries[idx].event != 0)
+        {
+            idx = (idx + 1) & mask;
+            probes++;
+        }
+        entries[idx].event = event;
+        entries[idx].first = first;
+        entries[idx].count = count;
+
+        first += count;
+    }
+    return probes;
+}
+
+/**
+ * @brief Builds the constant-time event dispatch table of a state.
+ *
+ * Candidates are the state's own event-triggered transitions followed by
+ * those of its ancestors within the region, grouped by event while keeping
+ * that priority order. Densely numbered events get a jump table indexed by
+ * event - base. Sparse events get a multiplicative hash of twice the number
+ * of events; the first seed without collisions is used, which makes the hash
+ * perfect, otherwise the seed with the fewest linear probes is kept.
+ *
+ * @param ctx Pointer to the compile context. Transition records must be filled.
+ * @param s Pointer to the state.
+ */
+
+static void compile_event_table(CompileContext *ctx, State *s)
+{
+    if (count_event_transitions(s) == 0)
+    {
+        return;
+    }
+
+    EventTableDef *table = &ctx->event_tables[ctx->num_event_tables];
+    uint32_t *candidates = &ctx->refs[ctx->num_refs];
+    ctx->states[s->id].event_table = ctx->num_event_tables++;
+    table->transitions = ctx->num_refs;
+    table->entries = ctx->num_event_entries;
+
+    /* Group candidates by event in order of first appearance, innermost
+       state first. An event is new if no earlier group has claimed it. */
+    unsigned k = 0;
+    unsigned num_events = 0;
+    int min_event = 0;
+    int max_event = 0;
+    for (State *p = s; p; p = p->parent)
+    {
+        for (int i = 0; i < p->num_transitions; ++i)
+        {
+            int event = p->transitions[i].event;
+            int seen = 0;
+            for (unsigned j = 0; j < k && !seen; ++j)
+            {
+                seen = (ctx->transitions[candidates[j]].event == event);
+            }
+            if (event == 0 || seen)
+            {
+                continue;
+            }
+
+            if (num_events == 0 || event < min_event) min_event = event;
+            if (num_events == 0 || event > max_event) max_event = event;
+            num_events++;
+
+            for (State *q = p; q; q = q->parent)
+            {
+                uint32_t first_transition = ctx->states[q->id].first_transition;
+                for (int ii = (q == p) ? i : 0; ii < q->num_transitions; ++ii)
+                {
+                    if (q->transitions[ii].event == event)
+                    {
+                        candidates[k++] = first_transition + (uint32_t)ii;
+                    }
+                }
+            }
+        }
+    }
+    ctx->num_refs += k;
+
+    unsigned span = (unsigned)max_event - (unsigned)min_event + 1u;
+    if (span <= 2u * num_events)
+    {
+        /* Dense jump table */
+        EventEntry *entries = &ctx->event_entries[table->entries];
+        table->size = span;
+        table->seed = 0;
+        table->shift = 0;
+        table->base = min_event;
+
+        for (unsigned i = 0; i < span; ++i)
+        {
+            entries[i].event = 0;
+        }
+        for (unsigned first = 0; first < k; )
+        {
+            int32_t event = ctx->transitions[candidates[first]].event;
+            unsigned count = 1;
+            while (first + count < k && ctx->transitions[candidates[first + count]].event == event)
+            {
+                count++;
+            }
+            EventEntry *entry = &entries[event - min_event];
+            entry->event = event;
+            entry->first = first;
+            entry->count = count;
+            first += count;
+        }
+    }
+    else
+    {
+        /* Sparse events: search for a perfect multiplicative hash */
+        unsigned bits = 1;
+        while ((1u << bits) < 2u * num_events)
+        {
+            bits++;
+        }
+        table->size = 1u << bits;
+        table->shift = 32 - bits;
+        table->base = 0;
+
+        unsigned best_seed = 0;
+        unsigned best_probes = ~0u;
+        for (unsigned attempt = 0; attempt < 256 && best_probes != 0; ++attempt)
+        {
+            unsigned seed = 0x9E3779B1u + attempt * 0x632BE5ACu;  // Always odd
+            unsigned probes = fill_event_hash(ctx, table, k, seed);
+            if (probes < best_probes)
+            {
+                best_probes = probes;
+                best_seed = seed;
+            }
+        }
+        table->seed = best_seed;
+        fill_event_hash(ctx, table, k, best_seed);
+    }
+    ctx->num_event_entries += table->size;
+}
+
+static void compile_events(CompileContext *ctx, StateMachine *sm)
+{
+    for (int idx_state = 0; idx_state < sm->num_states; ++idx_state)
+    {
+        State *s = sm->states[idx_state];
+        compile_event_table(ctx, s);
+
+        for (int i = 0; i < s->num_submachines; ++i)
+        {
+            compile_events(ctx, &s->submachine[i]);
+        }
+    }
+}
+
+/* Levels of regions from sm down to its most deeply nested region. */
+static unsigned region_nesting(const StateMachine *sm)
+{
+    unsigned deepest = 0;
+    for (int idx_state = 0; idx_state < sm->num_states; ++idx_state)
+    {
+        const State *s = sm->states[idx_state];
+        for (int i = 0; i < s->num_submachines; ++i)
+        {
+            unsigned nesting = region_nesting(&s->submachine[i]);
+            deepest = nesting > deepest ? nesting : deepest;
+        }
+    }
+    return deepest + 1;
+}
+
+static void count_machine(StateMachine *sm, CompileCounts *counts)
+{
+    CompileCounts zero = {0};
+    *counts = zero;
+
+    sm->id = 0;
+    counts->regions = 1;
+    enumerate_region(sm, counts);
+}
+
+size_t state_machine_compile_size(StateMachine *sm)
+{
+    CompileCounts counts;
+    StateMachineImage image;
+    size_t handlers_offset, slots_offset;
+    unsigned capacity;
+
+    if (!sm)
+    {
+        return 0;
+    }
+    count_machine(sm, &counts);
+    return layout_image(&counts, &image, &handlers_offset, &slots_offset, &capacity);
+}
+
+/* Resolves the arrays of an image into a definition for fast access. */
+static void bind_definition(StateMachineDef *def, const StateMachineImage *image,
+                            const HandlerFunc *handlers)
+{
+    const char *base = (const char *)image;
+
+    def->image = image;
+    def->states = (const StateDef *)(base + image->states);
+    def->regions = (const RegionDef *)(base + image->regions);
+    def->transitions = (const TransitionDef *)(base + image->transitions);
+    def->event_tables = (const EventTableDef *)(base + image->event_tables);
+    def->event_entries = (const EventEntry *)(base + image->event_entries);
+    def->refs = (const uint32_t *)(base + image->refs);
+    def->paths = (const StateId *)(base + image->paths);
+    def->input_masks = (const uint32_t *)(base + image->input_masks);
+    def->async = (const AsyncDef *)(base + image->async);
+    def->handlers = handlers;
+    def->region_pool = NULL;
+    def->timer_wheel = NULL;
+}
+
+/**
+ * @brief Compiles a machine description into a shared, read-only definition.
+ *
+ * Must be called once after the hierarchy has been built. States and regions
+ * are numbered (the ids are written back into the description), and every
+ * state receives its root-to-state path, its list of polled transitions and
+ * its event dispatch table, while every transition receives its common
+ * ancestor, exit sequence and entry sequence. Everything is stored as flat,
+ * index-based arrays in the caller-provided buffer, followed by the table of
+ * callbacks they refer to. The buffer must stay alive as long as @p def is used;
+ * the description itself is no longer needed.
+ *
+ * @param sm Pointer to the root state machine description.
+ * @param def Receives the compiled definition.
+ * @param buffer Storage for the compiled data, aligned for pointers.
+ * @param size Size of @p buffer in bytes, at least state_machine_compile_size(sm).
+ * @return 0 on success, -1 if the buffer is missing or too small or the
+ *         description is invalid, including regions nested more than
+ *         HSM_MAX_REGION_NESTING levels deep.
+ *
+ * \startuml
+ * start
+ * :number states and regions;
+ * if (buffer big enough?) then (no)
+ *   :return -1;
+ *   stop
+ * endif
+ * :compile_states(root);
+ * note right: records and root-to-state paths
+ * :compile_transitions(root);
+ * note right: ancestor, exit and entry path per transition
+ * :compile_events(root);
+ * note right: event dispatch table per state
+ * :bind_definition;
+ * :return 0;
+ * stop
+ * \enduml
+ */
+
+int state_machine_compile(StateMachine *sm, StateMachineDef *def, void *buffer, size_t size)
+{
+    CompileCounts counts;
+    CompileContext ctx = {0};
+    size_t handlers_offset, slots_offset;
+    StateMachineImage *image = (StateMachineImage *)buffer;
+
+    if (!sm || !def || !buffer)
+    {
+        return -1;
+    }
+
+    count_machine(sm, &counts);
+    if (counts.states >= HSM_NO_STATE || counts.regions > 0xFFFF || counts.async >= HSM_NO_ASYNC ||
+        region_nesting(sm) > HSM_MAX_REGION_NESTING ||
+        sm->input_offset > 0xFFFFFFFFu ||
+        size < state_machine_compile_size(sm))
+    {
+        return -1;
+    }
+
+    layout_image(&counts, image, &handlers_offset, &slots_offset, &ctx.handler_capacity);
+    // Clear the padding and spare slots so equal machines give equal images
+    memset(image + 1, 0, image->size - sizeof(StateMachineImage));
+    image->num_states = (uint16_t)counts.states;
+    image->num_regions = (uint16_t)counts.regions;
+    image->num_transitions = counts.transitions;
+    image->input_offset = (uint32_t)sm->input_offset;
+
+    char *base = (char *)buffer;
+    ctx.states = (StateDef *)(base + image->states);
+    ctx.regions = (RegionDef *)(base + image->regions);
+    ctx.transitions = (TransitionDef *)(base + image->transitions);
+    ctx.event_tables = (EventTableDef *)(base + image->event_tables);
+    ctx.event_entries = (EventEntry *)(base + image->event_entries);
+    ctx.refs = (uint32_t *)(base + image->refs);
+    ctx.paths = (StateId *)(base + image->paths);
+    ctx.input_masks = (uint32_t *)(base + image->input_masks);
+    ctx.async = (AsyncDef *)(base + image->async);
+    ctx.handlers = (HandlerFunc *)(base + handlers_offset);
+    ctx.handler_slots = (uint32_t *)(base + slots_offset);
+    ctx.handlers[0] = NULL;
+    ctx.num_handlers = 1;
+    for (unsigned i = 0; i < ctx.handler_capacity; ++i)
+    {
+        ctx.handler_slots[i] = 0;
+    }
+
+    compile_states(&ctx, sm, HSM_NO_STATE);
+    compile_transitions(&ctx, sm);
+    compile_events(&ctx, sm);
+
+    image->num_handlers = ctx.num_handlers;
+    image->num_event_tables = ctx.num_event_tables;
+    image->num_memos = ctx.num_memos;
+    image->num_history = ctx.num_history;
+    image->num_timers = ctx.num_timers;
+    image->num_async = ctx.num_async;
+    if (ctx.error)
+    {
+        return -1;
+    }
+
+    bind_definition(def, image, ctx.handlers);
+    return 0;
+}
+
+/* Tells whether an array of count elements lies inside the image and is aligned. */
+static int array_fits(uint32_t offset, uint32_t count, size_t element, size_t align, size_t size)
+{
+    return offset % align == 0 && offset >= sizeof(StateMachineImage) &&
+           offset <= size && (size - offset) / element >= count;
+}
+
+/**
+ * @brief Binds an existing compiled image to a handler table.
+ *
+ * The image is used in place, wherever it lives: a buffer filled by
+ * state_machine_compile() in another process, a file read into memory or
+ * mapped pages. Only the header is checked, in constant time; the records
+ * themselves are trusted, so images from untrusted sources must be verified
+ * (for example with a fingerprint) before binding them.
+ *
+ * @param def Receives the definition.
+ * @param image Start of the image, aligned for uint32_t.
+ * @param size Bytes available at @p image.
+ * @param handlers Handler table, image->num_handlers entries, entry 0 unused.
+ * @return 0 on success, -1 if the header does not describe a valid layout.
+ */
+
+int state_machine_bind(StateMachineDef *def, const void *image, size_t size, const HandlerFunc *handlers)
+{
+    const StateMachineImage *header = (const StateMachineImage *)image;
+
+    if (!def || !image || !handlers || (uintptr_t)image % _Alignof(StateMachineImage) != 0 ||
+        size < sizeof(StateMachineImage) || header->size > size)
+    {
+        return -1;
+    }
+
+    size = header->size;
+    uint32_t num_event_entries = header->refs >= header->event_entries
+                                     ? (header->refs - header->event_entries) / sizeof(EventEntry) : 0;
+    if (header->num_states >= HSM_NO_STATE || header->num_regions == 0 || header->num_handlers == 0 ||
+        header->num_handlers > 0x10000 ||
+        !array_fits(header->states, header->num_states, sizeof(StateDef), _Alignof(StateDef), size) ||
+        !array_fits(header->regions, header->num_regions, sizeof(RegionDef), _Alignof(RegionDef), size) ||
+        !array_fits(header->transitions, header->num_transitions, sizeof(TransitionDef),
+                    _Alignof(TransitionDef), size) ||
+        !array_fits(header->event_tables, header->num_event_tables, sizeof(EventTableDef),
+                    _Alignof(EventTableDef), size) ||
+        !array_fits(header->event_entries, num_event_entries, sizeof(EventEntry), _Alignof(EventEntry), size) ||
+        !array_fits(header->refs, 0, sizeof(uint32_t), _Alignof(uint32_t), size) ||
+        !array_fits(header->paths, 0, sizeof(StateId), _Alignof(StateId), size) ||
+        !array_fits(header->input_masks, 0, sizeof(uint32_t), _Alignof(uint32_t), size) ||
+        header->num_async >= HSM_NO_ASYNC ||
+        !array_fits(header->async, header->num_async, sizeof(AsyncDef), _Alignof(AsyncDef), size))
+    {
+        return -1;
+    }
+
+    bind_definition(def, header, handlers);
+    return 0;
+}
+
+/* ----------------------------------------------------------------------------
+ * Runtime
+ * ------------------------------------------------------------------------- */
+
+static inline StateId *previous_states(const StateMachineDef *def, StateMachineInstance *inst)
+{
+    return &inst->state[def->image->num_regions];
+}
+
+// Only present when def->image->num_history != 0
+static inline StateId *history_states(const StateMachineDef *def, StateMachineInstance *inst)
+{
+    return &inst->state[2u * def->image->num_regions];
+}
+
+// Byte offset of the timers behind the state slots, aligned for pointers
+static inline size_t timers_offset(const StateMachineDef *def)
+{
+    size_t end = sizeof(StateMachineInstance) + state_machine_state_slots(def) * sizeof(StateId);
+    return (end + _Alignof(TimerNode) - 1) & ~(size_t)(_Alignof(TimerNode) - 1);
+}
+
+static inline TimerNode *instance_timers(const StateMachineDef *def, StateMachineInstance *inst)
+{
+    return (TimerNode *)((char *)inst + timers_offset(def));
+}
+
+// Byte offset of the asynchronous operations behind the timers, aligned for pointers
+static inline size_t async_offset(const StateMachineDef *def)
+{
+    size_t end = timers_offset(def) + def->image->num_timers * sizeof(TimerNode);
+    return (end + _Alignof(AsyncOp) - 1) & ~(size_t)(_Alignof(AsyncOp) - 1);
+}
+
+static inline AsyncOp *instance_async(const StateMachineDef *def, StateMachineInstance *inst)
+{
+    return (AsyncOp *)((char *)inst + async_offset(def));
+}
+
+/* Starts an asynchronous action under a fresh token. Work the action
+   finished on the spot is completed right away. */
+static void start_async(const StateMachineDef *def, StateMachineInstance *inst, uint16_t async,
+                        uint16_t handler)
+{
+    AsyncOp *op = &instance_async(def, inst)[async];
+    AsyncToken token = {op, ++op->serial & ~HSM_ASYNC_POSTED};
+    if (token.id == 0)
+    {
+        token.id = ++op->serial & ~HSM_ASYNC_POSTED;  // 0 marks an idle operation
+    }
+    op->event = def->async[async].event;
+    atomic_store(&op->pending, token.id);
+    if (((AsyncFunc)def->handlers[handler])(inst->context, token) == HSM_ASYNC_DONE)
+    {
+        state_machine_complete(token);
+    }
+}
+
+/* Starts the run action of a state unless its previous work is still in
+   flight or its completion not delivered yet. */
+static inline void run_async(const StateMachineDef *def, StateMachineInstance *inst, const StateDef *s)
+{
+    const AsyncDef *a = &def->async[s->async];
+    if (a->run && atomic_load(&instance_async(def, inst)[s->async].pending) == 0)
+    {
+        start_async(def, inst, s->async, a->run);
+    }
+}
+
+/* Arms the time-triggered transitions of a state that was just entered. */
+static void arm_timers(const StateMachineDef *def, StateMachineInstance *inst, const StateDef *s)
+{
+    TimerWheel *wheel = def->timer_wheel;
+    if (!wheel)
+    {
+        return;
+    }
+    for (uint32_t i = s->first_transition; i < s->first_transition + s->num_transitions; ++i)
+    {
+        const TransitionDef *t = &def->transitions[i];
+        if (t->timer != HSM_NO_TIMER)
+        {
+            TimerNode *timer = &instance_timers(def, inst)[t->timer];
+            timer->owner = inst;
+            timer->id = i;
+            timer_wheel_arm(wheel, timer, wheel->now + t->after);
+        }
+    }
+}
+
+/* Cancels the timers of a state that is being exited. */
+static void cancel_timers(const StateMachineDef *def, StateMachineInstance *inst, const StateDef *s)
+{
+    if (!def->timer_wheel)
+    {
+        return;
+    }
+    for (uint32_t i = s->first_transition; i < s->first_transition + s->num_transitions; ++i)
+    {
+        const TransitionDef *t = &def->transitions[i];
+        if (t->timer != HSM_NO_TIMER)
+        {
+            timer_wheel_cancel(def->timer_wheel, &instance_timers(def, inst)[t->timer]);
+        }
+    }
+}
+
+static inline void call_state_func(const StateMachineDef *def, uint16_t handler, void *context)
+{
+    if (handler)
+    {
+        ((StateFunc)def->handlers[handler])(context);
+    }
+}
+
+// Results of the pure guards already called during one tick of one instance
+typedef struct GuardMemo {
+    uint64_t evaluated;
+    uint64_t value;
+} GuardMemo;
+
+static inline uint32_t read_inputs(const StateMachineDef *def, const void *context)
+{
+    return *(const uint32_t *)((const char *)context + def->image->input_offset);
+}
+
+/* Calls the guard of a transition, or reads its result from the memo when
+   the guard is pure and was already called in this tick. */
+static inline int evaluate_guard(const StateMachineDef *def, const TransitionDef *t, void *context,
+                                 GuardMemo *memo)
+{
+    if (t->memo == HSM_NO_MEMO)
+    {
+        return ((GuardFunc)def->handlers[t->guard])(context);
+    }
+
+    uint64_t bit = 1ull << t->memo;
+    if (memo->evaluated & bit)
+    {
+        return (memo->value & bit) != 0;
+    }
+    int hit = ((GuardFunc)def->handlers[t->guard])(context);
+    memo->evaluated |= bit;
+    memo->value |= hit ? bit : 0;
+    return hit;
+}
+
+#define NO_REGION 0xFFFFu
+
+// One level of the exit work stack: a run of states being exited
+typedef struct ExitFrame {
+    const StateId *next;  // Next state to exit
+    int step;             // 1 along an exit path, -1 backwards along a root-to-state path
+    uint16_t remaining;   // States left to exit
+    uint16_t sub;         // Regions of *next already exited
+    uint16_t region;      // Region left empty once done, NO_REGION for a transition's exit path
+} ExitFrame;
+
+/**
+ * @brief Exits a run of states, innermost first.
+ *
+ * Any orthogonal regions of a composite state are fully exited before the
+ * composite's own `on_exit` runs. Instead of recursing into those regions,
+ * each one being exited pushes a frame onto a fixed-size work stack, one
+ * frame per level of region nesting, so the stack use is bounded by
+ * HSM_MAX_REGION_NESTING however deep the hierarchy inside a region is.
+ *
+ * @param def Pointer to the machine definition.
+ * @param inst Pointer to the instance being run.
+ * @param first First state to exit.
+ * @param step Direction in which the following states lie: 1 for the
+ *        precompiled exit paths, -1 for a root-to-state path walked back.
+ * @param count Number of states to exit.
+ *
+ * @note The transition should later be completed by calling enter_from_common_ancestor().
+ *
+ * \startuml
+ * start
+ * :push the run of states;
+ * while (frames on the stack?)
+ *   if (frame has states left?) then (no)
+ *     :record history and clear the frame's region;
+ *     :pop;
+ *   elseif (active regions of the state left?) then (yes)
+ *     :push the active states of the next region, leaf first;
+ *   else
+ *     :cancel timers, drop async work;
+ *     :Call on_exit();
+ *     :advance to the next state;
+ *   endif
+ * endwhile
+ * stop
+ * \enduml
+ */
+
+static void exit_to_common_ancestor(const StateMachineDef *def, StateMachineInstance *inst,
+                                    const StateId *first, int step, int count)
+{
+    ExitFrame stack[HSM_MAX_REGION_NESTING];
+    int top = 0;
+
+    stack[0] = (ExitFrame){first, step, (uint16_t)count, 0, NO_REGION};
+    while (top >= 0)
+    {
+        ExitFrame *f = &stack[top];
+        if (f->remaining == 0)
+        {
+            if (f->region != NO_REGION)
+            {
+                if (def->image->num_history)
+                {
+                    history_states(def, inst)[f->region] = inst->state[f->region];
+                }
+                inst->state[f->region] = HSM_NO_STATE;
+            }
+            top--;
+            continue;
+        }
+
+        const StateDef *from = &def->states[*f->next];
+
+        // If this state has parallel regions, exit each active one first
+        if (f->sub < from->num_regions)
+        {
+            unsigned region = from->first_region + f->sub++;
+            StateId leaf = inst->state[region];
+            if (leaf != HSM_NO_STATE && top + 1 < HSM_MAX_REGION_NESTING)
+            {
+                const StateDef *l = &def->states[leaf];
+                stack[++top] = (ExitFrame){&def->paths[l->path + l->depth - 1], -1, l->depth, 0,
+                                           (uint16_t)region};
+            }
+            continue;
+        }
+
+        if (from->flags & HSM_STATE_TIMED)
+        {
+            cancel_timers(def, inst, from);
+        }
+        if (from->flags & HSM_STATE_ASYNC)
+        {
+            // Work still in flight is left to finish; its completion is dropped, even if already queued
+            atomic_store(&instance_async(def, inst)[from->async].pending, 0);
+        }
+
+        /* Check if the on_exit function exists before executing. */
+        call_state_func(def, from->on_exit, inst->context);
+#ifdef HSM_COUNTERS
+        perf_count_exit(def, *f->next);
+#endif
+        f->next += f->step;
+        f->remaining--;
+        f->sub = 0;
+    }
+}
+
+// One level of the entry work stack: a run of states being entered
+typedef struct EntryFrame {
+    const StateId *next;              // Next state to enter, outermost first
+    const StateId *parallel_targets;  // Region overrides for the last state, or NULL
+    uint16_t remaining;               // States left to enter
+    uint16_t sub;                     // Regions of *next already entered
+    uint16_t num_parallel_targets;
+    uint8_t deep;                     // Restore the regions below from history
+    uint8_t entered;                  // *next itself is entered, its regions are next
+} EntryFrame;
+
+/**
+ * @brief Enters a sequence of states, outermost first.
+ *
+ * Each state's `on_entry` runs before its orthogonal regions are entered.
+ * Regions start in their initial state unless the last state on the path
+ * has an override for them, or they resume from their history: a region
+ * with shallow history re-enters the top-level state it was last in, one
+ * with deep history (or below a region restored deeply) its last leaf.
+ * Like exiting, entering nested regions pushes frames onto a fixed-size
+ * work stack rather than recursing.
+ *
+ * @param def Pointer to the machine definition.
+ * @param inst Pointer to the instance being run.
+ * @param entry_path Precompiled states to enter, outermost first.
+ * @param entry_len Number of states in @p entry_path.
+ * @param parallel_targets Optional per-region entry overrides for the last state.
+ * @param num_parallel_targets Number of entries in @p parallel_targets.
+ * @param deep Non-zero to restore every region below the path from history.
+ *
+ * @note This function is typically called after exiting up to the common ancestor during
+ *       a state transition in a hierarchical state machine using exit_to_common_ancestor.
+ */
+
+static void enter_from_common_ancestor(const StateMachineDef *def, StateMachineInstance *inst,
+                                       const StateId *entry_path, int entry_len,
+                                       const StateId *parallel_targets, int num_parallel_targets,
+                                       int deep)
+{
+    EntryFrame stack[HSM_MAX_REGION_NESTING];
+    int top = 0;
+
+    stack[0] = (EntryFrame){entry_path, parallel_targets, (uint16_t)entry_len, 0,
+                            (uint16_t)num_parallel_targets, (uint8_t)(deep != 0), 0};
+    while (top >= 0)
+    {
+        EntryFrame *f = &stack[top];
+        if (f->remaining == 0)
+        {
+            top--;
+            continue;
+        }
+
+        const StateDef *to = &def->states[*f->next];
+        if (!f->entered)
+        {
+            /* Check if the on_entry function exists before executing. */
+            call_state_func(def, to->on_entry, inst->context);
+#ifdef HSM_COUNTERS
+            perf_count_entry(def, *f->next);
+#endif
+            if ((to->flags & HSM_STATE_ASYNC) && def->async[to->async].start)
+            {
+                start_async(def, inst, to->async, def->async[to->async].start);
+            }
+            if (to->flags & HSM_STATE_TIMED)
+            {
+                arm_timers(def, inst, to);
+            }
+            f->entered = 1;
+        }
+
+        /* If the destination state happens to be a state machine or
+           orthogonal region in its own right (compound state), then
+           initialize it or them. Overrides only apply at the target. */
+        if (f->sub < to->num_regions)
+        {
+            int idx_sub = f->sub++;
+            unsigned region = to->first_region + (unsigned)idx_sub;
+            const RegionDef *r = &def->regions[region];
+            StateId target = r->initial;
+            int resume_deep = 0;
+
+            if (f->remaining == 1 && f->parallel_targets && idx_sub < f->num_parallel_targets &&
+                f->parallel_targets[idx_sub] != HSM_NO_STATE)
+            {
+                target = f->parallel_targets[idx_sub];
+            }
+            else if ((f->deep || r->history != HSM_HISTORY_NONE) &&
+                     history_states(def, inst)[region] != HSM_NO_STATE)
+            {
+                // A single lookup: the leaf recorded on exit, or its top-level state
+                StateId last = history_states(def, inst)[region];
+                resume_deep = f->deep || r->history == HSM_HISTORY_DEEP;
+                target = resume_deep ? last : def->paths[def->states[last].path];
+            }
+
+            previous_states(def, inst)[region] = HSM_NO_STATE;
+            inst->state[region] = target;
+            if (target != HSM_NO_STATE && top + 1 < HSM_MAX_REGION_NESTING)
+            {
+                const StateDef *s = &def->states[target];
+                stack[++top] = (EntryFrame){&def->paths[s->path], NULL, s->depth, 0, 0,
+                                            (uint8_t)resume_deep, 0};
+            }
+            continue;
+        }
+
+        f->next++;
+        f->remaining--;
+        f->sub = 0;
+        f->entered = 0;
+    }
+}
+
+static void enter_region(const StateMachineDef *def, StateMachineInstance *inst,
+                         unsigned region, StateId target, int deep)
+{
+    previous_states(def, inst)[region] = HSM_NO_STATE;
+    inst->state[region] = target;
+
+    if (target != HSM_NO_STATE)
+    {
+        const StateDef *s = &def->states[target];
+        enter_from_common_ancestor(def, inst, &def->paths[s->path], s->depth, NULL, 0, deep);
+    }
+}
+
+/* Number of StateId slots of an instance: current and previous states,
+   plus the history states when the machine has history. */
+unsigned state_machine_state_slots(const StateMachineDef *def)
+{
+    return (def->image->num_history ? 3u : 2u) * def->image->num_regions;
+}
+
+/* Timers of the time-triggered transitions of an instance, indexed by
+   TransitionDef.timer; NULL when the machine has none. */
+TimerNode *state_machine_timers(const StateMachineDef *def, StateMachineInstance *inst)
+{
+    return def->image->num_timers ? instance_timers(def, inst) : NULL;
+}
+
+/* Asynchronous operations of an instance, indexed by StateDef.async and
+   TransitionDef.async; NULL when the machine has none. */
+AsyncOp *state_machine_async_ops(const StateMachineDef *def, StateMachineInstance *inst)
+{
+    return def->image->num_async ? instance_async(def, inst) : NULL;
+}
+
+/**
+ * @brief Sets the queue the completion events of an instance are posted to.
+ *
+ * Machines with asynchronous actions need a queue for each instance, set
+ * before state_machine_init() since entering the initial states may already
+ * start work; state_machine_init() keeps it. Does nothing for machines
+ * without asynchronous actions.
+ *
+ * @param def Pointer to the machine definition.
+ * @param inst Pointer to the instance, not necessarily initialized yet.
+ * @param queue Queue drained into the instance, e.g. by state_machine_dispatch().
+ */
+
+void state_machine_set_queue(const StateMachineDef *def, StateMachineInstance *inst, EventQueue *queue)
+{
+    for (unsigned i = 0; i < def->image->num_async; ++i)
+    {
+        instance_async(def, inst)[i].queue = queue;
+    }
+}
+
+size_t state_machine_instance_size(const StateMachineDef *def)
+{
+    if (def->image->num_async)
+    {
+        return async_offset(def) + def->image->num_async * sizeof(AsyncOp);
+    }
+    if (def->image->num_timers == 0)
+    {
+        return sizeof(StateMachineInstance) + state_machine_state_slots(def) * sizeof(StateId);
+    }
+    return timers_offset(def) + def->image->num_timers * sizeof(TimerNode);
+}
+
+StateId state_machine_current_state(const StateMachineDef *def, const StateMachineInstance *inst,
+                                    unsigned region)
+{
+    if (region >= def->image->num_regions)
+    {
+        return HSM_NO_STATE;
+    }
+    return inst->state[region];
+}
+
+StateId state_machine_previous_state(const StateMachineDef *def, const StateMachineInstance *inst,
+                                     unsigned region)
+{
+    if (region >= def->image->num_regions)
+    {
+        return HSM_NO_STATE;
+    }
+    return inst->state[def->image->num_regions + region];
+}
+
+/* Leaf a region was in when it was last exited, HSM_NO_STATE if it never
+   was or the machine has no history. */
+StateId state_machine_history_state(const StateMachineDef *def, const StateMachineInstance *inst,
+                                    unsigned region)
+{
+    if (region >= def->image->num_regions || !def->image->num_history)
+    {
+        return HSM_NO_STATE;
+    }
+    return inst->state[2u * def->image->num_regions + region];
+}
+
+/**
+ * @brief Tells whether a state is part of an instance's active configuration.
+ *
+ * A state is active when its region is active and it lies on the root-to-state
+ * path of the region's current state, which is a single lookup.
+ */
+
+int state_machine_is_active(const StateMachineDef *def, const StateMachineInstance *inst,
+                            StateId state)
+{
+    if (state >= def->image->num_states)
+    {
+        return 0;
+    }
+
+    const StateDef *s = &def->states[state];
+    StateId leaf = inst->state[s->region];
+    if (leaf == HSM_NO_STATE)
+    {
+        return 0;
+    }
+
+    const StateDef *l = &def->states[leaf];
+    return l->depth >= s->depth && def->paths[l->path + s->depth - 1] == state;
+}
+
 /**
- * @brief Recursively exits states up to the common ancestor.
- *
- * This function handles the first half of a hierarchical state transition by
- * exiting all states from the current state up to, but not including, the common ancestor.
- * It checks if each state has a valid `on_exit` function before calling it.
+ * @brief Arms the timers of the active states.
  *
- * @param from Pointer to the current state (starting point of the transition).
- * @param ancestor Pointer to the common ancestor state. Exiting stops when this state is reached.
+ * For instances whose configuration was written without entering it, such
+ * as by state_machine_restore(). Every active state, outermost first, gets
+ * its time-triggered transitions armed in def->timer_wheel for their full
+ * delay. No handlers run.
  *
- * @note The transition should later be completed by calling enter_from_common_ancestor().
- *
- * 
- * \startuml
- * start
- * while (from != ancestor?) 
-   -yes-> if (current->on_exit != NULL?)
-           -yes-> :Call current->on_exit();
-           -no->  :Skip on_exit;
-         :Set from = from->parent;
- * endwhile
- * stop
- * \enduml
+ * @param def Pointer to the machine definition.
+ * @param inst Pointer to the instance, its timers disarmed or armed in def->timer_wheel.
  */
 
-static void exit_to_common_ancestor(State *from, State *ancestor)
+void state_machine_rearm(const StateMachineDef *def, StateMachineInstance *inst)
 {
-    /* Iterate through the intervening states between from and ancestor. */
-    while (from && from != ancestor)
+    if (!def->image->num_timers)
     {
-        // If this state has parallel regions, exit each active one
-        if ((from->submachine) && (from->num_submachines > 0))
+        return;
+    }
+    for (unsigned region = 0; region < def->image->num_regions; ++region)
+    {
+        StateId leaf = inst->state[region];
+        if (leaf == HSM_NO_STATE)
         {
-            for (int i = 0; i < from->num_submachines; ++i)
-            {
-                StateMachine *child_sm = &from->submachine[i];
-                if (child_sm->current_state)
-                {
-                    exit_to_common_ancestor(child_sm->current_state, NULL);  // Fully exit
-                }
-            }
+            continue;
         }
-
-        /* Check if the on_exit function exists before executing. */
-        if (from->on_exit)
+        const StateDef *l = &def->states[leaf];
+        for (unsigned d = 0; d < l->depth; ++d)
         {
-            from->on_exit(from);
+            const StateDef *s = &def->states[def->paths[l->path + d]];
+            if (s->flags & HSM_STATE_TIMED)
+            {
+                arm_timers(def, inst, s);
+            }
         }
-        /* Go one level higher for the next iteration. */
-        from = from->parent;
     }
 }
 
 /**
- * @brief Recursively enters states from the common ancestor to the target state.
- *
- * This function handles the second half of a hierarchical state transition by entering
- * all intermediate states from the common ancestor to the target state, in proper order.
- * It ensures that composite state entry functions are called before their child states'
- * entry functions.
+ * @brief Restarts the asynchronous entry work of the active states.
  *
- * @param to Pointer to the target state to enter.
- * @param ancestor Pointer to the common ancestor state between source and target.
+ * Opt-in companion of state_machine_rearm() for restored instances, whose
+ * work in flight was abandoned: all work of the instance, transition
+ * actions included, is abandoned, then every active state, outermost
+ * first, has its async_entry action started again under a fresh token.
+ * No other handlers run. The context and the queue of the instance must be
+ * set.
  *
- * @note This function is typically called after exiting up to the common ancestor during
- *       a state transition in a hierarchical state machine using exit_to_common_ancestor.
- *
- * \startuml
- * participant "LeafState (Target)" as tgt
- * participant "CompositeState (Intermediate)" as int
- * participant "CompositeState (Ancestor)" as anc
-
- * tgt -> int: enter_from_common_ancestor(Intermediate, Ancestor)
- * int -> anc: enter_from_common_ancestor(Ancestor, Ancestor)
- * anc -> anc: on_entry(Ancestor)
- * anc -> anc: state_machine_init(Ancestor)
- * anc --> int: enter_from_common_ancestor(Ancestor, Ancestor)
- * int -> int: on_entry(Intermediate)
- * int -> int: state_machine_init(Intermediate)
- * int --> tgt: enter_from_common_ancestor(Intermediate, Ancestor)
- * tgt -> tgt: on_entry(Target)
- * tgt -> tgt: state_machine_init(Target)
-
- * \enduml
+ * @param def Pointer to the machine definition.
+ * @param inst Pointer to the instance.
  */
 
-static void enter_from_common_ancestor(State *to, State *ancestor)
+void state_machine_restart_async(const StateMachineDef *def, StateMachineInstance *inst)
 {
-    /* Recursive ascent from the target state to the ancestor. */
-    if (to->parent != ancestor)
+    if (!def->image->num_async)
     {
-        enter_from_common_ancestor(to->parent, ancestor);
+        return;
     }
-    /* Once we get past the above check, we can start executing the 
-    on_entry functions from the top down. */
-
-    /* Check if the on_entry function exists before executing. */
-    if (to->on_entry) 
+    for (unsigned i = 0; i < def->image->num_async; ++i)
     {
-        to->on_entry(to);
+        atomic_store(&instance_async(def, inst)[i].pending, 0);
     }
-
-    /* If the destination state happens to be a state machine or 
-       orthogonal region in its own right (compound state), then 
-       initialize it or them. */
-    if ((to->submachine) && (to->num_submachines > 0))
+    for (unsigned region = 0; region < def->image->num_regions; ++region)
     {
-        for (int i = 0; i < to->num_submachines; ++i)
+        StateId leaf = inst->state[region];
+        if (leaf == HSM_NO_STATE)
+        {
+            continue;
+        }
+        // Ancestors shared with an enclosing region were started from there
+        const StateDef *l = &def->states[leaf];
+        for (unsigned d = 0; d < l->depth; ++d)
         {
-            state_machine_init(&to->submachine[i]);
+            const StateDef *s = &def->states[def->paths[l->path + d]];
+            if (s->region == region && (s->flags & HSM_STATE_ASYNC) && def->async[s->async].start)
+            {
+                start_async(def, inst, s->async, def->async[s->async].start);
+            }
         }
     }
 }
 
-static void enter_from_common_ancestor_with_overrides(State *to,
-                                                      State *ancestor,
-                                                      State **parallel_targets,
-                                                      int num_parallel_targets) 
+void state_machine_init(const StateMachineDef *def, StateMachineInstance *inst, void *context)
+{
+    inst->context = context;
+    for (unsigned i = 0; i < state_machine_state_slots(def); ++i)
+    {
+        inst->state[i] = HSM_NO_STATE;
+    }
+    for (unsigned i = 0; i < def->image->num_timers; ++i)
     {
-    // Recursive ascent from target to ancestor
-    if (to->parent != ancestor)
+        timer_node_init(&instance_timers(def, inst)[i]);
+    }
+    for (unsigned i = 0; i < def->image->num_async; ++i)
     {
-        enter_from_common_ancestor_with_overrides(
-            to->parent,
-            ancestor,
-            NULL,  // Only apply overrides at the compound state level
-            0
-        );
+        atomic_init(&instance_async(def, inst)[i].pending, 0);
+        instance_async(def, inst)[i].serial = 0;
     }
 
-    // Run this state's entry function
-    if (to->on_entry)
+    /* Check if the default state exists, if so execute the on_entry function. */
+#ifdef HSM_TRACE
+    uint64_t trace_start = trace_now();
+#endif
+    enter_region(def, inst, 0, def->regions[0].initial, 0);
+#ifdef HSM_TRACE
+    trace_transition(inst, 0, HSM_NO_STATE, def->regions[0].initial, 0,
+                     trace_start, trace_start, trace_now(), TRACE_INIT);
+#endif
+}
+
+/**
+ * @brief Takes a compiled transition out of a region's current state.
+ *
+ * The transition may belong to an ancestor of the current state when it was
+ * inherited through the event table, in which case the states below its
+ * source are exited first. The transition's actions run between the exits
+ * and the entries; an asynchronous action is only started there.
+ *
+ * @param def Pointer to the machine definition.
+ * @param inst Pointer to the instance being run.
+ * @param region Region the transition happens in.
+ * @param t Pointer to the transition to take.
+ */
+
+static void take_transition(const StateMachineDef *def, StateMachineInstance *inst,
+                            unsigned region, const TransitionDef *t)
+{
+    StateId current = inst->state[region];
+    const StateDef *s = &def->states[current];
+    const StateId *path = &def->paths[s->path];
+#ifdef HSM_TRACE
+    uint64_t trace_start = trace_now();
+#endif
+
+    // === Exit from current down to the transition's source ===
+    exit_to_common_ancestor(def, inst, &path[s->depth - 1], -1, s->depth - def->states[t->source].depth);
+
+    // === Exit from source to the precompiled ancestor ===
+    exit_to_common_ancestor(def, inst, &def->paths[t->exit_path], 1, t->exit_len);
+#ifdef HSM_TRACE
+    uint64_t trace_exited = trace_now();
+#endif
+
+    // === Optional transition actions ===
+    call_state_func(def, t->action, inst->context);
+    if (t->async != HSM_NO_ASYNC)
     {
-        to->on_entry(to);
+        start_async(def, inst, t->async, def->async[t->async].start);
     }
 
-    // If this is a compound state with orthogonal regions
-    if (to->submachine && to->num_submachines > 0)
+#ifdef HSM_COUNTERS
+    perf_count_taken(def, (unsigned)(t - def->transitions));
+#endif
+
+    // === Update state machine ===
+    previous_states(def, inst)[region] = current;
+    inst->state[region] = t->target;
+
+    // === Enter from ancestor to target ===
+    enter_from_common_ancestor(def, inst,
+                               &def->paths[t->entry_path],
+                               t->entry_len,
+                               t->num_parallel_targets ? &def->paths[t->parallel_targets] : NULL,
+                               t->num_parallel_targets, 0);
+#ifdef HSM_TRACE
+    trace_transition(inst, region, current, t->target, t->event,
+                     trace_start, trace_exited, trace_now(), TRACE_TRANSITION);
+#endif
+}
+
+/* Returns the first polled transition of a state whose guard passes, NULL if none. */
+static const TransitionDef *find_polled_transition(const StateMachineDef *def, StateMachineInstance *inst,
+                                                   const StateDef *s, GuardMemo *memo)
+{
+    for (unsigned idx_trans = 0; idx_trans < s->num_polled; ++idx_trans)
     {
-        for (int i = 0; i < to->num_submachines; ++i)
+        const TransitionDef *t = &def->transitions[def->refs[s->polled + idx_trans]];
+        int hit = evaluate_guard(def, t, inst->context, memo);
+#ifdef HSM_COUNTERS
+        perf_count_guard(def, def->refs[s->polled + idx_trans], hit);
+#endif
+        if (hit)
         {
-            StateMachine *sub = &to->submachine[i];
+            return t;
+        }
+    }
+    return NULL;
+}
 
-            if (parallel_targets && i < num_parallel_targets && parallel_targets[i])
-            {
-                // Use specified target state for this region
-                enter_from_common_ancestor_with_overrides(
-                    parallel_targets[i],
-                    NULL,  // We are entering from the root of this region
-                    NULL,
-                    0
-                );
-                sub->current_state = parallel_targets[i];  // Maintain state tracking
-            }
-            else
+/* Same for a state with bitmask guards: every mask is tested in one go,
+   then the transitions that passed are visited in polling order and their
+   conditions, if any, called. */
+static const TransitionDef *find_masked_transition(const StateMachineDef *def, StateMachineInstance *inst,
+                                                   const StateDef *s, GuardMemo *memo)
+{
+    uint32_t inputs = read_inputs(def, inst->context);
+    unsigned padded = (s->num_polled + INPUT_MASK_LANES - 1) & ~(INPUT_MASK_LANES - 1u);
+    const uint32_t *masks = &def->input_masks[s->input_masks];
+
+    for (unsigned first = 0; first < s->num_polled; first += 64)
+    {
+        unsigned count = padded - first < 64 ? padded - first : 64;
+        uint64_t matches = input_mask_match_guards(masks + first, masks + padded + first, count, inputs);
+        while (matches)
+        {
+            unsigned idx_trans = first + (unsigned)__builtin_ctzll(matches);
+            const TransitionDef *t = &def->transitions[def->refs[s->polled + idx_trans]];
+            int hit = !t->guard || evaluate_guard(def, t, inst->context, memo);
+            matches &= matches - 1;
+#ifdef HSM_COUNTERS
+            perf_count_guard(def, def->refs[s->polled + idx_trans], hit);
+#endif
+            if (hit)
             {
-                // Default initial entry
-                state_machine_init(sub);
+                return t;
             }
         }
     }
+    return NULL;
 }
 
-void state_machine_init(StateMachine *sm)
+static void tick_region(const StateMachineDef *def, StateMachineInstance *inst, unsigned region,
+                        GuardMemo *memo);
+
+// Regions of one composite handed to the region pool
+typedef struct RegionJob {
+    const StateMachineDef *def;
+    StateMachineInstance *inst;
+    unsigned first_region;
+    GuardMemo memo;  // Guards evaluated before the fork, copied by every region
+} RegionJob;
+
+static void tick_region_task(void *arg, unsigned task, unsigned worker)
 {
-    sm->previous_state = NULL;
-    sm->current_state = sm->initial_state;
+    RegionJob *job = arg;
+    GuardMemo memo = job->memo;
+    (void)worker;
+    tick_region(job->def, job->inst, job->first_region + task, &memo);
+}
 
-    /* Check if the default state exists, if so execute the on_entry function. */
-    if (sm->current_state)
+static void tick_region(const StateMachineDef *def, StateMachineInstance *inst, unsigned region,
+                        GuardMemo *memo)
+{
+    StateId current = inst->state[region];
+    if (current == HSM_NO_STATE)
     {
-        enter_from_common_ancestor(sm->current_state, NULL);
+        return;
     }
-}
 
-void state_machine_init_with_overrides(
-    StateMachine *sm,
-    State **parallel_targets,
-    int num_parallel_targets
-) {
-    if (!sm || !sm->initial_state)
-        return;
+    const StateDef *s = &def->states[current];
+#ifdef HSM_COUNTERS
+    perf_count_tick(def, current);
+#endif
 
-    sm->current_state = sm->initial_state;
+    // Evaluate the polled transitions from current state; event-triggered
+    // ones are only looked up when their event arrives
+    const TransitionDef *t = (s->flags & HSM_STATE_MASKED) ? find_masked_transition(def, inst, s, memo)
+                                                           : find_polled_transition(def, inst, s, memo);
+    if (t)
+    {
+        take_transition(def, inst, region, t);
+        return; // Transition taken
+    }
 
-    if (sm->current_state->on_entry)
+    // If no transition was taken, run the current state's logic
+#ifdef HSM_COUNTERS
+    uint64_t run_start = perf_now();
+    call_state_func(def, s->on_run, inst->context);
+    perf_count_run(def, current, perf_now() - run_start);
+#else
+    call_state_func(def, s->on_run, inst->context);
+#endif
+    if (s->flags & HSM_STATE_ASYNC)
     {
-        sm->current_state->on_entry(sm->current_state);
+        run_async(def, inst, s);
     }
 
-    // Initialize child state machines (orthogonal regions) if present
-    if (sm->current_state->submachine && sm->current_state->num_submachines > 0)
+    // Tick any active submachines (e.g. orthogonal regions). Transitions
+    // never leave a region, so concurrent regions only write their own slots.
+    // The timer wheel is shared and single-threaded, so with one attached the
+    // regions run one after another.
+    if ((s->flags & HSM_STATE_PARALLEL) && def->region_pool && !def->timer_wheel)
     {
-        for (int i = 0; i < sm->current_state->num_submachines; ++i)
+        RegionJob job = {def, inst, s->first_region, *memo};
+        if (worker_pool_try_run(def->region_pool, tick_region_task, &job, s->num_regions) == 0)
         {
-            StateMachine *sub = &sm->current_state->submachine[i];
-
-            if (parallel_targets && i < num_parallel_targets && parallel_targets[i])
-            {
-                enter_from_common_ancestor_with_overrides(
-                    parallel_targets[i],
-                    NULL,  // No ancestor since we’re doing a full initialization
-                    NULL,
-                    0
-                );
-                sub->current_state = parallel_targets[i];
-            }
-            else
-            {
-                state_machine_init(sub);  // Default behavior
-            }
+            return;
         }
     }
+    for (unsigned idx_sub = 0; idx_sub < s->num_regions; ++idx_sub)
+    {
+        tick_region(def, inst, s->first_region + idx_sub, memo);
+    }
 }
 
 /**
  * @brief Executes one tick of the hierarchical state machine.
  *
- * This function checks all transitions from the current state (including from ancestor states,
- * depending on implementation), evaluates their conditions, and performs a transition
- * if any condition is met. It then calls the `on_run` handler of the active state.
+ * This function checks the polled transitions from the current state, evaluates their
+ * conditions, and performs a transition if any condition is met. It then calls the
+ * `on_run` handler of the active state. Event-triggered transitions are not polled;
+ * they are taken by state_machine_send_event() when their event arrives.
  *
  * This tick-based execution model enables the state machine to advance deterministically
  * in response to external stimuli or internal logic without requiring asynchronous events.
  *
- * @param sm Pointer to the state machine to update.
+ * Guards of transitions declared with pure_guard are called at most once per tick:
+ * their results are kept in a bitset on the stack for the rest of the tick, which
+ * also covers the orthogonal regions ticked below the current state.
+ *
+ * @param def Pointer to the shared machine definition.
+ * @param inst Pointer to the instance to update.
  *
  * \startuml
  * start
@@ -347,11 +1830,8 @@ void state_machine_init_with_overrides(
  * :run this state's on_run function;
  * 
  * repeat
- *   if (this transition begins in the current state and has a valid condition function and the condition is active?) then (yes)
- *     :execute find_common_ancestor(current state, target state);
- *     :execute exit_to_common_ancestor(current state, common ancestor);
- *     :execute enter_from_common_ancestor(target state, common ancestor);
- *     :update state machine current state/previous state;
+ *   if (this polled transition's condition is active?) then (yes)
+ *     :execute take_transition;
  *   endif
  * repeat while (valid transition not executed or transitions remaining to be evaluated) is (yes) not (no)
  * 
@@ -359,77 +1839,524 @@ void state_machine_init_with_overrides(
  * \enduml
  */
 
-void state_machine_tick(StateMachine *sm)
+void state_machine_tick(const StateMachineDef *def, StateMachineInstance *inst)
 {
-    if (!sm || !sm->current_state)
+    GuardMemo memo = {0, 0};
+    if (!def || !inst)
     {
         return;
     }
+    tick_region(def, inst, 0, &memo);
+}
 
-    State *current = sm->current_state;
+size_t state_machine_batch_workspace_size(const StateMachineDef *def, int count)
+{
+    return (def->image->num_states + 1u) * sizeof(uint32_t) + sizeof(void *) +
+           (size_t)count * (sizeof(StateMachineInstance *) + sizeof(GuardMemo));
+}
+
+/**
+ * @brief Ticks many instances of one definition, grouped by their current state.
+ *
+ * Instances are bucketed by the current state of their root region with a
+ * counting sort into @p workspace. Each bucket is then run as a unit: every
+ * polled guard of the state is evaluated over the instances still pending in
+ * the bucket before moving on to the next guard, and the state's `on_run` is
+ * called for the remaining ones in one pass. The state's records and callbacks
+ * stay hot in cache and the indirect branches keep hitting the same target.
+ *
+ * Each instance sees exactly what state_machine_tick() would do: guards in
+ * declaration order, the first passing one taken, otherwise `on_run` followed
+ * by its orthogonal regions. Only the interleaving between instances differs,
+ * so callbacks must not depend on other instances of the same batch.
+ *
+ * @param def Pointer to the shared machine definition.
+ * @param instances Array of @p count instance pointers. The array is not reordered.
+ * @param count Number of instances.
+ * @param workspace Scratch memory of state_machine_batch_workspace_size() bytes,
+ *                  aligned for pointers.
+ *
+ * \startuml
+ * start
+ * :count instances per current state;
+ * :prefix sum into bucket offsets;
+ * :scatter instance pointers into buckets;
+ * while (buckets left?)
+ *   while (polled transitions left and instances pending?)
+ *     :evaluate the guard over every pending instance;
+ *     :take the transition where it passes, keep the rest pending;
+ *   endwhile
+ *   :on_run for every pending instance;
+ *   :tick the orthogonal regions of every pending instance;
+ * endwhile
+ * stop
+ * \enduml
+ */
 
-    // Evaluate transitions from current state
-    for (int idx_trans = 0; idx_trans < current->num_transitions; ++idx_trans) 
+void state_machine_tick_batch(const StateMachineDef *def, StateMachineInstance **instances,
+                              int count, void *workspace)
+{
+    unsigned num_states = def->image->num_states;
+    uint32_t *offsets = (uint32_t *)workspace;
+    size_t sorted_offset = ((num_states + 1u) * sizeof(uint32_t) + sizeof(void *) - 1) &
+                           ~(sizeof(void *) - 1);
+    StateMachineInstance **sorted = (StateMachineInstance **)((char *)workspace + sorted_offset);
+    // Per-instance guard memos travel with the sorted pointers, only when needed
+    GuardMemo *memos = def->image->num_memos ? (GuardMemo *)(sorted + count) : NULL;
+    GuardMemo scratch = {0, 0};
+
+    // === Bucket the instances by the current state of the root region ===
+    for (unsigned i = 0; i <= num_states; ++i)
+    {
+        offsets[i] = 0;
+    }
+    for (int i = 0; i < count; ++i)
+    {
+        StateId current = instances[i]->state[0];
+        if (current != HSM_NO_STATE)
+        {
+            offsets[current + 1]++;
+        }
+    }
+    for (unsigned i = 0; i < num_states; ++i)
     {
-        Transition *t = &current->transitions[idx_trans];
-        if (t->condition && t->condition())
+        offsets[i + 1] += offsets[i];
+    }
+    for (int i = 0; i < count; ++i)
+    {
+        StateId current = instances[i]->state[0];
+        if (current != HSM_NO_STATE)
         {
-            State *target = t->target;
+            if (memos)
+            {
+                memos[offsets[current]] = scratch;
+            }
+            sorted[offsets[current]++] = instances[i];
+        }
+    }
+
+    // === Run each bucket; offsets[state] now marks the end of its bucket ===
+    uint32_t begin = 0;
+    for (unsigned state = 0; state < num_states; ++state)
+    {
+        uint32_t end = offsets[state];
+        StateMachineInstance **bucket = &sorted[begin];
+        GuardMemo *bucket_memos = memos ? &memos[begin] : NULL;
+        uint32_t pending = end - begin;
+        const StateDef *s = &def->states[state];
+        begin = end;
 
-            // === Determine common ancestor ===
-            State *ancestor = find_common_ancestor(current, target);
+        if (pending == 0)
+        {
+            continue;
+        }
+#ifdef HSM_COUNTERS
+        PerfStateCounters *state_counters = perf_state(def, state);
+        if (state_counters)
+        {
+            perf_add(&state_counters->ticks, pending);
+        }
+#endif
 
-            // === Exit from current to ancestor ===
-            exit_to_common_ancestor(current, ancestor);
+        // Evaluate each guard over the whole bucket, compacting the
+        // instances that did not transition at the front
+        for (unsigned idx_trans = 0; idx_trans < s->num_polled && pending > 0; ++idx_trans)
+        {
+            const TransitionDef *t = &def->transitions[def->refs[s->polled + idx_trans]];
+            GuardFunc guard = (GuardFunc)def->handlers[t->guard];
+            uint32_t mask = 0, value = 0;
+            uint32_t kept = 0;
 
-            // === Optional transition action ===
-            //if (t->action)
-            //{
-            //    t->action();
-            //}
+            if (s->flags & HSM_STATE_MASKED)
+            {
+                unsigned padded = (s->num_polled + INPUT_MASK_LANES - 1) & ~(INPUT_MASK_LANES - 1u);
+                mask = def->input_masks[s->input_masks + idx_trans];
+                value = def->input_masks[s->input_masks + padded + idx_trans];
+            }
 
-            // === Update state machine ===
-            sm->previous_state = current;
-            sm->current_state = target;
+            if (mask == 0 && t->memo == HSM_NO_MEMO)
+            {
+                for (uint32_t i = 0; i < pending; ++i)
+                {
+                    StateMachineInstance *inst = bucket[i];
+                    if (guard(inst->context))
+                    {
+                        take_transition(def, inst, 0, t);
+                    }
+                    else
+                    {
+                        if (bucket_memos)
+                        {
+                            bucket_memos[kept] = bucket_memos[i];
+                        }
+                        bucket[kept++] = inst;
+                    }
+                }
+            }
+            else if (!t->guard)
+            {
+                // Bitmask guard only: gather the input words and compare 64 instances at a time
+                for (uint32_t first = 0; first < pending; first += 64)
+                {
+                    uint32_t inputs[64];
+                    unsigned count = pending - first < 64 ? pending - first : 64;
+                    for (unsigned i = 0; i < count; ++i)
+                    {
+                        inputs[i] = read_inputs(def, bucket[first + i]->context);
+                    }
+                    uint64_t matches = input_mask_match_inputs(inputs, count, mask, value);
+                    for (unsigned i = 0; i < count; ++i)
+                    {
+                        StateMachineInstance *inst = bucket[first + i];
+                        if ((matches >> i) & 1)
+                        {
+                            take_transition(def, inst, 0, t);
+                        }
+                        else
+                        {
+                            if (bucket_memos)
+                            {
+                                bucket_memos[kept] = bucket_memos[first + i];
+                            }
+                            bucket[kept++] = inst;
+                        }
+                    }
+                }
+            }
+            else
+            {
+                for (uint32_t i = 0; i < pending; ++i)
+                {
+                    StateMachineInstance *inst = bucket[i];
+                    if ((read_inputs(def, inst->context) & mask) == value &&
+                        evaluate_guard(def, t, inst->context, bucket_memos ? &bucket_memos[i] : &scratch))
+                    {
+                        take_transition(def, inst, 0, t);
+                    }
+                    else
+                    {
+                        if (bucket_memos)
+                        {
+                            bucket_memos[kept] = bucket_memos[i];
+                        }
+                        bucket[kept++] = inst;
+                    }
+                }
+            }
+#ifdef HSM_COUNTERS
+            PerfTransitionCounters *transition_counters = perf_transition(def, def->refs[s->polled + idx_trans]);
+            if (transition_counters)
+            {
+                perf_add(&transition_counters->guard_evaluations, pending);
+                perf_add(&transition_counters->guard_hits, pending - kept);
+            }
+#endif
+            pending = kept;
+        }
 
-            // === Enter from ancestor to target ===
-            enter_from_common_ancestor_with_overrides(
-            target,
-            ancestor,
-            t->parallel_targets,
-            t->num_parallel_targets);
+        // Run the state's logic for every instance that stayed
+        if (s->on_run)
+        {
+            StateFunc on_run = (StateFunc)def->handlers[s->on_run];
+            for (uint32_t i = 0; i < pending; ++i)
+            {
+#ifdef HSM_COUNTERS
+                uint64_t run_start = perf_now();
+                on_run(bucket[i]->context);
+                perf_count_run(def, state, perf_now() - run_start);
+#else
+                on_run(bucket[i]->context);
+#endif
+            }
+        }
+        if (s->flags & HSM_STATE_ASYNC)
+        {
+            for (uint32_t i = 0; i < pending; ++i)
+            {
+                run_async(def, bucket[i], s);
+            }
+        }
 
-            return; // Transition taken
+        for (unsigned idx_sub = 0; idx_sub < s->num_regions; ++idx_sub)
+        {
+            for (uint32_t i = 0; i < pending; ++i)
+            {
+                // Without pure guards the scratch memo is never written
+                tick_region(def, bucket[i], s->first_region + idx_sub, bucket_memos ? &bucket_memos[i] : &scratch);
+            }
         }
     }
-    
-    // If no transition was taken, run the current state's logic
-    if (current->on_run)
+}
+
+/**
+ * @brief Looks up the transitions an event triggers in a state.
+ *
+ * Dense tables are indexed directly by event - base. Hashed tables use a
+ * multiplicative hash that is perfect in the common case; the linear probe
+ * only runs for the rare tables where no collision-free seed was found.
+ *
+ * @param def Pointer to the machine definition.
+ * @param table Pointer to the state's compiled event table.
+ * @param event Event to look up.
+ * @return Pointer to the matching entry, or NULL if the event is not handled.
+ */
+
+static const EventEntry *find_event_entry(const StateMachineDef *def, const EventTableDef *table,
+                                          int event)
+{
+    const EventEntry *entries = &def->event_entries[table->entries];
+
+    if (table->seed == 0)
     {
-        current->on_run(current);
+        unsigned idx = (unsigned)event - (unsigned)table->base;
+        if (idx >= table->size || entries[idx].event != event)
+        {
+            return NULL;
+        }
+        return &entries[idx];
     }
 
-    // Tick any active submachines (e.g. orthogonal regions)
-    if (current->submachine)
+    unsigned mask = table->size - 1;
+    unsigned idx = ((uint32_t)event * table->seed) >> table->shift;
+    while (entries[idx].event != 0)
     {
-        for (int idx_sub = 0; idx_sub < current->num_submachines; ++idx_sub)
+        if (entries[idx].event == event)
         {
-            StateMachine *sub = &current->submachine[idx_sub];
-            state_machine_tick(sub);
+            return &entries[idx];
         }
+        idx = (idx + 1) & mask;
     }
+    return NULL;
 }
 
-void state_machine_send_event(StateMachine *sm, int event) {
-    if (!sm->current_state) return;
-    // Try submachine first
-    if (sm->current_state->submachine) {
-        state_machine_send_event(sm->current_state->submachine, event);
+static int send_event_region(const StateMachineDef *def, StateMachineInstance *inst,
+                             unsigned region, int event, GuardMemo *memo)
+{
+    StateId current = inst->state[region];
+    int consumed = 0;
+
+    if (current == HSM_NO_STATE)
+    {
+        return 0;
+    }
+
+    const StateDef *s = &def->states[current];
+
+    // Try submachines first
+    for (unsigned idx_sub = 0; idx_sub < s->num_regions; ++idx_sub)
+    {
+        consumed |= send_event_region(def, inst, s->first_region + idx_sub, event, memo);
+    }
+    if (consumed)
+    {
+        return 1;
+    }
+
+    // Then this region's own transitions
+    if (s->event_table != HSM_NO_TABLE)
+    {
+        const EventTableDef *table = &def->event_tables[s->event_table];
+        const EventEntry *entry = find_event_entry(def, table, event);
+        if (entry)
+        {
+            const uint32_t *candidates = &def->refs[table->transitions + entry->first];
+            for (unsigned i = 0; i < entry->count; ++i)
+            {
+                const TransitionDef *t = &def->transitions[candidates[i]];
+                int hit = !t->guard || evaluate_guard(def, t, inst->context, memo);
+#ifdef HSM_COUNTERS
+                if (t->guard)
+                {
+                    perf_count_guard(def, candidates[i], hit);
+                }
+#endif
+                if (hit)
+                {
+                    take_transition(def, inst, region, t);
+                    return 1;
+                }
+            }
+        }
     }
+
     // Then local handler
-    if (sm->current_state->on_event) {
-        sm->current_state->on_event(sm->current_state, event);
+    if (s->on_event)
+    {
+        ((EventFunc)def->handlers[s->on_event])(inst->context, event);
+    }
+    return 0;
+}
+
+/**
+ * @brief Delivers an event to the active configuration of an instance.
+ *
+ * The event goes to the orthogonal regions of the current state first. If none
+ * of them took a transition, the current state's dispatch table is consulted;
+ * it holds the state's own event-triggered transitions followed by those
+ * inherited from its ancestors, and the first one whose guard passes is taken.
+ * If no transition fires here either, the current state's `on_event` handler
+ * is notified.
+ *
+ * @param def Pointer to the shared machine definition.
+ * @param inst Pointer to the instance receiving the event.
+ * @param event Event to deliver (> 0).
+ * @return 1 if a transition was taken, 0 otherwise.
+ *
+ * \startuml
+ * start
+ * :deliver to every region of the current state;
+ * if (a region took a transition?) then (yes)
+ *   :return 1;
+ *   stop
+ * endif
+ * :entry = find_event_entry(current state, event);
+ * while (candidates left in entry?)
+ *   if (no guard or guard passes?) then (yes)
+ *     :take_transition;
+ *     :return 1;
+ *     stop
+ *   endif
+ * endwhile
+ * :call on_event;
+ * :return 0;
+ * stop
+ * \enduml
+ */
+
+int state_machine_send_event(const StateMachineDef *def, StateMachineInstance *inst, int event)
+{
+    GuardMemo memo = {0, 0};
+    return send_event_region(def, inst, 0, event, &memo);
+}
+
+/* Whether a queued event is to be delivered. An operation's completion
+   event only is while that operation has a completion posted, which it
+   then consumes; abandoned work may still have left its event behind. */
+static int accept_event(const StateMachineDef *def, StateMachineInstance *inst, int event)
+{
+    int completion = 0;
+    for (unsigned i = 0; i < def->image->num_async; ++i)
+    {
+        if (def->async[i].event != event)
+        {
+            continue;
+        }
+        completion = 1;
+        AsyncOp *op = &instance_async(def, inst)[i];
+        unsigned pending = atomic_load(&op->pending);
+        if ((pending & HSM_ASYNC_POSTED) && atomic_compare_exchange_strong(&op->pending, &pending, 0))
+        {
+            return 1;
+        }
+    }
+    return !completion;
+}
+
+/**
+ * @brief Drains queued events into an instance with run-to-completion semantics.
+ *
+ * Must be called from the thread that owns the instance. Each event is fully
+ * processed by state_machine_send_event() before the next one is popped, so
+ * handlers never observe a half-finished reaction. Events posted while the
+ * batch is running, including by the handlers themselves, are simply queued.
+ * Completion events of asynchronous work abandoned since they were posted
+ * are popped but not delivered.
+ *
+ * @param def Pointer to the shared machine definition.
+ * @param inst Pointer to the instance receiving the events.
+ * @param queue Pointer to the instance's event queue.
+ * @param max_events Maximum number of events to process in this batch, or 0
+ *                   to drain the queue.
+ * @return Number of events processed.
+ */
+
+int state_machine_dispatch(const StateMachineDef *def, StateMachineInstance *inst,
+                           EventQueue *queue, int max_events)
+{
+    int processed = 0;
+    int event;
+
+    while ((max_events <= 0 || processed < max_events) && event_queue_pop(queue, &event))
+    {
+        if (accept_event(def, inst, event))
+        {
+            state_machine_send_event(def, inst, event);
+        }
+        ++processed;
+    }
+    return processed;
+}
+
+/**
+ * @brief Completes asynchronous work. Safe to call from any thread.
+ *
+ * Posts the completion event of the action that handed out @p token to the
+ * instance's queue, unless the work was already completed or abandoned
+ * because its state was exited in the meantime. The work stays marked as
+ * posted until state_machine_dispatch() delivers the event, which it drops
+ * if the work was abandoned by then. When the queue is full the work stays
+ * pending under the same token, so the caller may retry.
+ *
+ * @param token Token the action was started with.
+ * @return 0 if the completion event was posted, -1 if the token is stale,
+ *         the instance has no queue or the queue is full.
+ */
+
+int state_machine_complete(AsyncToken token)
+{
+    unsigned expected = token.id;
+    if (!token.op || !token.op->queue ||
+        !atomic_compare_exchange_strong(&token.op->pending, &expected, token.id | HSM_ASYNC_POSTED))
+    {
+        return -1;
+    }
+    if (event_queue_post(token.op->queue, token.op->event) != 0)
+    {
+        // Unless the state was exited meanwhile, which cleared the mark
+        expected = token.id | HSM_ASYNC_POSTED;
+        atomic_compare_exchange_strong(&token.op->pending, &expected, token.id);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Takes the time-triggered transition of an expired timer.
+ *
+ * Meant as the expire callback of the definition's timer wheel, with the
+ * definition as its argument: timer_wheel_advance(wheel, now,
+ * state_machine_expire, &def). The transition is taken like one triggered
+ * by an event, running to completion before the next timer is looked at,
+ * provided its source state is still active and its condition, if any,
+ * passes.
+ *
+ * @param def Pointer to the shared machine definition.
+ * @param timer Timer of the instance that expired.
+ */
+
+void state_machine_expire(void *def, TimerNode *timer)
+{
+    const StateMachineDef *d = def;
+    StateMachineInstance *inst = timer->owner;
+    const TransitionDef *t = &d->transitions[timer->id];
+    GuardMemo memo = {0, 0};
+
+    if (!state_machine_is_active(d, inst, t->source))
+    {
+        return;
+    }
+    if (t->guard)
+    {
+        int hit = evaluate_guard(d, t, inst->context, &memo);
+#ifdef HSM_COUNTERS
+        perf_count_guard(d, timer->id, hit);
+#endif
+        if (!hit)
+        {
+            return;
+        }
     }
+    take_transition(d, inst, d->states[t->source].region, t);
 }
 
 /*
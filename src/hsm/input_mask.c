@@ -0,0 +1,159 @@
+#include "hsm/input_mask.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && defined(__GNUC__)
+#include <immintrin.h>
+#define INPUT_MASK_X86 1
+#endif
+
+/* Portable versions, used off x86 and for the tails of the vector loops.
+   They are exported so the vector kernels can be checked against them. */
+
+uint64_t input_mask_match_guards_scalar(const uint32_t *masks, const uint32_t *values, unsigned count,
+                                        uint32_t inputs)
+{
+    uint64_t matches = 0;
+    for (unsigned i = 0; i < count; ++i)
+    {
+        matches |= (uint64_t)((inputs & masks[i]) == values[i]) << i;
+    }
+    return matches;
+}
+
+uint64_t input_mask_match_inputs_scalar(const uint32_t *inputs, unsigned count, uint32_t mask, uint32_t value)
+{
+    uint64_t matches = 0;
+    for (unsigned i = 0; i < count; ++i)
+    {
+        matches |= (uint64_t)((inputs[i] & mask) == value) << i;
+    }
+    return matches;
+}
+
+#ifdef INPUT_MASK_X86
+
+static uint64_t match_guards_sse2(const uint32_t *masks, const uint32_t *values, unsigned count,
+                                  uint32_t inputs)
+{
+    __m128i in = _mm_set1_epi32((int)inputs);
+    uint64_t matches = 0;
+    for (unsigned i = 0; i < count; i += 4)
+    {
+        __m128i m = _mm_loadu_si128((const __m128i *)&masks[i]);
+        __m128i v = _mm_loadu_si128((const __m128i *)&values[i]);
+        __m128i eq = _mm_cmpeq_epi32(_mm_and_si128(in, m), v);
+        matches |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(eq)) << i;
+    }
+    return matches;
+}
+
+static uint64_t match_inputs_sse2(const uint32_t *inputs, unsigned count, uint32_t mask, uint32_t value)
+{
+    __m128i m = _mm_set1_epi32((int)mask);
+    __m128i v = _mm_set1_epi32((int)value);
+    uint64_t matches = 0;
+    unsigned i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i *)&inputs[i]);
+        __m128i eq = _mm_cmpeq_epi32(_mm_and_si128(in, m), v);
+        matches |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(eq)) << i;
+    }
+    if (i < count)
+    {
+        matches |= input_mask_match_inputs_scalar(inputs + i, count - i, mask, value) << i;
+    }
+    return matches;
+}
+
+__attribute__((target("avx2")))
+static uint64_t match_guards_avx2(const uint32_t *masks, const uint32_t *values, unsigned count,
+                                  uint32_t inputs)
+{
+    __m256i in = _mm256_set1_epi32((int)inputs);
+    uint64_t matches = 0;
+    for (unsigned i = 0; i < count; i += 8)
+    {
+        __m256i m = _mm256_loadu_si256((const __m256i *)&masks[i]);
+        __m256i v = _mm256_loadu_si256((const __m256i *)&values[i]);
+        __m256i eq = _mm256_cmpeq_epi32(_mm256_and_si256(in, m), v);
+        matches |= (uint64_t)(uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(eq)) << i;
+    }
+    return matches;
+}
+
+__attribute__((target("avx2")))
+static uint64_t match_inputs_avx2(const uint32_t *inputs, unsigned count, uint32_t mask, uint32_t value)
+{
+    __m256i m = _mm256_set1_epi32((int)mask);
+    __m256i v = _mm256_set1_epi32((int)value);
+    uint64_t matches = 0;
+    unsigned i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i in = _mm256_loadu_si256((const __m256i *)&inputs[i]);
+        __m256i eq = _mm256_cmpeq_epi32(_mm256_and_si256(in, m), v);
+        matches |= (uint64_t)(uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(eq)) << i;
+    }
+    if (i < count)
+    {
+        matches |= input_mask_match_inputs_scalar(inputs + i, count - i, mask, value) << i;
+    }
+    return matches;
+}
+
+static int have_avx2(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+#endif
+
+/**
+ * @brief Tests a table of bitmask guards against one input word.
+ *
+ * Used by state_machine_tick() for the polled transitions of a state. The
+ * table is padded with INPUT_MASK_PAD_MASK / INPUT_MASK_PAD_VALUE entries so
+ * whole vectors can be loaded.
+ */
+
+uint64_t input_mask_match_guards(const uint32_t *masks, const uint32_t *values, unsigned count,
+                                 uint32_t inputs)
+{
+#ifdef INPUT_MASK_X86
+    if (have_avx2())
+    {
+        return match_guards_avx2(masks, values, count, inputs);
+    }
+    return match_guards_sse2(masks, values, count, inputs);
+#else
+    return input_mask_match_guards_scalar(masks, values, count, inputs);
+#endif
+}
+
+/**
+ * @brief Tests one bitmask guard against the input words of many instances.
+ *
+ * Used by state_machine_tick_batch() for a transition guarded by a mask only.
+ */
+
+uint64_t input_mask_match_inputs(const uint32_t *inputs, unsigned count, uint32_t mask, uint32_t value)
+{
+#ifdef INPUT_MASK_X86
+    if (have_avx2())
+    {
+        return match_inputs_avx2(inputs, count, mask, value);
+    }
+    return match_inputs_sse2(inputs, count, mask, value);
+#else
+    return input_mask_match_inputs_scalar(inputs, count, mask, value);
+#endif
+}
+
+const char *input_mask_isa(void)
+{
+#ifdef INPUT_MASK_X86
+    return have_avx2() ? "avx2" : "sse2";
+#else
+    return "scalar";
+#endif
+}
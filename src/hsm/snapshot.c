@@ -0,0 +1,155 @@
+#include "hsm/snapshot.h"
+#include "hsm/timer_wheel.h"
+#include <string.h>
+
+/* Number of StateId slots following the context pointer of an instance. */
+static unsigned instance_slots(const StateMachineDef *def)
+{
+    return state_machine_state_slots(def);
+}
+
+/**
+ * @brief Computes a fingerprint of a compiled definition.
+ *
+ * FNV-1a over the pointer-free image, so the same description compiled in
+ * another process gives the same value while a changed machine does not.
+ */
+
+uint32_t state_machine_fingerprint(const StateMachineDef *def)
+{
+    const unsigned char *bytes = (const unsigned char *)def->image;
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < def->image->size; ++i)
+    {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+size_t state_machine_snapshot_size(const StateMachineDef *def, unsigned count)
+{
+    return sizeof(SnapshotHeader) + (size_t)count * instance_slots(def) * sizeof(StateId);
+}
+
+/**
+ * @brief Writes the active configuration of instances to a snapshot.
+ *
+ * @param def Pointer to the shared machine definition.
+ * @param instances Instances to save.
+ * @param count Number of instances.
+ * @param buffer Receives the snapshot.
+ * @param size Size of @p buffer, at least state_machine_snapshot_size().
+ * @return Number of bytes written, 0 if the buffer is missing or too small.
+ */
+
+size_t state_machine_snapshot(const StateMachineDef *def, StateMachineInstance *const *instances,
+                              unsigned count, void *buffer, size_t size)
+{
+    size_t total = state_machine_snapshot_size(def, count);
+    if (!buffer || size < total)
+    {
+        return 0;
+    }
+
+    unsigned slots = instance_slots(def);
+    SnapshotHeader header = {
+        .magic = SNAPSHOT_MAGIC,
+        .version = SNAPSHOT_VERSION,
+        .slots = (uint16_t)slots,
+        .definition = state_machine_fingerprint(def),
+        .count = count,
+    };
+    memcpy(buffer, &header, sizeof(header));
+
+    // The header keeps the slots 2-byte aligned
+    StateId *out = (StateId *)((char *)buffer + sizeof(header));
+    size_t bytes = slots * sizeof(StateId);
+    for (unsigned i = 0; i < count; ++i)
+    {
+        memcpy(out, instances[i]->state, bytes);
+        out += slots;
+    }
+    return total;
+}
+
+/**
+ * @brief Restores the active configuration of instances from a snapshot.
+ *
+ * The whole snapshot is validated before any instance is written: it must
+ * come from the same definition, hold @p count instances, and every state
+ * must belong to the region it is stored for. History slots are part of the
+ * configuration and restored too. No handlers are called: the timers of
+ * the active states are armed afresh against def->timer_wheel by
+ * state_machine_rearm(), so the instances must not have armed timers in a
+ * wheel, and asynchronous work started before is abandoned, its completions
+ * dropped. Contexts are left as they are, so set inst->context of newly
+ * allocated instances before ticking them.
+ *
+ * @param def Pointer to the shared machine definition.
+ * @param instances Instances to overwrite, allocated with state_machine_instance_size().
+ * @param count Number of instances, as saved.
+ * @param buffer Snapshot written by state_machine_snapshot().
+ * @param size Size of @p buffer.
+ * @return 0 on success, -1 if the snapshot does not fit the definition.
+ */
+
+int state_machine_restore(const StateMachineDef *def, StateMachineInstance *const *instances,
+                          unsigned count, const void *buffer, size_t size)
+{
+    SnapshotHeader header;
+    unsigned slots = instance_slots(def);
+    unsigned num_regions = def->image->num_regions;
+    unsigned num_states = def->image->num_states;
+
+    if (!buffer || size < sizeof(header))
+    {
+        return -1;
+    }
+    memcpy(&header, buffer, sizeof(header));
+    if (header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION ||
+        header.slots != slots || header.count != count ||
+        size < state_machine_snapshot_size(def, count) ||
+        header.definition != state_machine_fingerprint(def))
+    {
+        return -1;
+    }
+
+    const StateId *in = (const StateId *)((const char *)buffer + sizeof(header));
+    const StateId *slot = in;
+    for (unsigned i = 0; i < count; ++i)
+    {
+        // Slots come in groups of one per region: current, previous, history
+        for (unsigned k = 0, region = 0; k < slots; ++k, ++slot)
+        {
+            if (*slot != HSM_NO_STATE &&
+                (*slot >= num_states || def->states[*slot].region != region))
+            {
+                return -1;
+            }
+            if (++region == num_regions)
+            {
+                region = 0;
+            }
+        }
+    }
+
+    size_t bytes = slots * sizeof(StateId);
+    for (unsigned i = 0; i < count; ++i)
+    {
+        memcpy(instances[i]->state, in, bytes);
+        in += slots;
+
+        TimerNode *timers = state_machine_timers(def, instances[i]);
+        for (unsigned k = 0; timers && k < def->image->num_timers; ++k)
+        {
+            timer_node_init(&timers[k]);
+        }
+        AsyncOp *ops = state_machine_async_ops(def, instances[i]);
+        for (unsigned k = 0; ops && k < def->image->num_async; ++k)
+        {
+            atomic_store(&ops[k].pending, 0);
+        }
+        state_machine_rearm(def, instances[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,326 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  // syscall
+#endif
+
+#include "hsm/tickless_scheduler.h"
+#include <time.h>
+#include "hsm/timer_wheel.h"
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Smallest power of two of at least 2 holding count entries
+static unsigned ready_capacity(unsigned count)
+{
+    unsigned capacity = 2;
+    while (capacity < count)
+    {
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+/**
+ * @brief Returns the bytes of storage tickless_scheduler_init() needs.
+ *
+ * @param count Number of instances.
+ */
+
+size_t tickless_scheduler_storage_size(unsigned count)
+{
+    return ready_capacity(count) * sizeof(EventQueueSlot) + count * sizeof(atomic_uchar);
+}
+
+/**
+ * @brief Starts a tickless scheduler over an initialized instance population.
+ *
+ * No instance is ready initially; mark or post to the ones that need a first
+ * tick. When the definition has a timer wheel its ticks are bound to the
+ * monotonic clock from now on, the wheel's current tick being now, and the
+ * timers of every instance are tagged with the instance index so that their
+ * expiry marks the instance.
+ *
+ * @param sched Pointer to the scheduler to initialize.
+ * @param def Definition shared by all instances.
+ * @param instances Array of initialized instances, owned by the caller.
+ * @param queues Optional array of one event queue per instance, NULL if
+ *        the instances only run on timers and dirty inputs.
+ * @param count Number of instances.
+ * @param tick_ns Length of a timer wheel tick in nanoseconds. Ignored
+ *        without a timer wheel.
+ * @param storage Pointer-aligned storage of tickless_scheduler_storage_size()
+ *        bytes. Must outlive the scheduler.
+ * @param size Size of the storage.
+ * @return 0 on success, -1 if the arguments are invalid.
+ */
+
+int tickless_scheduler_init(TicklessScheduler *sched, const StateMachineDef *def,
+                            StateMachineInstance **instances, EventQueue *queues, unsigned count,
+                            uint64_t tick_ns, void *storage, size_t size)
+{
+    unsigned capacity = ready_capacity(count);
+
+    if (!sched || !def || (!instances && count > 0) || !storage ||
+        size < tickless_scheduler_storage_size(count) || (def->timer_wheel && tick_ns == 0))
+    {
+        return -1;
+    }
+
+    sched->def = def;
+    sched->instances = instances;
+    sched->queues = queues;
+    sched->count = count;
+    if (event_queue_init(&sched->ready, storage, capacity) != 0)
+    {
+        return -1;
+    }
+    sched->queued = (atomic_uchar *)((EventQueueSlot *)storage + capacity);
+    for (unsigned i = 0; i < count; ++i)
+    {
+        atomic_init(&sched->queued[i], 0);
+    }
+
+    sched->tick_ns = tick_ns;
+    sched->epoch_ns = now_ns();
+    sched->epoch_tick = def->timer_wheel ? def->timer_wheel->now : 0;
+    if (def->timer_wheel && def->image->num_timers)
+    {
+        for (unsigned i = 0; i < count; ++i)
+        {
+            TimerNode *timers = state_machine_timers(def, instances[i]);
+            for (uint32_t k = 0; k < def->image->num_timers; ++k)
+            {
+                timers[k].tag = i;
+            }
+        }
+    }
+
+    atomic_init(&sched->wake, 0);
+    atomic_init(&sched->sleeping, 0);
+#ifndef __linux__
+    pthread_mutex_init(&sched->lock, NULL);
+    pthread_cond_init(&sched->cond, NULL);
+#endif
+
+    sched->cycles = 0;
+    sched->ticked = 0;
+    sched->expired = 0;
+    sched->sleeps = 0;
+    return 0;
+}
+
+/* Wakes the scheduler thread if it is sleeping in tickless_scheduler_wait(). */
+static void wake_scheduler(TicklessScheduler *sched)
+{
+    if (!atomic_load(&sched->sleeping))
+    {
+        return;
+    }
+#ifdef __linux__
+    atomic_fetch_add(&sched->wake, 1);
+    syscall(SYS_futex, &sched->wake, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+    pthread_mutex_lock(&sched->lock);
+    atomic_fetch_add(&sched->wake, 1);
+    pthread_cond_signal(&sched->cond);
+    pthread_mutex_unlock(&sched->lock);
+#endif
+}
+
+/**
+ * @brief Marks an instance ready for the next cycle. Safe to call from any thread.
+ *
+ * Marking an instance that is already ready does nothing, so writers may
+ * mark after every change to the context.
+ *
+ * @param sched Pointer to the scheduler.
+ * @param index Index of the instance.
+ *
+ * \startuml
+ * start
+ * if (exchange queued[index] -> 1 was 0?) then (yes)
+ *   :post index to the ready queue;
+ *   if (scheduler sleeping?) then (yes)
+ *     :bump wake and wake the scheduler;
+ *   endif
+ * endif
+ * stop
+ * \enduml
+ */
+
+void tickless_scheduler_mark(TicklessScheduler *sched, unsigned index)
+{
+    if (index >= sched->count || atomic_exchange(&sched->queued[index], 1))
+    {
+        return;
+    }
+    // Never full: the queue holds every instance at most once
+    event_queue_post(&sched->ready, (int)index);
+    // Pairs with the fence in tickless_scheduler_wait(): the post must be
+    // visible before sleeping is read, or both sides can miss each other
+    atomic_thread_fence(memory_order_seq_cst);
+    wake_scheduler(sched);
+}
+
+/**
+ * @brief Posts an event to an instance and marks it ready. Safe to call from any thread.
+ *
+ * @param sched Pointer to the scheduler.
+ * @param index Index of the instance.
+ * @param event Event to post.
+ * @return 0 on success, -1 if the scheduler has no event queues or the
+ *         instance's queue is full.
+ */
+
+int tickless_scheduler_post(TicklessScheduler *sched, unsigned index, int event)
+{
+    if (!sched->queues || index >= sched->count ||
+        event_queue_post(&sched->queues[index], event) != 0)
+    {
+        return -1;
+    }
+    tickless_scheduler_mark(sched, index);
+    return 0;
+}
+
+// Timer wheel callback: takes the transition, then gives the instance a tick
+static void expire_timer(void *arg, TimerNode *timer)
+{
+    TicklessScheduler *sched = arg;
+
+    state_machine_expire((void *)sched->def, timer);
+    sched->expired++;
+    tickless_scheduler_mark(sched, timer->tag);
+}
+
+/**
+ * @brief Runs one cycle over the instances that are ready.
+ *
+ * Expires the timers that are due, then dispatches the queued events of
+ * every ready instance and ticks it once. Instances marked while the cycle
+ * runs, including by their own handlers, are ticked in the next cycle.
+ *
+ * @param sched Pointer to the scheduler.
+ * @return Number of instances ticked.
+ */
+
+unsigned tickless_scheduler_run(TicklessScheduler *sched)
+{
+    TimerWheel *wheel = sched->def->timer_wheel;
+    unsigned ticked = 0;
+
+    if (wheel)
+    {
+        uint64_t now = sched->epoch_tick + (now_ns() - sched->epoch_ns) / sched->tick_ns;
+        timer_wheel_advance(wheel, now, expire_timer, sched);
+    }
+
+    // Only what was ready when the cycle started
+    for (unsigned n = event_queue_depth(&sched->ready); n > 0; --n)
+    {
+        int index;
+        if (!event_queue_pop(&sched->ready, &index))
+        {
+            break;
+        }
+        // Cleared before the tick, so that changes made meanwhile mark it again
+        atomic_store(&sched->queued[index], 0);
+
+        StateMachineInstance *inst = sched->instances[index];
+        if (sched->queues)
+        {
+            state_machine_dispatch(sched->def, inst, &sched->queues[index], 0);
+        }
+        state_machine_tick(sched->def, inst);
+        ticked++;
+    }
+
+    sched->ticked += ticked;
+    sched->cycles++;
+    return ticked;
+}
+
+/**
+ * @brief Sleeps until an instance is ready, the next timer is due or @p max_ns passed.
+ *
+ * Returns at once when an instance is already ready. A mark() racing with
+ * the call is never lost: either it is seen before sleeping, or it bumps the
+ * wake word the sleep is conditioned on.
+ *
+ * @param sched Pointer to the scheduler.
+ * @param max_ns Longest time to sleep, in nanoseconds.
+ * @return 1 if the thread slept, 0 if there was work already.
+ */
+
+int tickless_scheduler_wait(TicklessScheduler *sched, uint64_t max_ns)
+{
+    TimerWheel *wheel = sched->def->timer_wheel;
+    uint64_t timeout = max_ns;
+
+    if (wheel)
+    {
+        uint64_t next = timer_wheel_next_expiry(wheel);
+        if (next != UINT64_MAX)
+        {
+            uint64_t due = sched->epoch_ns + (next - sched->epoch_tick) * sched->tick_ns;
+            uint64_t now = now_ns();
+            uint64_t until = due > now ? due - now : 0;
+            if (until < timeout)
+            {
+                timeout = until;
+            }
+        }
+    }
+
+    unsigned seen = atomic_load(&sched->wake);
+    atomic_store(&sched->sleeping, 1);
+    atomic_thread_fence(memory_order_seq_cst);  // See tickless_scheduler_mark()
+    if (timeout == 0 || event_queue_depth(&sched->ready) > 0)
+    {
+        atomic_store(&sched->sleeping, 0);
+        return 0;
+    }
+
+#ifdef __linux__
+    struct timespec ts = {(time_t)(timeout / 1000000000u), (long)(timeout % 1000000000u)};
+    syscall(SYS_futex, &sched->wake, FUTEX_WAIT_PRIVATE, seen, &ts, NULL, 0);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t deadline = (uint64_t)ts.tv_nsec + timeout;
+    ts.tv_sec += (time_t)(deadline / 1000000000u);
+    ts.tv_nsec = (long)(deadline % 1000000000u);
+    pthread_mutex_lock(&sched->lock);
+    while (atomic_load(&sched->wake) == seen)
+    {
+        if (pthread_cond_timedwait(&sched->cond, &sched->lock, &ts) != 0)
+        {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sched->lock);
+#endif
+
+    atomic_store(&sched->sleeping, 0);
+    sched->sleeps++;
+    return 1;
+}
+
+void tickless_scheduler_destroy(TicklessScheduler *sched)
+{
+#ifndef __linux__
+    pthread_mutex_destroy(&sched->lock);
+    pthread_cond_destroy(&sched->cond);
+#else
+    (void)sched;
+#endif
+}
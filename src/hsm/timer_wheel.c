@@ -0,0 +1,205 @@
+#include "hsm/timer_wheel.h"
+#include <stddef.h>
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1u)
+#define LEVEL_SHIFT(level) ((unsigned)(level) * TIMER_WHEEL_BITS)
+
+void timer_wheel_init(TimerWheel *wheel, uint64_t now)
+{
+    wheel->now = now;
+    wheel->armed = 0;
+    for (unsigned level = 0; level < TIMER_WHEEL_LEVELS; ++level)
+    {
+        for (unsigned slot = 0; slot < TIMER_WHEEL_SLOTS; ++slot)
+        {
+            wheel->slots[level][slot] = NULL;
+        }
+    }
+}
+
+void timer_node_init(TimerNode *timer)
+{
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->expires = 0;
+}
+
+/* Links a timer into the slot its expiry falls in, relative to wheel->now. */
+static void insert_timer(TimerWheel *wheel, TimerNode *timer)
+{
+    uint64_t delta = timer->expires - wheel->now;
+    unsigned level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (uint64_t)TIMER_WHEEL_SLOTS << LEVEL_SHIFT(level))
+    {
+        level++;
+    }
+
+    uint64_t at = timer->expires;
+    if (delta >> LEVEL_SHIFT(level) >= TIMER_WHEEL_SLOTS)
+    {
+        // Beyond the range of the wheel: park in the farthest slot, cascading re-evaluates it
+        at = wheel->now + ((uint64_t)SLOT_MASK << LEVEL_SHIFT(level));
+    }
+
+    TimerNode **head = &wheel->slots[level][(at >> LEVEL_SHIFT(level)) & SLOT_MASK];
+    timer->next = *head;
+    timer->pprev = head;
+    if (*head)
+    {
+        (*head)->pprev = &timer->next;
+    }
+    *head = timer;
+}
+
+static void unlink_timer(TimerNode *timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next)
+    {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+/**
+ * @brief Arms a timer, or re-arms it if it is already armed.
+ *
+ * @param wheel Pointer to the wheel.
+ * @param timer Pointer to a node set up with timer_node_init().
+ * @param expires Tick to fire at. Ticks not after wheel->now fire on the next advance.
+ */
+
+void timer_wheel_arm(TimerWheel *wheel, TimerNode *timer, uint64_t expires)
+{
+    if (timer->pprev)
+    {
+        unlink_timer(timer);
+        wheel->armed--;
+    }
+    timer->expires = expires > wheel->now ? expires : wheel->now + 1;
+    insert_timer(wheel, timer);
+    wheel->armed++;
+}
+
+void timer_wheel_cancel(TimerWheel *wheel, TimerNode *timer)
+{
+    if (timer->pprev)
+    {
+        unlink_timer(timer);
+        wheel->armed--;
+    }
+}
+
+/* Moves the timers of one upper-level slot down to where they now belong. */
+static void cascade(TimerWheel *wheel, unsigned level)
+{
+    TimerNode **head = &wheel->slots[level][(wheel->now >> LEVEL_SHIFT(level)) & SLOT_MASK];
+    TimerNode *timer = *head;
+    *head = NULL;
+    while (timer)
+    {
+        TimerNode *next = timer->next;
+        insert_timer(wheel, timer);
+        timer = next;
+    }
+}
+
+/**
+ * @brief Advances the wheel to a new time and fires the timers due by then.
+ *
+ * Every tick up to @p now is processed in order, so timers fire in expiry
+ * order, one tick at a time. The expire callback may arm and cancel timers,
+ * including the one it was called for, which is no longer armed at that point.
+ * When no timer is armed the wheel jumps to @p now directly.
+ *
+ * @param wheel Pointer to the wheel.
+ * @param now New current tick.
+ * @param expire Called for every expired timer.
+ * @param arg Passed to @p expire.
+ * @return Number of timers fired.
+ *
+ * \startuml
+ * start
+ * while (wheel->now < now?)
+ *   if (no timer armed?) then (yes)
+ *     :wheel->now = now;
+ *     break
+ *   endif
+ *   :wheel->now++;
+ *   while (lower bits of the level wrapped to 0?)
+ *     :cascade the current slot of the next level;
+ *   endwhile
+ *   :detach the current level 0 slot;
+ *   :call expire for each of its timers;
+ * endwhile
+ * :return fired;
+ * stop
+ * \enduml
+ */
+
+unsigned timer_wheel_advance(TimerWheel *wheel, uint64_t now, TimerExpireFunc expire, void *arg)
+{
+    unsigned fired = 0;
+
+    while (wheel->now < now)
+    {
+        if (wheel->armed == 0)
+        {
+            wheel->now = now;
+            break;
+        }
+
+        wheel->now++;
+        for (unsigned level = 1; level < TIMER_WHEEL_LEVELS &&
+                                 (wheel->now & (((uint64_t)1 << LEVEL_SHIFT(level)) - 1)) == 0; ++level)
+        {
+            cascade(wheel, level);
+        }
+
+        TimerNode **head = &wheel->slots[0][wheel->now & SLOT_MASK];
+        while (*head)
+        {
+            TimerNode *timer = *head;
+            unlink_timer(timer);
+            wheel->armed--;
+            fired++;
+            expire(arg, timer);
+        }
+    }
+    return fired;
+}
+
+/**
+ * @brief Returns a lower bound of the tick the next timer fires at.
+ *
+ * Exact for timers within the span of level 0, otherwise the tick their
+ * slot is cascaded at. UINT64_MAX when no timer is armed. Meant for sleeping
+ * until the next tick that can have work.
+ */
+
+uint64_t timer_wheel_next_expiry(const TimerWheel *wheel)
+{
+    if (wheel->armed == 0)
+    {
+        return UINT64_MAX;
+    }
+
+    // An upper slot may be cascaded before the first level 0 timer fires
+    uint64_t next = UINT64_MAX;
+    for (unsigned level = 0; level < TIMER_WHEEL_LEVELS; ++level)
+    {
+        unsigned shift = LEVEL_SHIFT(level);
+        uint64_t base = wheel->now >> shift;
+        for (unsigned i = 1; i <= TIMER_WHEEL_SLOTS; ++i)
+        {
+            if (wheel->slots[level][(base + i) & SLOT_MASK])
+            {
+                uint64_t at = level == 0 ? wheel->now + i : (base + i) << shift;
+                next = at < next ? at : next;
+                break;
+            }
+        }
+    }
+    return next;
+}
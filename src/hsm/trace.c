@@ -0,0 +1,181 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "hsm/trace.h"
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+static _Thread_local TraceRing *thread_ring;
+static atomic_uint next_thread = 1;
+
+static uint64_t clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t trace_now(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return clock_ns();
+#endif
+}
+
+/* Measures the time stamp counter against the monotonic clock. */
+static double ticks_per_ns(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint64_t ns_start = clock_ns();
+    uint64_t ticks_start = trace_now();
+    while (clock_ns() - ns_start < 10000000u)
+    {
+    }
+    return (double)(trace_now() - ticks_start) / (double)(clock_ns() - ns_start);
+#else
+    return 1.0;
+#endif
+}
+
+/**
+ * @brief Attaches a ring to the calling thread.
+ *
+ * Transitions taken on this thread are recorded into the ring from now on,
+ * replacing any ring attached before.
+ *
+ * @param ring Pointer to the ring to initialize.
+ * @param storage Storage for @p capacity records.
+ * @param capacity Number of records, a power of 2.
+ * @return 0 on success, -1 if the capacity is not a power of 2.
+ */
+
+int trace_attach(TraceRing *ring, TraceRecord *storage, uint32_t capacity)
+{
+    if (!ring || !storage || capacity == 0 || (capacity & (capacity - 1)) != 0)
+    {
+        return -1;
+    }
+
+    ring->records = storage;
+    ring->mask = capacity - 1;
+    ring->thread = atomic_fetch_add(&next_thread, 1);
+    atomic_init(&ring->head, 0);
+    thread_ring = ring;
+    return 0;
+}
+
+void trace_detach(void)
+{
+    thread_ring = NULL;
+}
+
+/* Number of records currently held, at most the capacity. */
+uint32_t trace_count(const TraceRing *ring)
+{
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    return head > ring->mask ? ring->mask + 1 : (uint32_t)head;
+}
+
+/* Record number index, oldest first. */
+const TraceRecord *trace_record(const TraceRing *ring, uint32_t index)
+{
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint64_t first = head - trace_count(ring);
+    return &ring->records[(first + index) & ring->mask];
+}
+
+void trace_transition(const StateMachineInstance *inst, unsigned region, StateId source, StateId target,
+                      int event, uint64_t start, uint64_t exited, uint64_t entered, unsigned type)
+{
+    TraceRing *ring = thread_ring;
+    if (!ring)
+    {
+        return;
+    }
+
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    TraceRecord *r = &ring->records[head & ring->mask];
+    r->timestamp = start;
+    r->instance = (uint32_t)(uintptr_t)inst;
+    r->source = source;
+    r->target = target;
+    r->event = event;
+    r->exit_ticks = (uint32_t)(exited - start);
+    r->entry_ticks = (uint32_t)(entered - exited);
+    r->region = (uint16_t)region;
+    r->type = (uint16_t)type;
+
+    // Publish the record to readers on other threads
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/**
+ * @brief Writes the records of a ring to a binary dump.
+ *
+ * The dump is a TraceDumpHeader followed by the records, oldest first.
+ * Dumps of several rings may be concatenated into one file. The ring should
+ * not be written to while it is dumped.
+ *
+ * @return 0 on success, -1 on a write error.
+ */
+
+int trace_dump(const TraceRing *ring, FILE *out)
+{
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    TraceDumpHeader header = {
+        .magic = TRACE_MAGIC,
+        .version = TRACE_VERSION,
+        .record_size = sizeof(TraceRecord),
+        .ticks_per_ns = ticks_per_ns(),
+        .thread = ring->thread,
+        .count = trace_count(ring),
+    };
+    header.dropped = head - header.count;
+
+    if (fwrite(&header, sizeof(header), 1, out) != 1)
+    {
+        return -1;
+    }
+    for (uint32_t i = 0; i < header.count; ++i)
+    {
+        if (fwrite(trace_record(ring, i), sizeof(TraceRecord), 1, out) != 1)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void write_region_names(StateMachine *sm, FILE *out)
+{
+    for (int i = 0; i < sm->num_states; ++i)
+    {
+        State *s = sm->states[i];
+        if (s->name)
+        {
+            fprintf(out, "%u %s\n", (unsigned)s->id, s->name);
+        }
+    }
+    for (int i = 0; i < sm->num_states; ++i)
+    {
+        for (int k = 0; k < sm->states[i]->num_submachines; ++k)
+        {
+            write_region_names(&sm->states[i]->submachine[k], out);
+        }
+    }
+}
+
+/**
+ * @brief Writes the names of a compiled description for the trace decoder.
+ *
+ * One "<state id> <name>" line per named state. Must be called after
+ * state_machine_compile() has assigned the ids.
+ */
+
+void trace_write_names(StateMachine *sm, FILE *out)
+{
+    write_region_names(sm, out);
+}
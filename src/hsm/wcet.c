@@ -0,0 +1,443 @@
+#include "hsm/wcet.h"
+#include <stdint.h>
+#include <string.h>
+
+// Per state and per region bounds, carved out of the caller's workspace
+typedef struct WcetTables {
+    WcetCounts *state_exit;      // Exiting the state and everything active below it
+    WcetCounts *state_enter[2];  // Entering the state and its regions, [1] when restoring deeply
+    WcetCounts *region_exit;     // Exiting a region from whichever state it is in
+    WcetCounts *region_enter[2]; // Entering a region, [1] when restoring deeply
+    WcetCounts *region_tick;     // Ticking a region from whichever state it is in
+    unsigned *region_offsets;    // num_regions + 1 entries into region_states
+    StateId *region_states;      // State ids grouped by region
+    unsigned *region_level;      // Nesting level of each region, the root being 1
+} WcetTables;
+
+static size_t wcet_table(size_t count, size_t size)
+{
+    return (count * size + _Alignof(WcetCounts) - 1) & ~(size_t)(_Alignof(WcetCounts) - 1);
+}
+
+/**
+ * @brief Returns the workspace state_machine_wcet() needs for a definition.
+ */
+
+size_t state_machine_wcet_workspace_size(const StateMachineDef *def)
+{
+    size_t states = def->image->num_states;
+    size_t regions = def->image->num_regions;
+    return wcet_table(3 * states + 4 * regions, sizeof(WcetCounts)) +
+           wcet_table(regions + 1, sizeof(unsigned)) + wcet_table(states, sizeof(StateId)) +
+           wcet_table(regions, sizeof(unsigned));
+}
+
+static void wcet_add(WcetCounts *a, const WcetCounts *b)
+{
+    a->entries += b->entries;
+    a->exits += b->exits;
+    a->guards += b->guards;
+    a->runs += b->runs;
+    a->actions += b->actions;
+    a->calls += b->calls;
+}
+
+/* Keeps the larger of each count. calls is maximised on its own, so it stays
+   the largest total of any single way through rather than a sum of maxima. */
+static void wcet_max(WcetCounts *a, const WcetCounts *b)
+{
+    a->entries = b->entries > a->entries ? b->entries : a->entries;
+    a->exits = b->exits > a->exits ? b->exits : a->exits;
+    a->guards = b->guards > a->guards ? b->guards : a->guards;
+    a->runs = b->runs > a->runs ? b->runs : a->runs;
+    a->actions = b->actions > a->actions ? b->actions : a->actions;
+    a->calls = b->calls > a->calls ? b->calls : a->calls;
+}
+
+static inline void wcet_call(WcetCounts *c, uint32_t *counter)
+{
+    (*counter)++;
+    c->calls++;
+}
+
+// Exits along the root-to-state path of s, from s up to the region root
+static WcetCounts exit_path(const StateMachineDef *def, const WcetTables *w, const StateDef *s)
+{
+    WcetCounts c = {0};
+    for (unsigned i = 0; i < s->depth; ++i)
+    {
+        wcet_add(&c, &w->state_exit[def->paths[s->path + i]]);
+    }
+    return c;
+}
+
+// Entries along the root-to-state path of s
+static WcetCounts enter_path(const StateMachineDef *def, const WcetTables *w, const StateDef *s, int deep)
+{
+    WcetCounts c = {0};
+    for (unsigned i = 0; i < s->depth; ++i)
+    {
+        wcet_add(&c, &w->state_enter[deep][def->paths[s->path + i]]);
+    }
+    return c;
+}
+
+// Calls made entering the state itself, its regions aside
+static WcetCounts own_entry(const StateMachineDef *def, const StateDef *s)
+{
+    WcetCounts c = {0};
+    if (s->on_entry)
+    {
+        wcet_call(&c, &c.entries);
+    }
+    if ((s->flags & HSM_STATE_ASYNC) && def->async[s->async].start)
+    {
+        wcet_call(&c, &c.actions);
+    }
+    return c;
+}
+
+// Exits, actions and entries of taking one transition
+static WcetCounts transition_cost(const StateMachineDef *def, const WcetTables *w, const TransitionDef *t)
+{
+    WcetCounts c = {0};
+    for (unsigned i = 0; i < t->exit_len; ++i)
+    {
+        wcet_add(&c, &w->state_exit[def->paths[t->exit_path + i]]);
+    }
+    if (t->action)
+    {
+        wcet_call(&c, &c.actions);
+    }
+    if (t->async != HSM_NO_ASYNC)
+    {
+        wcet_call(&c, &c.actions);
+    }
+    for (unsigned i = 0; i < t->entry_len; ++i)
+    {
+        StateId id = def->paths[t->entry_path + i];
+        if (i + 1 < t->entry_len || t->num_parallel_targets == 0)
+        {
+            wcet_add(&c, &w->state_enter[0][id]);
+            continue;
+        }
+
+        // The target, some of whose regions start where the transition says
+        const StateDef *target = &def->states[id];
+        WcetCounts own = own_entry(def, target);
+        wcet_add(&c, &own);
+        for (unsigned sub = 0; sub < target->num_regions; ++sub)
+        {
+            StateId override = sub < t->num_parallel_targets ? def->paths[t->parallel_targets + sub]
+                                                              : HSM_NO_STATE;
+            if (override != HSM_NO_STATE)
+            {
+                WcetCounts entry = enter_path(def, w, &def->states[override], 0);
+                wcet_add(&c, &entry);
+            }
+            else
+            {
+                wcet_add(&c, &w->region_enter[0][target->first_region + sub]);
+            }
+        }
+    }
+    return c;
+}
+
+/* Worst tick of a region currently in s: guards are polled in order until
+   one passes and its transition is taken, or all fail and s runs and its
+   regions are ticked. */
+static WcetCounts tick_state(const StateMachineDef *def, const WcetTables *w, const StateDef *s)
+{
+    WcetCounts guards = {0};
+    WcetCounts worst = {0};
+    for (unsigned k = 0; k < s->num_polled; ++k)
+    {
+        const TransitionDef *t = &def->transitions[def->refs[s->polled + k]];
+        if (t->guard)
+        {
+            wcet_call(&guards, &guards.guards);
+        }
+        WcetCounts taken = transition_cost(def, w, t);
+        wcet_add(&taken, &guards);
+        wcet_max(&worst, &taken);
+    }
+
+    WcetCounts run = guards;
+    if (s->on_run)
+    {
+        wcet_call(&run, &run.runs);
+    }
+    if ((s->flags & HSM_STATE_ASYNC) && def->async[s->async].run)
+    {
+        wcet_call(&run, &run.actions);
+    }
+    for (unsigned sub = 0; sub < s->num_regions; ++sub)
+    {
+        wcet_add(&run, &w->region_tick[s->first_region + sub]);
+    }
+    wcet_max(&worst, &run);
+    return worst;
+}
+
+/* Bounds the states of one region and then the region itself. Every
+   region nested below has been done already. */
+static void bound_region(const StateMachineDef *def, WcetTables *w, unsigned region)
+{
+    const RegionDef *r = &def->regions[region];
+    const StateId *members = &w->region_states[w->region_offsets[region]];
+    unsigned count = w->region_offsets[region + 1] - w->region_offsets[region];
+
+    // The states on their own, with whatever their regions may hold
+    for (unsigned i = 0; i < count; ++i)
+    {
+        const StateDef *s = &def->states[members[i]];
+        WcetCounts exit = {0};
+        WcetCounts enter = own_entry(def, s);
+        WcetCounts enter_deep = enter;
+        if (s->on_exit)
+        {
+            wcet_call(&exit, &exit.exits);
+        }
+        for (unsigned sub = 0; sub < s->num_regions; ++sub)
+        {
+            wcet_add(&exit, &w->region_exit[s->first_region + sub]);
+            wcet_add(&enter, &w->region_enter[0][s->first_region + sub]);
+            wcet_add(&enter_deep, &w->region_enter[1][s->first_region + sub]);
+        }
+        w->state_exit[members[i]] = exit;
+        w->state_enter[0][members[i]] = enter;
+        w->state_enter[1][members[i]] = enter_deep;
+    }
+
+    // The region, from or into whichever state history or the hierarchy allows
+    WcetCounts initial = {0};
+    if (r->initial != HSM_NO_STATE)
+    {
+        initial = enter_path(def, w, &def->states[r->initial], 0);
+    }
+    WcetCounts exit = {0};
+    WcetCounts enter = initial;
+    WcetCounts enter_deep = initial;
+    WcetCounts tick = {0};
+    for (unsigned i = 0; i < count; ++i)
+    {
+        const StateDef *s = &def->states[members[i]];
+        WcetCounts path = exit_path(def, w, s);
+        wcet_max(&exit, &path);
+
+        path = enter_path(def, w, s, 1);
+        wcet_max(&enter_deep, &path);
+        if (r->history == HSM_HISTORY_DEEP)
+        {
+            wcet_max(&enter, &path);
+        }
+        else if (r->history == HSM_HISTORY_SHALLOW && s->depth == 1)
+        {
+            path = enter_path(def, w, s, 0);
+            wcet_max(&enter, &path);
+        }
+
+        path = tick_state(def, w, s);
+        wcet_max(&tick, &path);
+    }
+    w->region_exit[region] = exit;
+    w->region_enter[0][region] = enter;
+    w->region_enter[1][region] = enter_deep;
+    w->region_tick[region] = tick;
+}
+
+// Number of elements between two image arrays laid out one after the other
+static uint32_t array_length(uint32_t begin, uint32_t end, size_t element)
+{
+    return end >= begin ? (uint32_t)((end - begin) / element) : 0;
+}
+
+// Tells whether count path entries from first lie in the image and name states
+static int valid_path(const StateMachineDef *def, uint32_t first, uint32_t count, uint32_t num_paths,
+                      int allow_none)
+{
+    if (first > num_paths || num_paths - first < count)
+    {
+        return 0;
+    }
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        StateId id = def->paths[first + i];
+        if (id >= def->image->num_states && !(allow_none && id == HSM_NO_STATE))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Checks every index the analysis follows, so that images bound without
+   verification cannot send it outside their arrays. The lengths of refs
+   and paths follow from the image layout. */
+static int valid_records(const StateMachineDef *def)
+{
+    const StateMachineImage *image = def->image;
+    uint32_t num_refs = array_length(image->refs, image->paths, sizeof(uint32_t));
+    uint32_t num_paths = array_length(image->paths, image->input_masks, sizeof(StateId));
+
+    for (unsigned i = 0; i < image->num_states; ++i)
+    {
+        const StateDef *s = &def->states[i];
+        if (s->region >= image->num_regions || !valid_path(def, s->path, s->depth, num_paths, 0) ||
+            (s->num_regions && (s->first_region <= s->region ||
+                                s->first_region + (uint32_t)s->num_regions > image->num_regions)) ||
+            s->polled > num_refs || num_refs - s->polled < s->num_polled ||
+            ((s->flags & HSM_STATE_ASYNC) && s->async >= image->num_async))
+        {
+            return 0;
+        }
+        for (unsigned k = 0; k < s->num_polled; ++k)
+        {
+            if (def->refs[s->polled + k] >= image->num_transitions)
+            {
+                return 0;
+            }
+        }
+    }
+    for (unsigned r = 0; r < image->num_regions; ++r)
+    {
+        const RegionDef *region = &def->regions[r];
+        if ((region->owner != HSM_NO_STATE && region->owner >= image->num_states) ||
+            (region->initial != HSM_NO_STATE && region->initial >= image->num_states))
+        {
+            return 0;
+        }
+    }
+    for (unsigned i = 0; i < image->num_transitions; ++i)
+    {
+        const TransitionDef *t = &def->transitions[i];
+        if (!valid_path(def, t->exit_path, t->exit_len, num_paths, 0) ||
+            !valid_path(def, t->entry_path, t->entry_len, num_paths, 0) ||
+            !valid_path(def, t->parallel_targets, t->num_parallel_targets, num_paths, 1) ||
+            (t->async != HSM_NO_ASYNC && t->async >= image->num_async))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Bounds the handler calls of a single tick of any instance.
+ *
+ * The bound covers every configuration an instance can be in: the state
+ * of each region, which guards pass, and what history restores. It is
+ * computed bottom-up, each region from the regions nested in its states,
+ * which the compiler numbers after their owner. Pure guards are counted as
+ * if never cached, and a state's bitmask guards as if every mask matched.
+ *
+ * @param def Pointer to the machine definition.
+ * @param report Receives the bounds.
+ * @param workspace Storage of state_machine_wcet_workspace_size() bytes,
+ *        aligned for pointers.
+ * @return 0 on success, -1 if a record refers outside the image, or the
+ *         regions nest deeper than HSM_MAX_REGION_NESTING or are not
+ *         numbered after their owners.
+ *
+ * \startuml
+ * start
+ * if (records refer outside the image?) then (yes)
+ *   :return -1;
+ *   stop
+ * endif
+ * :group the states by region;
+ * :check the region numbering, measure nesting and depth;
+ * if (nested too deep or misnumbered?) then (yes)
+ *   :return -1;
+ *   stop
+ * endif
+ * while (regions left, last numbered first?)
+ *   :bound exit and entry of each state;
+ *   :bound exit, entry and tick of the region;
+ * endwhile
+ * :report the tick of the root region;
+ * :return 0;
+ * stop
+ * \enduml
+ */
+
+int state_machine_wcet(const StateMachineDef *def, WcetReport *report, void *workspace)
+{
+    unsigned num_states = def->image->num_states;
+    unsigned num_regions = def->image->num_regions;
+    unsigned char *p = workspace;
+    WcetTables w;
+
+    w.state_exit = (WcetCounts *)p;
+    w.state_enter[0] = w.state_exit + num_states;
+    w.state_enter[1] = w.state_enter[0] + num_states;
+    w.region_exit = w.state_enter[1] + num_states;
+    w.region_enter[0] = w.region_exit + num_regions;
+    w.region_enter[1] = w.region_enter[0] + num_regions;
+    w.region_tick = w.region_enter[1] + num_regions;
+    p += wcet_table(3 * (size_t)num_states + 4 * (size_t)num_regions, sizeof(WcetCounts));
+    w.region_offsets = (unsigned *)p;
+    p += wcet_table(num_regions + 1u, sizeof(unsigned));
+    w.region_states = (StateId *)p;
+    p += wcet_table(num_states, sizeof(StateId));
+    w.region_level = (unsigned *)p;
+
+    memset(report, 0, sizeof(*report));
+    if (!valid_records(def))
+    {
+        return -1;
+    }
+    memset(w.region_offsets, 0, (num_regions + 1u) * sizeof(unsigned));
+    for (unsigned i = 0; i < num_states; ++i)
+    {
+        w.region_offsets[def->states[i].region + 1]++;
+    }
+    for (unsigned r = 0; r < num_regions; ++r)
+    {
+        w.region_offsets[r + 1] += w.region_offsets[r];
+    }
+    for (unsigned i = 0; i < num_states; ++i)
+    {
+        const StateDef *s = &def->states[i];
+        w.region_states[w.region_offsets[s->region]++] = (StateId)i;
+        report->max_depth = s->depth > report->max_depth ? s->depth : report->max_depth;
+    }
+    for (unsigned r = num_regions; r > 0; --r)
+    {
+        w.region_offsets[r] = w.region_offsets[r - 1];
+    }
+    w.region_offsets[0] = 0;
+
+    // Regions are numbered after the region of their owner, so one pass
+    // forward gives every nesting level
+    for (unsigned r = 0; r < num_regions; ++r)
+    {
+        StateId owner = def->regions[r].owner;
+        if (owner == HSM_NO_STATE)
+        {
+            w.region_level[r] = 1;
+        }
+        else if (def->states[owner].region < r)
+        {
+            w.region_level[r] = w.region_level[def->states[owner].region] + 1;
+        }
+        else
+        {
+            return -1;
+        }
+        if (w.region_level[r] > HSM_MAX_REGION_NESTING)
+        {
+            return -1;
+        }
+        report->region_nesting = w.region_level[r] > report->region_nesting ? w.region_level[r]
+                                                                            : report->region_nesting;
+    }
+
+    for (unsigned r = num_regions; r > 0; --r)
+    {
+        bound_region(def, &w, r - 1);
+    }
+    report->tick = w.region_tick[0];
+    return 0;
+}
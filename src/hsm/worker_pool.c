@@ -0,0 +1,286 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  // pthread_setaffinity_np
+#endif
+
+#include "hsm/worker_pool.h"
+#include <stdlib.h>
+#include <time.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+typedef struct WorkerArgs {
+    WorkerPool *pool;
+    unsigned worker;
+} WorkerArgs;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void pin_thread(pthread_t thread, int cpu)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(thread, sizeof(set), &set);
+#else
+    (void)thread;
+    (void)cpu;
+#endif
+}
+
+/**
+ * @brief Runs one worker's share of the current job, then steals.
+ *
+ * The worker drains its own range first. Once it is empty it visits the
+ * other workers in a fixed rotation and claims whatever tasks are left in
+ * their ranges, so uneven task costs even out without any locking.
+ *
+ * @param pool Pointer to the pool.
+ * @param worker Index of the calling worker.
+ */
+
+static void run_worker(WorkerPool *pool, unsigned worker)
+{
+    WorkerStats *stats = &pool->stats[worker];
+    uint64_t start = now_ns();
+    unsigned tasks = 0;
+    unsigned steals = 0;
+
+    for (unsigned k = 0; k < pool->num_workers; ++k)
+    {
+        unsigned victim = (worker + k) % pool->num_workers;
+        WorkerRange *range = &pool->ranges[victim];
+
+        for (;;)
+        {
+            unsigned task = atomic_fetch_add_explicit(&range->next, 1, memory_order_relaxed);
+            if (task >= range->end)
+            {
+                break;
+            }
+            pool->task(pool->arg, task, worker);
+            tasks++;
+            if (k > 0)
+            {
+                steals++;
+            }
+        }
+    }
+
+    stats->busy_ns = now_ns() - start;
+    if (stats->busy_ns > stats->max_busy_ns)
+    {
+        stats->max_busy_ns = stats->busy_ns;
+    }
+    stats->tasks = tasks;
+    stats->steals = steals;
+}
+
+static void *worker_main(void *arg)
+{
+    WorkerArgs *args = arg;
+    WorkerPool *pool = args->pool;
+    unsigned worker = args->worker;
+    unsigned seen = 0;
+
+    free(args);
+
+    for (;;)
+    {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->generation == seen && !pool->stop)
+        {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->stop)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        run_worker(pool, worker);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->active == 0)
+        {
+            pthread_cond_signal(&pool->done);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+/**
+ * @brief Starts a pool of worker threads.
+ *
+ * The calling thread acts as worker 0, so num_workers - 1 threads are
+ * created. When @p cpus is given, worker i is pinned to CPU cpus[i], the
+ * calling thread included.
+ *
+ * @param pool Pointer to the pool to initialize.
+ * @param num_workers Number of workers, at least 1.
+ * @param cpus Optional array of num_workers CPU ids to pin the workers to.
+ * @return 0 on success, -1 on failure.
+ */
+
+int worker_pool_init(WorkerPool *pool, unsigned num_workers, const int *cpus)
+{
+    if (!pool || num_workers == 0)
+    {
+        return -1;
+    }
+
+    pool->num_workers = num_workers;
+    pool->threads = calloc(num_workers, sizeof(pthread_t));
+    pool->ranges = calloc(num_workers, sizeof(WorkerRange));
+    pool->stats = calloc(num_workers, sizeof(WorkerStats));
+    pool->task = NULL;
+    pool->arg = NULL;
+    pool->generation = 0;
+    pool->active = 0;
+    pool->stop = 0;
+    atomic_flag_clear(&pool->busy);
+
+    if (!pool->threads || !pool->ranges || !pool->stats)
+    {
+        free(pool->threads);
+        free(pool->ranges);
+        free(pool->stats);
+        return -1;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    pool->threads[0] = pthread_self();
+    if (cpus)
+    {
+        pin_thread(pool->threads[0], cpus[0]);
+    }
+
+    for (unsigned i = 1; i < num_workers; ++i)
+    {
+        WorkerArgs *args = malloc(sizeof(WorkerArgs));
+        if (!args)
+        {
+            pool->num_workers = i;
+            worker_pool_destroy(pool);
+            return -1;
+        }
+        args->pool = pool;
+        args->worker = i;
+        if (pthread_create(&pool->threads[i], NULL, worker_main, args) != 0)
+        {
+            free(args);
+            pool->num_workers = i;
+            worker_pool_destroy(pool);
+            return -1;
+        }
+        if (cpus)
+        {
+            pin_thread(pool->threads[i], cpus[i]);
+        }
+    }
+    return 0;
+}
+
+static void run_job(WorkerPool *pool, WorkerTask task, void *arg, unsigned num_tasks)
+{
+    unsigned per_worker = num_tasks / pool->num_workers;
+    unsigned remainder = num_tasks % pool->num_workers;
+    unsigned begin = 0;
+
+    pool->task = task;
+    pool->arg = arg;
+    for (unsigned i = 0; i < pool->num_workers; ++i)
+    {
+        unsigned size = per_worker + (i < remainder ? 1 : 0);
+        atomic_store_explicit(&pool->ranges[i].next, begin, memory_order_relaxed);
+        pool->ranges[i].end = begin + size;
+        begin += size;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->active = pool->num_workers - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_worker(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->active > 0)
+    {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * @brief Runs tasks [0, num_tasks) across the pool and waits for all of them.
+ *
+ * The tasks are split into one contiguous range per worker. Every task runs
+ * exactly once, on exactly one worker; which worker depends on stealing. The
+ * call returns once all workers have finished, acting as a barrier between
+ * consecutive jobs. Only one thread may run jobs on a pool at a time.
+ *
+ * @param pool Pointer to the pool.
+ * @param task Function run for every task index.
+ * @param arg Argument passed to @p task.
+ * @param num_tasks Number of tasks.
+ */
+
+void worker_pool_run(WorkerPool *pool, WorkerTask task, void *arg, unsigned num_tasks)
+{
+    atomic_flag_test_and_set_explicit(&pool->busy, memory_order_acquire);
+    run_job(pool, task, arg, num_tasks);
+    atomic_flag_clear_explicit(&pool->busy, memory_order_release);
+}
+
+/**
+ * @brief Runs a job like worker_pool_run() unless the pool is already busy.
+ *
+ * Lets code that may itself run inside a job, or on several threads at
+ * once, fall back to doing the work inline instead of deadlocking.
+ *
+ * @return 0 if the job ran, -1 if the pool was busy and nothing ran.
+ */
+
+int worker_pool_try_run(WorkerPool *pool, WorkerTask task, void *arg, unsigned num_tasks)
+{
+    if (atomic_flag_test_and_set_explicit(&pool->busy, memory_order_acquire))
+    {
+        return -1;
+    }
+    run_job(pool, task, arg, num_tasks);
+    atomic_flag_clear_explicit(&pool->busy, memory_order_release);
+    return 0;
+}
+
+void worker_pool_destroy(WorkerPool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (unsigned i = 1; i < pool->num_workers; ++i)
+    {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool->threads);
+    free(pool->ranges);
+    free(pool->stats);
+}
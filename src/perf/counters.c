@@ -0,0 +1,174 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "perf/counters.h"
+#include <time.h>
+
+_Thread_local PerfBinding perf_thread_bindings[PERF_MAX_DEFINITIONS];
+
+uint64_t perf_clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+size_t perf_counters_size(unsigned num_states, unsigned num_transitions)
+{
+    return num_states * sizeof(PerfStateCounters) + num_transitions * sizeof(PerfTransitionCounters);
+}
+
+/**
+ * @brief Sets up a zeroed counter set in caller-provided storage.
+ *
+ * For an HSM pass def->image->num_states and def->image->num_transitions,
+ * for an FSM its num_states and num_transitions.
+ *
+ * @param counters Pointer to the set to initialize.
+ * @param num_states Number of states to count.
+ * @param num_transitions Number of transitions to count.
+ * @param storage Storage aligned for uint64_t.
+ * @param size Size of @p storage, at least perf_counters_size().
+ * @return 0 on success, -1 if the storage is missing or too small.
+ */
+
+int perf_counters_init(PerfCounters *counters, unsigned num_states, unsigned num_transitions,
+                       void *storage, size_t size)
+{
+    if (!counters || !storage || size < perf_counters_size(num_states, num_transitions))
+    {
+        return -1;
+    }
+
+    counters->num_states = num_states;
+    counters->num_transitions = num_transitions;
+    counters->states = storage;
+    counters->transitions = (PerfTransitionCounters *)(counters->states + num_states);
+    perf_counters_reset(counters);
+    return 0;
+}
+
+void perf_counters_reset(PerfCounters *counters)
+{
+    for (unsigned i = 0; i < counters->num_states; ++i)
+    {
+        PerfStateCounters *s = &counters->states[i];
+        atomic_store_explicit(&s->entries, 0, memory_order_relaxed);
+        atomic_store_explicit(&s->exits, 0, memory_order_relaxed);
+        atomic_store_explicit(&s->ticks, 0, memory_order_relaxed);
+        atomic_store_explicit(&s->run_time, 0, memory_order_relaxed);
+        for (unsigned b = 0; b < PERF_HISTOGRAM_BUCKETS; ++b)
+        {
+            atomic_store_explicit(&s->run_histogram[b], 0, memory_order_relaxed);
+        }
+    }
+    for (unsigned i = 0; i < counters->num_transitions; ++i)
+    {
+        PerfTransitionCounters *t = &counters->transitions[i];
+        atomic_store_explicit(&t->guard_evaluations, 0, memory_order_relaxed);
+        atomic_store_explicit(&t->guard_hits, 0, memory_order_relaxed);
+        atomic_store_explicit(&t->taken, 0, memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Makes the calling thread count one definition's activity into a set.
+ *
+ * Attaching again for the same definition replaces its set, NULL stops
+ * counting it. Other definitions keep their sets.
+ *
+ * @param definition The definition pointer passed to the engine.
+ * @param counters The set to count into, shaped like the definition.
+ * @return 0 on success, -1 if the definition is NULL or the thread already
+ *         has PERF_MAX_DEFINITIONS sets attached.
+ */
+
+int perf_counters_attach(const void *definition, PerfCounters *counters)
+{
+    PerfBinding *free_binding = NULL;
+
+    if (!definition)
+    {
+        return -1;
+    }
+    for (unsigned i = 0; i < PERF_MAX_DEFINITIONS; ++i)
+    {
+        PerfBinding *b = &perf_thread_bindings[i];
+        if (b->definition == definition)
+        {
+            b->definition = counters ? definition : NULL;
+            b->counters = counters;
+            return 0;
+        }
+        if (!b->definition && !free_binding)
+        {
+            free_binding = b;
+        }
+    }
+    if (!counters)
+    {
+        return 0;
+    }
+    if (!free_binding)
+    {
+        return -1;
+    }
+    free_binding->definition = definition;
+    free_binding->counters = counters;
+    return 0;
+}
+
+void perf_counters_detach(const void *definition)
+{
+    perf_counters_attach(definition, NULL);
+}
+
+static void accumulate(PerfCounter *dest, const PerfCounter *src)
+{
+    atomic_store_explicit(dest, atomic_load_explicit(dest, memory_order_relaxed) +
+                                atomic_load_explicit(src, memory_order_relaxed),
+                          memory_order_relaxed);
+}
+
+/**
+ * @brief Adds the counters of several sets into a total.
+ *
+ * The parts may still be counting on their threads; every counter is read
+ * atomically, though the set as a whole is not a single point in time.
+ * @p total is reset first and must have the same shape as the parts.
+ */
+
+void perf_counters_aggregate(PerfCounters *total, const PerfCounters *const *parts, unsigned count)
+{
+    perf_counters_reset(total);
+    for (unsigned p = 0; p < count; ++p)
+    {
+        const PerfCounters *part = parts[p];
+        for (unsigned i = 0; i < total->num_states && i < part->num_states; ++i)
+        {
+            const PerfStateCounters *s = &part->states[i];
+            PerfStateCounters *d = &total->states[i];
+            accumulate(&d->entries, &s->entries);
+            accumulate(&d->exits, &s->exits);
+            accumulate(&d->ticks, &s->ticks);
+            accumulate(&d->run_time, &s->run_time);
+            for (unsigned b = 0; b < PERF_HISTOGRAM_BUCKETS; ++b)
+            {
+                accumulate(&d->run_histogram[b], &s->run_histogram[b]);
+            }
+        }
+        for (unsigned i = 0; i < total->num_transitions && i < part->num_transitions; ++i)
+        {
+            const PerfTransitionCounters *t = &part->transitions[i];
+            PerfTransitionCounters *d = &total->transitions[i];
+            accumulate(&d->guard_evaluations, &t->guard_evaluations);
+            accumulate(&d->guard_hits, &t->guard_hits);
+            accumulate(&d->taken, &t->taken);
+        }
+    }
+}
+
+/* Copies a set, possibly still counting on its thread, into dest. */
+void perf_counters_snapshot(PerfCounters *dest, const PerfCounters *src)
+{
+    perf_counters_aggregate(dest, &src, 1);
+}
@@ -0,0 +1,116 @@
+/*
+ * test_event_queue.c
+ *
+ * Several producer threads post events into a machine's queue while the
+ * owning thread drains them in batches. Producers retry when the queue is
+ * full, so every event must reach the machine exactly once while the dropped
+ * counter records the rejected attempts.
+ */
+
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include "hsm/hsm.h"
+
+#define NUM_PRODUCERS 4
+#define EVENTS_PER_PRODUCER 100000
+#define QUEUE_CAPACITY 1024
+
+// Handled events, only touched by the owning thread through the context
+typedef struct {
+    long handled;
+    long checksum;
+} Counter;
+
+void counter_on_event(void *context, int event)
+{
+    Counter *counter = context;
+    counter->handled++;
+    counter->checksum += event;
+}
+
+State counter = {NULL, NULL, NULL, NULL, counter_on_event};
+State *States[] = {&counter};
+StateMachine sm = {States, 1, &counter};
+
+EventQueueSlot slots[QUEUE_CAPACITY];
+EventQueue queue;
+atomic_int producers_done;
+
+void *producer(void *arg)
+{
+    int id = *(int *)arg;
+    for (int i = 0; i < EVENTS_PER_PRODUCER; ++i)
+    {
+        while (event_queue_post(&queue, id + 1) != 0)
+        {
+            sched_yield();
+        }
+    }
+    atomic_fetch_add(&producers_done, 1);
+    return NULL;
+}
+
+int main(void)
+{
+    StateMachineDef def;
+    size_t compiled_size = state_machine_compile_size(&sm);
+    void *compiled = malloc(compiled_size);
+    if (state_machine_compile(&sm, &def, compiled, compiled_size) != 0)
+    {
+        printf("Failed to compile state machine\n");
+        return 1;
+    }
+
+    Counter totals = {0, 0};
+    StateMachineInstance *instance = malloc(state_machine_instance_size(&def));
+    state_machine_init(&def, instance, &totals);
+    event_queue_init(&queue, slots, QUEUE_CAPACITY);
+
+    pthread_t threads[NUM_PRODUCERS];
+    int ids[NUM_PRODUCERS];
+    for (int i = 0; i < NUM_PRODUCERS; ++i)
+    {
+        ids[i] = i;
+        pthread_create(&threads[i], NULL, producer, &ids[i]);
+    }
+
+    unsigned max_depth = 0;
+    while (atomic_load(&producers_done) < NUM_PRODUCERS || event_queue_depth(&queue) > 0)
+    {
+        unsigned depth = event_queue_depth(&queue);
+        if (depth > max_depth)
+        {
+            max_depth = depth;
+        }
+        state_machine_dispatch(&def, instance, &queue, 64);
+    }
+
+    for (int i = 0; i < NUM_PRODUCERS; ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    long posted = (long)NUM_PRODUCERS * EVENTS_PER_PRODUCER;
+    long dropped = event_queue_dropped(&queue);
+    printf("posted %ld, handled %ld, rejected while full %ld, max depth %u\n",
+           posted, totals.handled, dropped, max_depth);
+
+    long expected_checksum = 0;
+    for (int i = 0; i < NUM_PRODUCERS; ++i)
+    {
+        expected_checksum += (long)(i + 1) * EVENTS_PER_PRODUCER;
+    }
+
+    free(instance);
+    free(compiled);
+
+    if (totals.handled != posted || totals.checksum != expected_checksum)
+    {
+        printf("FAILED: events lost or duplicated\n");
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,256 @@
+/*
+ * test_executor.c
+ *
+ * A thermostat control loop runs at 10 kHz on the periodic executor for half
+ * a second. Its cycles must stay on the absolute release grid, so the run
+ * takes 5000 periods plus at most the latency and duration of the last
+ * cycle, not the accumulated sleep latencies, and the latency histogram
+ * must account for every cycle. A slower loop then overruns once by two and
+ * a half periods under each catch-up policy: catching up keeps every cycle,
+ * skipping drops the missed releases and stays on the grid, restarting drops
+ * them and starts a new grid after the overrun. The slow loop records the
+ * release and end of every step, so the checks follow what actually
+ * happened rather than wall-clock margins. Finally a step stops the
+ * executor itself.
+ *
+ * Pass --realtime to run under SCHED_FIFO pinned to CPU 0 (needs privileges).
+ *
+ * RootStateMachine
+|
++-- Heating (Leaf)   hot -> Cooling
++-- Cooling (Leaf)   cold -> Heating
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "hsm/executor.h"
+#include "hsm/hsm.h"
+
+#define RATE_HZ 10000
+#define NUM_CYCLES 5000
+#define SLOW_PERIOD_NS 10000000u
+#define SLOW_CYCLES 8
+#define OVERRUN_CYCLE 3
+
+static int failures = 0;
+
+static void expect(int cond, const char *what)
+{
+    if (!cond)
+    {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+typedef struct {
+    int temperature;  // Tenths of a degree
+    unsigned switches;
+} Thermostat;
+
+int hot(void *context) { return ((Thermostat *)context)->temperature > 220; }
+int cold(void *context) { return ((Thermostat *)context)->temperature < 180; }
+void heat(void *context) { ((Thermostat *)context)->temperature++; }
+void cool(void *context) { ((Thermostat *)context)->temperature--; }
+void switched(void *context) { ((Thermostat *)context)->switches++; }
+
+extern State heating, cooling;
+
+Transition heating_transitions[] = {{&cooling, hot, switched}};
+Transition cooling_transitions[] = {{&heating, cold, switched}};
+
+State heating = {NULL, NULL, heat, NULL, NULL, heating_transitions, 1};
+State cooling = {NULL, NULL, cool, NULL, NULL, cooling_transitions, 1};
+
+State *root_states[] = {&heating, &cooling};
+StateMachine sm = {root_states, 2, &heating};
+
+// Step of the slow loop: one cycle takes two and a half periods
+typedef struct {
+    Executor *ex;
+    unsigned steps;
+    unsigned stop_after;
+    uint64_t release_ns[SLOW_CYCLES];  // Release of each step, read from the executor
+    uint64_t end_ns[SLOW_CYCLES];      // Time each step returned, just before the executor sees it
+} SlowLoop;
+
+static void slow_step(void *arg)
+{
+    SlowLoop *loop = arg;
+    unsigned step = loop->steps++;
+    if (step == OVERRUN_CYCLE)
+    {
+        usleep(SLOW_PERIOD_NS * 5 / 2 / 1000);
+    }
+    if (step < SLOW_CYCLES)
+    {
+        loop->release_ns[step] = loop->ex->release_ns;
+        loop->end_ns[step] = now_ns();
+    }
+    if (loop->stop_after && loop->steps == loop->stop_after)
+    {
+        executor_stop(loop->ex);
+    }
+}
+
+// Releases missed by a step that ended at end_ns, as the executor counts them
+static uint64_t missed_releases(uint64_t release_ns, uint64_t end_ns)
+{
+    uint64_t next = release_ns + SLOW_PERIOD_NS;
+    return end_ns > next ? (end_ns - next) / SLOW_PERIOD_NS + 1 : 0;
+}
+
+// Runs the slow loop under a policy and checks its releases against the steps' end times
+static void run_slow(int policy, ExecutorStats *stats, const char *name)
+{
+    Executor ex;
+    SlowLoop loop = {&ex, 0, 0, {0}, {0}};
+    executor_init(&ex, SLOW_PERIOD_NS, policy, slow_step, &loop);
+    uint64_t cycles = executor_run(&ex, SLOW_CYCLES);
+    expect(cycles == SLOW_CYCLES && loop.steps == SLOW_CYCLES, "every cycle run");
+    *stats = ex.stats;
+
+    /* The executor reads the clock a little after the step returns, so each
+       overrun it sees may miss one release more than computed here. */
+    uint64_t missed = 0;
+    for (unsigned i = 0; i < SLOW_CYCLES; ++i)
+    {
+        missed += missed_releases(loop.release_ns[i], loop.end_ns[i]);
+    }
+    expect(missed_releases(loop.release_ns[OVERRUN_CYCLE], loop.end_ns[OVERRUN_CYCLE]) >= 2 &&
+           stats->overruns >= 1, "the long step overran");
+
+    /* Skipping and catching up keep every release on the first grid.
+       Restarting either stays on the grid or, after an overrun, starts a
+       new one at least a period after the step ended. */
+    int on_grid = 1;
+    for (unsigned i = 1; i < SLOW_CYCLES; ++i)
+    {
+        uint64_t release = loop.release_ns[i];
+        uint64_t previous = loop.release_ns[i - 1];
+        if (policy == EXECUTOR_RESTART)
+        {
+            on_grid &= release == previous + SLOW_PERIOD_NS || release >= loop.end_ns[i - 1] + SLOW_PERIOD_NS;
+        }
+        else
+        {
+            on_grid &= release > previous && (release - loop.release_ns[0]) % SLOW_PERIOD_NS == 0;
+        }
+    }
+    if (policy == EXECUTOR_RESTART)
+    {
+        expect(loop.release_ns[OVERRUN_CYCLE + 1] >= loop.end_ns[OVERRUN_CYCLE] + SLOW_PERIOD_NS,
+               "restart starts a new grid after the overrun");
+    }
+
+    if (policy == EXECUTOR_CATCH_UP)
+    {
+        expect(stats->skipped == 0, "catch up keeps the releases");
+        // The cycle after the overrun starts at least 25 - 10 ms after its release
+        expect(stats->max_latency_ns >= SLOW_PERIOD_NS, "caught-up cycles run late");
+    }
+    else
+    {
+        expect(stats->skipped >= missed && stats->skipped <= missed + stats->overruns,
+               policy == EXECUTOR_SKIP ? "skip drops the missed releases" : "restart drops the missed releases");
+    }
+    expect(on_grid, "releases stay on the grid");
+    printf("%s: %llu overruns, %llu releases skipped, %llu missed by the steps\n", name,
+           (unsigned long long)stats->overruns, (unsigned long long)stats->skipped,
+           (unsigned long long)missed);
+}
+
+int main(int argc, char **argv)
+{
+    StateMachineDef def;
+    size_t size = state_machine_compile_size(&sm);
+    void *image = aligned_alloc(8, (size + 7) & ~(size_t)7);
+    if (state_machine_compile(&sm, &def, image, size) != 0)
+    {
+        printf("FAILED: compile\n");
+        return 1;
+    }
+    size_t inst_size = state_machine_instance_size(&def);
+    StateMachineInstance *inst = aligned_alloc(8, (inst_size + 7) & ~(size_t)7);
+    Thermostat thermostat = {200, 0};
+    state_machine_init(&def, inst, &thermostat);
+
+    // Real-time scheduling pins the thread and usually needs privileges, so it is opt-in
+    int realtime = 0;
+    if (argc > 1 && strcmp(argv[1], "--realtime") == 0)
+    {
+        realtime = executor_set_realtime(50, 0) == 0;
+        expect(realtime, "real-time scheduling");
+    }
+
+    // The 10 kHz loop
+    Executor ex;
+    ExecutorMachine machine = {&def, inst};
+    expect(executor_init(&ex, 1000000000u / RATE_HZ, EXECUTOR_SKIP, executor_tick_machine, &machine) == 0,
+           "init");
+    expect(executor_init(&ex, 0, EXECUTOR_SKIP, executor_tick_machine, &machine) != 0, "zero period");
+    executor_init(&ex, 1000000000u / RATE_HZ, EXECUTOR_SKIP, executor_tick_machine, &machine);
+    ex.spin_ns = 20000;
+    uint64_t start = now_ns();
+    uint64_t cycles = executor_run(&ex, NUM_CYCLES);
+    double elapsed_ms = (now_ns() - start) / 1e6;
+    const ExecutorStats *stats = &ex.stats;
+
+    uint64_t binned = 0;
+    for (unsigned i = 0; i < EXECUTOR_HISTOGRAM_BINS; ++i)
+    {
+        binned += stats->histogram[i];
+    }
+    expect(cycles == NUM_CYCLES && stats->cycles == NUM_CYCLES, "cycles run");
+    expect(binned == NUM_CYCLES, "histogram holds every cycle");
+    expect(thermostat.switches >= 100, "control loop ran");
+    expect(stats->min_latency_ns <= stats->max_latency_ns, "latency range");
+    expect(executor_jitter_ns(&ex) == stats->max_latency_ns - stats->min_latency_ns, "jitter");
+    /* The last cycle is released NUM_CYCLES - 1 periods in, dropped releases
+       stretch that, and it ends at most the worst latency and step later.
+       Drifting off the grid would add up the latencies of every cycle. */
+    double expected_ms = (NUM_CYCLES - 1 + stats->skipped) * 1e3 / RATE_HZ;
+    double last_cycle_ms = (stats->max_latency_ns + stats->max_step_ns) / 1e6;
+    expect(elapsed_ms >= expected_ms && elapsed_ms < expected_ms + last_cycle_ms + 1.0,
+           "cycles stay on the grid");
+    expect(stats->skipped >= stats->overruns, "every overrun drops a release");
+
+    printf("%d Hz over %.1f ms (%s): latency %.2f/%.2f/%.2f us min/avg/max, jitter %.2f us, "
+           "step %.2f us max, %llu overruns\n",
+           RATE_HZ, elapsed_ms, realtime ? "SCHED_FIFO" : "normal scheduling",
+           stats->min_latency_ns / 1e3, (double)stats->sum_latency_ns / stats->cycles / 1e3,
+           stats->max_latency_ns / 1e3, executor_jitter_ns(&ex) / 1e3, stats->max_step_ns / 1e3,
+           (unsigned long long)stats->overruns);
+
+    // Catch-up policies after an overrun of two and a half periods
+    ExecutorStats slow;
+    run_slow(EXECUTOR_CATCH_UP, &slow, "catch up");
+    run_slow(EXECUTOR_SKIP, &slow, "skip");
+    run_slow(EXECUTOR_RESTART, &slow, "restart");
+
+    // A step stopping the executor
+    SlowLoop loop = {&ex, 0, 5, {0}, {0}};
+    executor_init(&ex, 100000, EXECUTOR_SKIP, slow_step, &loop);
+    expect(executor_run(&ex, 0) == 5, "stopped by the step");
+
+    free(inst);
+    free(image);
+
+    if (failures)
+    {
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,339 @@
+/*
+ * test_filter_bank.c
+ *
+ * Checks the filter bank. 100 sensor channels, each behind its own cascade
+ * of four designed sections, are filtered block by block with the vector
+ * kernel and with the scalar one. Both must agree, and cutting the stream
+ * into blocks of any size must give exactly the same output. The design
+ * helpers must have the documented gains at DC, at their corner
+ * frequencies and at Nyquist.
+ *
+ * The bank then conditions a temperature sensor with noise spikes ahead of
+ * an HSM guard. The raw signal would raise false alarms; the filtered one
+ * must only raise the alarm for a real rise.
+ *
+ * RootStateMachine
+|
++-- Monitoring (Leaf)   run: filter a block, overheated -> Alarm
++-- Alarm (Leaf)
+
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "control/filter_bank.h"
+#include "hsm/hsm.h"
+
+#define NUM_CHANNELS 100
+#define NUM_SECTIONS 4
+#define NUM_FRAMES 4096
+#define FS 10000.0f
+#define BLOCK 64
+
+static int failures = 0;
+
+static void expect(int cond, const char *what)
+{
+    if (!cond)
+    {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+static float uniform(uint32_t *rng, float lo, float hi)
+{
+    *rng = *rng * 1664525u + 1013904223u;
+    return lo + (hi - lo) * (float)(*rng >> 8) / 16777216.0f;
+}
+
+static void *aligned_floats(size_t count)
+{
+    size_t size = (count * sizeof(float) + FILTER_ALIGN - 1) & ~(size_t)(FILTER_ALIGN - 1);
+    void *p = aligned_alloc(FILTER_ALIGN, size);
+    memset(p, 0, size);
+    return p;
+}
+
+static void *new_bank(FilterBank *bank, unsigned channels, unsigned sections)
+{
+    size_t size = filter_bank_storage_size(channels, sections);
+    void *storage = aligned_alloc(FILTER_ALIGN, size);
+    if (filter_bank_init(bank, channels, sections, storage, size) != 0)
+    {
+        printf("FAILED: bank init\n");
+        exit(1);
+    }
+    return storage;
+}
+
+// Gives every channel a different cascade: low-pass, high-pass, band-pass and notch
+static void design_bank(FilterBank *bank)
+{
+    uint32_t rng = 5;
+    for (unsigned ch = 0; ch < bank->channels; ++ch)
+    {
+        FilterSection s;
+        filter_design_lowpass(&s, FS, uniform(&rng, 500.0f, 3000.0f), uniform(&rng, 0.5f, 2.0f));
+        filter_bank_set(bank, ch, 0, &s);
+        filter_design_highpass1(&s, FS, uniform(&rng, 1.0f, 50.0f));
+        filter_bank_set(bank, ch, 1, &s);
+        filter_design_bandpass(&s, FS, uniform(&rng, 100.0f, 1000.0f), uniform(&rng, 0.3f, 1.0f));
+        filter_bank_set(bank, ch, 2, &s);
+        filter_design_notch(&s, FS, uniform(&rng, 40.0f, 70.0f), 5.0f);
+        filter_bank_set(bank, ch, 3, &s);
+    }
+}
+
+static void test_kernels(void)
+{
+    FilterBank vec, ref, blocks;
+    void *storage[3] = {new_bank(&vec, NUM_CHANNELS, NUM_SECTIONS), new_bank(&ref, NUM_CHANNELS, NUM_SECTIONS),
+                        new_bank(&blocks, NUM_CHANNELS, NUM_SECTIONS)};
+    design_bank(&vec);
+    design_bank(&ref);
+    design_bank(&blocks);
+
+    unsigned n = vec.padded;
+    float *in = aligned_floats((size_t)NUM_FRAMES * n);
+    float *out_vec = aligned_floats((size_t)NUM_FRAMES * n);
+    float *out_ref = aligned_floats((size_t)NUM_FRAMES * n);
+    float *out_blocks = aligned_floats((size_t)NUM_FRAMES * n);
+    uint32_t rng = 11;
+    for (size_t i = 0; i < (size_t)NUM_FRAMES * n; ++i)
+    {
+        in[i] = uniform(&rng, -1.0f, 1.0f);
+    }
+
+    for (unsigned f = 0; f < NUM_FRAMES; f += BLOCK)
+    {
+        filter_bank_process(&vec, in + (size_t)f * n, out_vec + (size_t)f * n, BLOCK);
+        filter_bank_process_scalar(&ref, in + (size_t)f * n, out_ref + (size_t)f * n, BLOCK);
+    }
+
+    // Uneven blocks, including single frames, filtered in place
+    memcpy(out_blocks, in, (size_t)NUM_FRAMES * n * sizeof(float));
+    static const unsigned sizes[] = {1, 7, 256, 3, 1000, 64};
+    unsigned f = 0;
+    for (unsigned k = 0; f < NUM_FRAMES; ++k)
+    {
+        unsigned frames = sizes[k % 6] < NUM_FRAMES - f ? sizes[k % 6] : NUM_FRAMES - f;
+        filter_bank_process(&blocks, out_blocks + (size_t)f * n, out_blocks + (size_t)f * n, frames);
+        f += frames;
+    }
+
+    float max_diff = 0.0f;
+    float max_out = 0.0f;
+    int same_blocks = 1;
+    for (unsigned frame = 0; frame < NUM_FRAMES; ++frame)
+    {
+        for (unsigned ch = 0; ch < NUM_CHANNELS; ++ch)
+        {
+            size_t i = (size_t)frame * n + ch;
+            float diff = fabsf(out_vec[i] - out_ref[i]);
+            max_diff = diff > max_diff ? diff : max_diff;
+            max_out = fabsf(out_ref[i]) > max_out ? fabsf(out_ref[i]) : max_out;
+            same_blocks &= out_blocks[i] == out_vec[i];
+        }
+    }
+    expect(max_out > 0.1f, "signals pass");
+    expect(max_diff < 1e-5f, "vector and scalar kernels agree");
+    expect(same_blocks, "block size does not matter");
+
+    FilterSection s = {1, 0, 0, 0, 0};
+    expect(filter_bank_set(&vec, NUM_CHANNELS, 0, &s) != 0, "channel out of range");
+    expect(filter_bank_set(&vec, 0, NUM_SECTIONS, &s) != 0, "section out of range");
+    expect(filter_bank_init(&vec, 1, FILTER_MAX_SECTIONS + 1, storage[0], 1 << 20) != 0, "too many sections");
+
+    free(in);
+    free(out_vec);
+    free(out_ref);
+    free(out_blocks);
+    for (int i = 0; i < 3; ++i)
+    {
+        free(storage[i]);
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+
+// Steady-state gain of one section for a sine at freq Hz, 0 for DC
+static float gain(const FilterSection *s, float freq)
+{
+    FilterBank bank;
+    void *storage = new_bank(&bank, 1, 1);
+    filter_bank_set(&bank, 0, 0, s);
+    unsigned frames = (unsigned)FS;
+    float *block = aligned_floats((size_t)frames * bank.padded);
+    for (unsigned f = 0; f < frames; ++f)
+    {
+        block[(size_t)f * bank.padded] = freq == 0.0f ? 1.0f : sinf(2.0f * 3.14159265f * freq * f / FS);
+    }
+    filter_bank_process(&bank, block, block, frames);
+
+    // RMS over the second half, a whole number of periods for the frequencies used
+    double sum = 0.0;
+    for (unsigned f = frames / 2; f < frames; ++f)
+    {
+        double y = block[(size_t)f * bank.padded];
+        sum += y * y;
+    }
+    free(block);
+    free(storage);
+    return (float)sqrt(sum / (frames - frames / 2) * (freq == 0.0f ? 1.0 : 2.0));
+}
+
+static int near(float value, float expected, float tolerance)
+{
+    return fabsf(value - expected) <= tolerance;
+}
+
+static void test_design(void)
+{
+    FilterSection s;
+    const float corner = 0.70710678f;
+
+    expect(filter_design_lowpass(&s, FS, 200.0f, 0.70710678f) == 0, "low-pass");
+    expect(near(gain(&s, 0.0f), 1.0f, 1e-3f), "low-pass passes DC");
+    expect(near(gain(&s, 200.0f), corner, 0.01f), "low-pass corner");
+    expect(gain(&s, 4000.0f) < 0.01f, "low-pass stops high frequencies");
+
+    expect(filter_design_highpass(&s, FS, 200.0f, 0.70710678f) == 0, "high-pass");
+    expect(gain(&s, 0.0f) < 1e-3f, "high-pass stops DC");
+    expect(near(gain(&s, 200.0f), corner, 0.01f), "high-pass corner");
+    expect(near(gain(&s, 4000.0f), 1.0f, 0.01f), "high-pass passes high frequencies");
+
+    expect(filter_design_bandpass(&s, FS, 500.0f, 2.0f) == 0, "band-pass");
+    expect(near(gain(&s, 500.0f), 1.0f, 0.01f), "band-pass centre");
+    expect(gain(&s, 50.0f) < 0.1f && gain(&s, 4000.0f) < 0.1f, "band-pass stops the rest");
+
+    expect(filter_design_notch(&s, FS, 50.0f, 5.0f) == 0, "notch");
+    expect(gain(&s, 50.0f) < 0.01f, "notch removes mains hum");
+    expect(near(gain(&s, 500.0f), 1.0f, 0.01f), "notch passes the rest");
+
+    expect(filter_design_lowpass1(&s, FS, 100.0f) == 0, "first-order low-pass");
+    expect(near(gain(&s, 0.0f), 1.0f, 1e-3f) && near(gain(&s, 100.0f), corner, 0.01f), "first-order low-pass gains");
+    expect(filter_design_highpass1(&s, FS, 100.0f) == 0, "first-order high-pass");
+    expect(gain(&s, 0.0f) < 1e-3f && near(gain(&s, 100.0f), corner, 0.01f), "first-order high-pass gains");
+
+    expect(filter_design_lowpass(&s, FS, FS / 2, 0.7f) != 0, "corner at Nyquist rejected");
+    expect(filter_design_notch(&s, FS, 50.0f, 0.0f) != 0, "zero q rejected");
+}
+
+/* ------------------------------------------------------------------------- */
+// Conditioning a sensor ahead of a guard
+
+typedef struct {
+    FilterBank bank;
+    float *block;        // One block of raw samples, filtered in place by on_run
+    unsigned frame;      // Samples delivered so far
+    uint32_t rng;
+    float temperature;   // Latest filtered value
+    float raw_max;       // Largest raw sample seen
+} Sensor;
+
+static float read_sensor(Sensor *sensor)
+{
+    float t = sensor->frame >= 3000 ? 80.0f : 40.0f;  // The real rise
+    t += uniform(&sensor->rng, -1.0f, 1.0f);
+    if (sensor->frame % 97 == 0)
+    {
+        t += 60.0f;  // Spike
+    }
+    sensor->frame++;
+    return t;
+}
+
+void monitoring_on_run(void *context)
+{
+    Sensor *sensor = context;
+    for (unsigned f = 0; f < BLOCK; ++f)
+    {
+        float t = read_sensor(sensor);
+        sensor->raw_max = t > sensor->raw_max ? t : sensor->raw_max;
+        sensor->block[(size_t)f * sensor->bank.padded] = t;
+    }
+    filter_bank_process(&sensor->bank, sensor->block, sensor->block, BLOCK);
+    sensor->temperature = sensor->block[(size_t)(BLOCK - 1) * sensor->bank.padded];
+}
+
+int overheated(void *context) { return ((Sensor *)context)->temperature > 60.0f; }
+
+extern State monitoring, alarm;
+
+Transition monitoring_transitions[] = {{&alarm, overheated}};
+
+State monitoring = {NULL, NULL, monitoring_on_run, NULL, NULL, monitoring_transitions, 1};
+State alarm = {NULL, NULL, NULL, NULL, NULL, NULL, 0};
+
+State *root_states[] = {&monitoring, &alarm};
+StateMachine sm = {root_states, 2, &monitoring};
+
+static void test_machine(void)
+{
+    StateMachineDef def;
+    size_t size = state_machine_compile_size(&sm);
+    void *image = aligned_alloc(8, (size + 7) & ~(size_t)7);
+    if (state_machine_compile(&sm, &def, image, size) != 0)
+    {
+        printf("FAILED: compile\n");
+        failures++;
+        return;
+    }
+    size_t inst_size = state_machine_instance_size(&def);
+    StateMachineInstance *inst = aligned_alloc(8, (inst_size + 7) & ~(size_t)7);
+
+    Sensor sensor = {.rng = 3, .temperature = 40.0f};
+    void *storage = new_bank(&sensor.bank, 1, 2);
+    sensor.block = aligned_floats((size_t)BLOCK * sensor.bank.padded);
+    FilterSection s;
+    filter_design_lowpass(&s, FS, 20.0f, 0.70710678f);
+    filter_bank_set(&sensor.bank, 0, 0, &s);
+    filter_bank_set(&sensor.bank, 0, 1, &s);
+    // Start settled on the first reading, not from zero
+    for (int k = 0; k < 100; ++k)
+    {
+        for (unsigned f = 0; f < BLOCK; ++f)
+        {
+            sensor.block[(size_t)f * sensor.bank.padded] = 40.0f;
+        }
+        filter_bank_process(&sensor.bank, sensor.block, sensor.block, BLOCK);
+    }
+    state_machine_init(&def, inst, &sensor);
+
+    unsigned alarm_frame = 0;
+    while (sensor.frame < 6000 && !alarm_frame)
+    {
+        state_machine_tick(&def, inst);
+        if (state_machine_current_state(&def, inst, 0) == alarm.id)
+        {
+            alarm_frame = sensor.frame;
+        }
+    }
+    expect(sensor.raw_max > 60.0f, "raw signal has spikes over the threshold");
+    expect(alarm_frame > 3000, "no false alarm on the filtered signal");
+    expect(alarm_frame > 0 && alarm_frame < 3000 + 20 * BLOCK, "real rise raises the alarm");
+    printf("Alarm %u samples after the rise\n", alarm_frame - 3000);
+
+    free(sensor.block);
+    free(storage);
+    free(inst);
+    free(image);
+}
+
+int main(void)
+{
+    test_kernels();
+    test_design();
+    test_machine();
+
+    if (failures)
+    {
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -9,73 +9,78 @@
 char current_input = '\0';
 
 // Condition functions
-char is_H_pressed(void) { return current_input == 'H'; }
-char is_E_pressed(void) { return current_input == 'E'; }
-char is_L1_pressed(void) { return current_input == 'L'; }
-char is_L2_pressed(void) { return current_input == 'L'; }
-char is_O_pressed(void) { return current_input == 'O'; }
+char is_H_pressed(void *context) { return current_input == 'H'; }
+char is_E_pressed(void *context) { return current_input == 'E'; }
+char is_L1_pressed(void *context) { return current_input == 'L'; }
+char is_L2_pressed(void *context) { return current_input == 'L'; }
+char is_O_pressed(void *context) { return current_input == 'O'; }
 
 // Entry and exit functions
-void entry_H(void) { printf("Enter 'H': "); }
-void exit_H(void) { printf("Received 'H'\n"); }
+void entry_H(void *context) { printf("Enter 'H': "); }
+void exit_H(void *context) { printf("Received 'H'\n"); }
 
-void entry_E(void) { printf("Enter 'E': "); }
-void exit_E(void) { printf("Received 'E'\n"); }
+void entry_E(void *context) { printf("Enter 'E': "); }
+void exit_E(void *context) { printf("Received 'E'\n"); }
 
-void entry_L1(void) { printf("Enter first 'L': "); }
-void exit_L1(void) { printf("Received first 'L'\n"); }
+void entry_L1(void *context) { printf("Enter first 'L': "); }
+void exit_L1(void *context) { printf("Received first 'L'\n"); }
 
-void entry_L2(void) { printf("Enter second 'L': "); }
-void exit_L2(void) { printf("Received second 'L'\n"); }
+void entry_L2(void *context) { printf("Enter second 'L': "); }
+void exit_L2(void *context) { printf("Received second 'L'\n"); }
 
-void entry_O(void) { printf("Enter 'O': "); }
-void exit_O(void) { printf("Received 'O'\n"); }
+void entry_O(void *context) { printf("Enter 'O': "); }
+void exit_O(void *context) { printf("Received 'O'\n"); }
 
-void entry_DONE(void) { printf("Success! You spelled 'HELLO'.\n"); }
-void exit_DONE(void) {}
+void entry_DONE(void *context) { printf("Success! You spelled 'HELLO'.\n"); }
+void exit_DONE(void *context) {}
+
+// State indices
+enum { STATE_H, STATE_E, STATE_L1, STATE_L2, STATE_O, STATE_DONE, NUM_STATES };
 
 // Define states
-st_State state_H = { entry_H, NULL, exit_H };
-st_State state_E = { entry_E, NULL, exit_E };
-st_State state_L1 = { entry_L1, NULL, exit_L1 };
-st_State state_L2 = { entry_L2, NULL, exit_L2 };
-st_State state_O = { entry_O, NULL, exit_O };
-st_State state_DONE = { entry_DONE, NULL, exit_DONE };
+st_State states[NUM_STATES] = {
+    [STATE_H] = { entry_H, NULL, exit_H },
+    [STATE_E] = { entry_E, NULL, exit_E },
+    [STATE_L1] = { entry_L1, NULL, exit_L1 },
+    [STATE_L2] = { entry_L2, NULL, exit_L2 },
+    [STATE_O] = { entry_O, NULL, exit_O },
+    [STATE_DONE] = { entry_DONE, NULL, exit_DONE }
+};
 
 // Define transitions
 st_Transition transitions[] = {
-    { &state_H, &state_E, is_H_pressed },
-    { &state_E, &state_L1, is_E_pressed },
-    { &state_L1, &state_L2, is_L1_pressed },
-    { &state_L2, &state_O, is_L2_pressed },
-    { &state_O, &state_DONE, is_O_pressed }
+    { &states[STATE_H], &states[STATE_E], is_H_pressed },
+    { &states[STATE_E], &states[STATE_L1], is_E_pressed },
+    { &states[STATE_L1], &states[STATE_L2], is_L1_pressed },
+    { &states[STATE_L2], &states[STATE_O], is_L2_pressed },
+    { &states[STATE_O], &states[STATE_DONE], is_O_pressed }
 };
 
-
+// Per-state transition index
+uint16_t transition_offsets[NUM_STATES + 1];
 
 int main(void) {
 
     // Define state machine
-    st_State states[] = { state_H, state_E, state_L1, state_L2, state_O, state_DONE };
-
     st_StateMachine sm = {
     .states = states,
     .transitions = transitions,
     .num_states = sizeof(states) / sizeof(states[0]),
     .num_transitions = sizeof(transitions) / sizeof(transitions[0]),
-    .default_state = &state_H,
-    .prev_state = NULL,
-    .current_state = NULL
+    .transition_offsets = transition_offsets,
+    .default_state = &states[STATE_H]
 };
+    st_StateMachineInstance instance;
 
-    state_machine_init(&sm);
+    state_machine_compile(&sm);
+    state_machine_init(&sm, &instance, NULL);
 
-    while (sm.current_state != &state_DONE) {
+    while (instance.current_state != STATE_DONE) {
         int ch = getchar();
         if (ch == EOF) break;
         if (ch == '\n') continue;
         current_input = (char)ch;
-        state_machine_run(&sm);
+        state_machine_run(&sm, &instance);
     }
 
     return 0;
@@ -0,0 +1,449 @@
+/*
+ * test_hsm_async.c
+ *
+ * A data logger whose slow work runs on simulated devices, each served by
+ * its own thread: flash writes take 20 ms, ADC conversions 1 ms. The entry
+ * action of Saving and the run action of Sampling only start that work and
+ * return pending tokens, so ticks must stay short and the Sensor region
+ * must keep sampling while a write is in flight. Completions come back as
+ * events through the instance's queue. The action of START finishes on the
+ * spot, and a write abandoned by leaving Saving must not complete. A
+ * completion refused by a full queue must stay pending so it can be retried.
+ * A poll abandoned after its completion was queued must not be delivered
+ * to the re-entered Polling, whose run action must start polling again.
+ *
+ * RootStateMachine
+|
++-- Idle (Leaf)               START / calibrate -> Active
++-- Active (Composite)        STOP -> Idle
+    |
+    +-- Storage (Region)
+    |   +-- Ready (Leaf)      SAVE -> Saving
+    |   +-- Saving (Leaf)     entry: write flash, SAVED -> Ready
+    |
+    +-- Sensor (Region)
+        +-- Sampling (Leaf)   run: read ADC, SAMPLE counted
+
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "hsm/event_queue.h"
+#include "hsm/hsm.h"
+
+#define EV_START 1
+#define EV_STOP 2
+#define EV_SAVE 3
+#define EV_SAVED 4
+#define EV_SAMPLE 5
+#define EV_CALIBRATED 6
+#define EV_HELD 7
+#define EV_POLLED 8
+#define EV_PAUSE 9
+#define EV_RESUME 10
+#define MAX_JOBS 16
+#define QUEUE_CAPACITY 64
+
+static int failures = 0;
+
+static void expect(int cond, const char *what)
+{
+    if (!cond)
+    {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+/* ------------------------------------------------------------------------- */
+// A device serving one request at a time on its own thread
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    AsyncToken jobs[MAX_JOBS];
+    unsigned count;
+    unsigned delay_us;
+    unsigned completed;  // Completions that posted their event
+    unsigned stale;      // Completions dropped because the work was abandoned
+    int stop;
+} Device;
+
+static void device_submit(Device *dev, AsyncToken token)
+{
+    pthread_mutex_lock(&dev->lock);
+    if (dev->count < MAX_JOBS)
+    {
+        dev->jobs[dev->count++] = token;
+    }
+    pthread_cond_signal(&dev->cond);
+    pthread_mutex_unlock(&dev->lock);
+}
+
+static void *device_thread(void *arg)
+{
+    Device *dev = arg;
+    pthread_mutex_lock(&dev->lock);
+    while (!dev->stop)
+    {
+        if (dev->count == 0)
+        {
+            pthread_cond_wait(&dev->cond, &dev->lock);
+            continue;
+        }
+        AsyncToken token = dev->jobs[0];
+        for (unsigned i = 1; i < dev->count; ++i)
+        {
+            dev->jobs[i - 1] = dev->jobs[i];
+        }
+        dev->count--;
+        pthread_mutex_unlock(&dev->lock);
+
+        usleep(dev->delay_us);
+        int result = state_machine_complete(token);
+
+        pthread_mutex_lock(&dev->lock);
+        if (result == 0)
+        {
+            dev->completed++;
+        }
+        else
+        {
+            dev->stale++;
+        }
+    }
+    pthread_mutex_unlock(&dev->lock);
+    return NULL;
+}
+
+static Device flash = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, {{0}}, 0, 20000, 0, 0, 0};
+static Device adc = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, {{0}}, 0, 1000, 0, 0, 0};
+
+static unsigned device_counter(Device *dev, const unsigned *counter)
+{
+    pthread_mutex_lock(&dev->lock);
+    unsigned value = *counter;
+    pthread_mutex_unlock(&dev->lock);
+    return value;
+}
+
+/* ------------------------------------------------------------------------- */
+
+typedef struct {
+    unsigned actions;
+    unsigned calibrations;
+    unsigned samples;
+    unsigned writes;
+} Logger;
+
+void start_action(void *context) { ((Logger *)context)->actions++; }
+
+int calibrate(void *context, AsyncToken token)
+{
+    (void)context;
+    (void)token;
+    return HSM_ASYNC_DONE;
+}
+
+int write_flash(void *context, AsyncToken token)
+{
+    ((Logger *)context)->writes++;
+    device_submit(&flash, token);
+    return HSM_ASYNC_PENDING;
+}
+
+int read_adc(void *context, AsyncToken token)
+{
+    (void)context;
+    device_submit(&adc, token);
+    return HSM_ASYNC_PENDING;
+}
+
+void sampling_on_event(void *context, int event) { ((Logger *)context)->samples += event == EV_SAMPLE; }
+void logger_on_event(void *context, int event) { ((Logger *)context)->calibrations += event == EV_CALIBRATED; }
+
+extern State idle, active, ready, saving, sampling;
+
+Transition idle_transitions[] = {
+    {&active, NULL, start_action, NULL, 0, EV_START, 0, 0, 0, 0, calibrate, EV_CALIBRATED},
+};
+Transition active_transitions[] = {{&idle, NULL, NULL, NULL, 0, EV_STOP}};
+Transition ready_transitions[] = {{&saving, NULL, NULL, NULL, 0, EV_SAVE}};
+Transition saving_transitions[] = {{&ready, NULL, NULL, NULL, 0, EV_SAVED}};
+
+State ready = {NULL, NULL, NULL, NULL, NULL, ready_transitions, 1};
+State saving = {NULL, NULL, NULL, NULL, NULL, saving_transitions, 1, NULL, 0, 0, "Saving", 0,
+                write_flash, NULL, EV_SAVED};
+State sampling = {NULL, NULL, NULL, NULL, sampling_on_event, NULL, 0, NULL, 0, 0, "Sampling", 0,
+                  NULL, read_adc, EV_SAMPLE};
+
+State *storage_states[] = {&ready, &saving};
+State *sensor_states[] = {&sampling};
+StateMachine active_regions[] = {
+    {storage_states, 2, &ready},
+    {sensor_states, 1, &sampling},
+};
+
+State idle = {NULL, NULL, NULL, NULL, logger_on_event, idle_transitions, 1};
+State active = {NULL, NULL, NULL, NULL, logger_on_event, active_transitions, 1, active_regions, 2};
+
+State *root_states[] = {&idle, &active};
+StateMachine sm = {root_states, 2, &idle};
+
+static StateMachineDef def;
+
+// A second machine whose entry work is completed by hand
+static AsyncToken held;
+
+int hold_work(void *context, AsyncToken token)
+{
+    (void)context;
+    held = token;
+    return HSM_ASYNC_PENDING;
+}
+
+extern State waiting, done;
+
+Transition waiting_transitions[] = {{&done, NULL, NULL, NULL, 0, EV_HELD}};
+
+State waiting = {NULL, NULL, NULL, NULL, NULL, waiting_transitions, 1, NULL, 0, 0, "Waiting", 0,
+                 hold_work, NULL, EV_HELD};
+State done = {NULL};
+
+State *held_states[] = {&waiting, &done};
+StateMachine held_sm = {held_states, 2, &waiting};
+
+static void test_full_queue(void)
+{
+    StateMachineDef held_def;
+    size_t size = state_machine_compile_size(&held_sm);
+    void *image = aligned_alloc(8, (size + 7) & ~(size_t)7);
+    if (state_machine_compile(&held_sm, &held_def, image, size) != 0)
+    {
+        expect(0, "compile");
+        return;
+    }
+    size_t inst_size = state_machine_instance_size(&held_def);
+    StateMachineInstance *inst = aligned_alloc(8, (inst_size + 7) & ~(size_t)7);
+    EventQueueSlot slots[2];
+    EventQueue queue;
+    event_queue_init(&queue, slots, 2);
+    state_machine_set_queue(&held_def, inst, &queue);
+    state_machine_init(&held_def, inst, NULL);
+
+    while (event_queue_post(&queue, 0) == 0)
+    {
+    }
+    expect(state_machine_complete(held) != 0, "completion refused by a full queue");
+    int event;
+    while (event_queue_pop(&queue, &event))
+    {
+    }
+    expect(state_machine_complete(held) == 0, "completion retried once the queue drained");
+    expect(state_machine_complete(held) != 0, "completed work completes once");
+    state_machine_dispatch(&held_def, inst, &queue, 0);
+    expect(state_machine_current_state(&held_def, inst, 0) == done.id, "retried completion delivered");
+
+    free(inst);
+    free(image);
+}
+
+// A third machine polling by hand from its run action
+typedef struct {
+    AsyncToken token;  // Poll in flight
+    unsigned polls;
+    unsigned polled;   // Completions delivered
+} Poller;
+
+int start_poll(void *context, AsyncToken token)
+{
+    Poller *p = context;
+    p->token = token;
+    p->polls++;
+    return HSM_ASYNC_PENDING;
+}
+
+void polling_on_event(void *context, int event) { ((Poller *)context)->polled += event == EV_POLLED; }
+
+extern State polling, paused;
+
+Transition polling_transitions[] = {{&paused, NULL, NULL, NULL, 0, EV_PAUSE}};
+Transition paused_transitions[] = {{&polling, NULL, NULL, NULL, 0, EV_RESUME}};
+
+State polling = {NULL, NULL, NULL, NULL, polling_on_event, polling_transitions, 1, NULL, 0, 0, "Polling", 0,
+                 NULL, start_poll, EV_POLLED};
+State paused = {NULL, NULL, NULL, NULL, NULL, paused_transitions, 1};
+
+State *poller_states[] = {&polling, &paused};
+StateMachine poller_sm = {poller_states, 2, &polling};
+
+static void test_abandoned_completion(void)
+{
+    StateMachineDef poller_def;
+    size_t size = state_machine_compile_size(&poller_sm);
+    void *image = aligned_alloc(8, (size + 7) & ~(size_t)7);
+    if (state_machine_compile(&poller_sm, &poller_def, image, size) != 0)
+    {
+        expect(0, "compile");
+        return;
+    }
+    size_t inst_size = state_machine_instance_size(&poller_def);
+    StateMachineInstance *inst = aligned_alloc(8, (inst_size + 7) & ~(size_t)7);
+    EventQueueSlot slots[4];
+    EventQueue queue;
+    Poller poller = {{0}};
+    event_queue_init(&queue, slots, 4);
+    state_machine_set_queue(&poller_def, inst, &queue);
+    state_machine_init(&poller_def, inst, &poller);
+
+    // Queued, then abandoned by leaving and re-entering before it is delivered
+    state_machine_tick(&poller_def, inst);
+    AsyncToken first = poller.token;
+    expect(state_machine_complete(first) == 0, "poll completed");
+    state_machine_send_event(&poller_def, inst, EV_PAUSE);
+    state_machine_send_event(&poller_def, inst, EV_RESUME);
+    state_machine_dispatch(&poller_def, inst, &queue, 0);
+    expect(poller.polled == 0, "abandoned completion not delivered after re-entry");
+
+    state_machine_tick(&poller_def, inst);
+    expect(poller.polls == 2 && poller.token.id != first.id, "re-entered state polls again");
+
+    // Refused by a full queue, then abandoned: the retry must not revive it
+    while (event_queue_post(&queue, 0) == 0)
+    {
+    }
+    AsyncToken second = poller.token;
+    expect(state_machine_complete(second) != 0, "completion refused by a full queue");
+    state_machine_send_event(&poller_def, inst, EV_PAUSE);
+    state_machine_send_event(&poller_def, inst, EV_RESUME);
+    state_machine_dispatch(&poller_def, inst, &queue, 0);
+    expect(state_machine_complete(second) != 0 && event_queue_depth(&queue) == 0,
+           "abandoned completion not revived by a retry");
+
+    state_machine_tick(&poller_def, inst);
+    expect(poller.polls == 3, "poll restarted after the refused completion");
+    expect(state_machine_complete(poller.token) == 0, "current poll completed");
+    state_machine_dispatch(&poller_def, inst, &queue, 0);
+    expect(poller.polled == 1, "current completion delivered");
+
+    free(inst);
+    free(image);
+}
+
+// Delivers the completions that arrived, then ticks; returns the tick's duration
+static double step(StateMachineInstance *inst, EventQueue *queue)
+{
+    state_machine_dispatch(&def, inst, queue, 0);
+    double start = now_ms();
+    state_machine_tick(&def, inst);
+    return now_ms() - start;
+}
+
+int main(void)
+{
+    size_t size = state_machine_compile_size(&sm);
+    void *image = aligned_alloc(8, (size + 7) & ~(size_t)7);
+    if (state_machine_compile(&sm, &def, image, size) != 0)
+    {
+        printf("FAILED: compile\n");
+        return 1;
+    }
+    expect(def.image->num_async == 3, "one operation per async state and transition");
+
+    pthread_t flash_thread, adc_thread;
+    pthread_create(&flash_thread, NULL, device_thread, &flash);
+    pthread_create(&adc_thread, NULL, device_thread, &adc);
+
+    size_t inst_size = state_machine_instance_size(&def);
+    StateMachineInstance *inst = aligned_alloc(8, (inst_size + 7) & ~(size_t)7);
+    EventQueueSlot slots[QUEUE_CAPACITY];
+    EventQueue queue;
+    Logger logger = {0};
+    event_queue_init(&queue, slots, QUEUE_CAPACITY);
+    state_machine_set_queue(&def, inst, &queue);
+    state_machine_init(&def, inst, &logger);
+
+    // The transition actions: the synchronous one and one done on the spot
+    state_machine_send_event(&def, inst, EV_START);
+    expect(logger.actions == 1, "transition action called");
+    expect(event_queue_depth(&queue) == 1, "immediate completion posted");
+    step(inst, &queue);
+    expect(logger.calibrations == 1, "completion delivered as an event");
+
+    // A write in flight does not hold up the ticks nor the other region
+    state_machine_send_event(&def, inst, EV_SAVE);
+    expect(state_machine_current_state(&def, inst, 1) == saving.id, "saving");
+    expect(logger.writes == 1, "write started on entry");
+    double start = now_ms();
+    double max_tick_ms = 0;
+    unsigned ticks_while_saving = 0;
+    unsigned samples_before = logger.samples;
+    while (state_machine_current_state(&def, inst, 1) == saving.id && now_ms() - start < 2000)
+    {
+        double tick_ms = step(inst, &queue);
+        max_tick_ms = tick_ms > max_tick_ms ? tick_ms : max_tick_ms;
+        ticks_while_saving++;
+        usleep(200);
+    }
+    double save_ms = now_ms() - start;
+    unsigned samples_while_saving = logger.samples - samples_before;
+    expect(state_machine_current_state(&def, inst, 1) == ready.id, "write completed");
+    expect(save_ms >= 19.0, "write took its time");
+    expect(ticks_while_saving > 10, "machine kept ticking while the write was in flight");
+    expect(samples_while_saving > 3, "sensor region kept sampling");
+    expect(max_tick_ms < 5.0, "ticks do not block on the write");
+    expect(logger.writes == 1, "one write per entry");
+
+    // Abandoned write: leaving Saving drops its completion
+    state_machine_send_event(&def, inst, EV_SAVE);
+    state_machine_send_event(&def, inst, EV_STOP);
+    expect(state_machine_current_state(&def, inst, 0) == idle.id, "stopped");
+    start = now_ms();
+    while (device_counter(&flash, &flash.stale) == 0 && now_ms() - start < 2000)
+    {
+        usleep(1000);
+    }
+    expect(device_counter(&flash, &flash.stale) == 1, "abandoned write dropped");
+    expect(device_counter(&flash, &flash.completed) == 1, "only the first write completed");
+    int event;
+    while (event_queue_pop(&queue, &event))
+    {
+        expect(event != EV_SAVED, "no completion of the abandoned write");
+    }
+
+    test_full_queue();
+    test_abandoned_completion();
+
+    printf("Write in flight for %.1f ms: %u ticks of at most %.3f ms, %u samples\n", save_ms,
+           ticks_while_saving, max_tick_ms, samples_while_saving);
+
+    pthread_mutex_lock(&flash.lock);
+    flash.stop = 1;
+    pthread_cond_signal(&flash.cond);
+    pthread_mutex_unlock(&flash.lock);
+    pthread_mutex_lock(&adc.lock);
+    adc.stop = 1;
+    pthread_cond_signal(&adc.cond);
+    pthread_mutex_unlock(&adc.lock);
+    pthread_join(flash_thread, NULL);
+    pthread_join(adc_thread, NULL);
+    free(inst);
+    free(image);
+
+    if (failures)
+    {
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
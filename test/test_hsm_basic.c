@@ -54,9 +54,9 @@ void handle_input(char input);
 
 // Entry/Exit/Run handlers for various states
 #define DEFINE_STATE_FUNCS(name) \
-    void name##_on_entry(State* self) { printf("Entered %s\n", #name); } \
-    void name##_on_exit(State* self)  { printf("Exited %s\n", #name); } \
-    void name##_on_run(State* self)   { printf("Running %s. Enter command: ", #name); }
+    void name##_on_entry(void *context) { printf("Entered %s\n", #name); } \
+    void name##_on_exit(void *context)  { printf("Exited %s\n", #name); } \
+    void name##_on_run(void *context)   { printf("Running %s. Enter command: ", #name); }
 
 // Leaf state handlers
 DEFINE_STATE_FUNCS(home_screen);
@@ -105,13 +105,13 @@ State diagnostics_menu;
 char current_input = '\0';
 
 // Transition functions
-int detect_a(void) { return current_input == 'a'; }
-int detect_s(void) { return current_input == 's'; }
-int detect_d(void) { return current_input == 'd'; }
-int detect_1(void) { return current_input == '1'; }
-int detect_2(void) { return current_input == '2'; }
-int detect_b(void) { return current_input == 'b'; }
-int detect_q(void) { return current_input == 'q'; }
+int detect_a(void *context) { return current_input == 'a'; }
+int detect_s(void *context) { return current_input == 's'; }
+int detect_d(void *context) { return current_input == 'd'; }
+int detect_1(void *context) { return current_input == '1'; }
+int detect_2(void *context) { return current_input == '2'; }
+int detect_b(void *context) { return current_input == 'b'; }
+int detect_q(void *context) { return current_input == 'q'; }
 
 // Define transitions
 Transition main_menu_transitions[] = {
@@ -202,14 +202,26 @@ StateMachine sm = {States,
                    &main_menu};
 int main(void)
 {
-    state_machine_init(&sm);
+    StateMachineDef def;
+    size_t compiled_size = state_machine_compile_size(&sm);
+    void *compiled = malloc(compiled_size);
+    if (state_machine_compile(&sm, &def, compiled, compiled_size) != 0)
+    {
+        printf("Failed to compile state machine\n");
+        return 1;
+    }
+
+    StateMachineInstance *instance = malloc(state_machine_instance_size(&def));
+    state_machine_init(&def, instance, NULL);
 
     while (current_input != 'x') {
         current_input = (char)getchar();
         if (current_input == EOF) break;
         if (current_input == '\n') continue;
-        state_machine_tick(&sm);
+        state_machine_tick(&def, instance);
     }
 
+    free(instance);
+    free(compiled);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,132 @@
+/*
+ * test_hsm_batch.c
+ *
+ * A population of thermostats is ticked twice: once instance by instance
+ * with state_machine_tick() and once with state_machine_tick_batch(). Both
+ * populations must end up in exactly the same states with the same context.
+ *
+ * RootStateMachine
+|
++-- Idle (Leaf)
++-- Heating (Leaf)
++-- Cooling (Leaf)
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hsm/hsm.h"
+
+#define NUM_INSTANCES 10000
+#define NUM_CYCLES 200
+
+typedef struct {
+    int temperature;
+    int drift;
+    int entries;
+    int runs;
+} Thermostat;
+
+extern State idle, heating, cooling;
+
+int too_cold(void *context) { return ((Thermostat *)context)->temperature < 18; }
+int too_hot(void *context) { return ((Thermostat *)context)->temperature > 24; }
+int comfortable(void *context)
+{
+    Thermostat *t = context;
+    return t->temperature >= 20 && t->temperature <= 22;
+}
+
+void any_on_entry(void *context) { ((Thermostat *)context)->entries++; }
+void idle_on_run(void *context)
+{
+    Thermostat *t = context;
+    t->temperature += t->drift;
+    t->runs++;
+}
+void heating_on_run(void *context) { ((Thermostat *)context)->temperature += 2; ((Thermostat *)context)->runs++; }
+void cooling_on_run(void *context) { ((Thermostat *)context)->temperature -= 2; ((Thermostat *)context)->runs++; }
+
+Transition idle_transitions[] = {
+    {&heating, too_cold},
+    {&cooling, too_hot},
+};
+Transition heating_transitions[] = {
+    {&idle, comfortable},
+};
+Transition cooling_transitions[] = {
+    {&idle, comfortable},
+};
+
+State idle = {NULL, any_on_entry, idle_on_run, NULL, NULL, idle_transitions, 2};
+State heating = {NULL, any_on_entry, heating_on_run, NULL, NULL, heating_transitions, 1};
+State cooling = {NULL, any_on_entry, cooling_on_run, NULL, NULL, cooling_transitions, 1};
+
+State *States[] = {&idle, &heating, &cooling};
+StateMachine sm = {States, 3, &idle};
+
+// Allocates a population whose instances start with varied temperatures
+StateMachineInstance **make_population(const StateMachineDef *def, Thermostat *contexts)
+{
+    size_t size = state_machine_instance_size(def);
+    StateMachineInstance **instances = malloc(NUM_INSTANCES * sizeof(*instances));
+    for (int i = 0; i < NUM_INSTANCES; ++i)
+    {
+        contexts[i].temperature = 15 + (i * 7) % 13;
+        contexts[i].drift = (i % 3) - 1;
+        contexts[i].entries = 0;
+        contexts[i].runs = 0;
+        instances[i] = malloc(size);
+        state_machine_init(def, instances[i], &contexts[i]);
+    }
+    return instances;
+}
+
+int main(void)
+{
+    StateMachineDef def;
+    size_t compiled_size = state_machine_compile_size(&sm);
+    void *compiled = malloc(compiled_size);
+    if (state_machine_compile(&sm, &def, compiled, compiled_size) != 0)
+    {
+        printf("Failed to compile state machine\n");
+        return 1;
+    }
+
+    static Thermostat single_contexts[NUM_INSTANCES];
+    static Thermostat batch_contexts[NUM_INSTANCES];
+    StateMachineInstance **single = make_population(&def, single_contexts);
+    StateMachineInstance **batch = make_population(&def, batch_contexts);
+    void *workspace = malloc(state_machine_batch_workspace_size(&def, NUM_INSTANCES));
+
+    for (int cycle = 0; cycle < NUM_CYCLES; ++cycle)
+    {
+        for (int i = 0; i < NUM_INSTANCES; ++i)
+        {
+            state_machine_tick(&def, single[i]);
+        }
+        state_machine_tick_batch(&def, batch, NUM_INSTANCES, workspace);
+    }
+
+    int mismatches = 0;
+    for (int i = 0; i < NUM_INSTANCES; ++i)
+    {
+        if (state_machine_current_state(&def, single[i], 0) != state_machine_current_state(&def, batch[i], 0) ||
+            memcmp(&single_contexts[i], &batch_contexts[i], sizeof(Thermostat)) != 0)
+        {
+            mismatches++;
+        }
+        free(single[i]);
+        free(batch[i]);
+    }
+
+    free(single);
+    free(batch);
+    free(workspace);
+    free(compiled);
+
+    printf("%d instances, %d cycles, %d mismatches\n", NUM_INSTANCES, NUM_CYCLES, mismatches);
+    printf(mismatches ? "FAILED\n" : "OK\n");
+    return mismatches ? 1 : 0;
+}
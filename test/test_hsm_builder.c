@@ -0,0 +1,298 @@
+/*
+ * test_hsm_builder.c
+ *
+ * A desk lamp with a fan is described twice: once as static globals and once
+ * with the machine builder. Both definitions must behave identically on the
+ * same sequence of events and inputs. The built one must keep its compiled
+ * image at the cache-line aligned start of the arena, its names as cold data
+ * behind it, and report the arena size it needs when given too little.
+ * Transitions added interleaved across many states must be grouped by
+ * source, each state's in the order they were added.
+ *
+ * RootStateMachine
+|
++-- Off (Leaf)             POWER -> On
++-- On (Composite)         POWER -> Off
+    |
+    +-- Light (Region)
+    |   +-- Dim (Leaf)     UP -> Bright
+    |   +-- Bright (Leaf)  DOWN -> Dim
+    |
+    +-- Fan (Region)
+        +-- Slow (Leaf)    hot -> Fast
+        +-- Fast (Leaf)    cool -> Slow
+
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hsm/builder.h"
+#include "hsm/hsm.h"
+
+#define EV_POWER 1
+#define EV_UP 2
+#define EV_DOWN 3
+#define NUM_STEPS 200
+#define NUM_BUILDS 10000
+#define ARENA_SIZE 16384
+#define RING_STATES 64
+#define RING_TRANSITIONS 16384
+
+typedef struct {
+    int temperature;
+    char log[4096];
+    size_t length;
+} Lamp;
+
+static int failures = 0;
+
+static void expect(int cond, const char *what)
+{
+    if (!cond)
+    {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void note(void *context, char c)
+{
+    Lamp *lamp = context;
+    if (lamp->length < sizeof(lamp->log) - 1)
+    {
+        lamp->log[lamp->length++] = c;
+    }
+}
+
+void on_enter(void *context) { note(context, 'O'); }
+void on_leave(void *context) { note(context, 'o'); }
+void dim_enter(void *context) { note(context, 'd'); }
+void bright_enter(void *context) { note(context, 'b'); }
+void slow_run(void *context) { note(context, 's'); }
+void fast_run(void *context) { note(context, 'f'); }
+int hot(void *context) { return ((Lamp *)context)->temperature > 30; }
+int cool(void *context) { return ((Lamp *)context)->temperature < 25; }
+
+/* ------------------------------------------------------------------------- */
+// The static description
+
+extern State off, on, dim, bright, slow, fast;
+
+Transition off_transitions[] = {{&on, NULL, NULL, NULL, 0, EV_POWER}};
+Transition on_transitions[] = {{&off, NULL, NULL, NULL, 0, EV_POWER}};
+Transition dim_transitions[] = {{&bright, NULL, NULL, NULL, 0, EV_UP}};
+Transition bright_transitions[] = {{&dim, NULL, NULL, NULL, 0, EV_DOWN}};
+Transition slow_transitions[] = {{&fast, hot}};
+Transition fast_transitions[] = {{&slow, cool}};
+
+State dim = {NULL, dim_enter, NULL, NULL, NULL, dim_transitions, 1};
+State bright = {NULL, bright_enter, NULL, NULL, NULL, bright_transitions, 1};
+State slow = {NULL, NULL, slow_run, NULL, NULL, slow_transitions, 1};
+State fast = {NULL, NULL, fast_run, NULL, NULL, fast_transitions, 1};
+
+State *light_states[] = {&dim, &bright};
+State *fan_states[] = {&slow, &fast};
+StateMachine on_regions[] = {
+    {light_states, 2, &dim},
+    {fan_states, 2, &slow},
+};
+
+State off = {NULL, NULL, NULL, NULL, NULL, off_transitions, 1};
+State on = {NULL, on_enter, NULL, on_leave, NULL, on_transitions, 1, on_regions, 2};
+
+State *root_states[] = {&off, &on};
+StateMachine sm = {root_states, 2, &off};
+
+/* ------------------------------------------------------------------------- */
+// The same machine, built at runtime. Transitions are added out of order on
+// purpose; each state must still get its own in the order they were added.
+
+static int build_lamp(MachineBuilder *b, StateMachineDef *def)
+{
+    StateMachine *root = machine_builder_root(b);
+    State *b_off = machine_builder_state(b, root, "Off", NULL, NULL, NULL);
+    State *b_on = machine_builder_state(b, root, "On", on_enter, NULL, on_leave);
+    StateMachine *regions = machine_builder_regions(b, b_on, 2);
+    if (!regions)
+    {
+        return -1;
+    }
+    State *b_dim = machine_builder_state(b, &regions[0], "Dim", dim_enter, NULL, NULL);
+    State *b_slow = machine_builder_state(b, &regions[1], "Slow", NULL, slow_run, NULL);
+    State *b_bright = machine_builder_state(b, &regions[0], "Bright", bright_enter, NULL, NULL);
+    State *b_fast = machine_builder_state(b, &regions[1], "Fast", NULL, fast_run, NULL);
+
+    machine_builder_transition(b, b_slow, b_fast, hot, 0);
+    machine_builder_transition(b, b_on, b_off, NULL, EV_POWER);
+    machine_builder_transition(b, b_dim, b_bright, NULL, EV_UP);
+    machine_builder_transition(b, b_off, b_on, NULL, EV_POWER);
+    machine_builder_transition(b, b_fast, b_slow, cool, 0);
+    machine_builder_transition(b, b_bright, b_dim, NULL, EV_DOWN);
+    return machine_builder_finish(b, def);
+}
+
+// Drives a lamp through a fixed mix of events and temperature changes
+static void exercise(const StateMachineDef *def, StateMachineInstance *inst, Lamp *lamp)
+{
+    static const int events[] = {EV_POWER, EV_UP, 0, EV_DOWN, 0, EV_UP, EV_POWER, 0};
+    uint32_t rng = 2024;
+
+    memset(lamp, 0, sizeof(*lamp));
+    state_machine_init(def, inst, lamp);
+    for (int i = 0; i < NUM_STEPS; ++i)
+    {
+        rng = rng * 1664525u + 1013904223u;
+        lamp->temperature = 15 + (int)((rng >> 16) % 25);
+        int event = events[i % (int)(sizeof(events) / sizeof(events[0]))];
+        if (event)
+        {
+            state_machine_send_event(def, inst, event);
+        }
+        state_machine_tick(def, inst);
+    }
+}
+
+/* A ring of states whose transitions are added round-robin, transition i
+   leaving state i % RING_STATES on event i + 1. */
+static void test_interleaved_transitions(void)
+{
+    MachineBuilder b;
+    size_t size = machine_builder_tables_size(RING_STATES, 1, RING_TRANSITIONS) + (4u << 20);
+    if (machine_builder_init(&b, NULL, size, RING_STATES, 1, RING_TRANSITIONS) != 0)
+    {
+        expect(0, "ring builder init");
+        return;
+    }
+    StateMachine *root = machine_builder_root(&b);
+    State *ring[RING_STATES];
+    for (unsigned k = 0; k < RING_STATES; ++k)
+    {
+        ring[k] = machine_builder_state(&b, root, NULL, NULL, NULL, NULL);
+    }
+    for (unsigned i = 0; i < RING_TRANSITIONS; ++i)
+    {
+        machine_builder_transition(&b, ring[i % RING_STATES], ring[(i + 1) % RING_STATES], NULL, (int)i + 1);
+    }
+    StateMachineDef def;
+    double start = now_ns();
+    expect(machine_builder_finish(&b, &def) == 0, "ring finishes");
+    double finish_ms = (now_ns() - start) / 1e6;
+
+    int grouped = 1;
+    for (unsigned k = 0; k < RING_STATES; ++k)
+    {
+        grouped &= ring[k]->num_transitions == RING_TRANSITIONS / RING_STATES;
+        for (int n = 0; grouped && n < ring[k]->num_transitions; ++n)
+        {
+            grouped &= ring[k]->transitions[n].event == (int)(n * RING_STATES + k + 1);
+        }
+    }
+    expect(grouped, "transitions grouped by source in the order added");
+
+    size_t inst_size = state_machine_instance_size(&def);
+    StateMachineInstance *inst = aligned_alloc(8, (inst_size + 7) & ~(size_t)7);
+    state_machine_init(&def, inst, NULL);
+    expect(state_machine_send_event(&def, inst, RING_STATES + 1) == 1 &&
+               state_machine_current_state(&def, inst, 0) == ring[1]->id, "ring transition taken");
+    printf("Ring of %d states with %d interleaved transitions finished in %.2f ms\n", RING_STATES,
+           RING_TRANSITIONS, finish_ms);
+    free(inst);
+    machine_builder_destroy(&b);
+}
+
+int main(void)
+{
+    StateMachineDef static_def;
+    size_t size = state_machine_compile_size(&sm);
+    void *buffer = aligned_alloc(8, (size + 7) & ~(size_t)7);
+    if (state_machine_compile(&sm, &static_def, buffer, size) != 0)
+    {
+        printf("FAILED: compile\n");
+        return 1;
+    }
+
+    // Builder allocating its own arena
+    MachineBuilder b;
+    StateMachineDef def;
+    expect(machine_builder_init(&b, NULL, ARENA_SIZE, 8, 4, 8) == 0, "init");
+    expect(build_lamp(&b, &def) == 0, "build");
+    expect((const void *)def.image == b.arena, "image at the start of the arena");
+    expect((uintptr_t)def.image % MACHINE_BUILDER_ALIGN == 0, "image cache-line aligned");
+    expect(b.hot <= b.cold, "hot and cold data apart");
+    expect(def.image->num_states == 6 && def.image->num_regions == 3, "built shape");
+    expect(strcmp(machine_builder_state_name(&b, b.states[1].id), "On") == 0, "names by id");
+    expect(strcmp(machine_builder_state_name(&b, b.states[5].id), "Fast") == 0, "names by id");
+    const char *name = machine_builder_state_name(&b, b.states[1].id);
+    expect((const unsigned char *)name >= b.arena + b.cold, "names are cold data");
+
+    // Both definitions must behave the same
+    size_t inst_size = state_machine_instance_size(&def);
+    expect(inst_size == state_machine_instance_size(&static_def), "same instance size");
+    StateMachineInstance *a = aligned_alloc(8, (inst_size + 7) & ~(size_t)7);
+    StateMachineInstance *c = aligned_alloc(8, (inst_size + 7) & ~(size_t)7);
+    Lamp *lamp_a = malloc(sizeof(Lamp));
+    Lamp *lamp_c = malloc(sizeof(Lamp));
+    exercise(&static_def, a, lamp_a);
+    exercise(&def, c, lamp_c);
+    expect(lamp_a->length > 50, "exercise did something");
+    expect(lamp_a->length == lamp_c->length && memcmp(lamp_a->log, lamp_c->log, lamp_a->length) == 0,
+           "same callbacks");
+    for (unsigned r = 0; r < 3; ++r)
+    {
+        expect(state_machine_current_state(&static_def, a, r) == state_machine_current_state(&def, c, r),
+               "same states");
+    }
+    machine_builder_destroy(&b);
+
+    // Too small an arena: the builder says how much it needs
+    size_t tables = machine_builder_tables_size(8, 4, 8);
+    unsigned char *arena = aligned_alloc(MACHINE_BUILDER_ALIGN, ARENA_SIZE);
+    expect(machine_builder_init(&b, arena, tables + 64, 8, 4, 8) == 0, "init small");
+    expect(build_lamp(&b, &def) != 0, "small arena fails");
+    expect(b.required > tables + 64 && b.required <= ARENA_SIZE, "required size reported");
+    size_t required = (b.required + MACHINE_BUILDER_ALIGN - 1) & ~(size_t)(MACHINE_BUILDER_ALIGN - 1);
+    expect(machine_builder_init(&b, arena, required, 8, 4, 8) == 0, "init exact");
+    expect(build_lamp(&b, &def) == 0, "exact arena fits");
+    expect(machine_builder_init(&b, arena + 8, ARENA_SIZE - 64, 8, 4, 8) != 0, "misaligned arena");
+
+    // Loading machine variants: no allocation per node, one arena reused
+    double start = now_ns();
+    for (int i = 0; i < NUM_BUILDS; ++i)
+    {
+        machine_builder_init(&b, arena, ARENA_SIZE, 8, 4, 8);
+        if (build_lamp(&b, &def) != 0)
+        {
+            failures++;
+            break;
+        }
+    }
+    double build_ns = (now_ns() - start) / NUM_BUILDS;
+    printf("Build and compile: %.2f us per machine, %zu bytes hot, %zu bytes cold\n", build_ns / 1e3,
+           b.hot, b.size - b.cold);
+
+    test_interleaved_transitions();
+
+    free(arena);
+    free(lamp_a);
+    free(lamp_c);
+    free(a);
+    free(c);
+    free(buffer);
+
+    if (failures)
+    {
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
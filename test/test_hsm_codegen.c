@@ -0,0 +1,174 @@
+/*
+ * test_hsm_codegen.c
+ *
+ * The pumping station of test_hsm_codegen.hsm is built twice: once with
+ * State and Transition structs for the interpreter, once by hsm_codegen.
+ * Both are driven with the same ticks and events and must call the same
+ * handlers in the same order and end up in the same states.
+ *
+ * RootStateMachine
+|
++-- Operational (CompositeState)
+|   |
+|   +-- Idle (Leaf)
+|   +-- Running (Leaf, two orthogonal regions)
+|       |
+|       +-- Region 0: PumpOn, PumpOff
+|       +-- Region 1: Logger
+|
++-- Fault (Leaf)
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "hsm/hsm.h"
+#include "test_hsm_codegen.h"
+
+#define NUM_STEPS 5000
+
+typedef struct {
+    unsigned tick;
+    int temperature;
+    unsigned trace;  // Hash of every handler called, in order
+} Station;
+
+static void trace(void *context, unsigned handler)
+{
+    Station *s = context;
+    s->trace = s->trace * 31u + handler;
+}
+
+#define DEFINE_STATE_FUNCS(name, id) \
+    void name##_on_entry(void *context) { trace(context, 3 * (id)); } \
+    void name##_on_exit(void *context)  { trace(context, 3 * (id) + 1); }
+
+DEFINE_STATE_FUNCS(operational, 1)
+DEFINE_STATE_FUNCS(idle, 2)
+DEFINE_STATE_FUNCS(running, 3)
+DEFINE_STATE_FUNCS(fault, 4)
+DEFINE_STATE_FUNCS(pump_on, 5)
+DEFINE_STATE_FUNCS(pump_off, 6)
+DEFINE_STATE_FUNCS(logger, 7)
+
+void idle_on_run(void *context) { trace(context, 100); }
+void running_on_run(void *context) { trace(context, 101); }
+void running_on_event(void *context, int event) { trace(context, 200 + (unsigned)event); }
+void pump_on_on_run(void *context) { ((Station *)context)->temperature++; }
+void pump_off_on_run(void *context) { ((Station *)context)->temperature -= 2; }
+void logger_on_run(void *context) { trace(context, 102); }
+
+int demand_high(void *context) { return ((Station *)context)->tick % 7 == 3; }
+int demand_low(void *context) { return ((Station *)context)->tick % 11 == 0; }
+int even_tick(void *context) { return ((Station *)context)->tick % 2 == 0; }
+int pump_hot(void *context) { return ((Station *)context)->temperature > 5; }
+int pump_cool(void *context) { return ((Station *)context)->temperature < 1; }
+
+extern State operational, idle, running, fault, pump_on, pump_off, logger;
+
+Transition operational_transitions[] = {
+    {&fault, .event = 3},
+};
+Transition idle_transitions[] = {
+    {&running, demand_high},
+    {&running, .event = 1},
+};
+Transition running_transitions[] = {
+    {&idle, demand_low},
+    {&idle, .event = 2},
+    {&operational, even_tick, .event = 5},
+};
+Transition fault_transitions[] = {
+    {&idle, .event = 4},
+    {&fault, .event = 5},
+};
+Transition pump_on_transitions[] = {
+    {&pump_off, pump_hot},
+    {&pump_off, .event = 6},
+};
+Transition pump_off_transitions[] = {
+    {&pump_on, pump_cool},
+};
+
+State pump_on = {NULL, pump_on_on_entry, pump_on_on_run, pump_on_on_exit, NULL, pump_on_transitions, 2};
+State pump_off = {NULL, pump_off_on_entry, pump_off_on_run, pump_off_on_exit, NULL, pump_off_transitions, 1};
+State logger = {NULL, logger_on_entry, logger_on_run, logger_on_exit, NULL, NULL, 0};
+
+State *PumpStates[] = {&pump_on, &pump_off};
+State *LoggerStates[] = {&logger};
+StateMachine RunningRegions[] = {
+    {PumpStates, 2, &pump_on},
+    {LoggerStates, 1, &logger},
+};
+
+State operational = {NULL, operational_on_entry, NULL, operational_on_exit, NULL, operational_transitions, 1};
+State idle = {&operational, idle_on_entry, idle_on_run, idle_on_exit, NULL, idle_transitions, 2};
+State running = {&operational, running_on_entry, running_on_run, running_on_exit, running_on_event,
+                 running_transitions, 3, RunningRegions, 2};
+State fault = {NULL, fault_on_entry, NULL, fault_on_exit, NULL, fault_transitions, 2};
+
+State *States[] = {&operational, &idle, &running, &fault};
+StateMachine sm = {States, 4, &idle};
+
+int main(void)
+{
+    StateMachineDef def;
+    size_t compiled_size = state_machine_compile_size(&sm);
+    void *compiled = malloc(compiled_size);
+    if (state_machine_compile(&sm, &def, compiled, compiled_size) != 0)
+    {
+        printf("Failed to compile state machine\n");
+        return 1;
+    }
+
+    if (def.image->num_states != STATION_NUM_STATES || def.image->num_regions != STATION_NUM_REGIONS ||
+        running.id != STATION_RUNNING || logger.id != STATION_LOGGER)
+    {
+        printf("Generated ids differ from the compiled definition\n");
+        return 1;
+    }
+    if (STATION_STATE_SLOTS != state_machine_state_slots(&def) ||
+        station_instance_size() != state_machine_instance_size(&def))
+    {
+        printf("Generated instance layout differs from the compiled definition\n");
+        return 1;
+    }
+
+    StateMachineInstance *interpreted = malloc(state_machine_instance_size(&def));
+    StateMachineInstance *generated = malloc(station_instance_size());
+    Station interpreted_context = {0, 0, 0};
+    Station generated_context = {0, 0, 0};
+
+    state_machine_init(&def, interpreted, &interpreted_context);
+    station_init(generated, &generated_context);
+
+    int mismatches = 0;
+    for (unsigned step = 0; step < NUM_STEPS; ++step)
+    {
+        interpreted_context.tick = generated_context.tick = step;
+        if (step % 3 == 0)
+        {
+            int event = (int)(step / 3 % 7) + 1;
+            int a = state_machine_send_event(&def, interpreted, event);
+            int b = station_send_event(generated, event);
+            mismatches += a != b;
+        }
+        state_machine_tick(&def, interpreted);
+        station_tick(generated);
+
+        for (unsigned r = 0; r < STATION_STATE_SLOTS; ++r)
+        {
+            mismatches += interpreted->state[r] != generated->state[r];
+        }
+        mismatches += interpreted_context.trace != generated_context.trace ||
+                      interpreted_context.temperature != generated_context.temperature;
+    }
+
+    free(interpreted);
+    free(generated);
+    free(compiled);
+
+    printf("%d steps, %d mismatches\n", NUM_STEPS, mismatches);
+    printf(mismatches ? "FAILED\n" : "OK\n");
+    return mismatches ? 1 : 0;
+}
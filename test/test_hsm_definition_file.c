@@ -0,0 +1,230 @@
+/*
+ * test_hsm_definition_file.c
+ *
+ * A machine of 10100 states is compiled, saved as a definition file, mapped
+ * back and bound by handler name. Instances run from the mapped pages must
+ * behave exactly like instances run from the compiled buffer. Files with a
+ * wrong header, an unbound handler name or a damaged image are rejected.
+ *
+ * RootStateMachine
+|
++-- Group 0 (Composite by parent)
+|   +-- Leaf 0 .. Leaf 99
++-- ...
++-- Group 99
+    +-- Leaf 9900 .. Leaf 9999
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hsm/hsm.h"
+#include "hsm/definition_file.h"
+
+#define NUM_GROUPS 100
+#define LEAVES_PER_GROUP 100
+#define NUM_LEAVES (NUM_GROUPS * LEAVES_PER_GROUP)
+#define NUM_INSTANCES 64
+#define NUM_CYCLES 500
+#define EVENT_SKIP 1
+
+typedef struct {
+    unsigned tick;
+    unsigned seed;
+    unsigned entries;
+    unsigned group_entries;
+    unsigned runs;
+} Walker;
+
+void leaf_entry(void *context) { ((Walker *)context)->entries++; }
+void group_entry(void *context) { ((Walker *)context)->group_entries++; }
+void leaf_run(void *context) { ((Walker *)context)->runs++; ((Walker *)context)->tick++; }
+int due(void *context)
+{
+    Walker *w = context;
+    return (w->tick + w->seed) % 3 == 0;
+}
+
+static State groups[NUM_GROUPS];
+static State leaves[NUM_LEAVES];
+static Transition leaf_transitions[NUM_LEAVES][2];
+static State *root_states[NUM_GROUPS + NUM_LEAVES];
+static StateMachine sm;
+
+static const HandlerBinding bindings[] = {
+    HSM_BIND(leaf_entry),
+    HSM_BIND(group_entry),
+    HSM_BIND(leaf_run),
+    HSM_BIND(due),
+};
+
+static void build_machine(void)
+{
+    for (int g = 0; g < NUM_GROUPS; ++g)
+    {
+        groups[g] = (State){NULL, group_entry};
+        root_states[g] = &groups[g];
+    }
+    for (int i = 0; i < NUM_LEAVES; ++i)
+    {
+        int g = i / LEAVES_PER_GROUP;
+        leaf_transitions[i][0] = (Transition){&leaves[(i + 1) % NUM_LEAVES], due};
+        leaf_transitions[i][1] = (Transition){&leaves[((g + 1) % NUM_GROUPS) * LEAVES_PER_GROUP], NULL, NULL,
+                                              NULL, 0, EVENT_SKIP};
+        leaves[i] = (State){&groups[g], leaf_entry, leaf_run, NULL, NULL, leaf_transitions[i], 2};
+        root_states[NUM_GROUPS + i] = &leaves[i];
+    }
+    sm = (StateMachine){root_states, NUM_GROUPS + NUM_LEAVES, &leaves[0]};
+}
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec * 1e-3;
+}
+
+int main(void)
+{
+    const char *path = "test_hsm_definition_file.hsmd";
+    int failures = 0;
+
+    build_machine();
+    StateMachineDef compiled_def;
+    size_t compiled_size = state_machine_compile_size(&sm);
+    void *compiled = malloc(compiled_size);
+    if (state_machine_compile(&sm, &compiled_def, compiled, compiled_size) != 0)
+    {
+        printf("Failed to compile state machine\n");
+        return 1;
+    }
+
+    // A handler without a name cannot be saved
+    if (definition_file_size(&compiled_def, bindings, 3) != 0)
+    {
+        printf("Saved a handler without a name\n");
+        failures++;
+    }
+
+    FILE *out = fopen(path, "wb");
+    if (!out || definition_file_save(&compiled_def, bindings, 4, out) != 0)
+    {
+        printf("Failed to save definition file\n");
+        return 1;
+    }
+    fclose(out);
+
+    double start = now_us();
+    MappedDefinition map;
+    StateMachineDef mapped_def;
+    HandlerFunc handlers[8];
+    if (definition_file_map(&map, path) != 0 ||
+        definition_file_bind(&mapped_def, map.data, map.size, bindings, 4, handlers, 8, 0) != 0)
+    {
+        printf("Failed to load definition file\n");
+        return 1;
+    }
+    double load_us = now_us() - start;
+
+    if (mapped_def.image->num_states != NUM_GROUPS + NUM_LEAVES ||
+        (const char *)mapped_def.image < (const char *)map.data ||
+        (const char *)mapped_def.image >= (const char *)map.data + map.size)
+    {
+        printf("Definition is not used in place\n");
+        failures++;
+    }
+
+    // Instances of both definitions must walk the same way
+    size_t instance_size = state_machine_instance_size(&compiled_def);
+    char *compiled_instances = calloc(NUM_INSTANCES, instance_size);
+    char *mapped_instances = calloc(NUM_INSTANCES, instance_size);
+    Walker compiled_walkers[NUM_INSTANCES] = {0};
+    Walker mapped_walkers[NUM_INSTANCES] = {0};
+    for (int i = 0; i < NUM_INSTANCES; ++i)
+    {
+        compiled_walkers[i].seed = mapped_walkers[i].seed = (unsigned)i;
+        state_machine_init(&compiled_def, (StateMachineInstance *)(compiled_instances + i * instance_size),
+                           &compiled_walkers[i]);
+        state_machine_init(&mapped_def, (StateMachineInstance *)(mapped_instances + i * instance_size),
+                           &mapped_walkers[i]);
+    }
+    for (int cycle = 0; cycle < NUM_CYCLES; ++cycle)
+    {
+        for (int i = 0; i < NUM_INSTANCES; ++i)
+        {
+            StateMachineInstance *a = (StateMachineInstance *)(compiled_instances + i * instance_size);
+            StateMachineInstance *b = (StateMachineInstance *)(mapped_instances + i * instance_size);
+            if ((cycle + i) % 7 == 0)
+            {
+                state_machine_send_event(&compiled_def, a, EVENT_SKIP);
+                state_machine_send_event(&mapped_def, b, EVENT_SKIP);
+            }
+            state_machine_tick(&compiled_def, a);
+            state_machine_tick(&mapped_def, b);
+        }
+    }
+    if (memcmp(compiled_walkers, mapped_walkers, sizeof(compiled_walkers)) != 0)
+    {
+        failures++;
+    }
+    for (int i = 0; i < NUM_INSTANCES; ++i)
+    {
+        StateMachineInstance *a = (StateMachineInstance *)(compiled_instances + i * instance_size);
+        StateMachineInstance *b = (StateMachineInstance *)(mapped_instances + i * instance_size);
+        if (memcmp(a->state, b->state, instance_size - sizeof(StateMachineInstance)) != 0)
+        {
+            failures++;
+        }
+    }
+    if (compiled_walkers[0].group_entries < 2)
+    {
+        printf("Walkers did not leave their first group\n");
+        failures++;
+    }
+
+    // Damaged copies of the file
+    size_t file_size = map.size;
+    char *copy = aligned_alloc(DEFINITION_FILE_ALIGN, (file_size + DEFINITION_FILE_ALIGN - 1) & ~(size_t)(DEFINITION_FILE_ALIGN - 1));
+    StateMachineDef rejected;
+    const HandlerBinding renamed[] = {
+        HSM_BIND(leaf_entry), HSM_BIND(group_entry), HSM_BIND(leaf_run), {"guard", (HandlerFunc)due},
+    };
+    if (definition_file_bind(&rejected, map.data, map.size, renamed, 4, handlers, 8, 0) == 0)
+    {
+        printf("Bound a file with an unknown handler name\n");
+        failures++;
+    }
+    memcpy(copy, map.data, file_size);
+    copy[0] ^= 1;
+    if (definition_file_bind(&rejected, copy, file_size, bindings, 4, handlers, 8, 0) == 0)
+    {
+        printf("Bound a file with a wrong magic\n");
+        failures++;
+    }
+    memcpy(copy, map.data, file_size);
+    copy[file_size - 1] ^= 1;
+    if (definition_file_bind(&rejected, copy, file_size, bindings, 4, handlers, 8, DEFINITION_FILE_VERIFY) == 0)
+    {
+        printf("Bound a file with a damaged image\n");
+        failures++;
+    }
+    if (definition_file_bind(&rejected, map.data, map.size / 2, bindings, 4, handlers, 8, 0) == 0)
+    {
+        printf("Bound a truncated file\n");
+        failures++;
+    }
+
+    printf("%d states, %zu byte file, mapped and bound in %.1f us\n",
+           NUM_GROUPS + NUM_LEAVES, file_size, load_us);
+
+    definition_file_unmap(&map);
+    remove(path);
+    free(copy);
+    free(compiled_instances);
+    free(mapped_instances);
+    free(compiled);
+    printf(failures ? "FAILED\n" : "OK\n");
+    return failures ? 1 : 0;
+}
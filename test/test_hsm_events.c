@@ -0,0 +1,136 @@
+/*
+ * test_hsm_events.c
+ *
+ * Event-triggered transitions on a small motor controller.
+ *
+ * RootStateMachine
+|
++-- Operational (CompositeState)
+|   |
+|   +-- Idle (Leaf)
+|   +-- Running (Leaf)
+|
++-- Fault (Leaf)
+
+ *
+ * START/STOP/FAULT are numbered densely and use a jump table, RESET and
+ * SERVICE are sparse and use the hashed table. FAULT is declared on
+ * Operational only and is inherited by both of its children.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "hsm/hsm.h"
+
+enum {
+    EV_START = 1,
+    EV_STOP = 2,
+    EV_FAULT = 3,
+    EV_RESET = 1000,
+    EV_SERVICE = 70000
+};
+
+extern State operational, idle, running, fault;
+
+// Entry/exit log of each instance, passed as its context
+char log_a[512];
+char log_b[512];
+
+#define DEFINE_STATE_FUNCS(name) \
+    void name##_on_entry(void *context) { strcat(context, "+" #name " "); } \
+    void name##_on_exit(void *context)  { strcat(context, "-" #name " "); }
+
+DEFINE_STATE_FUNCS(operational);
+DEFINE_STATE_FUNCS(idle);
+DEFINE_STATE_FUNCS(running);
+DEFINE_STATE_FUNCS(fault);
+
+int start_allowed = 0;
+int can_start(void *context) { return start_allowed; }
+
+Transition operational_transitions[] = {
+    {&fault, .event = EV_FAULT},
+};
+Transition idle_transitions[] = {
+    {&running, can_start, .event = EV_START},
+};
+Transition running_transitions[] = {
+    {&idle, .event = EV_STOP},
+};
+Transition fault_transitions[] = {
+    {&idle, .event = EV_RESET},
+    {&fault, .event = EV_SERVICE},
+};
+
+State operational = {NULL, operational_on_entry, NULL, operational_on_exit, NULL, operational_transitions, 1};
+State idle = {&operational, idle_on_entry, NULL, idle_on_exit, NULL, idle_transitions, 1};
+State running = {&operational, running_on_entry, NULL, running_on_exit, NULL, running_transitions, 1};
+State fault = {NULL, fault_on_entry, NULL, fault_on_exit, NULL, fault_transitions, 2};
+
+State *States[] = {&operational, &idle, &running, &fault};
+StateMachine sm = {States, 4, &idle};
+
+int failures = 0;
+StateMachineDef def;
+
+void expect(StateMachineInstance *inst, int event, int consumed, State *state, const char *log)
+{
+    char *log_buffer = inst->context;
+    log_buffer[0] = '\0';
+    int result = state_machine_send_event(&def, inst, event);
+    if (result != consumed || state_machine_current_state(&def, inst, 0) != state->id ||
+        strcmp(log_buffer, log) != 0)
+    {
+        printf("FAILED event %d: consumed %d, log '%s', expected '%s'\n",
+               event, result, log_buffer, log);
+        failures++;
+    }
+}
+
+int main(void)
+{
+    size_t compiled_size = state_machine_compile_size(&sm);
+    void *compiled = malloc(compiled_size);
+    if (state_machine_compile(&sm, &def, compiled, compiled_size) != 0)
+    {
+        printf("Failed to compile state machine\n");
+        return 1;
+    }
+
+    if (def.event_tables[def.states[fault.id].event_table].seed == 0 ||
+        def.event_tables[def.states[running.id].event_table].seed != 0)
+    {
+        printf("FAILED: unexpected event table layout\n");
+        failures++;
+    }
+
+    // Two instances share the definition but keep their own state
+    StateMachineInstance *a = malloc(state_machine_instance_size(&def));
+    StateMachineInstance *b = malloc(state_machine_instance_size(&def));
+    state_machine_init(&def, a, log_a);
+    state_machine_init(&def, b, log_b);
+
+    expect(a, EV_START, 0, &idle, "");                      // Guard blocks START
+    start_allowed = 1;
+    expect(a, EV_START, 1, &running, "-idle +running ");
+    expect(a, EV_RESET, 0, &running, "");                   // Not handled here
+    expect(a, EV_FAULT, 1, &fault, "-running -operational +fault ");
+    expect(b, EV_STOP, 0, &idle, "");
+    expect(a, EV_SERVICE, 1, &fault, "-fault +fault ");     // External self transition
+    expect(a, EV_RESET, 1, &idle, "-fault +operational +idle ");
+    expect(b, EV_FAULT, 1, &fault, "-idle -operational +fault ");
+
+    if (!state_machine_is_active(&def, a, operational.id) ||
+        state_machine_is_active(&def, b, operational.id))
+    {
+        printf("FAILED: unexpected active configuration\n");
+        failures++;
+    }
+
+    free(a);
+    free(b);
+    free(compiled);
+    printf(failures ? "FAILED\n" : "OK\n");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,211 @@
+/*
+ * test_hsm_guard_memo.c
+ *
+ * Three orthogonal channels of a monitor watch the same sensor. The sensor
+ * guard is declared pure, so one tick of one instance must call it at most
+ * once however many channels test it, both with state_machine_tick(),
+ * state_machine_tick_batch() and state_machine_send_event(). An identical
+ * machine without the declaration serves as the reference: both must take
+ * exactly the same transitions.
+ *
+ * RootStateMachine
+|
++-- Monitor (Composite)
+    |
+    +-- Region 0: LowA, HighA
+    +-- Region 1: LowB, HighB
+    +-- Region 2: LowC, HighC
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hsm/hsm.h"
+
+#define NUM_INSTANCES 1000
+#define NUM_CYCLES 100
+#define EVENT_RESET 1
+
+typedef struct {
+    unsigned tick;
+    unsigned phase;
+    unsigned sensor_calls;   // Calls of sensor_high during the current tick
+    unsigned max_calls;      // Largest number of calls seen in one tick
+    unsigned total_calls;
+    unsigned entries;
+} Monitor;
+
+void count_entry(void *context) { ((Monitor *)context)->entries++; }
+void monitor_run(void *context) { ((Monitor *)context)->tick++; }
+
+static int read_sensor(const Monitor *m) { return (m->tick + m->phase) % 4 < 2; }
+
+int sensor_high(void *context)
+{
+    Monitor *m = context;
+    m->sensor_calls++;
+    m->total_calls++;
+    if (m->sensor_calls > m->max_calls)
+    {
+        m->max_calls = m->sensor_calls;
+    }
+    return read_sensor(m);
+}
+
+int sensor_low(void *context) { return !read_sensor(context); }
+
+/* Builds the monitor machine, with or without the pure declaration. */
+typedef struct {
+    State monitor, low[3], high[3];
+    Transition low_transitions[3][1], high_transitions[3][2];
+    State *region_states[3][2];
+    StateMachine regions[3];
+    State *root_states[1];
+    StateMachine root;
+} MonitorMachine;
+
+static void build(MonitorMachine *m, int pure)
+{
+    memset(m, 0, sizeof(*m));
+    for (int r = 0; r < 3; ++r)
+    {
+        m->low_transitions[r][0] = (Transition){&m->high[r], sensor_high};
+        m->high_transitions[r][0] = (Transition){&m->low[r], sensor_low};
+        m->high_transitions[r][1] = (Transition){&m->low[r], sensor_high, NULL, NULL, 0, EVENT_RESET};
+        m->low_transitions[r][0].pure_guard = pure;
+        m->high_transitions[r][1].pure_guard = pure;
+        m->low[r] = (State){NULL, count_entry, NULL, NULL, NULL, m->low_transitions[r], 1};
+        m->high[r] = (State){NULL, count_entry, NULL, NULL, NULL, m->high_transitions[r], 2};
+        m->region_states[r][0] = &m->low[r];
+        m->region_states[r][1] = &m->high[r];
+        m->regions[r] = (StateMachine){m->region_states[r], 2, &m->low[r]};
+    }
+    m->monitor = (State){NULL, count_entry, monitor_run, NULL, NULL, NULL, 0, m->regions, 3};
+    m->root_states[0] = &m->monitor;
+    m->root = (StateMachine){m->root_states, 1, &m->monitor};
+}
+
+typedef struct {
+    MonitorMachine machine;
+    StateMachineDef def;
+    void *compiled;
+    char *instances;
+    size_t instance_size;
+    Monitor contexts[NUM_INSTANCES];
+} Population;
+
+static int setup(Population *p, int pure)
+{
+    build(&p->machine, pure);
+    size_t size = state_machine_compile_size(&p->machine.root);
+    p->compiled = malloc(size);
+    if (state_machine_compile(&p->machine.root, &p->def, p->compiled, size) != 0)
+    {
+        return -1;
+    }
+    p->instance_size = state_machine_instance_size(&p->def);
+    p->instances = calloc(NUM_INSTANCES, p->instance_size);
+    for (int i = 0; i < NUM_INSTANCES; ++i)
+    {
+        p->contexts[i] = (Monitor){.phase = (unsigned)i % 4};
+        state_machine_init(&p->def, (StateMachineInstance *)(p->instances + i * p->instance_size),
+                           &p->contexts[i]);
+    }
+    return 0;
+}
+
+static StateMachineInstance *instance(Population *p, int i)
+{
+    return (StateMachineInstance *)(p->instances + i * p->instance_size);
+}
+
+static void start_tick(Population *p)
+{
+    for (int i = 0; i < NUM_INSTANCES; ++i)
+    {
+        p->contexts[i].sensor_calls = 0;
+    }
+}
+
+int main(void)
+{
+    static Population reference, memoized, batched;
+    int failures = 0;
+
+    if (setup(&reference, 0) != 0 || setup(&memoized, 1) != 0 || setup(&batched, 1) != 0)
+    {
+        printf("Failed to compile state machine\n");
+        return 1;
+    }
+    if (memoized.def.image->num_memos != 1 || reference.def.image->num_memos != 0)
+    {
+        printf("Wrong number of guard memos\n");
+        failures++;
+    }
+
+    StateMachineInstance **pointers = malloc(NUM_INSTANCES * sizeof(*pointers));
+    for (int i = 0; i < NUM_INSTANCES; ++i)
+    {
+        pointers[i] = instance(&batched, i);
+    }
+    void *workspace = malloc(state_machine_batch_workspace_size(&batched.def, NUM_INSTANCES));
+
+    for (int cycle = 0; cycle < NUM_CYCLES; ++cycle)
+    {
+        start_tick(&reference);
+        start_tick(&memoized);
+        start_tick(&batched);
+        for (int i = 0; i < NUM_INSTANCES; ++i)
+        {
+            state_machine_tick(&reference.def, instance(&reference, i));
+            state_machine_tick(&memoized.def, instance(&memoized, i));
+        }
+        state_machine_tick_batch(&batched.def, pointers, NUM_INSTANCES, workspace);
+
+        if (cycle % 10 == 5)
+        {
+            start_tick(&reference);
+            start_tick(&memoized);
+            start_tick(&batched);
+            for (int i = 0; i < NUM_INSTANCES; ++i)
+            {
+                state_machine_send_event(&reference.def, instance(&reference, i), EVENT_RESET);
+                state_machine_send_event(&memoized.def, instance(&memoized, i), EVENT_RESET);
+                state_machine_send_event(&batched.def, instance(&batched, i), EVENT_RESET);
+            }
+        }
+    }
+
+    unsigned reference_calls = 0, memoized_calls = 0;
+    for (int i = 0; i < NUM_INSTANCES; ++i)
+    {
+        size_t slots = reference.instance_size - sizeof(StateMachineInstance);
+        if (memcmp(instance(&reference, i)->state, instance(&memoized, i)->state, slots) != 0 ||
+            memcmp(instance(&reference, i)->state, instance(&batched, i)->state, slots) != 0 ||
+            reference.contexts[i].entries != memoized.contexts[i].entries ||
+            reference.contexts[i].entries != batched.contexts[i].entries)
+        {
+            failures++;
+        }
+        if (memoized.contexts[i].max_calls > 1 || batched.contexts[i].max_calls > 1 ||
+            memoized.contexts[i].total_calls != batched.contexts[i].total_calls)
+        {
+            failures++;
+        }
+        reference_calls += reference.contexts[i].total_calls;
+        memoized_calls += memoized.contexts[i].total_calls;
+    }
+    if (memoized_calls >= reference_calls || reference.contexts[0].max_calls < 2)
+    {
+        printf("Pure guards were not cached\n");
+        failures++;
+    }
+
+    printf("Sensor calls: %u without memo, %u with memo\n", reference_calls, memoized_calls);
+
+    free(workspace);
+    free(pointers);
+    printf(failures ? "FAILED\n" : "OK\n");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * test_hsm_history.c
+ *
+ * Shallow and deep history on a media player. Powering off while music
+ * plays loudly and powering on again must resume according to the history
+ * of the Mode and Volume regions, running only the entry actions of the
+ * states actually resumed: nothing is entered first and left again.
+ *
+ * RootStateMachine
+|
++-- Off (Leaf)
++-- On (Composite)
+    |
+    +-- Region Mode: Menu, Playback (Playing, Paused)
+                                     |
+                                     +-- Playing (Composite)
+                                         +-- Region Volume: Quiet, Loud
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hsm/hsm.h"
+
+enum {
+    EV_POWER = 1,
+    EV_SELECT = 2,
+    EV_UP = 3,
+    EV_PAUSE = 4,
+    EV_RESUME = 5
+};
+
+extern State off, on, menu, playback, playing, paused, quiet, loud;
+
+char log_buffer[512];
+
+#define DEFINE_STATE_FUNCS(name) \
+    void name##_on_entry(void *context) { strcat(context, "+" #name " "); } \
+    void name##_on_exit(void *context)  { strcat(context, "-" #name " "); }
+
+DEFINE_STATE_FUNCS(off);
+DEFINE_STATE_FUNCS(on);
+DEFINE_STATE_FUNCS(menu);
+DEFINE_STATE_FUNCS(playback);
+DEFINE_STATE_FUNCS(playing);
+DEFINE_STATE_FUNCS(paused);
+DEFINE_STATE_FUNCS(quiet);
+DEFINE_STATE_FUNCS(loud);
+
+Transition off_transitions[] = {{&on, .event = EV_POWER}};
+Transition on_transitions[] = {{&off, .event = EV_POWER}};
+Transition menu_transitions[] = {{&playing, .event = EV_SELECT}};
+Transition playing_transitions[] = {{&paused, .event = EV_PAUSE}};
+Transition paused_transitions[] = {{&playing, .event = EV_RESUME}};
+Transition quiet_transitions[] = {{&loud, .event = EV_UP}};
+
+State quiet = {NULL, quiet_on_entry, NULL, quiet_on_exit, NULL, quiet_transitions, 1};
+State loud = {NULL, loud_on_entry, NULL, loud_on_exit};
+State *VolumeStates[] = {&quiet, &loud};
+StateMachine Volume[] = {{VolumeStates, 2, &quiet}};
+
+State menu = {NULL, menu_on_entry, NULL, menu_on_exit, NULL, menu_transitions, 1};
+State playback = {NULL, playback_on_entry, NULL, playback_on_exit};
+State playing = {&playback, playing_on_entry, NULL, playing_on_exit, NULL, playing_transitions, 1, Volume, 1};
+State paused = {&playback, paused_on_entry, NULL, paused_on_exit, NULL, paused_transitions, 1};
+State *ModeStates[] = {&menu, &playback, &playing, &paused};
+StateMachine Mode[] = {{ModeStates, 4, &menu}};
+
+State off = {NULL, off_on_entry, NULL, off_on_exit, NULL, off_transitions, 1};
+State on = {NULL, on_on_entry, NULL, on_on_exit, NULL, on_transitions, 1, Mode, 1};
+State *States[] = {&off, &on};
+StateMachine sm = {States, 2, &off};
+
+int failures = 0;
+StateMachineDef def;
+StateMachineInstance *inst;
+
+static void expect(const char *name, int event, const char *log)
+{
+    log_buffer[0] = '\0';
+    state_machine_send_event(&def, inst, event);
+    if (strcmp(log_buffer, log) != 0)
+    {
+        printf("FAILED %s, event %d: log '%s', expected '%s'\n", name, event, log_buffer, log);
+        failures++;
+    }
+}
+
+/* Compiles the player with the given history on both regions and plays
+   until powered off while playing loudly. */
+static void *start(const char *name, int mode_history, int volume_history)
+{
+    Mode[0].history = mode_history;
+    Volume[0].history = volume_history;
+    size_t compiled_size = state_machine_compile_size(&sm);
+    void *compiled = malloc(compiled_size);
+    if (state_machine_compile(&sm, &def, compiled, compiled_size) != 0)
+    {
+        printf("Failed to compile state machine\n");
+        exit(1);
+    }
+    inst = realloc(inst, state_machine_instance_size(&def));
+    log_buffer[0] = '\0';
+    state_machine_init(&def, inst, log_buffer);
+
+    expect(name, EV_POWER, "-off +on +menu ");
+    expect(name, EV_SELECT, "-menu +playback +playing +quiet ");
+    expect(name, EV_UP, "-quiet +loud ");
+    expect(name, EV_POWER, "-loud -playing -playback -on +off ");
+    return compiled;
+}
+
+int main(void)
+{
+    void *compiled;
+
+    // Without history everything starts over
+    compiled = start("none", HSM_HISTORY_NONE, HSM_HISTORY_NONE);
+    if (state_machine_instance_size(&def) != sizeof(StateMachineInstance) + 2 * 3 * sizeof(StateId) ||
+        state_machine_history_state(&def, inst, Mode[0].id) != HSM_NO_STATE)
+    {
+        printf("FAILED: history slots without history\n");
+        failures++;
+    }
+    expect("none", EV_POWER, "-off +on +menu ");
+    free(compiled);
+
+    // Shallow history resumes the top-level state of Mode only
+    compiled = start("shallow", HSM_HISTORY_SHALLOW, HSM_HISTORY_NONE);
+    if (state_machine_history_state(&def, inst, Mode[0].id) != playing.id ||
+        state_machine_history_state(&def, inst, Volume[0].id) != loud.id)
+    {
+        printf("FAILED: history not recorded on exit\n");
+        failures++;
+    }
+    expect("shallow", EV_POWER, "-off +on +playback ");
+    free(compiled);
+
+    // Deep history resumes the leaf of Mode and the nested Volume region
+    compiled = start("deep", HSM_HISTORY_DEEP, HSM_HISTORY_NONE);
+    expect("deep", EV_POWER, "-off +on +playback +playing +loud ");
+    if (state_machine_current_state(&def, inst, Mode[0].id) != playing.id ||
+        state_machine_current_state(&def, inst, Volume[0].id) != loud.id)
+    {
+        printf("FAILED: deep history did not restore the configuration\n");
+        failures++;
+    }
+    expect("deep", EV_PAUSE, "-loud -playing +paused ");
+    expect("deep", EV_POWER, "-paused -playback -on +off ");
+    expect("deep", EV_POWER, "-off +on +playback +paused ");
+    // An ordinary transition into Playing does not resume Volume
+    expect("deep", EV_RESUME, "-paused +playing +quiet ");
+    free(compiled);
+
+    // History of a nested region applies whenever its owner is entered
+    compiled = start("nested", HSM_HISTORY_NONE, HSM_HISTORY_SHALLOW);
+    expect("nested", EV_POWER, "-off +on +menu ");
+    expect("nested", EV_SELECT, "-menu +playback +playing +loud ");
+    free(compiled);
+
+    free(inst);
+    printf(failures ? "FAILED\n" : "OK\n");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,237 @@
+/*
+ * test_hsm_input_mask.c
+ *
+ * A switchboard of eight states, each leaving through twelve polled
+ * transitions. Most are guarded by bitmasks on the input word of the
+ * context, some also by a condition and one by a condition only. A plain C
+ * model of the polling order predicts the state after every tick;
+ * state_machine_tick() and state_machine_tick_batch() must both follow it
+ * for random inputs. The scalar kernels are checked against a plain
+ * expression and the dispatched (SIMD on x86) kernels against the scalar
+ * ones.
+ *
+ * RootStateMachine
+|
++-- S0 .. S7 (Leaf), each with transitions to the next twelve states
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hsm/hsm.h"
+#include "hsm/input_mask.h"
+
+#define NUM_STATES 8
+#define NUM_EXITS 12
+#define NUM_INSTANCES 2000
+#define NUM_CYCLES 200
+
+typedef struct {
+    uint32_t inputs;
+    unsigned tick;
+    unsigned entries;
+} Switchboard;
+
+void count_entry(void *context) { ((Switchboard *)context)->entries++; }
+void advance(void *context) { ((Switchboard *)context)->tick++; }
+int even_tick(void *context) { return ((Switchboard *)context)->tick % 2 == 0; }
+int seventh_tick(void *context) { return ((Switchboard *)context)->tick % 7 == 0; }
+
+static State states[NUM_STATES];
+static Transition exits[NUM_STATES][NUM_EXITS];
+static State *root_states[NUM_STATES];
+static StateMachine sm;
+
+static uint32_t exit_mask(int state, int k) { return (0x11u << ((state + k) % 24)) | (1u << (k + 8)); }
+static uint32_t exit_value(int state, int k) { return (k + state) % 3 ? exit_mask(state, k) : 1u << (k + 8); }
+
+static void build_machine(void)
+{
+    for (int i = 0; i < NUM_STATES; ++i)
+    {
+        for (int k = 0; k < NUM_EXITS; ++k)
+        {
+            Transition *t = &exits[i][k];
+            *t = (Transition){&states[(i + k + 1) % NUM_STATES]};
+            if (k == NUM_EXITS - 1)
+            {
+                t->condition = seventh_tick;
+                continue;
+            }
+            t->input_mask = exit_mask(i, k);
+            t->input_value = exit_value(i, k);
+            if (k % 4 == 3)
+            {
+                t->condition = even_tick;
+            }
+        }
+        states[i] = (State){NULL, count_entry, advance, NULL, NULL, exits[i], NUM_EXITS};
+        root_states[i] = &states[i];
+    }
+    sm = (StateMachine){root_states, NUM_STATES, &states[0], offsetof(Switchboard, inputs)};
+}
+
+/* Plain C model of one tick: the first exit whose guards pass is taken,
+   otherwise the state runs. */
+static int model_tick(int state, Switchboard *b)
+{
+    for (int k = 0; k < NUM_EXITS; ++k)
+    {
+        const Transition *t = &exits[state][k];
+        if (t->input_mask && (b->inputs & t->input_mask) != t->input_value)
+        {
+            continue;
+        }
+        if (t->condition && !t->condition(b))
+        {
+            continue;
+        }
+        b->entries++;
+        return (state + k + 1) % NUM_STATES;
+    }
+    b->tick++;
+    return state;
+}
+
+static uint32_t random_inputs(unsigned *seed)
+{
+    *seed = *seed * 1103515245u + 12345u;
+    uint32_t r = *seed;
+    *seed = *seed * 1103515245u + 12345u;
+    return r ^ (*seed >> 7) ^ (*seed << 13);
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int check_kernels(void)
+{
+    uint32_t masks[64], values[64], inputs[64];
+    unsigned seed = 7;
+    int failures = 0;
+
+    for (int round = 0; round < 1000; ++round)
+    {
+        for (int i = 0; i < 64; ++i)
+        {
+            masks[i] = random_inputs(&seed) & random_inputs(&seed);
+            values[i] = masks[i] & (round % 2 ? random_inputs(&seed) : ~0u);
+            inputs[i] = random_inputs(&seed) | (round % 3 ? 0 : masks[i]);
+        }
+        uint32_t in = random_inputs(&seed);
+        unsigned count = 8 * (1 + (unsigned)round % 8);
+        uint64_t expected_guards = 0, expected_inputs = 0;
+        for (unsigned i = 0; i < count; ++i)
+        {
+            expected_guards |= (uint64_t)((in & masks[i]) == values[i]) << i;
+        }
+        unsigned n = 1 + (unsigned)round % 64;
+        for (unsigned i = 0; i < n; ++i)
+        {
+            expected_inputs |= (uint64_t)((inputs[i] & masks[0]) == values[0]) << i;
+        }
+        uint64_t scalar_guards = input_mask_match_guards_scalar(masks, values, count, in);
+        uint64_t scalar_inputs = input_mask_match_inputs_scalar(inputs, n, masks[0], values[0]);
+        if (scalar_guards != expected_guards || scalar_inputs != expected_inputs)
+        {
+            failures++;
+        }
+        if (input_mask_match_guards(masks, values, count, in) != scalar_guards ||
+            input_mask_match_inputs(inputs, n, masks[0], values[0]) != scalar_inputs)
+        {
+            failures++;
+        }
+    }
+    return failures;
+}
+
+int main(void)
+{
+    int failures = check_kernels();
+    if (failures)
+    {
+        printf("Kernels disagree with the scalar reference\n");
+    }
+
+    build_machine();
+    StateMachineDef def;
+    size_t compiled_size = state_machine_compile_size(&sm);
+    void *compiled = malloc(compiled_size);
+    if (state_machine_compile(&sm, &def, compiled, compiled_size) != 0)
+    {
+        printf("Failed to compile state machine\n");
+        return 1;
+    }
+
+    size_t instance_size = state_machine_instance_size(&def);
+    char *single = calloc(NUM_INSTANCES, instance_size);
+    char *batched = calloc(NUM_INSTANCES, instance_size);
+    static Switchboard single_boards[NUM_INSTANCES], batched_boards[NUM_INSTANCES], model_boards[NUM_INSTANCES];
+    static int model_states[NUM_INSTANCES];
+    StateMachineInstance **pointers = malloc(NUM_INSTANCES * sizeof(*pointers));
+    void *workspace = malloc(state_machine_batch_workspace_size(&def, NUM_INSTANCES));
+
+    for (int i = 0; i < NUM_INSTANCES; ++i)
+    {
+        pointers[i] = (StateMachineInstance *)(batched + i * instance_size);
+        state_machine_init(&def, (StateMachineInstance *)(single + i * instance_size), &single_boards[i]);
+        state_machine_init(&def, pointers[i], &batched_boards[i]);
+        model_boards[i].entries = 1;
+    }
+
+    unsigned seed = 1;
+    int transitions = 0;
+    double tick_ns = 0;
+    for (int cycle = 0; cycle < NUM_CYCLES; ++cycle)
+    {
+        for (int i = 0; i < NUM_INSTANCES; ++i)
+        {
+            uint32_t inputs = random_inputs(&seed);
+            single_boards[i].inputs = batched_boards[i].inputs = model_boards[i].inputs = inputs;
+            int next = model_tick(model_states[i], &model_boards[i]);
+            transitions += next != model_states[i];
+            model_states[i] = next;
+        }
+
+        double start = now_ns();
+        for (int i = 0; i < NUM_INSTANCES; ++i)
+        {
+            state_machine_tick(&def, (StateMachineInstance *)(single + i * instance_size));
+        }
+        tick_ns += now_ns() - start;
+        state_machine_tick_batch(&def, pointers, NUM_INSTANCES, workspace);
+
+        for (int i = 0; i < NUM_INSTANCES; ++i)
+        {
+            const StateMachineInstance *a = (const StateMachineInstance *)(single + i * instance_size);
+            if (a->state[0] != states[model_states[i]].id || pointers[i]->state[0] != a->state[0] ||
+                memcmp(&single_boards[i], &model_boards[i], sizeof(Switchboard)) != 0 ||
+                memcmp(&batched_boards[i], &model_boards[i], sizeof(Switchboard)) != 0)
+            {
+                failures++;
+            }
+        }
+    }
+    if (transitions == 0 || transitions == NUM_INSTANCES * NUM_CYCLES)
+    {
+        printf("Inputs did not exercise the guards\n");
+        failures++;
+    }
+
+    printf("%s kernels, %d transitions, %.1f ns per tick\n", input_mask_isa(), transitions,
+           tick_ns / (NUM_INSTANCES * NUM_CYCLES));
+
+    free(workspace);
+    free(pointers);
+    free(single);
+    free(batched);
+    free(compiled);
+    printf(failures ? "FAILED\n" : "OK\n");
+    return failures ? 1 : 0;
+}
@@ -1,19 +1,187 @@
+/*
+ * test_hsm_parallel.c
+ *
+ * A controller composite with three orthogonal regions, each with heavy and
+ * independent on_run work: a CPU load monitor, sensor fusion and actuator
+ * control. The machine is run twice, once with the regions ticked one after
+ * another and once with them ticked concurrently on a worker pool. Both runs
+ * must end in the same states with the same context, and the concurrent run
+ * should be faster on a multi-core machine.
+ *
+ * RootStateMachine
+|
++-- Controller (Composite, parallel regions)
+    |
+    +-- Region 0: LoadMonitor
+    |   +-- CpuIdle (Leaf)
+    |   +-- CpuBusy (Leaf)
+    |   +-- CpuOverload (Leaf)
+    |
+    +-- Region 1: SensorFusion
+    |   +-- Fusing (Leaf)
+    |
+    +-- Region 2: ActuatorControl
+        +-- Driving (Leaf)
+
+ */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
-#include "hsm/hsm.h"  // Assumes your hierarchical state machine types and functions are defined here
+#include <time.h>
+#include "hsm/hsm.h"
+#include "hsm/worker_pool.h"
+
+#define NUM_TICKS 300
+#define WORK_UNITS 200000
+
+// Every region only touches its own part of the context
+typedef struct {
+    struct { unsigned load; unsigned samples; unsigned idle, busy, over; } monitor;
+    struct { unsigned estimate; } fusion;
+    struct { unsigned command; } actuator;
+} Controller;
+
+static unsigned crunch(unsigned seed)
+{
+    for (unsigned i = 0; i < WORK_UNITS; ++i)
+    {
+        seed = seed * 1664525u + 1013904223u;
+    }
+    return seed;
+}
+
+extern State cpu_idle, cpu_busy, cpu_over, fusing, driving;
 
-void cpu_idle_on_entry(void) {printf("Entered CPU idle.\n");}
-void cpu_busy_on_entry(void) {printf("Entered CPU busy.\n");}
-void cpu_over_on_entry(void) {printf("Entered CPU overload.\n");}
+void cpu_idle_on_entry(void *context) { ((Controller *)context)->monitor.idle++; }
+void cpu_busy_on_entry(void *context) { ((Controller *)context)->monitor.busy++; }
+void cpu_over_on_entry(void *context) { ((Controller *)context)->monitor.over++; }
+
+void monitor_on_run(void *context)
+{
+    Controller *c = context;
+    c->monitor.samples = crunch(c->monitor.samples);
+    c->monitor.load = c->monitor.samples % 100;
+}
+
+int load_low(void *context) { return ((Controller *)context)->monitor.load < 30; }
+int load_high(void *context) { return ((Controller *)context)->monitor.load >= 30; }
+int load_critical(void *context) { return ((Controller *)context)->monitor.load >= 90; }
+int load_normal(void *context) { return ((Controller *)context)->monitor.load < 90; }
+
+void fusing_on_run(void *context)
+{
+    Controller *c = context;
+    c->fusion.estimate = crunch(c->fusion.estimate);
+}
+
+void driving_on_run(void *context)
+{
+    Controller *c = context;
+    c->actuator.command = crunch(c->actuator.command ^ 0x5a5a5a5au);
+}
 
-State cpu_idle, cpu_busy, cpu_over;
+Transition cpu_idle_transitions[] = {
+    {&cpu_busy, load_high},
+};
+Transition cpu_busy_transitions[] = {
+    {&cpu_over, load_critical},
+    {&cpu_idle, load_low},
+};
+Transition cpu_over_transitions[] = {
+    {&cpu_busy, load_normal},
+};
+
+State cpu_idle = {NULL, cpu_idle_on_entry, monitor_on_run, NULL, NULL, cpu_idle_transitions, 1};
+State cpu_busy = {NULL, cpu_busy_on_entry, monitor_on_run, NULL, NULL, cpu_busy_transitions, 2};
+State cpu_over = {NULL, cpu_over_on_entry, monitor_on_run, NULL, NULL, cpu_over_transitions, 1};
+State fusing = {NULL, NULL, fusing_on_run, NULL, NULL, NULL, 0};
+State driving = {NULL, NULL, driving_on_run, NULL, NULL, NULL, 0};
+
+State *MonitorStates[] = {&cpu_idle, &cpu_busy, &cpu_over};
+State *FusionStates[] = {&fusing};
+State *ActuatorStates[] = {&driving};
+
+StateMachine ControllerRegions[] = {
+    {MonitorStates, 3, &cpu_idle},
+    {FusionStates, 1, &fusing},
+    {ActuatorStates, 1, &driving},
+};
+
+State controller = {NULL, NULL, NULL, NULL, NULL, NULL, 0, ControllerRegions, 3, 1};
+
+State *States[] = {&controller};
+StateMachine sm = {States, 1, &controller};
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Runs NUM_TICKS ticks from a fresh context and returns the elapsed time
+static double run(const StateMachineDef *def, StateMachineInstance *inst, Controller *c)
+{
+    memset(c, 0, sizeof(*c));
+    c->fusion.estimate = 7;
+    c->actuator.command = 11;
+    state_machine_init(def, inst, c);
+
+    double start = now_seconds();
+    for (int tick = 0; tick < NUM_TICKS; ++tick)
+    {
+        state_machine_tick(def, inst);
+    }
+    return now_seconds() - start;
+}
 
 int main(void)
 {
+    StateMachineDef def;
+    size_t compiled_size = state_machine_compile_size(&sm);
+    void *compiled = malloc(compiled_size);
+    if (state_machine_compile(&sm, &def, compiled, compiled_size) != 0)
+    {
+        printf("Failed to compile state machine\n");
+        return 1;
+    }
+
+    StateMachineInstance *sequential = malloc(state_machine_instance_size(&def));
+    StateMachineInstance *parallel = malloc(state_machine_instance_size(&def));
+    Controller sequential_context, parallel_context;
+
+    double sequential_time = run(&def, sequential, &sequential_context);
+
+    WorkerPool pool;
+    if (worker_pool_init(&pool, 3, NULL) != 0)
+    {
+        printf("Failed to start worker pool\n");
+        return 1;
+    }
+    def.region_pool = &pool;
+    double parallel_time = run(&def, parallel, &parallel_context);
+    worker_pool_destroy(&pool);
 
+    int mismatches = memcmp(&sequential_context, &parallel_context, sizeof(Controller)) != 0;
+    for (unsigned region = 0; region < def.image->num_regions; ++region)
+    {
+        if (state_machine_current_state(&def, sequential, region) !=
+            state_machine_current_state(&def, parallel, region))
+        {
+            mismatches++;
+        }
+    }
 
+    printf("CPU idle entered %u times, busy %u times, overload %u times\n",
+           parallel_context.monitor.idle, parallel_context.monitor.busy, parallel_context.monitor.over);
+    printf("sequential regions %.3f s, parallel regions %.3f s, speedup %.2fx\n",
+           sequential_time, parallel_time, sequential_time / parallel_time);
 
+    free(sequential);
+    free(parallel);
+    free(compiled);
 
-}
\ No newline at end of file
+    printf(mismatches ? "FAILED\n" : "OK\n");
+    return mismatches ? 1 : 0;
+}
@@ -0,0 +1,340 @@
+/*
+ * test_hsm_snapshot.c
+ *
+ * A population of process controllers, each with two orthogonal regions,
+ * is run for a while, checkpointed and restored into freshly allocated
+ * instances. The restored population must have the same configuration, no
+ * entry action may run while restoring, and both populations must keep
+ * behaving identically afterwards. Snapshots of another machine and
+ * corrupted snapshots must be rejected.
+ *
+ * A purge cycle with a timed state and asynchronous entry work is then
+ * rolled back in place with a fresh wheel: the timer of the restored
+ * Rinsing must fire again, no entry work may be started by the restore,
+ * and the completion of the work started before the snapshot is ignored.
+ * Restarting the asynchronous work of the restored Flushing afterwards
+ * must let it complete.
+ *
+ * RootStateMachine
+|
++-- Stopped (Leaf)
++-- Active (Composite)
+    |
+    +-- Region 0: Filling, Draining
+    +-- Region 1: Heating, Holding
+
+RootStateMachine
+|
++-- Flushing (Leaf)   entry: start flush, FLUSHED -> Rinsing
++-- Rinsing (Leaf)    after 10 -> Flushing
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hsm/event_queue.h"
+#include "hsm/hsm.h"
+#include "hsm/snapshot.h"
+#include "hsm/timer_wheel.h"
+
+#define NUM_INSTANCES 100000
+#define NUM_CYCLES 20
+#define EV_FLUSHED 1
+
+typedef struct {
+    unsigned tick;
+    unsigned level;
+    unsigned temperature;
+    unsigned entries;
+} Process;
+
+extern State stopped, active, filling, draining, heating, holding;
+
+void count_entry(void *context) { ((Process *)context)->entries++; }
+void active_on_run(void *context) { ((Process *)context)->tick++; }
+void stopped_on_run(void *context) { ((Process *)context)->tick++; }
+void filling_on_run(void *context) { ((Process *)context)->level += 3; }
+void draining_on_run(void *context) { ((Process *)context)->level -= 2; }
+void heating_on_run(void *context) { ((Process *)context)->temperature += 2; }
+void holding_on_run(void *context) { ((Process *)context)->temperature--; }
+
+int should_start(void *context) { return ((Process *)context)->tick % 5 == 4; }
+int should_stop(void *context) { return ((Process *)context)->tick % 13 == 12; }
+int full(void *context) { return ((Process *)context)->level > 20; }
+int empty(void *context) { return ((Process *)context)->level < 5; }
+int hot(void *context) { return ((Process *)context)->temperature > 60; }
+int cold(void *context) { return ((Process *)context)->temperature < 50; }
+
+Transition stopped_transitions[] = {{&active, should_start}};
+Transition active_transitions[] = {{&stopped, should_stop}};
+Transition filling_transitions[] = {{&draining, full}};
+Transition draining_transitions[] = {{&filling, empty}};
+Transition heating_transitions[] = {{&holding, hot}};
+Transition holding_transitions[] = {{&heating, cold}};
+
+State filling = {NULL, count_entry, filling_on_run, NULL, NULL, filling_transitions, 1};
+State draining = {NULL, count_entry, draining_on_run, NULL, NULL, draining_transitions, 1};
+State heating = {NULL, count_entry, heating_on_run, NULL, NULL, heating_transitions, 1};
+State holding = {NULL, count_entry, holding_on_run, NULL, NULL, holding_transitions, 1};
+
+State *LevelStates[] = {&filling, &draining};
+State *TemperatureStates[] = {&heating, &holding};
+StateMachine ActiveRegions[] = {
+    {LevelStates, 2, &filling},
+    {TemperatureStates, 2, &heating},
+};
+
+State stopped = {NULL, count_entry, stopped_on_run, NULL, NULL, stopped_transitions, 1};
+State active = {NULL, count_entry, active_on_run, NULL, NULL, active_transitions, 1, ActiveRegions, 2};
+
+State *States[] = {&stopped, &active};
+StateMachine sm = {States, 2, &stopped};
+
+// A different machine, only used to check that its snapshots are refused
+State other = {NULL};
+State *OtherStates[] = {&other, &stopped};
+StateMachine other_sm = {OtherStates, 1, &other};
+
+typedef struct {
+    AsyncToken token;  // Flush in flight
+    unsigned starts;
+} Purge;
+
+extern State flushing, rinsing;
+
+int start_flush(void *context, AsyncToken token)
+{
+    Purge *p = context;
+    p->token = token;
+    p->starts++;
+    return HSM_ASYNC_PENDING;
+}
+
+Transition flushing_transitions[] = {{&rinsing, .event = EV_FLUSHED}};
+Transition rinsing_transitions[] = {{&flushing, .after = 10}};
+
+State flushing = {NULL, NULL, NULL, NULL, NULL, flushing_transitions, 1,
+                  .async_entry = start_flush, .done_event = EV_FLUSHED};
+State rinsing = {NULL, NULL, NULL, NULL, NULL, rinsing_transitions, 1};
+
+State *PurgeStates[] = {&flushing, &rinsing};
+StateMachine purge_sm = {PurgeStates, 2, &flushing};
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+static StateMachineInstance **allocate(const StateMachineDef *def, Process *contexts)
+{
+    size_t size = state_machine_instance_size(def);
+    char *arena = malloc(size * NUM_INSTANCES);
+    StateMachineInstance **instances = malloc(NUM_INSTANCES * sizeof(*instances));
+    for (int i = 0; i < NUM_INSTANCES; ++i)
+    {
+        instances[i] = (StateMachineInstance *)(arena + i * size);
+        instances[i]->context = &contexts[i];
+    }
+    return instances;
+}
+
+static int check(int cond, const char *what)
+{
+    if (!cond)
+    {
+        printf("%s\n", what);
+    }
+    return !cond;
+}
+
+/* Rolls one purge in Rinsing and one in Flushing back to a snapshot, in
+   place and with a fresh wheel, as after restarting a faulted controller */
+static int test_timers_and_async(void)
+{
+    StateMachineDef def;
+    size_t compiled_size = state_machine_compile_size(&purge_sm);
+    void *compiled = malloc(compiled_size);
+    if (state_machine_compile(&purge_sm, &def, compiled, compiled_size) != 0)
+    {
+        printf("Failed to compile state machine\n");
+        return 1;
+    }
+    TimerWheel wheel;
+    EventQueue queue;
+    EventQueueSlot slots[8];
+    timer_wheel_init(&wheel, 0);
+    event_queue_init(&queue, slots, 8);
+    def.timer_wheel = &wheel;
+
+    size_t size = state_machine_instance_size(&def);
+    StateMachineInstance *instances[2] = {malloc(size), malloc(size)};
+    Purge contexts[2] = {{{0}}}, saved_contexts[2];
+    int failures = 0;
+
+    for (int i = 0; i < 2; ++i)
+    {
+        state_machine_set_queue(&def, instances[i], &queue);
+        state_machine_init(&def, instances[i], &contexts[i]);
+    }
+    state_machine_complete(contexts[0].token);
+    state_machine_dispatch(&def, instances[0], &queue, 0);
+    timer_wheel_advance(&wheel, 3, state_machine_expire, &def);
+    failures += check(state_machine_current_state(&def, instances[0], 0) == rinsing.id,
+                      "Purge did not start rinsing");
+
+    size_t snapshot_size = state_machine_snapshot_size(&def, 2);
+    void *blob = malloc(snapshot_size);
+    size_t written = state_machine_snapshot(&def, instances, 2, blob, snapshot_size);
+    memcpy(saved_contexts, contexts, sizeof(contexts));
+    AsyncToken stale = contexts[1].token;
+
+    // Restart: a new wheel, the contexts rolled back, then the configuration
+    timer_wheel_init(&wheel, 100);
+    memcpy(contexts, saved_contexts, sizeof(contexts));
+    failures += check(state_machine_restore(&def, instances, 2, blob, written) == 0, "Restore failed");
+    failures += check(wheel.armed == 1, "Rinsing timer not re-armed");
+    failures += check(contexts[0].starts == 1 && contexts[1].starts == 1, "Restore ran entry work");
+
+    // The flush started before the snapshot completes late and is ignored
+    failures += check(state_machine_complete(stale) != 0 && event_queue_depth(&queue) == 0,
+                      "Stale completion accepted");
+
+    state_machine_restart_async(&def, instances[0]);
+    state_machine_restart_async(&def, instances[1]);
+    failures += check(contexts[0].starts == 1 && contexts[1].starts == 2, "Flush work not restarted");
+    state_machine_complete(contexts[1].token);
+    state_machine_dispatch(&def, instances[1], &queue, 0);
+    failures += check(state_machine_current_state(&def, instances[1], 0) == rinsing.id,
+                      "Restarted flush did not complete");
+
+    timer_wheel_advance(&wheel, 109, state_machine_expire, &def);
+    failures += check(state_machine_current_state(&def, instances[0], 0) == rinsing.id,
+                      "Restored timer fired early");
+    timer_wheel_advance(&wheel, 110, state_machine_expire, &def);
+    failures += check(state_machine_current_state(&def, instances[0], 0) == flushing.id &&
+                      contexts[0].starts == 2, "Restored timer did not fire");
+
+    free(instances[0]);
+    free(instances[1]);
+    free(blob);
+    free(compiled);
+    return failures;
+}
+
+int main(void)
+{
+    StateMachineDef def;
+    size_t compiled_size = state_machine_compile_size(&sm);
+    void *compiled = malloc(compiled_size);
+    if (state_machine_compile(&sm, &def, compiled, compiled_size) != 0)
+    {
+        printf("Failed to compile state machine\n");
+        return 1;
+    }
+
+    static Process original_contexts[NUM_INSTANCES];
+    static Process restored_contexts[NUM_INSTANCES];
+    StateMachineInstance **original = allocate(&def, original_contexts);
+    StateMachineInstance **restored = allocate(&def, restored_contexts);
+    int failures = 0;
+
+    for (int i = 0; i < NUM_INSTANCES; ++i)
+    {
+        original_contexts[i].tick = (unsigned)i % 17;
+        original_contexts[i].level = 5 + (unsigned)i % 15;
+        original_contexts[i].temperature = 50 + (unsigned)i % 10;
+        state_machine_init(&def, original[i], &original_contexts[i]);
+    }
+    for (int cycle = 0; cycle < NUM_CYCLES; ++cycle)
+    {
+        for (int i = 0; i < NUM_INSTANCES; ++i)
+        {
+            state_machine_tick(&def, original[i]);
+        }
+    }
+
+    size_t size = state_machine_snapshot_size(&def, NUM_INSTANCES);
+    unsigned char *blob = malloc(size);
+
+    double start = now_ms();
+    size_t written = state_machine_snapshot(&def, original, NUM_INSTANCES, blob, size);
+    double snapshot_ms = now_ms() - start;
+
+    // Contexts travel separately; copy them the way an application would
+    memcpy(restored_contexts, original_contexts, sizeof(original_contexts));
+    unsigned entries_before = 0;
+    for (int i = 0; i < NUM_INSTANCES; ++i)
+    {
+        entries_before += restored_contexts[i].entries;
+    }
+
+    start = now_ms();
+    int result = state_machine_restore(&def, restored, NUM_INSTANCES, blob, written);
+    double restore_ms = now_ms() - start;
+
+    unsigned entries_after = 0;
+    for (int i = 0; i < NUM_INSTANCES; ++i)
+    {
+        entries_after += restored_contexts[i].entries;
+    }
+    if (written != size || result != 0 || entries_after != entries_before)
+    {
+        printf("Snapshot or restore failed\n");
+        failures++;
+    }
+
+    // Both populations must keep behaving the same
+    for (int cycle = 0; cycle < NUM_CYCLES; ++cycle)
+    {
+        for (int i = 0; i < NUM_INSTANCES; ++i)
+        {
+            state_machine_tick(&def, original[i]);
+            state_machine_tick(&def, restored[i]);
+        }
+    }
+    size_t instance_size = state_machine_instance_size(&def) - sizeof(StateMachineInstance);
+    for (int i = 0; i < NUM_INSTANCES; ++i)
+    {
+        if (memcmp(original[i]->state, restored[i]->state, instance_size) != 0 ||
+            memcmp(&original_contexts[i], &restored_contexts[i], sizeof(Process)) != 0)
+        {
+            failures++;
+        }
+    }
+
+    // A snapshot of another machine is refused
+    StateMachineDef other_def;
+    size_t other_size = state_machine_compile_size(&other_sm);
+    void *other_compiled = malloc(other_size);
+    state_machine_compile(&other_sm, &other_def, other_compiled, other_size);
+    if (state_machine_restore(&other_def, restored, NUM_INSTANCES, blob, written) == 0)
+    {
+        printf("Restored a snapshot of another machine\n");
+        failures++;
+    }
+    state_machine_compile(&sm, &def, compiled, compiled_size);
+
+    // So is a state stored in the wrong region
+    StateId *slots = (StateId *)(blob + sizeof(SnapshotHeader));
+    slots[1] = stopped.id;
+    if (state_machine_restore(&def, restored, NUM_INSTANCES, blob, written) == 0)
+    {
+        printf("Restored a corrupted snapshot\n");
+        failures++;
+    }
+
+    printf("%d instances, %zu byte snapshot, saved in %.2f ms, restored in %.2f ms\n",
+           NUM_INSTANCES, written, snapshot_ms, restore_ms);
+
+    free(blob);
+    free(other_compiled);
+    free(compiled);
+
+    failures += test_timers_and_async();
+    printf(failures ? "FAILED\n" : "OK\n");
+    return failures ? 1 : 0;
+}
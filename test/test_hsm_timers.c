@@ -0,0 +1,339 @@
+/*
+ * test_hsm_timers.c
+ *
+ * First the timing wheel on its own: a million timers spread over three
+ * levels, a third of them cancelled, must each fire exactly on their tick.
+ * Then time-triggered transitions on a heater, whose timers must be armed
+ * on entry, survive transitions below their state and be cancelled when
+ * their state is left. Finally a composite with parallel regions whose
+ * states arm timers on every tick: with a region pool and a wheel attached
+ * the regions must not touch the wheel concurrently.
+ *
+ * RootStateMachine
+|
++-- Idle (Leaf)          after 50 -> Heating
++-- Active (Composite)   after 100 -> Idle, STOP -> Idle
+    |
+    +-- Heating (Leaf)   after 20 -> Holding
+    +-- Holding (Leaf)   after 30 if hot -> Heating
+
+RootStateMachine
+|
++-- Lanes (Composite, parallel regions)
+    |
+    +-- Region 0: Ping0 <-> Pong0   every tick, or after 1000
+    +-- Region 1: Ping1 <-> Pong1   every tick, or after 1000
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hsm/hsm.h"
+#include "hsm/timer_wheel.h"
+#include "hsm/worker_pool.h"
+
+#define NUM_TIMERS 1000000
+#define MAX_DELAY (1u << 20)
+#define NUM_HEATERS 100000
+#define NUM_LANES 2000
+#define LANE_TICKS 100
+#define EV_STOP 1
+
+static int failures = 0;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* ------------------------------------------------------------------------- */
+
+typedef struct {
+    unsigned fired;
+    unsigned late;
+} WheelCheck;
+
+static TimerWheel wheel;
+
+static void check_expiry(void *arg, TimerNode *timer)
+{
+    WheelCheck *check = arg;
+    check->fired++;
+    if (timer->expires != wheel.now || timer->id & 1)
+    {
+        check->late++;
+    }
+    timer->id |= 2;
+}
+
+static void test_wheel(void)
+{
+    TimerNode *timers = malloc(NUM_TIMERS * sizeof(TimerNode));
+    uint32_t rng = 12345;
+    WheelCheck check = {0, 0};
+
+    timer_wheel_init(&wheel, 1000);
+    double start = now_ns();
+    for (unsigned i = 0; i < NUM_TIMERS; ++i)
+    {
+        rng = rng * 1664525u + 1013904223u;
+        timer_node_init(&timers[i]);
+        timers[i].id = 0;
+        timer_wheel_arm(&wheel, &timers[i], wheel.now + 1 + (rng >> 12) % MAX_DELAY);
+    }
+    double arm_ns = (now_ns() - start) / NUM_TIMERS;
+
+    start = now_ns();
+    unsigned cancelled = 0;
+    for (unsigned i = 0; i < NUM_TIMERS; i += 3)
+    {
+        timer_wheel_cancel(&wheel, &timers[i]);
+        timers[i].id = 1;  // Must never fire
+        cancelled++;
+    }
+    double cancel_ns = (now_ns() - start) / cancelled;
+
+    // The bound must not be later than the earliest armed timer
+    uint64_t earliest = UINT64_MAX;
+    for (unsigned i = 0; i < NUM_TIMERS; ++i)
+    {
+        if (timer_node_armed(&timers[i]) && timers[i].expires < earliest)
+        {
+            earliest = timers[i].expires;
+        }
+    }
+    if (timer_wheel_next_expiry(&wheel) > earliest)
+    {
+        printf("Next expiry %llu after the earliest timer %llu\n",
+               (unsigned long long)timer_wheel_next_expiry(&wheel), (unsigned long long)earliest);
+        failures++;
+    }
+
+    start = now_ns();
+    timer_wheel_advance(&wheel, wheel.now + MAX_DELAY + 1, check_expiry, &check);
+    double advance_ms = (now_ns() - start) * 1e-6;
+
+    if (check.fired != NUM_TIMERS - cancelled || check.late != 0 || wheel.armed != 0 ||
+        timer_wheel_next_expiry(&wheel) != UINT64_MAX)
+    {
+        printf("Wheel fired %u of %u timers, %u late\n", check.fired, NUM_TIMERS - cancelled, check.late);
+        failures++;
+    }
+
+    printf("%d timers: arm %.1f ns, cancel %.1f ns, %u ticks advanced in %.1f ms\n",
+           NUM_TIMERS, arm_ns, cancel_ns, MAX_DELAY + 1, advance_ms);
+    free(timers);
+}
+
+/* ------------------------------------------------------------------------- */
+
+typedef struct {
+    int hot;
+} Heater;
+
+extern State idle, active, heating, holding;
+
+int is_hot(void *context) { return ((Heater *)context)->hot; }
+
+Transition idle_transitions[] = {{&heating, .after = 50}};
+Transition active_transitions[] = {{&idle, .after = 100}, {&idle, .event = EV_STOP}};
+Transition heating_transitions[] = {{&holding, .after = 20}};
+Transition holding_transitions[] = {{&heating, is_hot, .after = 30}};
+
+State idle = {NULL, NULL, NULL, NULL, NULL, idle_transitions, 1};
+State active = {NULL, NULL, NULL, NULL, NULL, active_transitions, 2};
+State heating = {&active, NULL, NULL, NULL, NULL, heating_transitions, 1};
+State holding = {&active, NULL, NULL, NULL, NULL, holding_transitions, 1};
+
+State *States[] = {&idle, &active, &heating, &holding};
+StateMachine sm = {States, 4, &idle};
+
+static StateMachineDef def;
+
+static void run_until(uint64_t t)
+{
+    timer_wheel_advance(&wheel, t, state_machine_expire, &def);
+}
+
+static void expect(StateMachineInstance *inst, uint64_t t, State *state, unsigned armed)
+{
+    run_until(t);
+    if (state_machine_current_state(&def, inst, 0) != state->id || wheel.armed != armed)
+    {
+        printf("At %llu: state %u with %llu timers, expected %u with %u\n", (unsigned long long)t,
+               state_machine_current_state(&def, inst, 0), (unsigned long long)wheel.armed, state->id, armed);
+        failures++;
+    }
+}
+
+static void test_transitions(void)
+{
+    size_t compiled_size = state_machine_compile_size(&sm);
+    void *compiled = malloc(compiled_size);
+    if (state_machine_compile(&sm, &def, compiled, compiled_size) != 0)
+    {
+        printf("Failed to compile state machine\n");
+        exit(1);
+    }
+    def.timer_wheel = &wheel;
+    timer_wheel_init(&wheel, 0);
+
+    Heater heater = {0};
+    StateMachineInstance *inst = malloc(state_machine_instance_size(&def));
+    state_machine_init(&def, inst, &heater);
+
+    expect(inst, 49, &idle, 1);
+    expect(inst, 50, &heating, 2);      // Active and Heating armed
+    expect(inst, 70, &holding, 2);      // Active keeps running below
+    expect(inst, 100, &holding, 1);     // Guard failed, timer consumed
+    expect(inst, 150, &idle, 1);        // Active timed out
+    expect(inst, 200, &heating, 2);
+    if (state_machine_send_event(&def, inst, EV_STOP) != 1 || wheel.armed != 1)
+    {
+        printf("Leaving Active did not cancel its timers\n");
+        failures++;
+    }
+    heater.hot = 1;
+    expect(inst, 249, &idle, 1);
+    expect(inst, 250, &heating, 2);
+    expect(inst, 270, &holding, 2);
+    expect(inst, 300, &heating, 2);     // Guard passed
+
+    // Many idle instances cost nothing until their timers expire
+    size_t instance_size = state_machine_instance_size(&def);
+    char *arena = malloc(NUM_HEATERS * instance_size);
+    timer_wheel_init(&wheel, 0);
+    for (int i = 0; i < NUM_HEATERS; ++i)
+    {
+        state_machine_init(&def, (StateMachineInstance *)(arena + i * instance_size), &heater);
+    }
+    double start = now_ns();
+    run_until(49);
+    double idle_ns = now_ns() - start;
+    start = now_ns();
+    run_until(50);
+    double expire_ns = now_ns() - start;
+    if (wheel.armed != 2 * NUM_HEATERS)
+    {
+        printf("%llu timers armed after expiry\n", (unsigned long long)wheel.armed);
+        failures++;
+    }
+    printf("%d heaters: 49 idle ticks in %.1f us, expiring all in %.1f ms\n",
+           NUM_HEATERS, idle_ns * 1e-3, expire_ns * 1e-6);
+
+    free(arena);
+    free(inst);
+    free(compiled);
+}
+
+/* ------------------------------------------------------------------------- */
+
+extern State ping0, pong0, ping1, pong1;
+
+// Spins a little so the regions of an instance overlap on the pool
+int always(void *context)
+{
+    volatile unsigned spin = 0;
+    for (unsigned i = 0; i < 200; ++i)
+    {
+        spin += i;
+    }
+    return 1;
+}
+
+Transition ping0_transitions[] = {{&pong0, always}, {&pong0, .after = 1000}};
+Transition pong0_transitions[] = {{&ping0, always}, {&ping0, .after = 1000}};
+Transition ping1_transitions[] = {{&pong1, always}, {&pong1, .after = 1000}};
+Transition pong1_transitions[] = {{&ping1, always}, {&ping1, .after = 1000}};
+
+State ping0 = {NULL, NULL, NULL, NULL, NULL, ping0_transitions, 2};
+State pong0 = {NULL, NULL, NULL, NULL, NULL, pong0_transitions, 2};
+State ping1 = {NULL, NULL, NULL, NULL, NULL, ping1_transitions, 2};
+State pong1 = {NULL, NULL, NULL, NULL, NULL, pong1_transitions, 2};
+
+State *Lane0States[] = {&ping0, &pong0};
+State *Lane1States[] = {&ping1, &pong1};
+StateMachine LaneRegions[] = {{Lane0States, 2, &ping0}, {Lane1States, 2, &ping1}};
+
+State lanes = {NULL, NULL, NULL, NULL, NULL, NULL, 0, LaneRegions, 2, 1};
+
+State *LaneStates[] = {&lanes};
+StateMachine lanes_sm = {LaneStates, 1, &lanes};
+
+static void check_lanes(const StateMachineDef *lanes_def, char *arena, size_t instance_size,
+                        State *lane0, State *lane1, const char *when)
+{
+    unsigned wrong = 0;
+    for (int i = 0; i < NUM_LANES; ++i)
+    {
+        StateMachineInstance *inst = (StateMachineInstance *)(arena + i * instance_size);
+        wrong += state_machine_current_state(lanes_def, inst, 1) != lane0->id;
+        wrong += state_machine_current_state(lanes_def, inst, 2) != lane1->id;
+    }
+    if (wrong || wheel.armed != 2 * NUM_LANES)
+    {
+        printf("%s: %u regions in the wrong state, %llu timers armed, expected %d\n", when, wrong,
+               (unsigned long long)wheel.armed, 2 * NUM_LANES);
+        failures++;
+    }
+}
+
+static void test_parallel_regions(void)
+{
+    StateMachineDef lanes_def;
+    size_t compiled_size = state_machine_compile_size(&lanes_sm);
+    void *compiled = malloc(compiled_size);
+    if (state_machine_compile(&lanes_sm, &lanes_def, compiled, compiled_size) != 0)
+    {
+        printf("Failed to compile state machine\n");
+        exit(1);
+    }
+
+    WorkerPool pool;
+    if (worker_pool_init(&pool, 3, NULL) != 0)
+    {
+        printf("Failed to start worker pool\n");
+        exit(1);
+    }
+    lanes_def.region_pool = &pool;
+    lanes_def.timer_wheel = &wheel;
+    timer_wheel_init(&wheel, 0);
+
+    Heater heater = {0};
+    size_t instance_size = state_machine_instance_size(&lanes_def);
+    char *arena = malloc(NUM_LANES * instance_size);
+    for (int i = 0; i < NUM_LANES; ++i)
+    {
+        state_machine_init(&lanes_def, (StateMachineInstance *)(arena + i * instance_size), &heater);
+    }
+
+    // Every tick exits and enters a state in both regions, cancelling and arming timers
+    for (int tick = 0; tick < LANE_TICKS; ++tick)
+    {
+        for (int i = 0; i < NUM_LANES; ++i)
+        {
+            state_machine_tick(&lanes_def, (StateMachineInstance *)(arena + i * instance_size));
+        }
+    }
+    check_lanes(&lanes_def, arena, instance_size, &ping0, &ping1, "After ticking");
+
+    timer_wheel_advance(&wheel, 1000, state_machine_expire, &lanes_def);
+    check_lanes(&lanes_def, arena, instance_size, &pong0, &pong1, "After expiry");
+
+    worker_pool_destroy(&pool);
+    free(arena);
+    free(compiled);
+}
+
+int main(void)
+{
+    test_wheel();
+    test_transitions();
+    test_parallel_regions();
+    printf(failures ? "FAILED\n" : "OK\n");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * test_hsm_trace.c
+ *
+ * Built with HSM_TRACE. A door controller is driven through a fixed event
+ * sequence while a small trace ring is attached, so the ring wraps. The
+ * newest records must match the transitions taken and the dump must read
+ * back. pctrl_bench reports the cost of tracing.
+ *
+ * RootStateMachine
+|
++-- Closed (CompositeState)
+|   |
+|   +-- Unlocked (Leaf)
+|   +-- Locked (Leaf)
+|
++-- Open (Leaf)
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "hsm/hsm.h"
+#include "hsm/trace.h"
+
+#define RING_SIZE 16
+#define NUM_ROUNDS 10
+
+enum {
+    EV_OPEN = 1,
+    EV_CLOSE = 2,
+    EV_LOCK = 3,
+    EV_UNLOCK = 4
+};
+
+extern State closed, unlocked, locked, open;
+
+Transition unlocked_transitions[] = {
+    {&open, .event = EV_OPEN},
+    {&locked, .event = EV_LOCK},
+};
+Transition locked_transitions[] = {
+    {&unlocked, .event = EV_UNLOCK},
+};
+Transition open_transitions[] = {
+    {&unlocked, .event = EV_CLOSE},
+};
+
+State closed = {NULL, .name = "closed"};
+State unlocked = {&closed, NULL, NULL, NULL, NULL, unlocked_transitions, 2, .name = "unlocked"};
+State locked = {&closed, NULL, NULL, NULL, NULL, locked_transitions, 1, .name = "locked"};
+State open = {NULL, NULL, NULL, NULL, NULL, open_transitions, 1, .name = "open"};
+
+State *States[] = {&closed, &unlocked, &locked, &open};
+StateMachine sm = {States, 4, &unlocked};
+
+// One round: unlocked -> open -> unlocked -> locked -> unlocked
+static const int round_events[] = {EV_OPEN, EV_CLOSE, EV_LOCK, EV_UNLOCK};
+
+int main(void)
+{
+    StateMachineDef def;
+    size_t compiled_size = state_machine_compile_size(&sm);
+    void *compiled = malloc(compiled_size);
+    if (state_machine_compile(&sm, &def, compiled, compiled_size) != 0)
+    {
+        printf("Failed to compile state machine\n");
+        return 1;
+    }
+
+    static TraceRecord storage[RING_SIZE];
+    TraceRing ring;
+    int failures = 0;
+
+    if (trace_attach(&ring, storage, 12) == 0)
+    {
+        printf("Accepted a ring size that is not a power of 2\n");
+        failures++;
+    }
+    trace_attach(&ring, storage, RING_SIZE);
+
+    StateMachineInstance *inst = malloc(state_machine_instance_size(&def));
+    state_machine_init(&def, inst, NULL);
+    for (int round = 0; round < NUM_ROUNDS; ++round)
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            state_machine_send_event(&def, inst, round_events[i]);
+        }
+    }
+
+    // 1 init record and 4 per round, of which the last RING_SIZE are kept
+    uint64_t written = 1 + 4 * NUM_ROUNDS;
+    if (trace_count(&ring) != RING_SIZE)
+    {
+        printf("Expected %d records, got %u\n", RING_SIZE, trace_count(&ring));
+        failures++;
+    }
+
+    static const struct { State *source, *target; int event; } expected[] = {
+        {&unlocked, &open, EV_OPEN},
+        {&open, &unlocked, EV_CLOSE},
+        {&unlocked, &locked, EV_LOCK},
+        {&locked, &unlocked, EV_UNLOCK},
+    };
+    for (uint32_t i = 0; i < RING_SIZE; ++i)
+    {
+        const TraceRecord *r = trace_record(&ring, i);
+        int step = (int)((written - RING_SIZE + i - 1) % 4);
+        if (r->type != TRACE_TRANSITION || r->source != expected[step].source->id ||
+            r->target != expected[step].target->id || r->event != expected[step].event ||
+            r->instance != (uint32_t)(uintptr_t)inst ||
+            (i > 0 && r->timestamp < trace_record(&ring, i - 1)->timestamp))
+        {
+            printf("Record %u does not match step %d\n", i, step);
+            failures++;
+        }
+    }
+
+    FILE *dump = tmpfile();
+    TraceDumpHeader header;
+    if (!dump || trace_dump(&ring, dump) != 0)
+    {
+        printf("Failed to write the dump\n");
+        return 1;
+    }
+    rewind(dump);
+    if (fread(&header, sizeof(header), 1, dump) != 1 || header.magic != TRACE_MAGIC ||
+        header.count != RING_SIZE || header.dropped != written - RING_SIZE || header.ticks_per_ns <= 0)
+    {
+        printf("Dump header does not match the ring\n");
+        failures++;
+    }
+    fclose(dump);
+    trace_detach();
+
+    free(inst);
+    free(compiled);
+
+    printf(failures ? "FAILED\n" : "OK\n");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,370 @@
+/*
+ * test_hsm_wcet.c
+ *
+ * The engine must walk deep hierarchies without recursing: a region holding
+ * two chains of 300 nested states, and 32 levels of regions within regions,
+ * the most allowed; one level more must fail to compile. The worst-case
+ * analysis must bound every tick of a small robot, whose guards pass at
+ * random, and the random ticks must reach each bound. Copies of its image
+ * with records pointing outside the image must be refused by the analysis.
+ *
+ * RootStateMachine
+|
++-- Off (Leaf)                  on / act -> On
++-- On (Composite)              off -> Off
+    |
+    +-- Motion (Region, deep history)
+    |   +-- Stopped (Leaf)      go -> Slow
+    |   +-- Moving (Composite)
+    |       +-- Slow (Leaf)     fast -> Fast, stop -> Stopped
+    |       +-- Fast (Leaf)     slow -> Slow
+    |
+    +-- Light (Region)
+        +-- Dark (Leaf)         light -> Lit
+        +-- Lit (Leaf)          dark -> Dark
+
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hsm/hsm.h"
+#include "hsm/wcet.h"
+
+#define EV_JUMP 1
+#define CHAIN_LENGTH 300
+#define NUM_TICKS 200000
+
+static int failures = 0;
+
+static void expect(int cond, const char *what)
+{
+    if (!cond)
+    {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+// Calls made by the handlers since the counters were last cleared
+typedef struct {
+    WcetCounts calls;
+    uint32_t rng;
+} Robot;
+
+static void count(void *context, uint32_t *counter)
+{
+    (*counter)++;
+    ((Robot *)context)->calls.calls++;
+}
+
+void entry(void *context) { count(context, &((Robot *)context)->calls.entries); }
+void leave(void *context) { count(context, &((Robot *)context)->calls.exits); }
+void run(void *context) { count(context, &((Robot *)context)->calls.runs); }
+void act(void *context) { count(context, &((Robot *)context)->calls.actions); }
+
+int coin(void *context)
+{
+    Robot *robot = context;
+    count(context, &robot->calls.guards);
+    robot->rng = robot->rng * 1664525u + 1013904223u;
+    return (robot->rng >> 16) & 1;
+}
+
+int always(void *context)
+{
+    count(context, &((Robot *)context)->calls.guards);
+    return 1;
+}
+
+static void *compile(StateMachine *sm, StateMachineDef *def)
+{
+    size_t size = state_machine_compile_size(sm);
+    void *image = aligned_alloc(8, (size + 7) & ~(size_t)7);
+    if (state_machine_compile(sm, def, image, size) != 0)
+    {
+        free(image);
+        return NULL;
+    }
+    return image;
+}
+
+static StateMachineInstance *new_instance(const StateMachineDef *def, Robot *robot)
+{
+    size_t size = state_machine_instance_size(def);
+    StateMachineInstance *inst = aligned_alloc(8, (size + 7) & ~(size_t)7);
+    memset(robot, 0, sizeof(*robot));
+    state_machine_init(def, inst, robot);
+    return inst;
+}
+
+/* ------------------------------------------------------------------------- */
+// Two chains of nested states in one region; JUMP goes from the innermost
+// state of one to the innermost of the other
+
+static State chain[2][CHAIN_LENGTH];
+static Transition jump[2];
+
+static void test_deep_chain(void)
+{
+    State *states[2 * CHAIN_LENGTH];
+    for (int c = 0; c < 2; ++c)
+    {
+        for (int i = 0; i < CHAIN_LENGTH; ++i)
+        {
+            State *s = &chain[c][i];
+            memset(s, 0, sizeof(*s));
+            s->parent = i > 0 ? &chain[c][i - 1] : NULL;
+            s->on_entry = entry;
+            s->on_exit = leave;
+            states[c * CHAIN_LENGTH + i] = s;
+        }
+        jump[c] = (Transition){&chain[1 - c][CHAIN_LENGTH - 1], .event = EV_JUMP};
+        chain[c][CHAIN_LENGTH - 1].transitions = &jump[c];
+        chain[c][CHAIN_LENGTH - 1].num_transitions = 1;
+    }
+    StateMachine sm = {states, 2 * CHAIN_LENGTH, &chain[0][CHAIN_LENGTH - 1]};
+
+    StateMachineDef def;
+    void *image = compile(&sm, &def);
+    expect(image != NULL, "deep chain compiles");
+    if (!image)
+    {
+        return;
+    }
+
+    Robot robot;
+    StateMachineInstance *inst = new_instance(&def, &robot);
+    expect(robot.calls.entries == CHAIN_LENGTH, "whole chain entered");
+    memset(&robot.calls, 0, sizeof(robot.calls));
+    state_machine_send_event(&def, inst, EV_JUMP);
+    expect(robot.calls.exits == CHAIN_LENGTH && robot.calls.entries == CHAIN_LENGTH, "chain to chain");
+    expect(state_machine_current_state(&def, inst, 0) == chain[1][CHAIN_LENGTH - 1].id, "other chain");
+
+    void *workspace = malloc(state_machine_wcet_workspace_size(&def));
+    WcetReport report;
+    expect(state_machine_wcet(&def, &report, workspace) == 0, "chain analysed");
+    expect(report.max_depth == CHAIN_LENGTH && report.region_nesting == 1, "chain depth");
+    free(workspace);
+    free(inst);
+    free(image);
+}
+
+/* ------------------------------------------------------------------------- */
+// Regions within regions: level[i] is the only state of region i and owns
+// region i + 1. A guard that always passes re-enters the outermost level.
+
+static State level[HSM_MAX_REGION_NESTING + 1];
+static State *level_states[HSM_MAX_REGION_NESTING + 1];
+static StateMachine level_regions[HSM_MAX_REGION_NESTING + 1];
+static Transition restart = {&level[0], always};
+
+static StateMachine *nest_regions(int levels)
+{
+    for (int i = 0; i < levels; ++i)
+    {
+        State *s = &level[i];
+        memset(s, 0, sizeof(*s));
+        s->on_entry = entry;
+        s->on_exit = leave;
+        s->submachine = i + 1 < levels ? &level_regions[i + 1] : NULL;
+        s->num_submachines = i + 1 < levels ? 1 : 0;
+        level_states[i] = s;
+        level_regions[i] = (StateMachine){&level_states[i], 1, s};
+    }
+    level[0].transitions = &restart;
+    level[0].num_transitions = 1;
+    level[levels - 1].on_run = run;
+    return &level_regions[0];
+}
+
+static void test_nested_regions(void)
+{
+    StateMachineDef def;
+    void *image = compile(nest_regions(HSM_MAX_REGION_NESTING), &def);
+    expect(image != NULL, "deepest nesting allowed compiles");
+    if (!image)
+    {
+        return;
+    }
+
+    Robot robot;
+    StateMachineInstance *inst = new_instance(&def, &robot);
+    expect(robot.calls.entries == HSM_MAX_REGION_NESTING, "every level entered");
+    expect(state_machine_current_state(&def, inst, HSM_MAX_REGION_NESTING - 1) ==
+               level[HSM_MAX_REGION_NESTING - 1].id, "innermost level active");
+
+    void *workspace = malloc(state_machine_wcet_workspace_size(&def));
+    WcetReport report;
+    expect(state_machine_wcet(&def, &report, workspace) == 0, "nesting analysed");
+    expect(report.region_nesting == HSM_MAX_REGION_NESTING, "nesting reported");
+    expect(report.tick.exits == HSM_MAX_REGION_NESTING && report.tick.entries == HSM_MAX_REGION_NESTING &&
+               report.tick.guards == 1 && report.tick.calls == 2 * HSM_MAX_REGION_NESTING + 1,
+           "restart bound");
+
+    memset(&robot.calls, 0, sizeof(robot.calls));
+    state_machine_tick(&def, inst);
+    expect(robot.calls.calls == report.tick.calls, "restart takes its bound");
+    expect(state_machine_current_state(&def, inst, HSM_MAX_REGION_NESTING - 1) ==
+               level[HSM_MAX_REGION_NESTING - 1].id, "innermost level active again");
+    free(workspace);
+    free(inst);
+    free(image);
+
+    expect(compile(nest_regions(HSM_MAX_REGION_NESTING + 1), &def) == NULL, "one level too deep");
+}
+
+/* ------------------------------------------------------------------------- */
+// The robot
+
+extern State off, on, stopped, moving, slow, fast, dark, lit;
+
+Transition off_transitions[] = {{&on, coin, act}};
+Transition on_transitions[] = {{&off, coin}};
+Transition stopped_transitions[] = {{&slow, coin}};
+Transition slow_transitions[] = {{&fast, coin}, {&stopped, coin}};
+Transition fast_transitions[] = {{&slow, coin}};
+Transition dark_transitions[] = {{&lit, coin}};
+Transition lit_transitions[] = {{&dark, coin}};
+
+State stopped = {NULL, entry, run, NULL, NULL, stopped_transitions, 1};
+State moving = {NULL, entry, NULL, leave};
+State slow = {&moving, entry, run, leave, NULL, slow_transitions, 2};
+State fast = {&moving, entry, run, leave, NULL, fast_transitions, 1};
+State dark = {NULL, NULL, run, NULL, NULL, dark_transitions, 1};
+State lit = {NULL, entry, NULL, leave, NULL, lit_transitions, 1};
+
+State *motion_states[] = {&stopped, &moving, &slow, &fast};
+State *light_states[] = {&dark, &lit};
+StateMachine on_regions[] = {
+    {motion_states, 4, &stopped, .history = HSM_HISTORY_DEEP},
+    {light_states, 2, &dark},
+};
+
+State off = {NULL, NULL, NULL, NULL, NULL, off_transitions, 1};
+State on = {NULL, entry, NULL, leave, NULL, on_transitions, 1, on_regions, 2};
+
+State *root_states[] = {&off, &on};
+StateMachine sm = {root_states, 2, &off};
+
+static void test_robot(void)
+{
+    StateMachineDef def;
+    void *image = compile(&sm, &def);
+    expect(image != NULL, "robot compiles");
+    if (!image)
+    {
+        return;
+    }
+
+    void *workspace = malloc(state_machine_wcet_workspace_size(&def));
+    WcetReport report;
+    expect(state_machine_wcet(&def, &report, workspace) == 0, "robot analysed");
+
+    // Worked out by hand: Off -> On resuming Fast enters 3 states, On -> Off
+    // from Fast and Lit exits 4, and the most calls are made when On stays
+    // while Slow stops (5) and the light changes (2).
+    WcetCounts expected = {3, 4, 4, 2, 1, 8};
+    expect(memcmp(&report.tick, &expected, sizeof(expected)) == 0, "robot bound");
+    expect(report.max_depth == 2 && report.region_nesting == 2, "robot shape");
+
+    Robot robot;
+    StateMachineInstance *inst = new_instance(&def, &robot);
+    robot.rng = 7;
+    WcetCounts worst = {0};
+    int within = 1;
+    for (int i = 0; i < NUM_TICKS; ++i)
+    {
+        memset(&robot.calls, 0, sizeof(robot.calls));
+        state_machine_tick(&def, inst);
+        const WcetCounts *c = &robot.calls;
+        within &= c->entries <= report.tick.entries && c->exits <= report.tick.exits &&
+                  c->guards <= report.tick.guards && c->runs <= report.tick.runs &&
+                  c->actions <= report.tick.actions && c->calls <= report.tick.calls;
+        worst.entries = c->entries > worst.entries ? c->entries : worst.entries;
+        worst.exits = c->exits > worst.exits ? c->exits : worst.exits;
+        worst.guards = c->guards > worst.guards ? c->guards : worst.guards;
+        worst.runs = c->runs > worst.runs ? c->runs : worst.runs;
+        worst.actions = c->actions > worst.actions ? c->actions : worst.actions;
+        worst.calls = c->calls > worst.calls ? c->calls : worst.calls;
+    }
+    expect(within, "every tick within the bound");
+    expect(memcmp(&worst, &report.tick, sizeof(worst)) == 0, "random ticks reach the bound");
+
+    printf("Worst tick: %u entries, %u exits, %u guards, %u runs, %u actions, %u calls\n",
+           report.tick.entries, report.tick.exits, report.tick.guards, report.tick.runs,
+           report.tick.actions, report.tick.calls);
+    free(workspace);
+    free(inst);
+    free(image);
+}
+
+/* Binds a copy of an image with one record corrupted by the caller and
+   tells whether the analysis refuses it. */
+static int refuses(const StateMachineDef *def, void *copy, void *workspace)
+{
+    StateMachineDef corrupt;
+    WcetReport report;
+    if (state_machine_bind(&corrupt, copy, def->image->size, def->handlers) != 0)
+    {
+        return 0;
+    }
+    return state_machine_wcet(&corrupt, &report, workspace) != 0;
+}
+
+static void test_corrupt_records(void)
+{
+    StateMachineDef def;
+    void *image = compile(&sm, &def);
+    size_t size = def.image->size;
+    char *copy = aligned_alloc(8, (size + 7) & ~(size_t)7);
+    void *workspace = malloc(state_machine_wcet_workspace_size(&def));
+    const StateMachineImage *layout = def.image;
+    StateDef *states = (StateDef *)(copy + layout->states);
+    RegionDef *regions = (RegionDef *)(copy + layout->regions);
+    TransitionDef *transitions = (TransitionDef *)(copy + layout->transitions);
+    uint32_t *refs = (uint32_t *)(copy + layout->refs);
+
+    memcpy(copy, image, size);
+    states[on.id].path = 0x7FFFFFFFu;
+    expect(refuses(&def, copy, workspace), "state path outside the image refused");
+
+    memcpy(copy, image, size);
+    states[on.id].num_regions = 0x100;
+    expect(refuses(&def, copy, workspace), "regions outside the image refused");
+
+    memcpy(copy, image, size);
+    refs[states[off.id].polled] = 0xFFFFu;
+    expect(refuses(&def, copy, workspace), "polled transition outside the image refused");
+
+    memcpy(copy, image, size);
+    transitions[0].exit_len = 0xFFFF;
+    expect(refuses(&def, copy, workspace), "exit path outside the image refused");
+
+    memcpy(copy, image, size);
+    regions[0].initial = (StateId)(layout->num_states + 1);
+    expect(refuses(&def, copy, workspace), "initial state outside the image refused");
+
+    memcpy(copy, image, size);
+    expect(!refuses(&def, copy, workspace), "intact copy analysed");
+
+    free(workspace);
+    free(copy);
+    free(image);
+}
+
+int main(void)
+{
+    test_deep_chain();
+    test_nested_regions();
+    test_robot();
+    test_corrupt_records();
+
+    if (failures)
+    {
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,236 @@
+/*
+ * test_perf_counters.c
+ *
+ * Built with HSM_COUNTERS. Two threads tick their own thermostats, each
+ * counting into its own set. The aggregated counters must be consistent
+ * with the work done: every tick is counted once, every transition taken
+ * is one guard hit, one exit and one entry. Each thread also ticks a second
+ * definition compiled from the same machine, so both number their states and
+ * transitions alike; it counts into a set of its own and neither definition
+ * may add into the other's.
+ *
+ * RootStateMachine
+|
++-- Idle (Leaf)
++-- Heating (Leaf)
++-- Cooling (Leaf)
+
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "hsm/hsm.h"
+#include "perf/counters.h"
+
+#define NUM_THREADS 2
+#define NUM_INSTANCES 1000
+#define NUM_CYCLES 100
+
+typedef struct {
+    int temperature;
+    int drift;
+} Thermostat;
+
+extern State idle, heating, cooling;
+
+int too_cold(void *context) { return ((Thermostat *)context)->temperature < 18; }
+int too_hot(void *context) { return ((Thermostat *)context)->temperature > 24; }
+int comfortable(void *context)
+{
+    Thermostat *t = context;
+    return t->temperature >= 20 && t->temperature <= 22;
+}
+
+void idle_on_run(void *context) { ((Thermostat *)context)->temperature += ((Thermostat *)context)->drift; }
+void heating_on_run(void *context) { ((Thermostat *)context)->temperature += 2; }
+void cooling_on_run(void *context) { ((Thermostat *)context)->temperature -= 2; }
+
+Transition idle_transitions[] = {
+    {&heating, too_cold},
+    {&cooling, too_hot},
+};
+Transition heating_transitions[] = {
+    {&idle, comfortable},
+};
+Transition cooling_transitions[] = {
+    {&idle, comfortable},
+};
+
+State idle = {NULL, NULL, idle_on_run, NULL, NULL, idle_transitions, 2};
+State heating = {NULL, NULL, heating_on_run, NULL, NULL, heating_transitions, 1};
+State cooling = {NULL, NULL, cooling_on_run, NULL, NULL, cooling_transitions, 1};
+
+State *States[] = {&idle, &heating, &cooling};
+StateMachine sm = {States, 3, &idle};
+
+StateMachineDef def;
+StateMachineDef other_def;
+
+typedef struct {
+    PerfCounters counters;
+    PerfCounters other_counters;
+    void *storage;
+    void *other_storage;
+    int offset;
+} Worker;
+
+static void *run_worker(void *arg)
+{
+    Worker *w = arg;
+    size_t size = state_machine_instance_size(&def);
+    StateMachineInstance **instances = malloc(NUM_INSTANCES * sizeof(*instances));
+    StateMachineInstance *other = malloc(size);
+    Thermostat *contexts = malloc(NUM_INSTANCES * sizeof(*contexts));
+    Thermostat other_context = {10, 0};
+
+    perf_counters_attach(&def, &w->counters);
+    perf_counters_attach(&other_def, &w->other_counters);
+    state_machine_init(&other_def, other, &other_context);
+    for (int i = 0; i < NUM_INSTANCES; ++i)
+    {
+        contexts[i].temperature = 15 + (i * 7 + w->offset) % 13;
+        contexts[i].drift = (i % 3) - 1;
+        instances[i] = malloc(size);
+        state_machine_init(&def, instances[i], &contexts[i]);
+    }
+    for (int cycle = 0; cycle < NUM_CYCLES; ++cycle)
+    {
+        for (int i = 0; i < NUM_INSTANCES; ++i)
+        {
+            state_machine_tick(&def, instances[i]);
+        }
+        state_machine_tick(&other_def, other);
+    }
+    perf_counters_detach(&def);
+    perf_counters_detach(&other_def);
+
+    for (int i = 0; i < NUM_INSTANCES; ++i)
+    {
+        free(instances[i]);
+    }
+    free(instances);
+    free(other);
+    free(contexts);
+    return NULL;
+}
+
+int main(void)
+{
+    size_t compiled_size = state_machine_compile_size(&sm);
+    void *compiled = malloc(compiled_size);
+    void *other_compiled = malloc(compiled_size);
+    if (state_machine_compile(&sm, &def, compiled, compiled_size) != 0 ||
+        state_machine_compile(&sm, &other_def, other_compiled, compiled_size) != 0)
+    {
+        printf("Failed to compile state machine\n");
+        return 1;
+    }
+
+    unsigned num_states = def.image->num_states;
+    unsigned num_transitions = def.image->num_transitions;
+    size_t counters_size = perf_counters_size(num_states, num_transitions);
+    Worker workers[NUM_THREADS];
+    pthread_t threads[NUM_THREADS];
+    const PerfCounters *parts[NUM_THREADS];
+
+    for (int t = 0; t < NUM_THREADS; ++t)
+    {
+        workers[t].storage = malloc(counters_size);
+        workers[t].offset = t * 5;
+        workers[t].other_storage = malloc(counters_size);
+        perf_counters_init(&workers[t].counters, num_states, num_transitions, workers[t].storage, counters_size);
+        perf_counters_init(&workers[t].other_counters, num_states, num_transitions, workers[t].other_storage,
+                           counters_size);
+        parts[t] = &workers[t].counters;
+        pthread_create(&threads[t], NULL, run_worker, &workers[t]);
+    }
+    for (int t = 0; t < NUM_THREADS; ++t)
+    {
+        pthread_join(threads[t], NULL);
+    }
+
+    PerfCounters total;
+    void *total_storage = malloc(counters_size);
+    perf_counters_init(&total, num_states, num_transitions, total_storage, counters_size);
+    perf_counters_aggregate(&total, parts, NUM_THREADS);
+
+    uint64_t ticks = 0, entries = 0, exits = 0, runs = 0, taken = 0, hits = 0;
+    for (unsigned i = 0; i < num_states; ++i)
+    {
+        PerfStateCounters *s = &total.states[i];
+        uint64_t state_runs = 0;
+        for (unsigned b = 0; b < PERF_HISTOGRAM_BUCKETS; ++b)
+        {
+            state_runs += s->run_histogram[b];
+        }
+        ticks += s->ticks;
+        entries += s->entries;
+        exits += s->exits;
+        runs += state_runs;
+        printf("state %u: %llu entries, %llu ticks, %llu runs, %.1f ticks per run\n", i,
+               (unsigned long long)s->entries, (unsigned long long)s->ticks,
+               (unsigned long long)state_runs, state_runs ? (double)s->run_time / state_runs : 0.0);
+    }
+    for (unsigned i = 0; i < num_transitions; ++i)
+    {
+        PerfTransitionCounters *t = &total.transitions[i];
+        taken += t->taken;
+        hits += t->guard_hits;
+        printf("transition %u: %llu evaluations, %.1f%% hit rate, %llu taken\n", i,
+               (unsigned long long)t->guard_evaluations,
+               t->guard_evaluations ? 100.0 * t->guard_hits / t->guard_evaluations : 0.0,
+               (unsigned long long)t->taken);
+    }
+
+    int failures = 0;
+    uint64_t expected_ticks = (uint64_t)NUM_THREADS * NUM_INSTANCES * NUM_CYCLES;
+    uint64_t initial_entries = (uint64_t)NUM_THREADS * NUM_INSTANCES;
+    failures += ticks != expected_ticks;
+    failures += hits != taken;
+    failures += entries != initial_entries + taken;
+    failures += exits != taken;
+    failures += runs != ticks - taken;
+
+    // A snapshot of one thread must match its own set
+    PerfCounters snapshot;
+    void *snapshot_storage = malloc(counters_size);
+    perf_counters_init(&snapshot, num_states, num_transitions, snapshot_storage, counters_size);
+    perf_counters_snapshot(&snapshot, &workers[0].counters);
+    failures += snapshot.states[idle.id].ticks != workers[0].counters.states[idle.id].ticks;
+
+    /* The second definition counts into its own set only: starting cold and
+       never drifting, it leaves Idle once for Heating and returns at 20 */
+    for (int t = 0; t < NUM_THREADS; ++t)
+    {
+        PerfCounters *o = &workers[t].other_counters;
+        uint64_t other_ticks = 0, other_taken = 0;
+        for (unsigned i = 0; i < num_states; ++i)
+        {
+            other_ticks += o->states[i].ticks;
+        }
+        for (unsigned i = 0; i < num_transitions; ++i)
+        {
+            other_taken += o->transitions[i].taken;
+        }
+        failures += other_ticks != NUM_CYCLES;
+        failures += other_taken != 2;
+        failures += o->states[idle.id].entries != 2;
+        failures += o->states[heating.id].entries != 1;
+        failures += o->states[cooling.id].entries != 0;
+    }
+
+    for (int t = 0; t < NUM_THREADS; ++t)
+    {
+        free(workers[t].storage);
+        free(workers[t].other_storage);
+    }
+    free(total_storage);
+    free(snapshot_storage);
+    free(compiled);
+    free(other_compiled);
+
+    printf("%llu ticks, %llu transitions\n", (unsigned long long)ticks, (unsigned long long)taken);
+    printf(failures ? "FAILED\n" : "OK\n");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,276 @@
+/*
+ * test_pid.c
+ *
+ * A fleet of 4096 PID loops, each driving a first-order plant, is run once
+ * with the vector kernel and once with the scalar per-loop update; both must
+ * produce the same outputs and settle every plant on its setpoint. Single
+ * loops then check the anti-windup (a saturated loop recovers at once when
+ * the setpoint comes back in reach, where one without it lags), that a
+ * setpoint step does not kick the derivative, and that the derivative
+ * filter damps a measurement step. The fleet finally runs as the on_run
+ * work of an HSM state.
+ *
+ * RootStateMachine
+|
++-- Manual (Leaf)   AUTO -> Auto
++-- Auto (Leaf)     run: update the loops, MANUAL -> Manual
+
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "control/pid.h"
+#include "hsm/hsm.h"
+
+#define NUM_LOOPS 4096
+#define NUM_STEPS 3000
+#define DT 0.001f
+#define EV_AUTO 1
+#define EV_MANUAL 2
+
+static int failures = 0;
+
+static void expect(int cond, const char *what)
+{
+    if (!cond)
+    {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+static float uniform(uint32_t *rng, float lo, float hi)
+{
+    *rng = *rng * 1664525u + 1013904223u;
+    return lo + (hi - lo) * (float)(*rng >> 8) / 16777216.0f;
+}
+
+// First-order plants: tau * y' = gain * u - y
+typedef struct {
+    float gain[NUM_LOOPS];
+    float tau[NUM_LOOPS];
+} Plants;
+
+static void step_plants(const Plants *plants, PidBank *bank)
+{
+    for (unsigned i = 0; i < bank->count; ++i)
+    {
+        float y = bank->measurement[i];
+        bank->measurement[i] = y + DT * (plants->gain[i] * bank->output[i] - y) / plants->tau[i];
+    }
+}
+
+static void *new_bank(PidBank *bank, unsigned count, float dt)
+{
+    size_t size = pid_bank_storage_size(count);
+    void *storage = aligned_alloc(PID_ALIGN, (size + PID_ALIGN - 1) & ~(size_t)(PID_ALIGN - 1));
+    if (pid_bank_init(bank, count, dt, storage, size) != 0)
+    {
+        printf("FAILED: bank init\n");
+        exit(1);
+    }
+    return storage;
+}
+
+// Tunes the fleet the same way in every bank it is called for
+static void tune_fleet(PidBank *bank, Plants *plants)
+{
+    uint32_t rng = 42;
+    for (unsigned i = 0; i < bank->count; ++i)
+    {
+        PidGains gains = {uniform(&rng, 2.0f, 4.0f), uniform(&rng, 10.0f, 20.0f), uniform(&rng, 0.0f, 0.02f),
+                          0.005f, 1.0f, -10.0f, 10.0f};
+        pid_bank_set(bank, i, &gains);
+        plants->gain[i] = uniform(&rng, 0.5f, 2.0f);
+        plants->tau[i] = uniform(&rng, 0.05f, 0.5f);
+        bank->setpoint[i] = uniform(&rng, -2.0f, 2.0f);
+        bank->measurement[i] = 0.0f;
+    }
+    pid_bank_reset(bank);
+}
+
+static void test_fleet(void)
+{
+    static Plants plants;
+    PidBank vec, ref;
+    void *vec_storage = new_bank(&vec, NUM_LOOPS, DT);
+    void *ref_storage = new_bank(&ref, NUM_LOOPS, DT);
+    tune_fleet(&vec, &plants);
+    tune_fleet(&ref, &plants);
+
+    float max_diff = 0.0f;
+    for (int step = 0; step < NUM_STEPS; ++step)
+    {
+        pid_bank_update(&vec);
+        pid_bank_update_scalar(&ref);
+        for (unsigned i = 0; i < NUM_LOOPS; ++i)
+        {
+            float diff = fabsf(vec.output[i] - ref.output[i]);
+            max_diff = diff > max_diff ? diff : max_diff;
+        }
+        step_plants(&plants, &vec);
+        step_plants(&plants, &ref);
+    }
+    expect(max_diff < 1e-4f, "vector and scalar updates agree");
+
+    unsigned settled = 0;
+    for (unsigned i = 0; i < NUM_LOOPS; ++i)
+    {
+        settled += fabsf(vec.measurement[i] - vec.setpoint[i]) < 0.01f;
+    }
+    expect(settled == NUM_LOOPS, "every plant settles on its setpoint");
+    for (unsigned i = NUM_LOOPS; i < vec.padded; ++i)
+    {
+        expect(vec.output[i] == 0.0f, "padding loops stay idle");
+    }
+
+    free(vec_storage);
+    free(ref_storage);
+}
+
+/* ------------------------------------------------------------------------- */
+
+// Steps until a loop's output leaves the upper limit, at most limit steps
+static int steps_to_recover(PidBank *bank, float gain, int limit)
+{
+    for (int step = 1; step <= limit; ++step)
+    {
+        pid_bank_update(bank);
+        bank->measurement[0] += DT * (gain * bank->output[0] - bank->measurement[0]) / 0.1f;
+        if (bank->output[0] < 1.0f)
+        {
+            return step;
+        }
+    }
+    return limit + 1;
+}
+
+static void test_single_loops(void)
+{
+    PidBank bank;
+    void *storage = new_bank(&bank, 2, DT);
+    PidGains gains = {1.0f, 10.0f, 0.0f, 0.0f, 1.0f, -1.0f, 1.0f};
+
+    // Anti-windup: two seconds pushing against the limit, then a reachable setpoint
+    float windup[2];
+    int recovery[2];
+    for (int k = 0; k < 2; ++k)
+    {
+        gains.kt = k == 0 ? 1.0f : 0.0f;
+        pid_bank_set(&bank, 0, &gains);
+        bank.setpoint[0] = 2.0f;
+        bank.measurement[0] = 0.0f;
+        pid_bank_reset(&bank);
+        steps_to_recover(&bank, 1.0f, 2000);
+        expect(bank.output[0] == 1.0f, "output clamped");
+        windup[k] = bank.integral[0];
+        bank.setpoint[0] = 0.5f;
+        recovery[k] = steps_to_recover(&bank, 1.0f, 5000);
+    }
+    expect(windup[0] <= 1.0f, "integral held at the limit");
+    expect(windup[1] > 10.0f, "integral winds up without anti-windup");
+    expect(recovery[0] <= 5, "recovers at once with anti-windup");
+    expect(recovery[1] > 100 * recovery[0], "lags without anti-windup");
+
+    // A setpoint step leaves the derivative alone
+    gains = (PidGains){0.0f, 0.0f, 1.0f, 0.0f, 1.0f, -1e6f, 1e6f};
+    pid_bank_set(&bank, 0, &gains);
+    gains.tf = 0.01f;
+    pid_bank_set(&bank, 1, &gains);
+    bank.setpoint[0] = bank.setpoint[1] = 0.0f;
+    bank.measurement[0] = bank.measurement[1] = 0.0f;
+    pid_bank_reset(&bank);
+    bank.setpoint[0] = bank.setpoint[1] = 5.0f;
+    pid_bank_update(&bank);
+    expect(bank.output[0] == 0.0f && bank.output[1] == 0.0f, "no derivative kick");
+
+    // A measurement step: unfiltered the derivative jumps to kd/dt, filtered
+    // by alpha = dt / (tf + dt) of it, then decays
+    bank.measurement[0] = bank.measurement[1] = 1.0f;
+    pid_bank_update(&bank);
+    expect(fabsf(bank.output[0] + 1.0f / DT) < 1e-2f, "unfiltered derivative");
+    expect(fabsf(bank.output[1] + (1.0f / DT) * DT / (0.01f + DT)) < 1e-2f, "filtered derivative");
+    float first = bank.output[1];
+    pid_bank_update(&bank);
+    expect(bank.output[0] == 0.0f, "unfiltered derivative gone");
+    expect(bank.output[1] < 0.0f && bank.output[1] > first, "filtered derivative decays");
+
+    PidGains bad = {1.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f, -1.0f};
+    expect(pid_bank_set(&bank, 0, &bad) != 0, "inverted limits rejected");
+    expect(pid_bank_set(&bank, 2, &gains) != 0, "index out of range");
+    free(storage);
+}
+
+/* ------------------------------------------------------------------------- */
+// The fleet as HSM work
+
+typedef struct {
+    PidBank bank;  // First, so pid_bank_on_run() can take the context
+    Plants plants;
+} Plant;
+
+extern State manual, automatic;
+
+Transition manual_transitions[] = {{&automatic, NULL, NULL, NULL, 0, EV_AUTO}};
+Transition automatic_transitions[] = {{&manual, NULL, NULL, NULL, 0, EV_MANUAL}};
+
+State manual = {NULL, NULL, NULL, NULL, NULL, manual_transitions, 1};
+State automatic = {NULL, NULL, pid_bank_on_run, NULL, NULL, automatic_transitions, 1};
+
+State *root_states[] = {&manual, &automatic};
+StateMachine sm = {root_states, 2, &manual};
+
+static void test_machine(void)
+{
+    StateMachineDef def;
+    size_t size = state_machine_compile_size(&sm);
+    void *image = aligned_alloc(8, (size + 7) & ~(size_t)7);
+    if (state_machine_compile(&sm, &def, image, size) != 0)
+    {
+        printf("FAILED: compile\n");
+        failures++;
+        return;
+    }
+    size_t inst_size = state_machine_instance_size(&def);
+    StateMachineInstance *inst = aligned_alloc(8, (inst_size + 7) & ~(size_t)7);
+    Plant *plant = malloc(sizeof(Plant));
+    void *storage = new_bank(&plant->bank, NUM_LOOPS, DT);
+    tune_fleet(&plant->bank, &plant->plants);
+    state_machine_init(&def, inst, plant);
+
+    state_machine_tick(&def, inst);
+    expect(plant->bank.output[0] == 0.0f, "manual leaves the loops alone");
+    state_machine_send_event(&def, inst, EV_AUTO);
+    for (int step = 0; step < NUM_STEPS; ++step)
+    {
+        state_machine_tick(&def, inst);
+        step_plants(&plant->plants, &plant->bank);
+    }
+    unsigned settled = 0;
+    for (unsigned i = 0; i < NUM_LOOPS; ++i)
+    {
+        settled += fabsf(plant->bank.measurement[i] - plant->bank.setpoint[i]) < 0.01f;
+    }
+    expect(settled == NUM_LOOPS, "loops settle under the machine");
+
+    free(storage);
+    free(plant);
+    free(inst);
+    free(image);
+}
+
+int main(void)
+{
+    test_fleet();
+    test_single_loops();
+    test_machine();
+
+    if (failures)
+    {
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,162 @@
+/*
+ * test_scheduler.c
+ *
+ * A fleet of simulated pumps is ticked once on a single thread and once with
+ * the multi-core scheduler. The load is deliberately skewed: the first
+ * instances do far more work per tick than the rest, so without stealing the
+ * first worker would hold up every cycle. Both fleets must end up in exactly
+ * the same states with the same context.
+ *
+ * RootStateMachine
+|
++-- Standby (Leaf)
++-- Pumping (Leaf)
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "hsm/hsm.h"
+#include "hsm/scheduler.h"
+
+#define NUM_INSTANCES 20000
+#define NUM_CYCLES 50
+#define MAX_WORKERS 16
+
+typedef struct {
+    unsigned load;      // Work units per tick
+    unsigned level;
+    unsigned checksum;
+} Pump;
+
+extern State standby, pumping;
+
+int level_low(void *context) { return ((Pump *)context)->level < 10; }
+int level_high(void *context) { return ((Pump *)context)->level > 90; }
+
+// Stands in for the per-tick simulation work of one pump
+void simulate(Pump *p)
+{
+    for (unsigned i = 0; i < p->load; ++i)
+    {
+        p->checksum = p->checksum * 1664525u + 1013904223u + i;
+    }
+}
+
+void standby_on_run(void *context) { simulate(context); ((Pump *)context)->level -= 3; }
+void pumping_on_run(void *context) { simulate(context); ((Pump *)context)->level += 5; }
+
+Transition standby_transitions[] = {
+    {&pumping, level_low},
+};
+Transition pumping_transitions[] = {
+    {&standby, level_high},
+};
+
+State standby = {NULL, NULL, standby_on_run, NULL, NULL, standby_transitions, 1};
+State pumping = {NULL, NULL, pumping_on_run, NULL, NULL, pumping_transitions, 1};
+
+State *States[] = {&standby, &pumping};
+StateMachine sm = {States, 2, &standby};
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Allocates a fleet whose first tenth is twenty times as expensive
+StateMachineInstance **make_fleet(const StateMachineDef *def, Pump *contexts)
+{
+    size_t size = state_machine_instance_size(def);
+    StateMachineInstance **instances = malloc(NUM_INSTANCES * sizeof(*instances));
+    for (int i = 0; i < NUM_INSTANCES; ++i)
+    {
+        contexts[i].load = i < NUM_INSTANCES / 10 ? 2000 : 100;
+        contexts[i].level = 5 + (i * 13) % 90;
+        contexts[i].checksum = (unsigned)i;
+        instances[i] = malloc(size);
+        state_machine_init(def, instances[i], &contexts[i]);
+    }
+    return instances;
+}
+
+int main(void)
+{
+    StateMachineDef def;
+    size_t compiled_size = state_machine_compile_size(&sm);
+    void *compiled = malloc(compiled_size);
+    if (state_machine_compile(&sm, &def, compiled, compiled_size) != 0)
+    {
+        printf("Failed to compile state machine\n");
+        return 1;
+    }
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned num_workers = cores < 2 ? 2 : cores > MAX_WORKERS ? MAX_WORKERS : (unsigned)cores;
+
+    static Pump single_contexts[NUM_INSTANCES];
+    static Pump sharded_contexts[NUM_INSTANCES];
+    StateMachineInstance **single = make_fleet(&def, single_contexts);
+    StateMachineInstance **sharded = make_fleet(&def, sharded_contexts);
+
+    double start = now_seconds();
+    for (int cycle = 0; cycle < NUM_CYCLES; ++cycle)
+    {
+        for (int i = 0; i < NUM_INSTANCES; ++i)
+        {
+            state_machine_tick(&def, single[i]);
+        }
+    }
+    double single_time = now_seconds() - start;
+
+    Scheduler sched;
+    if (scheduler_init(&sched, &def, sharded, NUM_INSTANCES, 32, num_workers, NULL) != 0)
+    {
+        printf("Failed to start scheduler\n");
+        return 1;
+    }
+
+    start = now_seconds();
+    for (int cycle = 0; cycle < NUM_CYCLES; ++cycle)
+    {
+        scheduler_tick(&sched);
+    }
+    double sharded_time = now_seconds() - start;
+
+    printf("%u workers, last cycle %.3f ms, worst %.3f ms\n", num_workers,
+           sched.cycle_ns * 1e-6, sched.max_cycle_ns * 1e-6);
+    for (unsigned w = 0; w < num_workers; ++w)
+    {
+        const WorkerStats *stats = scheduler_worker_stats(&sched, w);
+        printf("  worker %2u: busy %.3f ms (worst %.3f ms), %u chunks, %u stolen\n", w,
+               stats->busy_ns * 1e-6, stats->max_busy_ns * 1e-6, stats->tasks, stats->steals);
+    }
+    scheduler_destroy(&sched);
+
+    int mismatches = 0;
+    for (int i = 0; i < NUM_INSTANCES; ++i)
+    {
+        if (state_machine_current_state(&def, single[i], 0) != state_machine_current_state(&def, sharded[i], 0) ||
+            memcmp(&single_contexts[i], &sharded_contexts[i], sizeof(Pump)) != 0)
+        {
+            mismatches++;
+        }
+        free(single[i]);
+        free(sharded[i]);
+    }
+
+    free(single);
+    free(sharded);
+    free(compiled);
+
+    printf("single thread %.3f s, scheduler %.3f s, speedup %.2fx\n",
+           single_time, sharded_time, single_time / sharded_time);
+    printf("%d instances, %d cycles, %d mismatches\n", NUM_INSTANCES, NUM_CYCLES, mismatches);
+    printf(mismatches ? "FAILED\n" : "OK\n");
+    return mismatches ? 1 : 0;
+}
@@ -0,0 +1,250 @@
+/*
+ * test_tickless_scheduler.c
+ *
+ * A large population of valves of which only a handful are ever active.
+ * Valves open on an event or when their request input is marked dirty and
+ * close again on a timer. The tickless scheduler must tick exactly the
+ * valves that had something to do, sleep while none has, wake up when
+ * another thread posts an event or a timer is due, and spend a cycle in
+ * proportion to the active valves rather than the whole population.
+ *
+ * RootStateMachine
+|
++-- Closed (Leaf)   OPEN -> Open, requested -> Open
++-- Open (Leaf)     after 5 -> Closed
+
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "hsm/hsm.h"
+#include "hsm/tickless_scheduler.h"
+#include "hsm/timer_wheel.h"
+
+#define NUM_VALVES 100000
+#define TICK_NS 1000000u  // 1 ms timer wheel ticks
+#define EV_OPEN 1
+#define QUEUE_CAPACITY 4
+#define NUM_CYCLES 1000
+
+typedef struct {
+    int request;
+    unsigned ticks;
+    unsigned opened;
+} Valve;
+
+static int failures = 0;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+extern State closed, open_;
+
+int requested(void *context) { return ((Valve *)context)->request; }
+void count_tick(void *context) { ((Valve *)context)->ticks++; }
+void open_on_entry(void *context) { ((Valve *)context)->opened++; ((Valve *)context)->request = 0; }
+
+Transition closed_transitions[] = {
+    {&open_, NULL, NULL, NULL, 0, EV_OPEN},
+    {&open_, requested},
+};
+Transition open_transitions[] = {
+    {&closed, NULL, NULL, NULL, 0, 0, 0, 0, 0, 5},
+};
+
+State closed = {NULL, NULL, count_tick, NULL, NULL, closed_transitions, 2};
+State open_ = {NULL, open_on_entry, count_tick, NULL, NULL, open_transitions, 1};
+
+State *States[] = {&closed, &open_};
+StateMachine sm = {States, 2, &closed};
+
+static StateMachineDef def;
+static TimerWheel wheel;
+static StateMachineInstance **instances;
+static Valve *valves;
+static TicklessScheduler sched;
+
+static void expect(int cond, const char *what)
+{
+    if (!cond)
+    {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+// on_run calls over the whole population; a tick taking a transition has none
+static unsigned total_ticks(void)
+{
+    unsigned ticks = 0;
+    for (unsigned i = 0; i < NUM_VALVES; ++i)
+    {
+        ticks += valves[i].ticks;
+    }
+    return ticks;
+}
+
+// Runs cycles, sleeping in between, until every open valve closed again
+static void run_until_closed(unsigned expected_expiries)
+{
+    uint64_t expired = sched.expired + expected_expiries;
+    double deadline = now_ns() + 2e9;
+    while (sched.expired < expired && now_ns() < deadline)
+    {
+        tickless_scheduler_wait(&sched, 1000000000u);
+        tickless_scheduler_run(&sched);
+    }
+    tickless_scheduler_run(&sched);
+}
+
+static void *post_later(void *arg)
+{
+    (void)arg;
+    usleep(20000);
+    tickless_scheduler_post(&sched, NUM_VALVES / 2, EV_OPEN);
+    return NULL;
+}
+
+int main(void)
+{
+    size_t size = state_machine_compile_size(&sm);
+    void *image = aligned_alloc(8, (size + 7) & ~(size_t)7);
+    if (state_machine_compile(&sm, &def, image, size) != 0)
+    {
+        printf("FAILED: compile\n");
+        return 1;
+    }
+    timer_wheel_init(&wheel, 0);
+    def.timer_wheel = &wheel;
+
+    size_t inst_size = state_machine_instance_size(&def);
+    char *arena = aligned_alloc(8, NUM_VALVES * inst_size);
+    EventQueue *queues = aligned_alloc(64, NUM_VALVES * sizeof(EventQueue));
+    EventQueueSlot *slots = malloc(NUM_VALVES * QUEUE_CAPACITY * sizeof(EventQueueSlot));
+    instances = malloc(NUM_VALVES * sizeof(*instances));
+    valves = calloc(NUM_VALVES, sizeof(Valve));
+    for (unsigned i = 0; i < NUM_VALVES; ++i)
+    {
+        instances[i] = (StateMachineInstance *)(arena + i * inst_size);
+        state_machine_init(&def, instances[i], &valves[i]);
+        event_queue_init(&queues[i], &slots[i * QUEUE_CAPACITY], QUEUE_CAPACITY);
+    }
+
+    size_t storage_size = tickless_scheduler_storage_size(NUM_VALVES);
+    void *storage = aligned_alloc(8, (storage_size + 7) & ~(size_t)7);
+    if (tickless_scheduler_init(&sched, &def, instances, queues, NUM_VALVES, TICK_NS, storage,
+                                storage_size) != 0)
+    {
+        printf("FAILED: init\n");
+        return 1;
+    }
+
+    // Nothing ready: nothing ticked
+    expect(tickless_scheduler_run(&sched) == 0, "idle cycle ticks nothing");
+    expect(tickless_scheduler_wait(&sched, 1000000u) == 1, "idle scheduler sleeps");
+
+    // Events: every valve is ticked once, however often it was posted to
+    double start = now_ns();
+    for (unsigned i = 0; i < 10; ++i)
+    {
+        tickless_scheduler_post(&sched, i * 1000, EV_OPEN);
+    }
+    tickless_scheduler_post(&sched, 0, EV_OPEN);
+    expect(tickless_scheduler_wait(&sched, 1000000000u) == 0, "no sleep with ready valves");
+    expect(tickless_scheduler_run(&sched) == 10, "posted valves ticked once each");
+
+    // Dirty inputs: polled guards only see the change once marked
+    for (unsigned i = 0; i < 5; ++i)
+    {
+        valves[7 + i].request = 1;
+        tickless_scheduler_mark(&sched, 7 + i);
+        tickless_scheduler_mark(&sched, 7 + i);
+    }
+    valves[99].request = 1;  // Never marked
+    expect(tickless_scheduler_run(&sched) == 5, "marked valves ticked once each");
+    for (unsigned i = 0; i < 10; ++i)
+    {
+        expect(state_machine_current_state(&def, instances[i * 1000], 0) == open_.id, "event opened valve");
+        expect(valves[i * 1000].ticks == 1, "event valve ticked once");
+    }
+    for (unsigned i = 0; i < 5; ++i)
+    {
+        expect(state_machine_current_state(&def, instances[7 + i], 0) == open_.id, "input opened valve");
+    }
+    expect(state_machine_current_state(&def, instances[99], 0) == closed.id, "unmarked valve stays closed");
+    expect(total_ticks() == 10, "only ready valves ticked");
+
+    // Timers: the scheduler sleeps until they are due, then ticks their valves
+    run_until_closed(15);
+    double elapsed_ms = (now_ns() - start) / 1e6;
+    for (unsigned i = 0; i < 10; ++i)
+    {
+        expect(state_machine_current_state(&def, instances[i * 1000], 0) == closed.id, "timer closed valve");
+        expect(valves[i * 1000].ticks == 2, "expiry ticks the valve");
+        expect(valves[7 + i / 2].ticks == 1, "expiry ticks the valve");
+    }
+    expect(sched.expired == 15, "each timer expired once");
+    expect(total_ticks() == 25, "only expired valves ticked");
+    expect(elapsed_ms >= 4.0, "timers not early");
+
+    // Wake-up from another thread while sleeping without timers
+    pthread_t thread;
+    pthread_create(&thread, NULL, post_later, NULL);
+    start = now_ns();
+    uint64_t sleeps = sched.sleeps;
+    while (tickless_scheduler_run(&sched) == 0)
+    {
+        tickless_scheduler_wait(&sched, 2000000000u);
+    }
+    double wake_ms = (now_ns() - start) / 1e6;
+    pthread_join(thread, NULL);
+    expect(sched.sleeps > sleeps, "slept while idle");
+    expect(wake_ms < 1000.0, "woken by the post");
+    expect(state_machine_current_state(&def, instances[NUM_VALVES / 2], 0) == open_.id, "posted valve opened");
+    run_until_closed(1);
+    expect(state_machine_current_state(&def, instances[NUM_VALVES / 2], 0) == closed.id, "posted valve closed");
+
+    // Cycle cost follows activity: ten ready valves against the whole population
+    start = now_ns();
+    for (unsigned c = 0; c < NUM_CYCLES; ++c)
+    {
+        for (unsigned i = 0; i < 10; ++i)
+        {
+            tickless_scheduler_mark(&sched, i * 7919);
+        }
+        tickless_scheduler_run(&sched);
+    }
+    double tickless_ns = (now_ns() - start) / NUM_CYCLES;
+    start = now_ns();
+    for (unsigned i = 0; i < NUM_VALVES; ++i)
+    {
+        state_machine_tick(&def, instances[i]);
+    }
+    double full_ns = now_ns() - start;
+    printf("%u valves: tickless cycle with 10 ready %.2f us, ticking all %.2f us, slept %llu times\n",
+           NUM_VALVES, tickless_ns / 1e3, full_ns / 1e3, (unsigned long long)sched.sleeps);
+    expect(tickless_ns * 100 < full_ns, "tickless cycle far cheaper than a full tick");
+
+    tickless_scheduler_destroy(&sched);
+    free(storage);
+    free(valves);
+    free(instances);
+    free(slots);
+    free(queues);
+    free(arena);
+    free(image);
+
+    if (failures)
+    {
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,976 @@
+/*
+ * hsm_codegen.c
+ *
+ * Generates a specialized, switch-based C implementation of a hierarchical
+ * state machine from a textual description. The generated code keeps the
+ * instance layout and the execution semantics of hsm.c: states and regions
+ * are numbered the same way, so a generated machine can replace an
+ * interpreted one instance for instance. Every entry and exit sequence is
+ * resolved at generation time and guards are called directly, so they can be
+ * inlined when their definitions are visible (e.g. from an included header).
+ *
+ * Usage: hsm_codegen [--hsm-api] <description> <output base>
+ *
+ * Writes <output base>.c and <output base>.h. With --hsm-api the generated
+ * source also defines state_machine_init(), state_machine_tick() and
+ * state_machine_send_event(), so it can be linked in place of hsm.c; the
+ * definition argument is ignored, so it must be compiled from the same
+ * machine. Instances take <machine>_instance_size() bytes, which equals
+ * state_machine_instance_size() of that definition.
+ *
+ * Description format, one statement per line, '#' starts a comment:
+ *
+ *   machine <name>                 Prefix of the generated symbols
+ *   include <"file.h"|<file.h>>    Emitted as #include; handler prototypes are
+ *                                  only generated when there is none
+ *   state <name> [parent <name>] [initial]
+ *     entry <function>             void function(void *context)
+ *     run <function>               void function(void *context)
+ *     exit <function>              void function(void *context)
+ *     event <function>             void function(void *context, int event)
+ *   region <owner>                 Following states form a new orthogonal
+ *                                  region of the composite <owner>
+ *   transition <source> -> <target> [on <event>] [if <guard>]
+ *                                  guard: int function(void *context)
+ *
+ * States before the first region line belong to the root region. A region
+ * starts in the state marked initial, or its first state. Transitions with an
+ * event are taken by <machine>_send_event(), the others are polled through
+ * their guard by <machine>_tick().
+ *
+ * History, time-triggered transitions, asynchronous actions, pure guards and
+ * bitmask guards are not generated; descriptions using them are rejected and
+ * such machines are left to the interpreter.
+ */
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_NAME 64
+#define MAX_STATES 1024
+#define MAX_REGIONS 256
+#define MAX_TRANSITIONS 4096
+#define MAX_INCLUDES 32
+#define MAX_LINE 512
+
+typedef struct {
+    char name[MAX_NAME];
+    int parent;       // Index into states, -1 at the region root
+    int region;       // Index into regions
+    int id;           // Id assigned like state_machine_compile()
+    char on_entry[MAX_NAME];
+    char on_run[MAX_NAME];
+    char on_exit[MAX_NAME];
+    char on_event[MAX_NAME];
+} GenState;
+
+typedef struct {
+    int owner;        // Index into states, -1 for the root region
+    int initial;      // Index into states, -1 while unset
+    int id;
+} GenRegion;
+
+typedef struct {
+    int source;
+    int target;
+    char event[MAX_NAME];  // Empty for polled transitions
+    char guard[MAX_NAME];
+} GenTransition;
+
+static GenState states[MAX_STATES];
+static GenRegion regions[MAX_REGIONS];
+static GenTransition transitions[MAX_TRANSITIONS];
+static char includes[MAX_INCLUDES][MAX_NAME * 2];
+static int num_states, num_regions, num_transitions, num_includes;
+static char machine[MAX_NAME] = "hsm";
+static char upper_machine[MAX_NAME];
+
+// Id-ordered views, filled by enumerate_region()
+static int state_by_id[MAX_STATES];
+static int region_by_id[MAX_REGIONS];
+static int next_state_id, next_region_id;
+
+static const char *input_name;
+static int input_line;
+
+static void fail(const char *format, ...)
+{
+    va_list args;
+    fprintf(stderr, "%s:%d: ", input_name, input_line);
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+    exit(1);
+}
+
+static int is_identifier(const char *s)
+{
+    if (!isalpha((unsigned char)*s) && *s != '_')
+    {
+        return 0;
+    }
+    for (; *s; ++s)
+    {
+        if (!isalnum((unsigned char)*s) && *s != '_')
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Events may be integer literals or identifiers of integer constants
+static int is_event(const char *s)
+{
+    const char *p = s;
+    if (*p == '-')
+    {
+        p++;
+    }
+    if (isdigit((unsigned char)*p))
+    {
+        strtol(s, (char **)&p, 0);
+        return *p == '\0';
+    }
+    return is_identifier(s);
+}
+
+// Features of the interpreter the generated code does not implement
+static void reject_unsupported(const char *token)
+{
+    static const char *const unsupported[] = {
+        "history", "after", "async", "async_entry", "async_run", "done", "pure", "mask",
+    };
+    for (size_t i = 0; i < sizeof(unsupported) / sizeof(unsupported[0]); ++i)
+    {
+        if (strcmp(token, unsupported[i]) == 0)
+        {
+            fail("'%s' is not supported by hsm_codegen", token);
+        }
+    }
+}
+
+static void copy_name(char *dest, const char *src)
+{
+    if (!is_identifier(src) || strlen(src) >= MAX_NAME)
+    {
+        fail("invalid name '%s'", src);
+    }
+    strcpy(dest, src);
+}
+
+static int find_state(const char *name)
+{
+    for (int i = 0; i < num_states; ++i)
+    {
+        if (strcmp(states[i].name, name) == 0)
+        {
+            return i;
+        }
+    }
+    fail("unknown state '%s'", name);
+    return -1;
+}
+
+static int get_depth(int s)
+{
+    int depth = 0;
+    for (; s >= 0; s = states[s].parent)
+    {
+        depth++;
+    }
+    return depth;
+}
+
+// Lowest common ancestor within a region, -1 at the region root. Like
+// state_machine_compile(), a transition into the source or one of its
+// ancestors leaves and re-enters the target.
+static int transition_ancestor(int source, int target)
+{
+    for (int a = source; a >= 0; a = states[a].parent)
+    {
+        for (int b = target; b >= 0; b = states[b].parent)
+        {
+            if (a == b)
+            {
+                return a == target ? states[target].parent : a;
+            }
+        }
+    }
+    return -1;
+}
+
+/* ----------------------------------------------------------------------------
+ * Parsing
+ * ------------------------------------------------------------------------- */
+
+static char *next_token(char **cursor)
+{
+    char *p = *cursor;
+    while (*p && isspace((unsigned char)*p))
+    {
+        p++;
+    }
+    if (!*p)
+    {
+        *cursor = p;
+        return NULL;
+    }
+    char *start = p;
+    while (*p && !isspace((unsigned char)*p))
+    {
+        p++;
+    }
+    if (*p)
+    {
+        *p++ = '\0';
+    }
+    *cursor = p;
+    return start;
+}
+
+static char *expect_token(char **cursor, const char *what)
+{
+    char *token = next_token(cursor);
+    if (!token)
+    {
+        fail("expected %s", what);
+    }
+    return token;
+}
+
+static void parse_state(char **cursor, int region)
+{
+    if (num_states == MAX_STATES)
+    {
+        fail("too many states");
+    }
+
+    GenState *s = &states[num_states];
+    memset(s, 0, sizeof(*s));
+    copy_name(s->name, expect_token(cursor, "state name"));
+    s->parent = -1;
+    s->region = region;
+    for (int i = 0; i < num_states; ++i)
+    {
+        if (strcmp(states[i].name, s->name) == 0)
+        {
+            fail("duplicate state '%s'", s->name);
+        }
+    }
+
+    char *token;
+    while ((token = next_token(cursor)) != NULL)
+    {
+        if (strcmp(token, "parent") == 0)
+        {
+            s->parent = find_state(expect_token(cursor, "parent name"));
+            if (states[s->parent].region != region)
+            {
+                fail("parent of '%s' is in another region", s->name);
+            }
+        }
+        else if (strcmp(token, "initial") == 0)
+        {
+            regions[region].initial = num_states;
+        }
+        else
+        {
+            reject_unsupported(token);
+            fail("unexpected '%s'", token);
+        }
+    }
+
+    if (regions[region].initial < 0)
+    {
+        regions[region].initial = num_states;
+    }
+    num_states++;
+}
+
+static void parse_transition(char **cursor)
+{
+    if (num_transitions == MAX_TRANSITIONS)
+    {
+        fail("too many transitions");
+    }
+
+    GenTransition *t = &transitions[num_transitions];
+    memset(t, 0, sizeof(*t));
+    t->source = find_state(expect_token(cursor, "source state"));
+    if (strcmp(expect_token(cursor, "'->'"), "->") != 0)
+    {
+        fail("expected '->'");
+    }
+    t->target = find_state(expect_token(cursor, "target state"));
+    if (states[t->source].region != states[t->target].region)
+    {
+        fail("transition leaves the region of '%s'", states[t->source].name);
+    }
+
+    char *token;
+    while ((token = next_token(cursor)) != NULL)
+    {
+        if (strcmp(token, "on") == 0)
+        {
+            token = expect_token(cursor, "event");
+            if (!is_event(token) || strlen(token) >= MAX_NAME || strcmp(token, "0") == 0)
+            {
+                fail("invalid event '%s'", token);
+            }
+            strcpy(t->event, token);
+        }
+        else if (strcmp(token, "if") == 0)
+        {
+            copy_name(t->guard, expect_token(cursor, "guard"));
+        }
+        else
+        {
+            reject_unsupported(token);
+            fail("unexpected '%s'", token);
+        }
+    }
+
+    if (!t->event[0] && !t->guard[0])
+    {
+        fail("transition needs an event or a guard");
+    }
+    num_transitions++;
+}
+
+static void parse(FILE *in)
+{
+    char line[MAX_LINE];
+    int region = 0;
+
+    regions[0].owner = -1;
+    regions[0].initial = -1;
+    num_regions = 1;
+
+    while (fgets(line, sizeof(line), in))
+    {
+        input_line++;
+        char *comment = strchr(line, '#');
+        if (comment)
+        {
+            *comment = '\0';
+        }
+
+        char *cursor = line;
+        char *keyword = next_token(&cursor);
+        if (!keyword)
+        {
+            continue;
+        }
+
+        if (strcmp(keyword, "machine") == 0)
+        {
+            copy_name(machine, expect_token(&cursor, "machine name"));
+        }
+        else if (strcmp(keyword, "include") == 0)
+        {
+            char *file = expect_token(&cursor, "include file");
+            if (num_includes == MAX_INCLUDES || strlen(file) >= sizeof(includes[0]))
+            {
+                fail("too many includes");
+            }
+            strcpy(includes[num_includes++], file);
+        }
+        else if (strcmp(keyword, "state") == 0)
+        {
+            parse_state(&cursor, region);
+        }
+        else if (strcmp(keyword, "region") == 0)
+        {
+            if (num_regions == MAX_REGIONS)
+            {
+                fail("too many regions");
+            }
+            region = num_regions++;
+            regions[region].owner = find_state(expect_token(&cursor, "region owner"));
+            regions[region].initial = -1;
+            char *token = next_token(&cursor);
+            if (token)
+            {
+                reject_unsupported(token);
+                fail("unexpected '%s'", token);
+            }
+        }
+        else if (strcmp(keyword, "transition") == 0)
+        {
+            parse_transition(&cursor);
+        }
+        else if (strcmp(keyword, "entry") == 0 || strcmp(keyword, "run") == 0 ||
+                 strcmp(keyword, "exit") == 0 || strcmp(keyword, "event") == 0)
+        {
+            if (num_states == 0)
+            {
+                fail("'%s' outside of a state", keyword);
+            }
+            GenState *s = &states[num_states - 1];
+            char *dest = keyword[1] == 'n' ? s->on_entry :
+                         keyword[0] == 'r' ? s->on_run :
+                         keyword[1] == 'x' ? s->on_exit : s->on_event;
+            copy_name(dest, expect_token(&cursor, "function name"));
+        }
+        else
+        {
+            reject_unsupported(keyword);
+            fail("unknown statement '%s'", keyword);
+        }
+
+        if (next_token(&cursor))
+        {
+            fail("trailing tokens after '%s'", keyword);
+        }
+    }
+
+    if (num_states == 0)
+    {
+        fail("no states");
+    }
+}
+
+/* ----------------------------------------------------------------------------
+ * Numbering, identical to state_machine_compile()
+ * ------------------------------------------------------------------------- */
+
+static void enumerate_region(int region)
+{
+    for (int i = 0; i < num_states; ++i)
+    {
+        if (states[i].region == region)
+        {
+            states[i].id = next_state_id;
+            state_by_id[next_state_id++] = i;
+        }
+    }
+
+    for (int i = 0; i < num_states; ++i)
+    {
+        for (int r = 0; r < num_regions; ++r)
+        {
+            if (states[i].region == region && regions[r].owner == i)
+            {
+                regions[r].id = next_region_id;
+                region_by_id[next_region_id++] = r;
+            }
+        }
+    }
+
+    for (int i = 0; i < num_states; ++i)
+    {
+        for (int r = 0; r < num_regions; ++r)
+        {
+            if (states[i].region == region && regions[r].owner == i)
+            {
+                enumerate_region(r);
+            }
+        }
+    }
+}
+
+/* ----------------------------------------------------------------------------
+ * Emission
+ * ------------------------------------------------------------------------- */
+
+static void emit_state_constant(FILE *out, int s)
+{
+    fprintf(out, "%s_", upper_machine);
+    for (const char *p = states[s].name; *p; ++p)
+    {
+        fputc(toupper((unsigned char)*p), out);
+    }
+}
+
+// Regions owned by a state, in id order
+static int owned_regions(int s, int *owned)
+{
+    int count = 0;
+    for (int id = 0; id < num_regions; ++id)
+    {
+        if (regions[region_by_id[id]].owner == s)
+        {
+            owned[count++] = id;
+        }
+    }
+    return count;
+}
+
+static void emit_transition(FILE *out, const GenTransition *t, int current, const char *indent,
+                            const char *result)
+{
+    int ancestor = transition_ancestor(t->source, t->target);
+    int ancestor_depth = ancestor >= 0 ? get_depth(ancestor) : 0;
+    int region = regions[states[current].region].id;
+    int path[MAX_STATES];
+    int depth = 0;
+
+    // Exit from the current state up to the common ancestor
+    for (int s = current; s >= 0 && get_depth(s) > ancestor_depth; s = states[s].parent)
+    {
+        fprintf(out, "%s%s_exit_%s(inst);\n", indent, machine, states[s].name);
+    }
+
+    fprintf(out, "%sinst->state[%d] = ", indent, num_regions + region);
+    emit_state_constant(out, current);
+    fprintf(out, ";\n%sinst->state[%d] = ", indent, region);
+    emit_state_constant(out, t->target);
+    fprintf(out, ";\n");
+
+    // Enter from below the common ancestor down to the target
+    for (int s = t->target; s >= 0 && get_depth(s) > ancestor_depth; s = states[s].parent)
+    {
+        path[depth++] = s;
+    }
+    while (depth > 0)
+    {
+        fprintf(out, "%s%s_enter_%s(inst);\n", indent, machine, states[path[--depth]].name);
+    }
+    fprintf(out, "%sreturn%s;\n", indent, result);
+}
+
+static void emit_prototypes(FILE *out)
+{
+    // Deduplicated handler prototypes, unless the description includes them
+    const char *seen[MAX_STATES * 4 + MAX_TRANSITIONS];
+    const char *kind[MAX_STATES * 4 + MAX_TRANSITIONS];
+    int count = 0;
+
+    for (int i = 0; i < num_states + num_transitions; ++i)
+    {
+        const char *names[4];
+        const char *kinds[4];
+        int n = 0;
+        if (i < num_states)
+        {
+            names[n] = states[i].on_entry; kinds[n++] = "void %s(void *context);\n";
+            names[n] = states[i].on_run; kinds[n++] = "void %s(void *context);\n";
+            names[n] = states[i].on_exit; kinds[n++] = "void %s(void *context);\n";
+            names[n] = states[i].on_event; kinds[n++] = "void %s(void *context, int event);\n";
+        }
+        else
+        {
+            names[n] = transitions[i - num_states].guard; kinds[n++] = "int %s(void *context);\n";
+        }
+
+        for (int k = 0; k < n; ++k)
+        {
+            int dup = !names[k][0];
+            for (int j = 0; j < count && !dup; ++j)
+            {
+                dup = strcmp(seen[j], names[k]) == 0;
+                if (dup && kind[j] != kinds[k])
+                {
+                    fail("'%s' is used as two kinds of handler", names[k]);
+                }
+            }
+            if (!dup)
+            {
+                seen[count] = names[k];
+                kind[count++] = kinds[k];
+            }
+        }
+    }
+
+    if (num_includes > 0)
+    {
+        return;
+    }
+    fprintf(out, "/* Handlers */\n");
+    for (int i = 0; i < count; ++i)
+    {
+        fprintf(out, kind[i], seen[i]);
+    }
+    fprintf(out, "\n");
+}
+
+/* State slots of an instance, like state_machine_state_slots(). The layout
+   of state_machine_instance_size() adds history slots, timers and
+   asynchronous operations behind them, none of which a description can have,
+   so the instance ends with the slots. */
+static unsigned state_slots(void)
+{
+    return 2u * (unsigned)num_regions;
+}
+
+static void emit_header(FILE *out, const char *source)
+{
+    fprintf(out, "/* Generated by hsm_codegen from %s. Do not edit. */\n\n", source);
+    fprintf(out, "#ifndef %s_HSM_H\n#define %s_HSM_H\n\n", upper_machine, upper_machine);
+    fprintf(out, "#include <stddef.h>\n#include \"hsm/hsm.h\"\n\n");
+    fprintf(out, "// State ids, identical to those assigned by state_machine_compile()\n");
+    fprintf(out, "enum {\n");
+    for (int id = 0; id < num_states; ++id)
+    {
+        fprintf(out, "    ");
+        emit_state_constant(out, state_by_id[id]);
+        fprintf(out, " = %d,\n", id);
+    }
+    fprintf(out, "    %s_NUM_STATES = %d,\n", upper_machine, num_states);
+    fprintf(out, "    %s_NUM_REGIONS = %d,\n", upper_machine, num_regions);
+    fprintf(out, "    // Instance slots, like state_machine_state_slots(); there are no history regions\n");
+    fprintf(out, "    %s_STATE_SLOTS = %u\n};\n\n", upper_machine, state_slots());
+    fprintf(out, "size_t %s_instance_size(void);\n", machine);
+    fprintf(out, "void %s_init(StateMachineInstance *inst, void *context);\n", machine);
+    fprintf(out, "void %s_tick(StateMachineInstance *inst);\n", machine);
+    fprintf(out, "int %s_send_event(StateMachineInstance *inst, int event);\n\n", machine);
+    fprintf(out, "#endif // %s_HSM_H\n", upper_machine);
+}
+
+static void emit_state_helpers(FILE *out)
+{
+    int owned[MAX_REGIONS];
+
+    for (int id = 0; id < num_states; ++id)
+    {
+        const GenState *s = &states[state_by_id[id]];
+        int n = owned_regions(state_by_id[id], owned);
+
+        // Regions are exited before the composite, entered after it
+        fprintf(out, "static inline void %s_exit_%s(StateMachineInstance *inst)\n{\n", machine, s->name);
+        for (int i = 0; i < n; ++i)
+        {
+            fprintf(out, "    %s_exit_region_%d(inst);\n", machine, owned[i]);
+        }
+        if (s->on_exit[0])
+        {
+            fprintf(out, "    %s(inst->context);\n", s->on_exit);
+        }
+        else if (n == 0)
+        {
+            fprintf(out, "    (void)inst;\n");
+        }
+        fprintf(out, "}\n\n");
+
+        fprintf(out, "static inline void %s_enter_%s(StateMachineInstance *inst)\n{\n", machine, s->name);
+        if (s->on_entry[0])
+        {
+            fprintf(out, "    %s(inst->context);\n", s->on_entry);
+        }
+        else if (n == 0)
+        {
+            fprintf(out, "    (void)inst;\n");
+        }
+        for (int i = 0; i < n; ++i)
+        {
+            fprintf(out, "    %s_enter_region_%d(inst);\n", machine, owned[i]);
+        }
+        fprintf(out, "}\n\n");
+    }
+}
+
+static void emit_region_functions(FILE *out, int id)
+{
+    int region = region_by_id[id];
+    int owned[MAX_REGIONS];
+
+    // Exit: innermost first along the current state's path
+    fprintf(out, "static inline void %s_exit_region_%d(StateMachineInstance *inst)\n{\n", machine, id);
+    fprintf(out, "    switch (inst->state[%d])\n    {\n", id);
+    for (int i = 0; i < num_states; ++i)
+    {
+        if (states[state_by_id[i]].region != region)
+        {
+            continue;
+        }
+        fprintf(out, "    case ");
+        emit_state_constant(out, state_by_id[i]);
+        fprintf(out, ":\n");
+        for (int s = state_by_id[i]; s >= 0; s = states[s].parent)
+        {
+            fprintf(out, "        %s_exit_%s(inst);\n", machine, states[s].name);
+        }
+        fprintf(out, "        break;\n");
+    }
+    fprintf(out, "    default:\n        return;\n    }\n");
+    fprintf(out, "    inst->state[%d] = HSM_NO_STATE;\n}\n\n", id);
+
+    // Enter: outermost first along the initial state's path
+    fprintf(out, "static inline void %s_enter_region_%d(StateMachineInstance *inst)\n{\n", machine, id);
+    fprintf(out, "    inst->state[%d] = HSM_NO_STATE;\n", num_regions + id);
+    if (regions[region].initial < 0)
+    {
+        fprintf(out, "    inst->state[%d] = HSM_NO_STATE;\n}\n\n", id);
+    }
+    else
+    {
+        int path[MAX_STATES];
+        int depth = 0;
+        fprintf(out, "    inst->state[%d] = ", id);
+        emit_state_constant(out, regions[region].initial);
+        fprintf(out, ";\n");
+        for (int s = regions[region].initial; s >= 0; s = states[s].parent)
+        {
+            path[depth++] = s;
+        }
+        while (depth > 0)
+        {
+            fprintf(out, "    %s_enter_%s(inst);\n", machine, states[path[--depth]].name);
+        }
+        fprintf(out, "}\n\n");
+    }
+
+    // Tick: polled transitions of the current state, then on_run, then regions
+    fprintf(out, "static inline void %s_tick_region_%d(StateMachineInstance *inst)\n{\n", machine, id);
+    fprintf(out, "    switch (inst->state[%d])\n    {\n", id);
+    for (int i = 0; i < num_states; ++i)
+    {
+        int s = state_by_id[i];
+        if (states[s].region != region)
+        {
+            continue;
+        }
+        fprintf(out, "    case ");
+        emit_state_constant(out, s);
+        fprintf(out, ":\n");
+        for (int k = 0; k < num_transitions; ++k)
+        {
+            const GenTransition *t = &transitions[k];
+            if (t->source == s && !t->event[0])
+            {
+                fprintf(out, "        if (%s(inst->context))\n        {\n", t->guard);
+                emit_transition(out, t, s, "            ", "");
+                fprintf(out, "        }\n");
+            }
+        }
+        if (states[s].on_run[0])
+        {
+            fprintf(out, "        %s(inst->context);\n", states[s].on_run);
+        }
+        int n = owned_regions(s, owned);
+        for (int r = 0; r < n; ++r)
+        {
+            fprintf(out, "        %s_tick_region_%d(inst);\n", machine, owned[r]);
+        }
+        fprintf(out, "        return;\n");
+    }
+    fprintf(out, "    default:\n        return;\n    }\n}\n\n");
+
+    // Events: regions first, then own and inherited transitions, then on_event
+    fprintf(out, "static inline int %s_send_event_region_%d(StateMachineInstance *inst, int event)\n{\n",
+            machine, id);
+    fprintf(out, "    int consumed = 0;\n\n");
+    fprintf(out, "    switch (inst->state[%d])\n    {\n", id);
+    for (int i = 0; i < num_states; ++i)
+    {
+        int s = state_by_id[i];
+        if (states[s].region != region)
+        {
+            continue;
+        }
+        fprintf(out, "    case ");
+        emit_state_constant(out, s);
+        fprintf(out, ":\n");
+
+        int n = owned_regions(s, owned);
+        for (int r = 0; r < n; ++r)
+        {
+            fprintf(out, "        consumed |= %s_send_event_region_%d(inst, event);\n", machine, owned[r]);
+        }
+        if (n > 0)
+        {
+            fprintf(out, "        if (consumed)\n        {\n            return 1;\n        }\n");
+        }
+
+        // Group candidates by event in order of first appearance, innermost first
+        int emitted_switch = 0;
+        for (int p = s; p >= 0; p = states[p].parent)
+        {
+            for (int k = 0; k < num_transitions; ++k)
+            {
+                const GenTransition *t = &transitions[k];
+                int seen = 0;
+                if (t->source != p || !t->event[0])
+                {
+                    continue;
+                }
+                for (int q = s; q != p && !seen; q = states[q].parent)
+                {
+                    for (int j = 0; j < num_transitions && !seen; ++j)
+                    {
+                        seen = transitions[j].source == q && strcmp(transitions[j].event, t->event) == 0;
+                    }
+                }
+                for (int j = 0; j < k && !seen; ++j)
+                {
+                    seen = transitions[j].source == p && strcmp(transitions[j].event, t->event) == 0;
+                }
+                if (seen)
+                {
+                    continue;
+                }
+
+                if (!emitted_switch)
+                {
+                    fprintf(out, "        switch (event)\n        {\n");
+                    emitted_switch = 1;
+                }
+                fprintf(out, "        case %s:\n", t->event);
+                int unguarded = 0;
+                for (int q = p; q >= 0 && !unguarded; q = states[q].parent)
+                {
+                    for (int j = (q == p) ? k : 0; j < num_transitions && !unguarded; ++j)
+                    {
+                        const GenTransition *c = &transitions[j];
+                        if (c->source != q || strcmp(c->event, t->event) != 0)
+                        {
+                            continue;
+                        }
+                        if (c->guard[0])
+                        {
+                            fprintf(out, "            if (%s(inst->context))\n            {\n", c->guard);
+                            emit_transition(out, c, s, "                ", " 1");
+                            fprintf(out, "            }\n");
+                        }
+                        else
+                        {
+                            emit_transition(out, c, s, "            ", " 1");
+                            unguarded = 1;
+                        }
+                    }
+                }
+                if (!unguarded)
+                {
+                    fprintf(out, "            break;\n");
+                }
+            }
+        }
+        if (emitted_switch)
+        {
+            fprintf(out, "        default:\n            break;\n        }\n");
+        }
+        if (states[s].on_event[0])
+        {
+            fprintf(out, "        %s(inst->context, event);\n", states[s].on_event);
+        }
+        fprintf(out, "        return 0;\n");
+    }
+    fprintf(out, "    default:\n        (void)event;\n        return consumed;\n    }\n}\n\n");
+}
+
+static void emit_source(FILE *out, const char *source, const char *header, int hsm_api)
+{
+    fprintf(out, "/* Generated by hsm_codegen from %s. Do not edit. */\n\n", source);
+    fprintf(out, "#include \"%s\"\n", header);
+    for (int i = 0; i < num_includes; ++i)
+    {
+        fprintf(out, "#include %s\n", includes[i]);
+    }
+    fprintf(out, "\n");
+    emit_prototypes(out);
+
+    for (int id = 0; id < num_regions; ++id)
+    {
+        fprintf(out, "static inline void %s_exit_region_%d(StateMachineInstance *inst);\n", machine, id);
+        fprintf(out, "static inline void %s_enter_region_%d(StateMachineInstance *inst);\n", machine, id);
+    }
+    fprintf(out, "\n");
+
+    emit_state_helpers(out);
+    for (int id = num_regions - 1; id >= 0; --id)
+    {
+        emit_region_functions(out, id);
+    }
+
+    fprintf(out, "size_t %s_instance_size(void)\n{\n", machine);
+    fprintf(out, "    return sizeof(StateMachineInstance) + %s_STATE_SLOTS * sizeof(StateId);\n}\n\n",
+            upper_machine);
+    fprintf(out, "void %s_init(StateMachineInstance *inst, void *context)\n{\n", machine);
+    fprintf(out, "    inst->context = context;\n");
+    fprintf(out, "    for (unsigned i = 0; i < %s_STATE_SLOTS; ++i)\n    {\n", upper_machine);
+    fprintf(out, "        inst->state[i] = HSM_NO_STATE;\n    }\n");
+    fprintf(out, "    %s_enter_region_0(inst);\n}\n\n", machine);
+    fprintf(out, "void %s_tick(StateMachineInstance *inst)\n{\n", machine);
+    fprintf(out, "    %s_tick_region_0(inst);\n}\n\n", machine);
+    fprintf(out, "int %s_send_event(StateMachineInstance *inst, int event)\n{\n", machine);
+    fprintf(out, "    return %s_send_event_region_0(inst, event);\n}\n", machine);
+
+    if (hsm_api)
+    {
+        fprintf(out, "\n/* Drop-in replacements for the interpreter; the definition is unused. */\n\n");
+        fprintf(out, "void state_machine_init(const StateMachineDef *def, StateMachineInstance *inst, void *context)\n");
+        fprintf(out, "{\n    (void)def;\n    %s_init(inst, context);\n}\n\n", machine);
+        fprintf(out, "void state_machine_tick(const StateMachineDef *def, StateMachineInstance *inst)\n");
+        fprintf(out, "{\n    (void)def;\n    %s_tick(inst);\n}\n\n", machine);
+        fprintf(out, "int state_machine_send_event(const StateMachineDef *def, StateMachineInstance *inst, int event)\n");
+        fprintf(out, "{\n    (void)def;\n    return %s_send_event(inst, event);\n}\n", machine);
+    }
+}
+
+static FILE *open_output(const char *base, const char *extension, char *path, size_t size)
+{
+    snprintf(path, size, "%s%s", base, extension);
+    FILE *out = fopen(path, "w");
+    if (!out)
+    {
+        fprintf(stderr, "cannot write %s\n", path);
+        exit(1);
+    }
+    return out;
+}
+
+int main(int argc, char **argv)
+{
+    int hsm_api = 0;
+    int arg = 1;
+
+    if (arg < argc && strcmp(argv[arg], "--hsm-api") == 0)
+    {
+        hsm_api = 1;
+        arg++;
+    }
+    if (argc - arg != 2)
+    {
+        fprintf(stderr, "usage: %s [--hsm-api] <description> <output base>\n", argv[0]);
+        return 1;
+    }
+
+    input_name = argv[arg];
+    FILE *in = fopen(input_name, "r");
+    if (!in)
+    {
+        fprintf(stderr, "cannot read %s\n", input_name);
+        return 1;
+    }
+    parse(in);
+    fclose(in);
+
+    for (int i = 0; machine[i]; ++i)
+    {
+        upper_machine[i] = (char)toupper((unsigned char)machine[i]);
+    }
+
+    regions[0].id = next_region_id;
+    region_by_id[next_region_id++] = 0;
+    enumerate_region(0);
+    for (int r = 1; r < num_regions; ++r)
+    {
+        if (regions[r].initial < 0)
+        {
+            input_line = 0;
+            fail("region of '%s' has no states", states[regions[r].owner].name);
+        }
+    }
+
+    // Source names are printed without their directories
+    const char *source = strrchr(input_name, '/');
+    source = source ? source + 1 : input_name;
+
+    char header_path[1024];
+    char source_path[1024];
+    FILE *out = open_output(argv[arg + 1], ".h", header_path, sizeof(header_path));
+    emit_header(out, source);
+    fclose(out);
+
+    const char *header = strrchr(header_path, '/');
+    header = header ? header + 1 : header_path;
+    out = open_output(argv[arg + 1], ".c", source_path, sizeof(source_path));
+    emit_source(out, source, header, hsm_api);
+    fclose(out);
+    return 0;
+}
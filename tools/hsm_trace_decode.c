@@ -0,0 +1,170 @@
+/*
+ * hsm_trace_decode.c
+ *
+ * Turns binary trace dumps written by trace_dump() into readable text or
+ * into Chrome trace JSON (chrome://tracing, Perfetto).
+ *
+ * Usage: hsm_trace_decode [--chrome] <dump> [<names>]
+ *
+ * <names> is the output of trace_write_names(); states without a name are
+ * shown by id. A dump may hold several rings one after another.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hsm/trace.h"
+
+#define MAX_NAME 64
+
+static char (*names)[MAX_NAME];
+
+static void load_names(const char *path)
+{
+    FILE *in = fopen(path, "r");
+    if (!in)
+    {
+        fprintf(stderr, "cannot read %s\n", path);
+        exit(1);
+    }
+
+    names = calloc(HSM_NO_STATE, sizeof(*names));
+    unsigned id;
+    char name[MAX_NAME];
+    while (fscanf(in, "%u %63s", &id, name) == 2)
+    {
+        if (id < HSM_NO_STATE)
+        {
+            strcpy(names[id], name);
+        }
+    }
+    fclose(in);
+}
+
+static const char *state_name(StateId id, char *buffer)
+{
+    if (id == HSM_NO_STATE)
+    {
+        return "(none)";
+    }
+    if (names && names[id][0])
+    {
+        return names[id];
+    }
+    sprintf(buffer, "state%u", (unsigned)id);
+    return buffer;
+}
+
+static void print_text(const TraceDumpHeader *header, const TraceRecord *r, uint64_t origin)
+{
+    char source[16], target[16];
+    double ts = (double)(int64_t)(r->timestamp - origin) / header->ticks_per_ns / 1000.0;
+
+    printf("%12.3f us  thread %u  inst %08x  region %u  %s %s -> %s",
+           ts, header->thread, r->instance, r->region,
+           r->type == TRACE_INIT ? "init      " : "transition",
+           state_name(r->source, source), state_name(r->target, target));
+    if (r->event)
+    {
+        printf("  event %d", r->event);
+    }
+    printf("  exit %.0f ns  entry %.0f ns\n",
+           r->exit_ticks / header->ticks_per_ns, r->entry_ticks / header->ticks_per_ns);
+}
+
+static void print_chrome(const TraceDumpHeader *header, const TraceRecord *r, uint64_t origin, int *first)
+{
+    char source[16], target[16];
+    double ts = (double)(int64_t)(r->timestamp - origin) / header->ticks_per_ns / 1000.0;
+    double dur = (r->exit_ticks + (double)r->entry_ticks) / header->ticks_per_ns / 1000.0;
+
+    printf("%s\n    {\"name\": \"%s -> %s\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, "
+           "\"pid\": %u, \"tid\": %u, \"args\": {\"region\": %u, \"event\": %d, \"exit_ns\": %.0f, \"entry_ns\": %.0f}}",
+           *first ? "" : ",", state_name(r->source, source), state_name(r->target, target),
+           r->type == TRACE_INIT ? "init" : "transition", ts, dur, r->instance, header->thread,
+           r->region, r->event, r->exit_ticks / header->ticks_per_ns, r->entry_ticks / header->ticks_per_ns);
+    *first = 0;
+}
+
+int main(int argc, char **argv)
+{
+    int chrome = 0;
+    int arg = 1;
+
+    if (arg < argc && strcmp(argv[arg], "--chrome") == 0)
+    {
+        chrome = 1;
+        arg++;
+    }
+    if (argc - arg < 1 || argc - arg > 2)
+    {
+        fprintf(stderr, "usage: %s [--chrome] <dump> [<names>]\n", argv[0]);
+        return 1;
+    }
+    if (argc - arg == 2)
+    {
+        load_names(argv[arg + 1]);
+    }
+
+    FILE *in = fopen(argv[arg], "rb");
+    if (!in)
+    {
+        fprintf(stderr, "cannot read %s\n", argv[arg]);
+        return 1;
+    }
+
+    TraceDumpHeader header;
+    uint64_t origin = 0;
+    int have_origin = 0;
+    int first = 1;
+
+    if (chrome)
+    {
+        printf("{\"traceEvents\": [");
+    }
+    while (fread(&header, sizeof(header), 1, in) == 1)
+    {
+        if (header.magic != TRACE_MAGIC || header.version != TRACE_VERSION ||
+            header.record_size != sizeof(TraceRecord))
+        {
+            fprintf(stderr, "%s: not a trace dump of this version\n", argv[arg]);
+            return 1;
+        }
+        if (!chrome && header.dropped)
+        {
+            printf("# thread %u: %llu older records were overwritten\n",
+                   header.thread, (unsigned long long)header.dropped);
+        }
+
+        for (uint32_t i = 0; i < header.count; ++i)
+        {
+            TraceRecord r;
+            if (fread(&r, sizeof(r), 1, in) != 1)
+            {
+                fprintf(stderr, "%s: truncated dump\n", argv[arg]);
+                return 1;
+            }
+            // Times are shown relative to the first record of the file
+            if (!have_origin)
+            {
+                origin = r.timestamp;
+                have_origin = 1;
+            }
+            if (chrome)
+            {
+                print_chrome(&header, &r, origin, &first);
+            }
+            else
+            {
+                print_text(&header, &r, origin);
+            }
+        }
+    }
+    if (chrome)
+    {
+        printf("\n]}\n");
+    }
+
+    fclose(in);
+    return 0;
+}
@@ -0,0 +1,99 @@
+/*
+ * hsm_wcet.c
+ *
+ * Reports the worst-case number of handler calls a single tick can make for
+ * a machine saved by definition_file_save(). The handlers themselves are
+ * not needed; multiply the counts by their worst-case times to bound the
+ * execution time of a tick. The file is checked against its fingerprint
+ * and its records against the image before the analysis.
+ *
+ * Usage: hsm_wcet <file.hsmd>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hsm/definition_file.h"
+#include "hsm/snapshot.h"
+#include "hsm/wcet.h"
+
+int main(int argc, char **argv)
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: %s <file.hsmd>\n", argv[0]);
+        return 2;
+    }
+
+    MappedDefinition map;
+    if (definition_file_map(&map, argv[1]) != 0)
+    {
+        fprintf(stderr, "cannot read %s\n", argv[1]);
+        return 1;
+    }
+
+    // Only the handler indices matter, so nothing needs binding
+    unsigned num_handlers = definition_file_handlers(map.data, map.size);
+    if (num_handlers == 0)
+    {
+        fprintf(stderr, "%s: not a definition file of version %u\n", argv[1], DEFINITION_FILE_VERSION);
+        definition_file_unmap(&map);
+        return 1;
+    }
+    DefinitionFileHeader header;
+    memcpy(&header, map.data, sizeof(header));
+
+    HandlerFunc *handlers = calloc(num_handlers, sizeof(HandlerFunc));
+    if (!handlers)
+    {
+        fprintf(stderr, "out of memory\n");
+        definition_file_unmap(&map);
+        return 1;
+    }
+    StateMachineDef def;
+    if (state_machine_bind(&def, (const char *)map.data + header.image, header.image_size, handlers) != 0 ||
+        def.image->num_handlers != num_handlers ||
+        state_machine_fingerprint(&def) != header.fingerprint)
+    {
+        fprintf(stderr, "%s: invalid image\n", argv[1]);
+        free(handlers);
+        definition_file_unmap(&map);
+        return 1;
+    }
+
+    void *workspace = malloc(state_machine_wcet_workspace_size(&def));
+    if (!workspace)
+    {
+        fprintf(stderr, "out of memory\n");
+        free(handlers);
+        definition_file_unmap(&map);
+        return 1;
+    }
+    WcetReport report;
+    if (state_machine_wcet(&def, &report, workspace) != 0)
+    {
+        fprintf(stderr, "%s: invalid records, or regions nest deeper than %d levels\n", argv[1],
+                HSM_MAX_REGION_NESTING);
+        free(workspace);
+        free(handlers);
+        definition_file_unmap(&map);
+        return 1;
+    }
+
+    printf("%u states, %u regions, %u transitions\n", def.image->num_states, def.image->num_regions,
+           def.image->num_transitions);
+    printf("deepest path     %u states\n", report.max_depth);
+    printf("region nesting   %u of %d levels\n", report.region_nesting, HSM_MAX_REGION_NESTING);
+    printf("worst tick:\n");
+    printf("  on_entry       %u\n", report.tick.entries);
+    printf("  on_exit        %u\n", report.tick.exits);
+    printf("  guards         %u\n", report.tick.guards);
+    printf("  on_run         %u\n", report.tick.runs);
+    printf("  actions        %u\n", report.tick.actions);
+    printf("  calls in all   %u\n", report.tick.calls);
+
+    free(workspace);
+    free(handlers);
+    definition_file_unmap(&map);
+    return 0;
+}